@@ -327,6 +327,7 @@ contains(minimal, 1) {
 	SOURCES += \
 	    ../src/apps.c \
 	    ../src/chartdb.c \
+	    ../src/chart_cache.c \
 	    ../src/chart_prov_autorouter.c \
 	    ../src/chart_prov_common.c \
 	    ../src/chart_prov_faa.c \
@@ -354,3 +355,12 @@ contains(minimal, 1) {
 		SOURCES += ../src/platform/cursor-mac.m
 	}
 }
+
+# Optional in-process PDF rasterizer for chartdb, replacing the external
+# pdftoppm & pdfinfo utilities. Enable using "qmake -set ACFUTILS_POPPLER 1".
+# Users of the library then also need to link against poppler-glib.
+poppler = $$[ACFUTILS_POPPLER]
+contains(minimal, 1):contains(poppler, 1) {
+	DEFINES += ACFUTILS_POPPLER
+	QMAKE_CFLAGS += $$system("pkg-config --cflags poppler-glib")
+}
@@ -253,6 +253,84 @@ CALLS:  	MAG_AllocateLegendreFunctionMemory(NumTerms);  ( For storing the ALF fu
 	return (TRUE);
 }				/*MAG_Geomag */
 
+struct MAGtype_Workspace_s {
+	int nMax;
+	MAGtype_LegendreFunction *LegendreFunction;
+	MAGtype_SphericalHarmonicVariables *SphVariables;
+	/* geocentric latitude for which LegendreFunction is valid */
+	double phig;
+};
+
+MAGtype_Workspace *
+MAG_AllocateWorkspace(int nMax)
+{
+	MAGtype_Workspace *Workspace = calloc(1, sizeof (*Workspace));
+
+	if (Workspace == NULL) {
+		MAG_Error(1);
+		return (NULL);
+	}
+	Workspace->nMax = nMax;
+	Workspace->LegendreFunction = MAG_AllocateLegendreFunctionMemory(
+	    (nMax + 1) * (nMax + 2) / 2);
+	Workspace->SphVariables = MAG_AllocateSphVarMemory(nMax);
+	Workspace->phig = NAN;
+
+	return (Workspace);
+}				/*MAG_AllocateWorkspace */
+
+void
+MAG_FreeWorkspace(MAGtype_Workspace *Workspace)
+{
+	if (Workspace == NULL)
+		return;
+	MAG_FreeLegendreMemory(Workspace->LegendreFunction);
+	MAG_FreeSphVarMemory(Workspace->SphVariables);
+	free(Workspace);
+}				/*MAG_FreeWorkspace */
+
+double
+MAG_GeomagDecl(MAGtype_Workspace *Workspace, MAGtype_Ellipsoid Ellip,
+    MAGtype_CoordSpherical CoordSpherical,
+    MAGtype_CoordGeodetic CoordGeodetic,
+    MAGtype_MagneticModel * TimedMagneticModel)
+/*
+Same as MAG_Geomag, but only computes the declination of the main field
+(the secular variation summation is skipped) and uses the preallocated
+buffers in Workspace. The associated Legendre functions only depend on
+the geocentric latitude, so they are only recomputed when it differs from
+the previous call on the same Workspace. Callers evaluating many points
+should therefore order them by latitude & height to maximize reuse.
+
+INPUT: Workspace (allocated by MAG_AllocateWorkspace for at least the
+              model's nMax)
+              Ellip
+              CoordSpherical
+              CoordGeodetic
+              TimedMagneticModel
+
+OUTPUT : Magnetic declination in degrees (positive east)
+ */
+{
+	MAGtype_MagneticResults MagneticResultsSph, MagneticResultsGeo;
+
+	assert(TimedMagneticModel->nMax <= Workspace->nMax);
+
+	if (CoordSpherical.phig != Workspace->phig) {
+		MAG_AssociatedLegendreFunction(CoordSpherical,
+		    TimedMagneticModel->nMax, Workspace->LegendreFunction);
+		Workspace->phig = CoordSpherical.phig;
+	}
+	MAG_ComputeSphericalHarmonicVariables(Ellip, CoordSpherical,
+	    TimedMagneticModel->nMax, Workspace->SphVariables);
+	MAG_Summation(Workspace->LegendreFunction, TimedMagneticModel,
+	    *Workspace->SphVariables, CoordSpherical, &MagneticResultsSph);
+	MAG_RotateMagneticVector(CoordSpherical, CoordGeodetic,
+	    MagneticResultsSph, &MagneticResultsGeo);
+
+	return (RAD2DEG(atan2(MagneticResultsGeo.By, MagneticResultsGeo.Bx)));
+}				/*MAG_GeomagDecl */
+
 int
 MAG_robustReadMagModels(const char *filename,
     MAGtype_MagneticModel **magneticmodel)
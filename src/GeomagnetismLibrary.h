@@ -173,6 +173,21 @@ int MAG_Geomag(MAGtype_Ellipsoid Ellip,
     MAGtype_MagneticModel * TimedMagneticModel,
     MAGtype_GeoMagneticElements * GeoMagneticElements);
 
+/*
+ * Scratch state for repeated evaluations of the main field. Keeps the
+ * Legendre function and spherical harmonic variable buffers allocated
+ * between calls and skips recomputing the Legendre functions when
+ * consecutive points share the same geocentric latitude.
+ */
+typedef struct MAGtype_Workspace_s MAGtype_Workspace;
+
+MAGtype_Workspace *MAG_AllocateWorkspace(int nMax);
+void MAG_FreeWorkspace(MAGtype_Workspace *Workspace);
+double MAG_GeomagDecl(MAGtype_Workspace *Workspace, MAGtype_Ellipsoid Ellip,
+    MAGtype_CoordSpherical CoordSpherical,
+    MAGtype_CoordGeodetic CoordGeodetic,
+    MAGtype_MagneticModel * TimedMagneticModel);
+
 int MAG_robustReadMagModels(const char *filename,
     MAGtype_MagneticModel ** magneticmodel);
 
@@ -33,6 +33,7 @@
 #include <cairo.h>
 
 #include "core.h"
+#include "types.h"
 
 #ifdef	__cplusplus
 extern "C" {
@@ -64,6 +65,55 @@ extern "C" {
 API_EXPORT void cairo_utils_rounded_rect(cairo_t *cr, double x, double y,
     double w, double h, double radius);
 
+/**
+ * Inverts the colors of a block of pixels in cairo's native
+ * `CAIRO_FORMAT_ARGB32` format (premultiplied alpha), leaving the alpha
+ * channel intact. Fully opaque pixels are simply inverted, translucent
+ * pixels are inverted with respect to their alpha, so they remain
+ * valid premultiplied pixels.
+ * @param data Pointer to the first pixel of the top row.
+ * @param stride Number of bytes between the starts of consecutive rows.
+ * @param width Number of pixels in each row.
+ * @param height Number of rows.
+ */
+API_EXPORT void cairo_utils_invert_argb32(void *data, size_t stride,
+    unsigned width, unsigned height);
+/**
+ * Converts a block of pixels in cairo's `CAIRO_FORMAT_ARGB32` byte order,
+ * but with straight (non-premultiplied) alpha, into premultiplied alpha
+ * in-place. This is what you get when decoding a PNG file with BGRA
+ * byte order on a little-endian machine.
+ * @param data Pointer to the first pixel of the top row.
+ * @param stride Number of bytes between the starts of consecutive rows.
+ * @param width Number of pixels in each row.
+ * @param height Number of rows.
+ */
+API_EXPORT void cairo_utils_premultiply_argb32(void *data, size_t stride,
+    unsigned width, unsigned height);
+/**
+ * Converts a block of pixels in RGBA byte order with straight alpha (as
+ * returned by png_load_from_file_rgba() and friends) into cairo's native
+ * `CAIRO_FORMAT_ARGB32` format with premultiplied alpha.
+ * @param src Pointer to the first pixel of the top source row.
+ * @param src_stride Number of bytes between consecutive source rows.
+ * @param dst Pointer to the first pixel of the top destination row.
+ *	This must not overlap `src`, unless it is the same pointer and the
+ *	strides are equal, in which case the conversion is done in-place.
+ * @param dst_stride Number of bytes between consecutive destination rows.
+ * @param width Number of pixels in each row.
+ * @param height Number of rows.
+ */
+API_EXPORT void cairo_utils_rgba2argb32(const void *src, size_t src_stride,
+    void *dst, size_t dst_stride, unsigned width, unsigned height);
+/**
+ * Inverts the colors of an image surface in-place, e.g. to produce a
+ * night-mode version of a chart. The surface must be of the
+ * `CAIRO_FORMAT_ARGB32` or `CAIRO_FORMAT_RGB24` format.
+ * @return `B_TRUE` if the surface was inverted, `B_FALSE` if the surface
+ *	format isn't supported.
+ */
+API_EXPORT bool_t cairo_utils_invert_surface(cairo_surface_t *surf);
+
 #ifdef	__cplusplus
 }
 #endif
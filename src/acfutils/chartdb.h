@@ -158,6 +158,91 @@ typedef struct {
 	char		procs[MAX_CHART_PROCS][8];
 } chart_procs_t;
 
+/**
+ * Classes of background requests processed by the chart database's loader
+ * threads, in order of decreasing priority. Whenever a loader thread
+ * becomes available, it picks the oldest request of the highest priority
+ * class that has any requests pending.
+ * @see chartdb_get_load_stats()
+ */
+typedef enum {
+	/** Loading a chart for display (chartdb_get_chart_surface()). */
+	CHARTDB_LOAD_PRIO_VISIBLE,
+	/** Downloading a chart ahead of time (chartdb_prefetch_chart()). */
+	CHARTDB_LOAD_PRIO_PREFETCH,
+	/** METAR & TAF downloads (chartdb_get_metar() & chartdb_get_taf()). */
+	CHARTDB_LOAD_PRIO_METAR_TAF,
+	/** Lazy-loading of an airport's list of charts. */
+	CHARTDB_LOAD_PRIO_ARPT,
+	CHARTDB_NUM_LOAD_PRIOS
+} chartdb_load_prio_t;
+
+/**
+ * Latency statistics of a class of loader requests.
+ * @see chartdb_get_load_stats()
+ */
+typedef struct {
+	/** Number of requests currently waiting to be processed. */
+	unsigned	queued;
+	/** Number of requests which have been processed. */
+	uint64_t	completed;
+	/**
+	 * Number of requests which were canceled, either before or while
+	 * being processed, because they were superseded by a newer request
+	 * (such as a change of the displayed chart, page or zoom level).
+	 */
+	uint64_t	canceled;
+	/** Total time in microseconds requests spent waiting in the queue. */
+	uint64_t	wait_us_total;
+	/** Longest time in microseconds a request waited in the queue. */
+	uint64_t	wait_us_max;
+	/** Total time in microseconds taken to process requests. */
+	uint64_t	run_us_total;
+	/** Longest time in microseconds taken to process a request. */
+	uint64_t	run_us_max;
+} chartdb_load_stats_t;
+
+/**
+ * Describes the part of a chart to draw using
+ * chartdb_draw_chart_viewport().
+ */
+typedef struct {
+	/** Zero-based number of the page to draw. */
+	int	page;
+	/**
+	 * Zoom level to draw the chart at. At a zoom of 1.0, PDF charts are
+	 * rendered at 100 DPI (same as chartdb_get_chart_surface()), while
+	 * raster charts are drawn at their native resolution.
+	 */
+	double	zoom;
+	/** Draw the chart in night mode. */
+	bool_t	night;
+	/**
+	 * The visible part of the chart, in pixels of the chart drawn at
+	 * `zoom`. The top left corner of the chart is at 0,0.
+	 */
+	double	x, y, w, h;
+} chart_viewport_t;
+
+/**
+ * Status of a viewport drawn using chartdb_draw_chart_viewport().
+ */
+typedef struct {
+	/**
+	 * Size of the whole page in pixels at the requested zoom level.
+	 * Zero until the chart has been loaded.
+	 */
+	int	width, height;
+	/** Number of pages of the chart, -1 if not known yet. */
+	int	num_pages;
+	/**
+	 * `B_TRUE` if the entire viewport was drawn. Otherwise some parts
+	 * of the chart are still being loaded in the background and you
+	 * should redraw the viewport a little later.
+	 */
+	bool_t	complete;
+} chart_viewport_status_t;
+
 /**
  * Initializes a new chart database for a specific chart provider.
  * After initialization, the database can be accessed to retrieve
@@ -185,6 +270,13 @@ typedef struct {
  *	PDF charts. PDF charts are supplied by the Aeronav and Autorouter
  *	chart providers. If you specify `NULL` here, PDF chart support will
  *	not be available.
+ *
+ * If libacfutils was built with the optional in-process PDF rasterizer
+ * (`qmake -set ACFUTILS_POPPLER 1`, which requires linking against
+ * poppler-glib), PDF charts are rendered directly into the chart's
+ * surface without spawning any external processes, and both
+ * `pdftoppm_path` and `pdfinfo_path` are ignored. Large pages are then
+ * also displayed progressively, top-down, while they are being rendered.
  * @param airac The AIRAC cycle for which to initialize the provider. This
  *	information is used by the Aeronav provider, as charts are tied to
  *	a specific AIRAC cycle. Navigraph and Autorouter do not use this.
@@ -239,12 +331,51 @@ API_EXPORT bool_t chartdb_test_connection2(const char *provider_name,
  * @param bytes The new maximum sizeof the disk cache in bytes.
  */
 API_EXPORT void chartdb_set_load_limit(chartdb_t *cdb, uint64_t bytes);
+/**
+ * Sets the maximum amount of disk space used by downloaded charts and the
+ * chart tiles generated from them (see chartdb_draw_chart_viewport()).
+ * Once the limit is exceeded, the least recently used charts are deleted
+ * from the disk cache. Charts used within the last minute are never
+ * deleted, so the limit can be exceeded temporarily. The minimum limit
+ * is 64MB, the default is 1GB. This doesn't apply to the Navigraph
+ * provider, which never caches charts on disk.
+ * @param bytes The new maximum size of the disk cache in bytes.
+ */
+API_EXPORT void chartdb_set_disk_cache_limit(chartdb_t *cdb, uint64_t bytes);
+/**
+ * @return The amount of disk space currently used by the chart database's
+ *	disk cache in bytes. This becomes accurate once chartdb_is_ready()
+ *	returns `B_TRUE`.
+ */
+API_EXPORT uint64_t chartdb_get_disk_cache_usage(chartdb_t *cdb);
 /**
  * Instructs the chart database to immediately purge its disk cache.
  * You should generally not need to ever do this, as cache management
  * is automatic.
  */
 API_EXPORT void chartdb_purge(chartdb_t *cdb);
+/**
+ * Sets the maximum number of threads the chart database uses to load
+ * charts and other data in the background. Requests are prioritized
+ * according to \ref chartdb_load_prio_t, so a chart being displayed
+ * never has to wait for lower priority work queued before it, as long
+ * as a loader thread is available. The default is the number of CPUs
+ * in the machine, but at least 2 and no more than 4. Threads are only
+ * started when there is work to be done and are stopped again after
+ * a short period of inactivity.
+ * @param n_threads The new maximum number of loader threads. Must be
+ *	greater than 0.
+ */
+API_EXPORT void chartdb_set_loader_threads(chartdb_t *cdb, unsigned n_threads);
+/**
+ * Retrieves latency statistics of the chart database's background
+ * loader, separately for each class of requests.
+ * @param stats An array of \ref CHARTDB_NUM_LOAD_PRIOS elements, which
+ *	will be filled with the statistics of each request class, indexed
+ *	by \ref chartdb_load_prio_t.
+ */
+API_EXPORT void chartdb_get_load_stats(chartdb_t *cdb,
+    chartdb_load_stats_t stats[CHARTDB_NUM_LOAD_PRIOS]);
 /**
  * Sets the network proxy to use for chart data downloading. By default
  * no proxy is used for chart downloads.
@@ -395,6 +526,51 @@ API_EXPORT chart_procs_t chartdb_get_chart_procs(chartdb_t *cdb,
 API_EXPORT bool_t chartdb_get_chart_surface(chartdb_t *cdb,
     const char *icao, const char *chart_name, int page, double zoom,
     bool_t night, cairo_surface_t **surf, int *num_pages);
+/**
+ * Initiates a background download of a chart into the chart database's
+ * on-disk cache, so that a later call to chartdb_get_chart_surface()
+ * doesn't have to wait for the download. Prefetch requests have a lower
+ * priority than charts being displayed (\ref CHARTDB_LOAD_PRIO_PREFETCH).
+ * This function never blocks.
+ * @param icao The ICAO code of the airport for which the chart exists.
+ * @param chart_name The name of the chart as returned from
+ *	chartdb_get_chart_names().
+ * @return `B_TRUE` if the prefetch was queued (or the chart is already
+ *	being loaded), `B_FALSE` if the chart doesn't exist, or the chart
+ *	provider doesn't permit caching charts (Navigraph).
+ */
+API_EXPORT bool_t chartdb_prefetch_chart(chartdb_t *cdb, const char *icao,
+    const char *chart_name);
+/**
+ * Draws a part of a chart into a cairo context. This is an alternative
+ * to chartdb_get_chart_surface() for large charts and high zoom levels.
+ * Rather than loading the whole page into a single surface, the chart is
+ * split into a pyramid of 256x256 pixel tiles at several zoom levels,
+ * which is cached on disk when the chart provider allows it. Only the
+ * tiles covering the viewport are loaded into memory and the memory
+ * limit set by chartdb_set_load_limit() is enforced per tile. Tiles which
+ * are on screen are never evicted, so if the viewport needs more than
+ * the limit, memory use exceeds it until the tiles go off screen. The
+ * chart is drawn from the nearest pyramid level above the requested zoom
+ * and scaled down to fit.
+ *
+ * Tiles which aren't in memory yet are requested in the background and
+ * left out of the drawing. This function never blocks on I/O, so it is
+ * safe to call from a rendering callback.
+ * @param icao The ICAO code of the airport for which the chart exists.
+ * @param chart_name The name of the chart as returned from
+ *	chartdb_get_chart_names().
+ * @param vp The page, zoom level and part of the chart to draw.
+ * @param cr The cairo context to draw into. The viewport's top left
+ *	corner is placed at the context's current origin.
+ * @param status Optional return argument, which will be filled with
+ *	information about the chart and whether the drawing is complete.
+ * @return `B_TRUE` if the chart exists and (so far) can be loaded,
+ *	`B_FALSE` if the chart doesn't exist, or loading it has failed.
+ */
+API_EXPORT bool_t chartdb_draw_chart_viewport(chartdb_t *cdb,
+    const char *icao, const char *chart_name, const chart_viewport_t *vp,
+    cairo_t *cr, chart_viewport_status_t *status);
 /**
  * Queries the chart database whether it's ready to start processing chart
  * requests. Some chart providers need to perform disk or network I/O before
@@ -374,6 +374,17 @@ API_EXPORT geo_pos3_t geo2sph(geo_pos3_t pos, const ellip_t *ellip) PURE_ATTR;
 API_EXPORT vect3_t geo2ecef_mtr(geo_pos3_t pos, const ellip_t *ellip) PURE_ATTR;
 API_EXPORT vect3_t geo2ecef_ft(geo_pos3_t pos, const ellip_t *ellip) PURE_ATTR;
 API_EXPORT geo_pos3_t ecef2geo(vect3_t pos, const ellip_t *ellip) PURE_ATTR;
+API_EXPORT geo_pos3_t ecef2geo_fast(vect3_t pos, const ellip_t *ellip)
+    PURE_ATTR;
+API_EXPORT void geo2ecef_mtr_v(const double *lat, const double *lon,
+    const double *elev, size_t n, const ellip_t *ellip, double *restrict x,
+    double *restrict y, double *restrict z);
+API_EXPORT void ecef2geo_v(const double *x, const double *y, const double *z,
+    size_t n, const ellip_t *ellip, double *restrict lat,
+    double *restrict lon, double *restrict elev);
+API_EXPORT void ecef2geo_fast_v(const double *x, const double *y,
+    const double *z, size_t n, const ellip_t *ellip, double *restrict lat,
+    double *restrict lon, double *restrict elev);
 API_EXPORT geo_pos3_t ecef2sph(vect3_t v) PURE_ATTR;
 API_EXPORT vect3_t sph2ecef(geo_pos3_t pos) PURE_ATTR;
 /*
@@ -488,6 +499,8 @@ API_EXPORT fpp_t gnomo_fpp_init(geo_pos2_t center, double rot,
 API_EXPORT fpp_t stereo_fpp_init(geo_pos2_t center, double rot,
     const ellip_t *ellip, bool_t allow_inv);
 API_EXPORT vect2_t geo2fpp(geo_pos2_t pos, const fpp_t *fpp) PURE_ATTR;
+API_EXPORT void geo2fpp_v(const double *lat, const double *lon, size_t n,
+    const fpp_t *fpp, double *restrict x, double *restrict y);
 API_EXPORT geo_pos2_t fpp2geo(vect2_t pos, const fpp_t *fpp) PURE_ATTR;
 API_EXPORT void fpp_set_scale(fpp_t *fpp, vect2_t scale);
 API_EXPORT vect2_t fpp_get_scale(const fpp_t *fpp);
@@ -537,6 +550,181 @@ typedef struct {
 API_EXPORT void mat4_ident(mat4_t *mat);
 API_EXPORT void mat3_ident(mat3_t *mat);
 
+/**
+ * \def ACFUTILS_GEOM_INLINE
+ * The trivial vector arithmetic functions above (vect3_add(), vect3_sub(),
+ * vect3_dotprod(), etc.) are exported out-of-line functions, so every
+ * use costs a function call and prevents the compiler from optimizing
+ * (and vectorizing) across the arithmetic in hot loops. If you define
+ * `ACFUTILS_GEOM_INLINE` before including this header, these functions
+ * are instead redirected to static inline implementations with
+ * identical semantics. The exported symbols remain available
+ * regardless, so this doesn't change the library's ABI. If you need to
+ * take the address of one of the redirected functions, or explicitly
+ * call the out-of-line version, wrap the name in parentheses:
+ *```
+ * vect3_t (*func)(vect3_t, vect3_t) = (vect3_add);
+ *```
+ */
+#ifdef	ACFUTILS_GEOM_INLINE
+
+/** @note Internal. Do not call directly. Use vect3_abs() instead. */
+static inline double
+vect3_abs_impl(vect3_t a)
+{
+	return (sqrt(a.x * a.x + a.y * a.y + a.z * a.z));
+}
+
+/** @note Internal. Do not call directly. Use vect2_abs() instead. */
+static inline double
+vect2_abs_impl(vect2_t a)
+{
+	return (sqrt(a.x * a.x + a.y * a.y));
+}
+
+/** @note Internal. Do not call directly. Use vect3_add() instead. */
+static inline vect3_t
+vect3_add_impl(vect3_t a, vect3_t b)
+{
+	vect3_t r = { a.x + b.x, a.y + b.y, a.z + b.z };
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect2_add() instead. */
+static inline vect2_t
+vect2_add_impl(vect2_t a, vect2_t b)
+{
+	vect2_t r = { a.x + b.x, a.y + b.y };
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect3_sub() instead. */
+static inline vect3_t
+vect3_sub_impl(vect3_t a, vect3_t b)
+{
+	vect3_t r = { a.x - b.x, a.y - b.y, a.z - b.z };
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect2_sub() instead. */
+static inline vect2_t
+vect2_sub_impl(vect2_t a, vect2_t b)
+{
+	vect2_t r = { a.x - b.x, a.y - b.y };
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect3_mul() instead. */
+static inline vect3_t
+vect3_mul_impl(vect3_t a, vect3_t b)
+{
+	vect3_t r = { a.x * b.x, a.y * b.y, a.z * b.z };
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect2_mul() instead. */
+static inline vect2_t
+vect2_mul_impl(vect2_t a, vect2_t b)
+{
+	vect2_t r = { a.x * b.x, a.y * b.y };
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect3_scmul() instead. */
+static inline vect3_t
+vect3_scmul_impl(vect3_t a, double b)
+{
+	vect3_t r = { a.x * b, a.y * b, a.z * b };
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect2_scmul() instead. */
+static inline vect2_t
+vect2_scmul_impl(vect2_t a, double b)
+{
+	vect2_t r = { a.x * b, a.y * b };
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect3_dotprod() instead. */
+static inline double
+vect3_dotprod_impl(vect3_t a, vect3_t b)
+{
+	return (a.x * b.x + a.y * b.y + a.z * b.z);
+}
+
+/** @note Internal. Do not call directly. Use vect2_dotprod() instead. */
+static inline double
+vect2_dotprod_impl(vect2_t a, vect2_t b)
+{
+	return (a.x * b.x + a.y * b.y);
+}
+
+/** @note Internal. Do not call directly. Use vect3_xprod() instead. */
+static inline vect3_t
+vect3_xprod_impl(vect3_t a, vect3_t b)
+{
+	vect3_t r = {
+	    a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z,
+	    a.x * b.y - a.y * b.x
+	};
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect3_mean() instead. */
+static inline vect3_t
+vect3_mean_impl(vect3_t a, vect3_t b)
+{
+	vect3_t r = { (a.x + b.x) / 2, (a.y + b.y) / 2, (a.z + b.z) / 2 };
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect2_mean() instead. */
+static inline vect2_t
+vect2_mean_impl(vect2_t a, vect2_t b)
+{
+	vect2_t r = { (a.x + b.x) / 2, (a.y + b.y) / 2 };
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect3_neg() instead. */
+static inline vect3_t
+vect3_neg_impl(vect3_t v)
+{
+	vect3_t r = { -v.x, -v.y, -v.z };
+	return (r);
+}
+
+/** @note Internal. Do not call directly. Use vect2_neg() instead. */
+static inline vect2_t
+vect2_neg_impl(vect2_t v)
+{
+	vect2_t r = { -v.x, -v.y };
+	return (r);
+}
+
+#define	vect3_abs(a)		vect3_abs_impl((a))
+#define	vect2_abs(a)		vect2_abs_impl((a))
+#define	vect3_dist(a, b)	vect3_abs_impl(vect3_sub_impl((a), (b)))
+#define	vect2_dist(a, b)	vect2_abs_impl(vect2_sub_impl((a), (b)))
+#define	vect3_add(a, b)		vect3_add_impl((a), (b))
+#define	vect2_add(a, b)		vect2_add_impl((a), (b))
+#define	vect3_sub(a, b)		vect3_sub_impl((a), (b))
+#define	vect2_sub(a, b)		vect2_sub_impl((a), (b))
+#define	vect3_mul(a, b)		vect3_mul_impl((a), (b))
+#define	vect2_mul(a, b)		vect2_mul_impl((a), (b))
+#define	vect3_scmul(a, b)	vect3_scmul_impl((a), (b))
+#define	vect2_scmul(a, b)	vect2_scmul_impl((a), (b))
+#define	vect3_dotprod(a, b)	vect3_dotprod_impl((a), (b))
+#define	vect2_dotprod(a, b)	vect2_dotprod_impl((a), (b))
+#define	vect3_xprod(a, b)	vect3_xprod_impl((a), (b))
+#define	vect3_mean(a, b)	vect3_mean_impl((a), (b))
+#define	vect2_mean(a, b)	vect2_mean_impl((a), (b))
+#define	vect3_neg(v)		vect3_neg_impl((v))
+#define	vect2_neg(v)		vect2_neg_impl((v))
+
+#endif	/* ACFUTILS_GEOM_INLINE */
+
 #ifdef	__cplusplus
 }
 #endif
@@ -43,6 +43,7 @@
 #include "log.h"
 #include "safe_alloc.h"
 #include "sysmacros.h"
+#include "thread.h"
 
 #include <cglm/cglm.h>
 
@@ -115,6 +116,20 @@ typedef struct glutils_cache_s glutils_cache_t;
 typedef void (*glutils_texsz_enum_cb_t)(const char *token, int64_t bytes,
     void *userinfo);
 
+/**
+ * A TEXSZ allocation token. Don't declare these directly, use
+ * TEXSZ_MK_TOKEN(), TEXSZ_DECL_TOKEN_GLOB() and TEXSZ_DEF_TOKEN_GLOB().
+ * The byte counter lives right in the token, so accounting an
+ * allocation against it is a single atomic add. The token registers
+ * itself with the TEXSZ system on first use.
+ */
+typedef struct glutils_texsz_token_s {
+	const char			*name;
+	atomic64_t			bytes;
+	atomic32_t			registered;
+	struct glutils_texsz_token_s	*next;
+} glutils_texsz_token_t;
+
 API_EXPORT void glutils_sys_init(void);
 
 API_EXPORT void glutils_disable_all_client_state(void);
@@ -218,6 +233,28 @@ API_EXPORT void glutils_draw_lines(glutils_lines_t *lines, GLint prog);
 /*
  * glutils cache is a generic quads/lines object cache.
  */
+/**
+ * Lookup statistics of a glutils_cache_t, as returned by
+ * glutils_cache_get_stats().
+ */
+typedef struct {
+	/** Lookups which found an existing object. */
+	uint64_t	hits;
+	/** Lookups which had to create a new object. */
+	uint64_t	misses;
+	/** Objects freed to keep the cache within its capacity. */
+	uint64_t	evictions;
+	/**
+	 * Total & maximum time spent searching the cache in nanoseconds.
+	 * This doesn't include the time needed to create missing objects.
+	 */
+	uint64_t	lookup_ns_total;
+	uint64_t	lookup_ns_max;
+	/** Number of objects & bytes of vertex data currently cached. */
+	size_t		entries;
+	size_t		bytes;
+} glutils_cache_stats_t;
+
 API_EXPORT glutils_cache_t *glutils_cache_new(size_t cap_bytes);
 API_EXPORT void glutils_cache_destroy(glutils_cache_t *cache);
 API_EXPORT glutils_quads_t *glutils_cache_get_2D_quads(
@@ -226,6 +263,9 @@ API_EXPORT glutils_quads_t *glutils_cache_get_3D_quads(
     glutils_cache_t *cache, const vect3_t *p, const vect2_t *t, size_t num_pts);
 API_EXPORT glutils_lines_t *glutils_cache_get_3D_lines(
     glutils_cache_t *cache, const vect3_t *p, size_t num_pts);
+API_EXPORT void glutils_cache_get_stats(const glutils_cache_t *cache,
+    glutils_cache_stats_t *stats);
+API_EXPORT void glutils_cache_reset_stats(glutils_cache_t *cache);
 
 API_EXPORT void glutils_vp2pvm(GLfloat pvm[16]);
 
@@ -282,6 +322,12 @@ API_EXPORT void glutils_vp2pvm(GLfloat pvm[16]);
  * In that case, you can use the TEXSZ_ALLOC_INSTANCE() and
  * TEXSZ_FREE_INSTANCE() macros to generate per-pointer statistics.
  *
+ * Per-token accounting is lock-free and cheap enough to leave enabled
+ * in production builds. Per-instance tracking needs a global lock and
+ * a lookup on every call. If that is too expensive, initialize the
+ * system using glutils_texsz_init_sampled() to only track a fraction
+ * of the instances (or none at all). Per-token totals stay exact.
+ *
  * In addition to the TEXSZ_ALLOC_* and TEXSZ_FREE_* macros, there are
  * variations of these macros with the "_BYTES" suffix. These let you
  * pass the raw byte size of the allocation directly, instead of having
@@ -293,22 +339,22 @@ API_EXPORT void glutils_vp2pvm(GLfloat pvm[16]);
  * @see TEXSZ_ALLOC_BYTES_INSTANCE()
  * @see TEXSZ_FREE_BYTES_INSTANCE()
  */
-#define	TEXSZ_MK_TOKEN(name) \
-	static const char *__texsz_token_ ## name = #name
+#define	TEXSZ_MK_TOKEN(tok) \
+	static glutils_texsz_token_t __texsz_token_ ## tok = { .name = #tok }
 /**
  * Declares a global TEXSZ system tracking token. Place this into a header
  * which will be included from all modules which will need to use this token.
  * @see TEXSZ_MK_TOKEN
  */
-#define	TEXSZ_DECL_TOKEN_GLOB(name) \
-	extern const char *__texsz_token_ ## name
+#define	TEXSZ_DECL_TOKEN_GLOB(tok) \
+	extern glutils_texsz_token_t __texsz_token_ ## tok
 /**
  * Defines a global TEXSZ system tracking token. Place this into a single
  * implementation modules, which is where the token will live.
  * @see TEXSZ_MK_TOKEN
  */
-#define	TEXSZ_DEF_TOKEN_GLOB(name) \
-	const char *__texsz_token_ ## name = #name
+#define	TEXSZ_DEF_TOKEN_GLOB(tok) \
+	glutils_texsz_token_t __texsz_token_ ## tok = { .name = #tok }
 /**
  * Notifies the TEXSZ system of a texture allocation by incrementing the
  * token's byte counter. Every call to TEXSZ_ALLOC() must be balanced
@@ -346,6 +392,9 @@ API_EXPORT void glutils_vp2pvm(GLfloat pvm[16]);
  *
  * The filename should be shortened at build time using log_backtrace()
  * to only contain the last portion of the filename of the call site.
+ * The filename is copied when the instance is first allocated, so it
+ * needn't stay valid afterwards. Long names are cut down to their last
+ * 63 characters.
  * You should wrap your functions which use TEXSZ_ALLOC_INSTANCE() into a
  * macro and extract the call site information automatically using the
  * `__FILE__` and `__LINE__` built-in pre-processor variables (see the
@@ -360,7 +409,7 @@ API_EXPORT void glutils_vp2pvm(GLfloat pvm[16]);
  */
 #define	TEXSZ_ALLOC_INSTANCE(__token_id, __instance, __filename, __line, \
     __format, __type, __w, __h) \
-	glutils_texsz_alloc(__texsz_token_ ## __token_id, (__instance), \
+	glutils_texsz_alloc(&__texsz_token_ ## __token_id, (__instance), \
 	    (__filename), (__line), (__format), (__type), (__w), (__h))
 /**
  * Frees an instanced allocation, previously registered using
@@ -372,7 +421,7 @@ API_EXPORT void glutils_vp2pvm(GLfloat pvm[16]);
  */
 #define	TEXSZ_FREE_INSTANCE(__token_id, __instance, __format, __type, \
     __w, __h) \
-	glutils_texsz_free(__texsz_token_ ## __token_id, (__instance), \
+	glutils_texsz_free(&__texsz_token_ ## __token_id, (__instance), \
 	    (__format), (__type), (__w), (__h))
 /**
  * Same as TEXSZ_ALLOC(), but rather than taking texture information to
@@ -397,8 +446,8 @@ API_EXPORT void glutils_vp2pvm(GLfloat pvm[16]);
  */
 #define	TEXSZ_ALLOC_BYTES_INSTANCE(__token_id, __instance, __filename, \
     __line, __bytes) \
-	glutils_texsz_alloc_bytes(__texsz_token_ ## __token_id, (__instance), \
-	    (__filename), (__line), (__bytes))
+	glutils_texsz_alloc_bytes(&__texsz_token_ ## __token_id, \
+	    (__instance), (__filename), (__line), (__bytes))
 /**
  * Instanced variant of TEXSZ_FREE_BYTES(). The `__instance` argument
  * matches the behavior of TEXSZ_FREE_INSTANCE() instance argument.
@@ -406,19 +455,20 @@ API_EXPORT void glutils_vp2pvm(GLfloat pvm[16]);
  * @see TEXSZ_FREE_INSTANCE()
  */
 #define	TEXSZ_FREE_BYTES_INSTANCE(__token_id, __instance, __bytes) \
-	glutils_texsz_free_bytes(__texsz_token_ ## __token_id, (__instance), \
-	    (__bytes))
+	glutils_texsz_free_bytes(&__texsz_token_ ## __token_id, \
+	    (__instance), (__bytes))
 
 API_EXPORT void glutils_texsz_init(void);
+API_EXPORT void glutils_texsz_init_sampled(unsigned inst_sample_rate);
 API_EXPORT void glutils_texsz_fini(void);
-API_EXPORT void glutils_texsz_alloc(const char *token, const void *instance,
-    const char *filename, int line, GLenum format, GLenum type,
-    unsigned w, unsigned h);
-API_EXPORT void glutils_texsz_free(const char *token, const void *instance,
-    GLenum format, GLenum type, unsigned w, unsigned h);
-API_EXPORT void glutils_texsz_alloc_bytes(const char *token,
+API_EXPORT void glutils_texsz_alloc(glutils_texsz_token_t *token,
+    const void *instance, const char *filename, int line, GLenum format,
+    GLenum type, unsigned w, unsigned h);
+API_EXPORT void glutils_texsz_free(glutils_texsz_token_t *token,
+    const void *instance, GLenum format, GLenum type, unsigned w, unsigned h);
+API_EXPORT void glutils_texsz_alloc_bytes(glutils_texsz_token_t *token,
     const void *instance, const char *filename, int line, int64_t bytes);
-API_EXPORT void glutils_texsz_free_bytes(const char *token,
+API_EXPORT void glutils_texsz_free_bytes(glutils_texsz_token_t *token,
     const void *instance, int64_t bytes);
 
 API_EXPORT uint64_t glutils_texsz_get(void);
@@ -612,6 +662,44 @@ API_EXPORT glutils_nl_t *glutils_nl_alloc_3D(const vec3 *pts, size_t num_pts);
 API_EXPORT void glutils_nl_free(glutils_nl_t *nl);
 API_EXPORT void glutils_nl_draw(glutils_nl_t *nl, float width, GLuint prog);
 
+typedef struct glutils_batch_s glutils_batch_t;
+
+/**
+ * Drawing statistics of a glutils_batch_t, as returned by
+ * glutils_batch_get_stats().
+ */
+typedef struct {
+	/** Number of objects added to the batch. */
+	uint64_t	objects;
+	/** Number of draw calls issued. */
+	uint64_t	draws;
+	/** Number of vertices submitted in those draw calls. */
+	uint64_t	vertices;
+	/**
+	 * Number of times the batch had to wait for the GPU to finish
+	 * reading a part of the ring buffer before it could reuse it.
+	 * If this keeps growing, allocate a larger batch.
+	 */
+	uint64_t	stalls;
+} glutils_batch_stats_t;
+
+API_EXPORT glutils_batch_t *glutils_batch_alloc(size_t num_vtx);
+API_EXPORT void glutils_batch_free(glutils_batch_t *batch);
+API_EXPORT void glutils_batch_begin(glutils_batch_t *batch, GLint prog);
+API_EXPORT void glutils_batch_flush(glutils_batch_t *batch);
+API_EXPORT void glutils_batch_end(glutils_batch_t *batch);
+API_EXPORT void glutils_batch_add_2D_quads(glutils_batch_t *batch,
+    const vect2_t *p, const vect2_t *t, size_t num_pts);
+API_EXPORT void glutils_batch_add_3D_quads(glutils_batch_t *batch,
+    const vect3_t *p, const vect2_t *t, size_t num_pts);
+API_EXPORT void glutils_batch_add_2D_lines(glutils_batch_t *batch,
+    const vect2_t *p, size_t num_pts);
+API_EXPORT void glutils_batch_add_3D_lines(glutils_batch_t *batch,
+    const vect3_t *p, size_t num_pts);
+API_EXPORT void glutils_batch_get_stats(const glutils_batch_t *batch,
+    glutils_batch_stats_t *stats);
+API_EXPORT void glutils_batch_reset_stats(glutils_batch_t *batch);
+
 /**
  * A wrapper for glEnableVertexAttribArray() and glVertexAttribPointer().
  * In addition to performing both operations at the same time, this only
@@ -25,6 +25,11 @@
  * to free all resources associated with the pic.
  *
  * To draw the image, use lacf_gl_pic_draw() or lacf_gl_pic_draw_custom().
+ *
+ * Images are normally loaded synchronously on first use. To avoid
+ * stalling the drawing thread, use lacf_gl_pic_set_async() to decode
+ * them in the background, and lacf_gl_pic_preload_dir() to decode all
+ * images of a directory ahead of time.
  */
 
 #ifndef	_LIBACFUTILS_GL_PIC_H_
@@ -47,7 +52,16 @@ API_EXPORT lacf_gl_pic_t *lacf_gl_pic_new_from_dir(const char *dirpath,
     const char *filename);
 API_EXPORT void lacf_gl_pic_destroy(lacf_gl_pic_t *pic);
 
+API_EXPORT void lacf_gl_pic_set_async(lacf_gl_pic_t *pic, bool_t flag);
+API_EXPORT bool_t lacf_gl_pic_get_async(const lacf_gl_pic_t *pic);
+API_EXPORT void lacf_gl_pic_set_placeholder(lacf_gl_pic_t *pic,
+    lacf_gl_pic_t *placeholder);
+
+API_EXPORT void lacf_gl_pic_preload_dir(const char *dirpath);
+API_EXPORT void lacf_gl_pic_preload_flush(void);
+
 API_EXPORT bool_t lacf_gl_pic_load(lacf_gl_pic_t *pic);
+API_EXPORT bool_t lacf_gl_pic_is_loaded(const lacf_gl_pic_t *pic);
 API_EXPORT void lacf_gl_pic_unload(lacf_gl_pic_t *pic);
 
 API_EXPORT int lacf_gl_pic_get_width(lacf_gl_pic_t *pic);
@@ -55,6 +55,29 @@ API_EXPORT double *fx_lin_multi_inv2(double y, const struct vect2_s *points,
 API_EXPORT double *fx_lin_multi_inv3(double y, const struct vect2_s *points,
     size_t n_points, bool_t extrapolate, size_t *num_out);
 
+/**
+ * A "compiled" version of a multi-segment linear function, as used by
+ * fx_lin_multi(). Constructing the curve precomputes the slopes of all
+ * segments and a lookup table to quickly locate the segment containing
+ * a given input value, so evaluation doesn't need to walk the points
+ * list on every call. Use this for large curves which are evaluated
+ * frequently.
+ * @see fx_lin_curve_alloc()
+ * @see fx_lin_curve_eval()
+ */
+typedef struct fx_lin_curve_s fx_lin_curve_t;
+
+API_EXPORT fx_lin_curve_t *fx_lin_curve_alloc(const struct vect2_s *points);
+API_EXPORT fx_lin_curve_t *fx_lin_curve_alloc2(const struct vect2_s *points,
+    size_t n_points);
+API_EXPORT void fx_lin_curve_free(fx_lin_curve_t *curve);
+API_EXPORT double fx_lin_curve_eval(const fx_lin_curve_t *curve, double x,
+    bool_t extrapolate);
+API_EXPORT double fx_lin_curve_eval_hint(const fx_lin_curve_t *curve,
+    double x, bool_t extrapolate, size_t *hint);
+API_EXPORT void fx_lin_curve_eval_v(const fx_lin_curve_t *curve,
+    const double *x, size_t n, bool_t extrapolate, double *out);
+
 /**
  * @note Internall. Do not call directly. Use wavg() instead.
  * @see wavg()
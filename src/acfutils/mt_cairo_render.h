@@ -96,6 +96,11 @@ typedef void (*mt_cairo_render_cb_t)(cairo_t *cr, unsigned w, unsigned h,
     void *userinfo);
 typedef struct mt_cairo_render_s mt_cairo_render_t;
 typedef struct mt_cairo_uploader_s mt_cairo_uploader_t;
+/**
+ * A fixed-size pool of threads shared by multiple renderers.
+ * @see mt_cairo_render_pool_init()
+ */
+typedef struct mt_cairo_render_pool_s mt_cairo_render_pool_t;
 
 /**
  * Creates a new mt_cairo_render_t surface.
@@ -162,10 +167,16 @@ API_EXPORT void mt_cairo_render_set_uploader(mt_cairo_render_t *mtcr,
     mt_cairo_uploader_t *mtul);
 API_EXPORT mt_cairo_uploader_t *mt_cairo_render_get_uploader(
     mt_cairo_render_t *mtcr);
+API_EXPORT void mt_cairo_render_set_pool(mt_cairo_render_t *mtcr,
+    mt_cairo_render_pool_t *pool);
+API_EXPORT mt_cairo_render_pool_t *mt_cairo_render_get_pool(
+    mt_cairo_render_t *mtcr);
 
 API_EXPORT unsigned mt_cairo_render_get_tex(mt_cairo_render_t *mtcr);
 API_EXPORT unsigned mt_cairo_render_get_width(mt_cairo_render_t *mtcr);
 API_EXPORT unsigned mt_cairo_render_get_height(mt_cairo_render_t *mtcr);
+API_EXPORT void mt_cairo_render_get_render_time(mt_cairo_render_t *mtcr,
+    uint64_t *frames, uint64_t *total_us, uint64_t *max_us);
 typedef struct {
 	unsigned	x, y;
 	unsigned	w, h;
@@ -173,6 +184,102 @@ typedef struct {
 API_EXPORT void mt_cairo_render_blit_back2front(mt_cairo_render_t *mtcr,
     const mtcr_rect_t *rects, size_t num);
 
+/**
+ * Damage tracking modes, which control how much of the surface is
+ * uploaded to the GPU after each frame.
+ * @see mt_cairo_render_set_damage_mode()
+ */
+typedef enum {
+	MTCR_DAMAGE_FULL,	/**< Upload the whole surface (default) */
+	MTCR_DAMAGE_MANUAL,	/**< See mt_cairo_render_add_damage() */
+	MTCR_DAMAGE_AUTO	/**< Compare with previous frame in tiles */
+} mtcr_damage_mode_t;
+API_EXPORT void mt_cairo_render_set_damage_mode(mt_cairo_render_t *mtcr,
+    mtcr_damage_mode_t mode);
+API_EXPORT mtcr_damage_mode_t mt_cairo_render_get_damage_mode(
+    mt_cairo_render_t *mtcr);
+API_EXPORT void mt_cairo_render_add_damage(mt_cairo_render_t *mtcr,
+    double x, double y, double w, double h);
+API_EXPORT void mt_cairo_render_get_upload_stats(mt_cairo_render_t *mtcr,
+    uint64_t *total_bytes, uint64_t *bytes_per_sec);
+API_EXPORT void mt_cairo_render_set_skip_unchanged(mt_cairo_render_t *mtcr,
+    bool_t flag);
+API_EXPORT bool_t mt_cairo_render_get_skip_unchanged(mt_cairo_render_t *mtcr);
+API_EXPORT void mt_cairo_render_get_frame_counts(mt_cairo_render_t *mtcr,
+    uint64_t *rendered, uint64_t *skipped);
+
+/**
+ * Number of buckets in the render time histogram of mtcr_stats_t.
+ * Bucket `i` counts frames which took less than
+ * `MTCR_STATS_HIST_BASE << i` microseconds to render, but didn't fit
+ * into the previous bucket. The last bucket counts all slower frames.
+ */
+#define	MTCR_STATS_HIST_BUCKETS	12
+#define	MTCR_STATS_HIST_BASE	250	/* microseconds */
+
+/**
+ * Renderer performance statistics, as returned by
+ * mt_cairo_render_get_stats(). All times are in microseconds.
+ */
+typedef struct {
+	/** Number of times the rendering callback was called. */
+	uint64_t	frames;
+	/** Frames dropped by mt_cairo_render_set_skip_unchanged(). */
+	uint64_t	frames_skipped;
+	/** Total & maximum time spent in the rendering callback. */
+	uint64_t	render_time_total;
+	uint64_t	render_time_max;
+	/** Histogram of rendering callback times. */
+	uint64_t	render_time_hist[MTCR_STATS_HIST_BUCKETS];
+	/**
+	 * Number of frames rendered on a schedule (i.e. due to the fps
+	 * setting or mt_cairo_render_once()) and the total & maximum
+	 * time by which they were started late. Lateness is caused by
+	 * the rendering thread being busy, e.g. in an overloaded render
+	 * pool (see mt_cairo_render_pool_init()).
+	 */
+	uint64_t	sched_frames;
+	uint64_t	sched_late_total;
+	uint64_t	sched_late_max;
+	/**
+	 * Number of scheduled frames which finished rendering after the
+	 * following frame should already have started, i.e. the renderer
+	 * couldn't keep up with its fps setting.
+	 */
+	uint64_t	deadline_misses;
+	/**
+	 * Number of frames uploaded to the GPU and the total & maximum
+	 * time between a frame finishing rendering and its upload being
+	 * complete. This includes time spent waiting in the queue of an
+	 * mt_cairo_uploader_t or waiting for the next call to
+	 * mt_cairo_render_draw() if no uploader is used.
+	 */
+	uint64_t	uploads;
+	uint64_t	upload_latency_total;
+	uint64_t	upload_latency_max;
+	/** Total bytes uploaded and the upload rate over the last second. */
+	uint64_t	upload_bytes;
+	uint64_t	upload_bytes_per_sec;
+} mtcr_stats_t;
+
+API_EXPORT void mt_cairo_render_get_stats(mt_cairo_render_t *mtcr,
+    mtcr_stats_t *stats);
+API_EXPORT void mt_cairo_render_reset_stats(mt_cairo_render_t *mtcr);
+
+/**
+ * Callback for mt_cairo_render_enum().
+ * @param mtcr The renderer being enumerated.
+ * @param filename Source file name where the renderer was created.
+ * @param line Source line number where the renderer was created.
+ * @param userinfo The `userinfo` argument passed to mt_cairo_render_enum().
+ */
+typedef void (*mt_cairo_render_enum_cb_t)(mt_cairo_render_t *mtcr,
+    const char *filename, int line, void *userinfo);
+API_EXPORT void mt_cairo_render_set_registry_enabled(bool_t flag);
+API_EXPORT void mt_cairo_render_enum(mt_cairo_render_enum_cb_t cb,
+    void *userinfo);
+API_EXPORT void mt_cairo_render_dump_stats(void);
+
 #ifdef	LACF_MTCR_DEBUG
 API_EXPORT void mt_cairo_render_set_ctx_checking_enabled(
     mt_cairo_render_t *mtcr, bool_t flag);
@@ -187,6 +294,10 @@ API_EXPORT void mt_cairo_render_rounded_rectangle(cairo_t *cr, double x,
 API_EXPORT mt_cairo_uploader_t *mt_cairo_uploader_init(void);
 API_EXPORT void mt_cairo_uploader_fini(mt_cairo_uploader_t *mtul);
 
+API_EXPORT mt_cairo_render_pool_t *mt_cairo_render_pool_init(
+    unsigned num_threads);
+API_EXPORT void mt_cairo_render_pool_fini(mt_cairo_render_pool_t *pool);
+
 #ifdef	__cplusplus
 }
 #endif
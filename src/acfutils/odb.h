@@ -54,14 +54,34 @@ typedef struct odb_s odb_t;
 typedef void (*add_obst_cb_t)(obst_type_t type, geo_pos3_t pos,
     float agl, obst_light_t light, unsigned quant, void *userinfo);
 
+/*
+ * Obstacle returned from the area queries (odb_get_obstacles_radius() and
+ * odb_get_obstacles_corridor()). `pos.elev' is the elevation of the base
+ * of the obstacle in meters AMSL, `agl' is its height in meters.
+ */
+typedef struct {
+	obst_type_t	type;
+	geo_pos3_t	pos;
+	float		agl;
+	obst_light_t	light;
+	unsigned	quant;
+} odb_obst_t;
+
 API_EXPORT odb_t *odb_init(const char *xpdir, const char *cainfo);
 API_EXPORT void odb_fini(odb_t *odb);
 
 API_EXPORT void odb_set_unload_delay(odb_t *odb, unsigned seconds);
 API_EXPORT time_t odb_get_cc_refresh_date(odb_t *odb, const char *cc);
 API_EXPORT bool_t odb_refresh_cc(odb_t *odb, const char *cc);
+API_EXPORT bool_t odb_refresh_cc_from_file(odb_t *odb, const char *cc,
+    const char *path);
 API_EXPORT bool_t odb_get_obstacles(odb_t *odb, int lat, int lon,
     add_obst_cb_t cb, void *userinfo);
+API_EXPORT size_t odb_get_obstacles_radius(odb_t *odb, geo_pos2_t center,
+    double radius, double min_agl, odb_obst_t *out, size_t cap);
+API_EXPORT size_t odb_get_obstacles_corridor(odb_t *odb, geo_pos2_t start,
+    geo_pos2_t end, double half_width, double min_agl, odb_obst_t *out,
+    size_t cap);
 
 API_EXPORT void odb_set_proxy(odb_t *odb, const char *proxy);
 API_EXPORT size_t odb_get_proxy(odb_t *odb, char *proxy, size_t cap);
@@ -179,6 +179,40 @@ API_EXPORT GLuint shader_prog_from_text(const char *progname,
 API_EXPORT GLuint shader_prog_from_info(const char *dirpath,
     const shader_prog_info_t *info);
 
+/*
+ * Program binary cache
+ *
+ * Compiling and linking a few dozen shader programs at load time can take
+ * a considerable amount of time. If you call `shader_cache_init' with a
+ * writable directory, the linked program binaries are stored there
+ * (using glGetProgramBinary) and reused on subsequent loads, as long as
+ * the shader sources, specialization constants, attribute bindings and
+ * the OpenGL driver (vendor, renderer and version strings) haven't
+ * changed. Any mismatch, or a binary rejected by the driver, causes the
+ * program to be silently compiled from source again and the cache entry
+ * replaced. This applies to all of shader_prog_from_file,
+ * shader_prog_from_text, shader_prog_from_info and shader objects.
+ *
+ * The cache directory can be deleted at any time while the cache isn't
+ * initialized. Entries for old versions of shader sources aren't
+ * removed automatically.
+ */
+typedef struct {
+	uint64_t	hits;		/* programs loaded from the cache */
+	uint64_t	misses;		/* programs compiled from source */
+	uint64_t	rejects;	/* stale or invalid cache entries */
+	uint64_t	stores;		/* programs added to the cache */
+	uint64_t	hit_us;		/* total load time of cache hits */
+	uint64_t	miss_us;	/* total compile time of cache misses */
+} shader_cache_stats_t;
+
+#define	shader_cache_init	ACFSYM(shader_cache_init)
+API_EXPORT bool_t shader_cache_init(const char *cachedir);
+#define	shader_cache_fini	ACFSYM(shader_cache_fini)
+API_EXPORT void shader_cache_fini(void);
+#define	shader_cache_get_stats	ACFSYM(shader_cache_get_stats)
+API_EXPORT void shader_cache_get_stats(shader_cache_stats_t *stats);
+
 /*
  * Shader Objects
  *
@@ -38,6 +38,7 @@ extern "C" {
 #endif
 
 typedef struct alc alc_t;
+typedef struct wav_stream_s wav_stream_t;
 
 typedef struct wav_fmt_hdr {
 	uint16_t	datafmt;	/* PCM = 1 */
@@ -71,6 +72,8 @@ typedef struct wav_s {
 	float		pitch;
 
 	uint64_t	play_start;
+
+	wav_stream_t	*stream;	/* non-NULL if from wav_load_stream */
 } wav_t;
 
 API_EXPORT char **openal_list_output_devs(size_t *num_p);
@@ -81,6 +84,8 @@ API_EXPORT void openal_fini(alc_t *alc);
 
 API_EXPORT wav_t *wav_load(const char *filename, const char *descr_name,
     alc_t *alc);
+API_EXPORT wav_t *wav_load_stream(const char *filename,
+    const char *descr_name, alc_t *alc);
 API_EXPORT void wav_free(wav_t *wav);
 
 API_EXPORT void wav_set_offset(wav_t *wav, float offset_sec);
@@ -36,6 +36,13 @@ extern "C" {
 
 typedef struct wmm_s wmm_t;
 
+/*
+ * Maximum error (in degrees) of the declination grid cache relative to
+ * the full model. Every grid cell is validated against the full model
+ * when it is built. See wmm_set_decl_grid.
+ */
+#define	WMM_DECL_GRID_MAX_ERR	0.05
+
 API_EXPORT wmm_t *wmm_open(const char *filename, double year);
 API_EXPORT void wmm_reopen(wmm_t *wmm, double year);
 API_EXPORT void wmm_close(wmm_t *wmm);
@@ -46,6 +53,11 @@ API_EXPORT double wmm_get_end(const wmm_t *wmm);
 API_EXPORT double wmm_mag2true(const wmm_t *wmm, double m, geo_pos3_t pos);
 API_EXPORT double wmm_true2mag(const wmm_t *wmm, double t, geo_pos3_t pos);
 API_EXPORT double wmm_get_decl(const wmm_t *wmm, geo_pos3_t pos);
+API_EXPORT double wmm_get_decl_exact(const wmm_t *wmm, geo_pos3_t pos);
+API_EXPORT void wmm_get_decl_v(const wmm_t *wmm, const geo_pos3_t *pts,
+    size_t n, double *out);
+
+API_EXPORT void wmm_set_decl_grid(wmm_t *wmm, double res_deg);
 
 #ifdef	__cplusplus
 }
@@ -35,6 +35,9 @@
 #include <dirent.h>
 #endif	/* !IBM */
 
+/* Inline the vector math in the airport proximity searches */
+#define	ACFUTILS_GEOM_INLINE
+
 #include "acfutils/airportdb.h"
 #include "acfutils/assert.h"
 #include "acfutils/avl.h"
@@ -2925,7 +2928,9 @@ find_nearest_airports_tile(airportdb_t *db, vect3_t ecef,
 		return;
 	for (airport_t *arpt = avl_first(&tile->arpts); arpt != NULL;
 	    arpt = AVL_NEXT(&tile->arpts, arpt)) {
-		vect3_t arpt_ecef = geo2ecef_ft(arpt->refpt, &wgs84);
+		/* Loaded airports have their ECEF position precomputed */
+		vect3_t arpt_ecef = (arpt->load_complete ? arpt->ecef :
+		    geo2ecef_ft(arpt->refpt, &wgs84));
 		if (vect3_abs(vect3_sub(ecef, arpt_ecef)) < db->load_limit) {
 			list_insert_tail(l, arpt);
 			VERIFY(load_airport(arpt));
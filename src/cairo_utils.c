@@ -23,6 +23,10 @@
  * Copyright 2022 Saso Kiselkov. All rights reserved.
  */
 
+#ifdef	__SSE2__
+#include <emmintrin.h>
+#endif
+
 #include "acfutils/assert.h"
 #include "acfutils/geom.h"
 #include "acfutils/cairo_utils.h"
@@ -46,3 +50,225 @@ cairo_utils_rounded_rect(cairo_t *cr, double x, double y,
 	cairo_arc(cr, x + radius, y + radius, radius,
 	    DEG2RAD(180), DEG2RAD(270));
 }
+
+/*
+ * Pixel kernels. The scalar versions operate on whole native-endian
+ * 32-bit pixels, so they work regardless of byte order. On x86 we
+ * process 4 pixels at a time using SSE2, which every x86-64 CPU has.
+ */
+#define	ALPHA_MASK	0xff000000u
+
+/* Exact (c * a) / 255, rounded to nearest */
+static inline uint32_t
+mul_div255(uint32_t c, uint32_t a)
+{
+	uint32_t t = c * a + 128;
+	return ((t + (t >> 8)) >> 8);
+}
+
+static inline uint32_t
+px_invert(uint32_t px)
+{
+	uint32_t a = px >> 24;
+	/*
+	 * In valid premultiplied pixels no color channel exceeds alpha,
+	 * so the subtraction can't borrow across channels.
+	 */
+	return ((px & ALPHA_MASK) | (a * 0x010101u - (px & ~ALPHA_MASK)));
+}
+
+static inline uint32_t
+px_premultiply(uint32_t px)
+{
+	uint32_t a = px >> 24;
+
+	if (a == 255)
+		return (px);
+	return ((a << 24) | (mul_div255((px >> 16) & 0xff, a) << 16) |
+	    (mul_div255((px >> 8) & 0xff, a) << 8) |
+	    mul_div255(px & 0xff, a));
+}
+
+#ifdef	__SSE2__
+
+/* Broadcasts the alpha of each pixel into all 4 of its bytes */
+static inline __m128i
+alpha4(__m128i px)
+{
+	__m128i a = _mm_srli_epi32(px, 24);
+
+	a = _mm_or_si128(a, _mm_slli_epi32(a, 8));
+	return (_mm_or_si128(a, _mm_slli_epi32(a, 16)));
+}
+
+static inline __m128i
+invert4(__m128i px)
+{
+	const __m128i amask = _mm_set1_epi32(ALPHA_MASK);
+
+	/* The alpha channel ends up a - a = 0, so put it back */
+	return (_mm_or_si128(_mm_sub_epi8(alpha4(px), px),
+	    _mm_and_si128(px, amask)));
+}
+
+static inline __m128i
+mul_div255_8(__m128i c, __m128i a)
+{
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(c, a), _mm_set1_epi16(128));
+	return (_mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8));
+}
+
+static inline __m128i
+premultiply4(__m128i px)
+{
+	const __m128i amask = _mm_set1_epi32(ALPHA_MASK);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i a, lo, hi;
+
+	/* Most chart pixels are opaque, skip the math for those */
+	if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(px, amask),
+	    amask)) == 0xffff)
+		return (px);
+	/* Multiplying alpha by 255 leaves it unchanged */
+	a = _mm_or_si128(alpha4(px), amask);
+	lo = mul_div255_8(_mm_unpacklo_epi8(px, zero),
+	    _mm_unpacklo_epi8(a, zero));
+	hi = mul_div255_8(_mm_unpackhi_epi8(px, zero),
+	    _mm_unpackhi_epi8(a, zero));
+	return (_mm_packus_epi16(lo, hi));
+}
+
+/* RGBA byte order to BGRA (native ARGB32 on little-endian) */
+static inline __m128i
+swap_rb4(__m128i px)
+{
+	const __m128i ga_mask = _mm_set1_epi32(0xff00ff00u);
+	const __m128i b_mask = _mm_set1_epi32(0xffu);
+
+	return (_mm_or_si128(_mm_and_si128(px, ga_mask), _mm_or_si128(
+	    _mm_and_si128(_mm_srli_epi32(px, 16), b_mask),
+	    _mm_slli_epi32(_mm_and_si128(px, b_mask), 16))));
+}
+
+#endif	/* __SSE2__ */
+
+void
+cairo_utils_invert_argb32(void *data, size_t stride, unsigned width,
+    unsigned height)
+{
+	ASSERT(data != NULL || width == 0 || height == 0);
+	ASSERT3U(stride, >=, width * 4);
+
+	for (unsigned y = 0; y < height; y++) {
+		uint32_t *row = (uint32_t *)((uint8_t *)data + y * stride);
+		unsigned x = 0;
+#ifdef	__SSE2__
+		for (; x + 4 <= width; x += 4) {
+			__m128i *p = (__m128i *)&row[x];
+			_mm_storeu_si128(p, invert4(_mm_loadu_si128(p)));
+		}
+#endif
+		for (; x < width; x++)
+			row[x] = px_invert(row[x]);
+	}
+}
+
+static void
+invert_rgb24(void *data, size_t stride, unsigned width, unsigned height)
+{
+	for (unsigned y = 0; y < height; y++) {
+		uint32_t *row = (uint32_t *)((uint8_t *)data + y * stride);
+		unsigned x = 0;
+#ifdef	__SSE2__
+		const __m128i mask = _mm_set1_epi32(~ALPHA_MASK);
+
+		for (; x + 4 <= width; x += 4) {
+			__m128i *p = (__m128i *)&row[x];
+			_mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p),
+			    mask));
+		}
+#endif
+		/* The upper byte is unused in RGB24 */
+		for (; x < width; x++)
+			row[x] ^= ~ALPHA_MASK;
+	}
+}
+
+void
+cairo_utils_premultiply_argb32(void *data, size_t stride, unsigned width,
+    unsigned height)
+{
+	ASSERT(data != NULL || width == 0 || height == 0);
+	ASSERT3U(stride, >=, width * 4);
+
+	for (unsigned y = 0; y < height; y++) {
+		uint32_t *row = (uint32_t *)((uint8_t *)data + y * stride);
+		unsigned x = 0;
+#ifdef	__SSE2__
+		for (; x + 4 <= width; x += 4) {
+			__m128i *p = (__m128i *)&row[x];
+			_mm_storeu_si128(p, premultiply4(_mm_loadu_si128(p)));
+		}
+#endif
+		for (; x < width; x++)
+			row[x] = px_premultiply(row[x]);
+	}
+}
+
+void
+cairo_utils_rgba2argb32(const void *src, size_t src_stride, void *dst,
+    size_t dst_stride, unsigned width, unsigned height)
+{
+	ASSERT(src != NULL || width == 0 || height == 0);
+	ASSERT(dst != NULL || width == 0 || height == 0);
+	ASSERT3U(src_stride, >=, width * 4);
+	ASSERT3U(dst_stride, >=, width * 4);
+	ASSERT(src != dst || src_stride == dst_stride);
+
+	for (unsigned y = 0; y < height; y++) {
+		const uint8_t *in = (const uint8_t *)src + y * src_stride;
+		uint32_t *out = (uint32_t *)((uint8_t *)dst + y * dst_stride);
+		unsigned x = 0;
+#ifdef	__SSE2__
+		for (; x + 4 <= width; x += 4) {
+			__m128i px = _mm_loadu_si128(
+			    (const __m128i *)&in[x * 4]);
+			_mm_storeu_si128((__m128i *)&out[x],
+			    premultiply4(swap_rb4(px)));
+		}
+#endif
+		for (; x < width; x++) {
+			const uint8_t *p = &in[x * 4];
+			out[x] = px_premultiply(((uint32_t)p[3] << 24) |
+			    ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) |
+			    p[2]);
+		}
+	}
+}
+
+bool_t
+cairo_utils_invert_surface(cairo_surface_t *surf)
+{
+	cairo_format_t fmt;
+	void *data;
+	size_t stride;
+	unsigned width, height;
+
+	ASSERT(surf != NULL);
+
+	fmt = cairo_image_surface_get_format(surf);
+	if (fmt != CAIRO_FORMAT_ARGB32 && fmt != CAIRO_FORMAT_RGB24)
+		return (B_FALSE);
+	cairo_surface_flush(surf);
+	data = cairo_image_surface_get_data(surf);
+	stride = cairo_image_surface_get_stride(surf);
+	width = cairo_image_surface_get_width(surf);
+	height = cairo_image_surface_get_height(surf);
+	if (fmt == CAIRO_FORMAT_ARGB32)
+		cairo_utils_invert_argb32(data, stride, width, height);
+	else
+		invert_rgb24(data, stride, width, height);
+	cairo_surface_mark_dirty(surf);
+
+	return (B_TRUE);
+}
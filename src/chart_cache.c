@@ -0,0 +1,724 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if	IBM
+#include <windows.h>
+#endif
+
+#include "acfutils/assert.h"
+#include "acfutils/avl.h"
+#include "acfutils/crc64.h"
+#include "acfutils/helpers.h"
+#include "acfutils/list.h"
+#include "acfutils/log.h"
+#include "acfutils/safe_alloc.h"
+#include "acfutils/thread.h"
+
+#include "chart_cache.h"
+
+#define	INDEX_NAME	"cache.idx"
+#define	INDEX_HDR	"chart_cache 1"
+#define	INDEX_FIELDS	8
+#define	DERIVED_SUFFIX	".tiles"
+#define	MAX_AGE		86400	/* seconds until a file must be revalidated */
+#define	MIN_EVICT_AGE	60	/* seconds, recently used files are kept */
+#define	FLUSH_INTVAL	30	/* seconds */
+
+typedef struct {
+	char			*name;		/* relative to cache->dir */
+	uint64_t		hash;		/* crc64 of contents or 0 */
+	uint64_t		size;		/* bytes */
+	uint64_t		derived;	/* bytes */
+	time_t			atime;		/* last used */
+	time_t			vtime;		/* last validated with server */
+	chart_cache_valid_t	valid;
+	avl_node_t		node;
+	list_node_t		lru_node;
+} cache_ent_t;
+
+struct chart_cache_s {
+	mutex_t		lock;
+	char		*dir;
+	size_t		dir_len;
+	uint64_t	quota;
+	uint64_t	used;		/* bytes, files + derived data */
+	bool_t		dirty;
+	time_t		flush_t;
+	avl_tree_t	ents;
+	list_t		lru;		/* head = most recently used */
+};
+
+static int
+ent_compar(const void *a, const void *b)
+{
+	const cache_ent_t *ea = a, *eb = b;
+	int res = strcmp(ea->name, eb->name);
+
+	if (res < 0)
+		return (-1);
+	if (res > 0)
+		return (1);
+	return (0);
+}
+
+static int
+ent_atime_compar(const void *a, const void *b)
+{
+	const cache_ent_t *ea = *(const cache_ent_t **)a;
+	const cache_ent_t *eb = *(const cache_ent_t **)b;
+
+	/* Most recent first */
+	if (ea->atime > eb->atime)
+		return (-1);
+	if (ea->atime < eb->atime)
+		return (1);
+	return (0);
+}
+
+/*
+ * Returns the part of `path' relative to the cache directory, or NULL
+ * if the path lies outside of the cache.
+ */
+static const char *
+rel_name(const chart_cache_t *cache, const char *path)
+{
+	if (strncmp(path, cache->dir, cache->dir_len) != 0 ||
+	    (path[cache->dir_len] != '/' && path[cache->dir_len] != '\\') ||
+	    path[cache->dir_len + 1] == 0)
+		return (NULL);
+	return (&path[cache->dir_len + 1]);
+}
+
+static char *
+ent_path(const chart_cache_t *cache, const cache_ent_t *ent)
+{
+	return (mkpathname(cache->dir, ent->name, NULL));
+}
+
+static cache_ent_t *
+ent_find(chart_cache_t *cache, const char *path)
+{
+	const char *name = rel_name(cache, path);
+	cache_ent_t srch;
+
+	ASSERT_MUTEX_HELD(&cache->lock);
+	if (name == NULL)
+		return (NULL);
+	srch.name = (char *)name;
+	return (avl_find(&cache->ents, &srch, NULL));
+}
+
+static void
+ent_touch(chart_cache_t *cache, cache_ent_t *ent)
+{
+	ASSERT_MUTEX_HELD(&cache->lock);
+	ent->atime = time(NULL);
+	list_remove(&cache->lru, ent);
+	list_insert_head(&cache->lru, ent);
+	cache->dirty = B_TRUE;
+}
+
+static uint64_t
+file_hash(const char *path)
+{
+	size_t len;
+	void *buf = file2buf(path, &len);
+	uint64_t hash;
+
+	if (buf == NULL)
+		return (0);
+	hash = crc64(buf, len);
+	free(buf);
+
+	return (hash);
+}
+
+/*
+ * Looks up the entry for `path'. Files which exist, but aren't in the
+ * index yet (e.g. from before the cache existed) are adopted.
+ */
+static cache_ent_t *
+ent_get(chart_cache_t *cache, const char *path)
+{
+	const char *name = rel_name(cache, path);
+	cache_ent_t srch, *ent;
+	avl_index_t where;
+	ssize_t sz;
+
+	ASSERT_MUTEX_HELD(&cache->lock);
+
+	if (name == NULL)
+		return (NULL);
+	srch.name = (char *)name;
+	ent = avl_find(&cache->ents, &srch, &where);
+	if (ent != NULL || (sz = filesz(path)) < 0)
+		return (ent);
+
+	ent = safe_calloc(1, sizeof (*ent));
+	ent->name = safe_strdup(name);
+	ent->size = sz;
+	ent->hash = file_hash(path);
+	ent->atime = time(NULL);
+	avl_insert(&cache->ents, ent, where);
+	list_insert_head(&cache->lru, ent);
+	cache->used += ent->size;
+	cache->dirty = B_TRUE;
+
+	return (ent);
+}
+
+static void
+ent_remove(chart_cache_t *cache, cache_ent_t *ent, bool_t delete_files)
+{
+	ASSERT_MUTEX_HELD(&cache->lock);
+
+	if (delete_files) {
+		char *path = ent_path(cache, ent);
+		char *derived = chart_cache_derived_path(path);
+
+		remove_file(path, B_TRUE);
+		if (file_exists(derived, NULL))
+			remove_directory(derived);
+		free(derived);
+		free(path);
+	}
+	ASSERT3U(cache->used, >=, ent->size + ent->derived);
+	cache->used -= ent->size + ent->derived;
+	avl_remove(&cache->ents, ent);
+	list_remove(&cache->lru, ent);
+	free(ent->name);
+	free(ent);
+	cache->dirty = B_TRUE;
+}
+
+/*
+ * Deletes the least recently used files until we are back under quota.
+ * Files used within the last MIN_EVICT_AGE seconds are never evicted,
+ * since a loader thread might be working on them right now.
+ */
+static void
+evict(chart_cache_t *cache)
+{
+	time_t now = time(NULL);
+
+	ASSERT_MUTEX_HELD(&cache->lock);
+
+	while (cache->used > cache->quota) {
+		cache_ent_t *ent = list_tail(&cache->lru);
+
+		if (ent == NULL || now - ent->atime < MIN_EVICT_AGE)
+			break;
+		ent_remove(cache, ent, B_TRUE);
+	}
+}
+
+static bool_t
+replace_file(const char *tmp_path, const char *path)
+{
+	int err;
+#if	IBM
+	/*
+	 * Windows needs special handling, because it doesn't let us
+	 * use rename for the replace operation.
+	 */
+	if (file_exists(path, NULL)) {
+		if (!ReplaceFileA(path, tmp_path, NULL,
+		    REPLACEFILE_IGNORE_MERGE_ERRORS |
+		    REPLACEFILE_IGNORE_ACL_ERRORS, NULL, NULL)) {
+			win_perror(GetLastError(), "Error writing %s: "
+			    "ReplaceFile failed", path);
+			return (B_FALSE);
+		}
+		return (B_TRUE);
+	}
+#endif	/* IBM */
+	err = rename(tmp_path, path);
+	if (err != 0) {
+		logMsg("Error writing %s: atomic rename failed: %s", path,
+		    strerror(errno));
+		return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+
+/*
+ * Writes a file by way of a temporary file, so a crash or full disk
+ * never leaves a truncated file behind under the final name.
+ */
+static bool_t
+write_file(const char *path, const void *buf, size_t len)
+{
+	char *dname = lacf_dirname(path);
+	char *tmp_path = sprintf_alloc("%s.part", path);
+	FILE *fp;
+	bool_t res;
+
+	if (!create_directory_recursive(dname)) {
+		res = B_FALSE;
+		goto out;
+	}
+	fp = fopen(tmp_path, "wb");
+	if (fp == NULL) {
+		logMsg("Error writing %s: %s", tmp_path, strerror(errno));
+		res = B_FALSE;
+		goto out;
+	}
+	res = (fwrite(buf, 1, len, fp) == len);
+	res &= (fclose(fp) == 0);
+	if (!res) {
+		logMsg("Error writing %s: %s", tmp_path, strerror(errno));
+		remove_file(tmp_path, B_TRUE);
+		goto out;
+	}
+	res = replace_file(tmp_path, path);
+out:
+	free(tmp_path);
+	free(dname);
+
+	return (res);
+}
+
+static void
+flush_impl(chart_cache_t *cache)
+{
+	char *path, *buf = NULL;
+	size_t bufsz = 0;
+
+	ASSERT_MUTEX_HELD(&cache->lock);
+
+	cache->flush_t = time(NULL);
+	if (!cache->dirty)
+		return;
+	append_format(&buf, &bufsz, "%s\n", INDEX_HDR);
+	for (cache_ent_t *ent = list_head(&cache->lru); ent != NULL;
+	    ent = list_next(&cache->lru, ent)) {
+		append_format(&buf, &bufsz, "%s\t%" PRIx64 "\t%" PRIu64 "\t%"
+		    PRIu64 "\t%lld\t%lld\t%s\t%s\n", ent->name, ent->hash,
+		    ent->size, ent->derived, (long long)ent->atime,
+		    (long long)ent->vtime, ent->valid.etag,
+		    ent->valid.last_mod);
+	}
+	path = mkpathname(cache->dir, INDEX_NAME, NULL);
+	if (write_file(path, buf, bufsz))
+		cache->dirty = B_FALSE;
+	free(path);
+	free(buf);
+}
+
+static void
+maybe_flush(chart_cache_t *cache)
+{
+	ASSERT_MUTEX_HELD(&cache->lock);
+	if (time(NULL) - cache->flush_t >= FLUSH_INTVAL)
+		flush_impl(cache);
+}
+
+chart_cache_t *
+chart_cache_alloc(const char *dir, uint64_t quota)
+{
+	chart_cache_t *cache = safe_calloc(1, sizeof (*cache));
+
+	ASSERT(dir != NULL);
+
+	crc64_init();
+	mutex_init(&cache->lock);
+	cache->dir = safe_strdup(dir);
+	cache->dir_len = strlen(dir);
+	/* So we can do a simple prefix match in rel_name */
+	while (cache->dir_len > 1 && (cache->dir[cache->dir_len - 1] == '/' ||
+	    cache->dir[cache->dir_len - 1] == '\\'))
+		cache->dir[--cache->dir_len] = 0;
+	cache->quota = MAX(quota, CHART_CACHE_MIN_QUOTA);
+	avl_create(&cache->ents, ent_compar, sizeof (cache_ent_t),
+	    offsetof(cache_ent_t, node));
+	list_create(&cache->lru, sizeof (cache_ent_t),
+	    offsetof(cache_ent_t, lru_node));
+
+	return (cache);
+}
+
+/*
+ * Loads the index from disk. Entries whose files have disappeared are
+ * dropped and files which were modified behind our back lose their
+ * hash & validators, so they will be revalidated.
+ */
+void
+chart_cache_open(chart_cache_t *cache)
+{
+	char *path = mkpathname(cache->dir, INDEX_NAME, NULL);
+	FILE *fp = fopen(path, "rb");
+	char *line = NULL;
+	size_t cap = 0;
+	cache_ent_t **ents = NULL;
+	size_t n_ents = 0, ents_cap = 0;
+
+	ASSERT(cache != NULL);
+
+	mutex_enter(&cache->lock);
+
+	if (fp == NULL)
+		goto out;
+	if (lacf_getline(&line, &cap, fp) <= 0 ||
+	    strncmp(line, INDEX_HDR, strlen(INDEX_HDR)) != 0) {
+		logMsg("Chart cache index %s is corrupt, ignoring it", path);
+		goto out;
+	}
+	while (lacf_getline(&line, &cap, fp) > 0) {
+		char *comps[INDEX_FIELDS];
+		cache_ent_t *ent, srch;
+		char *filepath;
+		ssize_t sz;
+		avl_index_t where;
+
+		line[strcspn(line, "\r\n")] = 0;
+		if (explode_line(line, '\t', comps, INDEX_FIELDS) !=
+		    INDEX_FIELDS || *comps[0] == 0)
+			continue;
+		srch.name = comps[0];
+		if (avl_find(&cache->ents, &srch, &where) != NULL)
+			continue;
+		filepath = mkpathname(cache->dir, comps[0], NULL);
+		sz = filesz(filepath);
+		if (sz < 0) {
+			char *derived = chart_cache_derived_path(filepath);
+
+			if (file_exists(derived, NULL))
+				remove_directory(derived);
+			free(derived);
+			free(filepath);
+			cache->dirty = B_TRUE;
+			continue;
+		}
+		free(filepath);
+
+		ent = safe_calloc(1, sizeof (*ent));
+		ent->name = safe_strdup(comps[0]);
+		ent->hash = strtoull(comps[1], NULL, 16);
+		ent->size = strtoull(comps[2], NULL, 10);
+		ent->derived = strtoull(comps[3], NULL, 10);
+		ent->atime = strtoll(comps[4], NULL, 10);
+		ent->vtime = strtoll(comps[5], NULL, 10);
+		lacf_strlcpy(ent->valid.etag, comps[6],
+		    sizeof (ent->valid.etag));
+		lacf_strlcpy(ent->valid.last_mod, comps[7],
+		    sizeof (ent->valid.last_mod));
+		if ((uint64_t)sz != ent->size) {
+			ent->size = sz;
+			ent->hash = 0;
+			ent->vtime = 0;
+			memset(&ent->valid, 0, sizeof (ent->valid));
+			cache->dirty = B_TRUE;
+		}
+		avl_insert(&cache->ents, ent, where);
+		cache->used += ent->size + ent->derived;
+		if (n_ents == ents_cap) {
+			ents_cap = MAX(2 * ents_cap, 256);
+			ents = safe_realloc(ents, ents_cap * sizeof (*ents));
+		}
+		ents[n_ents++] = ent;
+	}
+	/* The index might not have been in LRU order if edited by hand */
+	if (n_ents != 0)
+		qsort(ents, n_ents, sizeof (*ents), ent_atime_compar);
+	for (size_t i = 0; i < n_ents; i++)
+		list_insert_tail(&cache->lru, ents[i]);
+	evict(cache);
+out:
+	flush_impl(cache);
+	mutex_exit(&cache->lock);
+
+	if (fp != NULL)
+		fclose(fp);
+	free(line);
+	free(ents);
+	free(path);
+}
+
+void
+chart_cache_free(chart_cache_t *cache)
+{
+	cache_ent_t *ent;
+	void *cookie = NULL;
+
+	if (cache == NULL)
+		return;
+
+	mutex_enter(&cache->lock);
+	flush_impl(cache);
+	mutex_exit(&cache->lock);
+
+	while (list_remove_head(&cache->lru) != NULL)
+		;
+	list_destroy(&cache->lru);
+	while ((ent = avl_destroy_nodes(&cache->ents, &cookie)) != NULL) {
+		free(ent->name);
+		free(ent);
+	}
+	avl_destroy(&cache->ents);
+	mutex_destroy(&cache->lock);
+	free(cache->dir);
+	free(cache);
+}
+
+void
+chart_cache_set_quota(chart_cache_t *cache, uint64_t quota)
+{
+	ASSERT(cache != NULL);
+	mutex_enter(&cache->lock);
+	cache->quota = MAX(quota, CHART_CACHE_MIN_QUOTA);
+	evict(cache);
+	mutex_exit(&cache->lock);
+}
+
+void
+chart_cache_get_usage(chart_cache_t *cache, uint64_t *used, uint64_t *quota)
+{
+	ASSERT(cache != NULL);
+	mutex_enter(&cache->lock);
+	if (used != NULL)
+		*used = cache->used;
+	if (quota != NULL)
+		*quota = cache->quota;
+	mutex_exit(&cache->lock);
+}
+
+/*
+ * Returns B_TRUE if the file exists and has been validated with the
+ * server recently enough that it can be used without asking again.
+ */
+bool_t
+chart_cache_is_fresh(chart_cache_t *cache, const char *path)
+{
+	cache_ent_t *ent;
+	bool_t fresh;
+
+	ASSERT(cache != NULL);
+	ASSERT(path != NULL);
+
+	mutex_enter(&cache->lock);
+	ent = ent_find(cache, path);
+	fresh = (ent != NULL && ent->vtime != 0 &&
+	    time(NULL) - ent->vtime < MAX_AGE &&
+	    filesz(path) == (ssize_t)ent->size);
+	mutex_exit(&cache->lock);
+
+	return (fresh);
+}
+
+void
+chart_cache_touch(chart_cache_t *cache, const char *path)
+{
+	cache_ent_t *ent;
+
+	ASSERT(cache != NULL);
+	ASSERT(path != NULL);
+
+	mutex_enter(&cache->lock);
+	ent = ent_get(cache, path);
+	if (ent != NULL) {
+		ent_touch(cache, ent);
+		evict(cache);
+		maybe_flush(cache);
+	}
+	mutex_exit(&cache->lock);
+}
+
+/*
+ * Retrieves the validators to send in a conditional request for `path'.
+ * Returns B_FALSE if we don't have any, e.g. because the file isn't
+ * cached or the server didn't send any validators with it.
+ */
+bool_t
+chart_cache_get_valid(chart_cache_t *cache, const char *path,
+    chart_cache_valid_t *valid)
+{
+	cache_ent_t *ent;
+	bool_t res = B_FALSE;
+
+	ASSERT(cache != NULL);
+	ASSERT(path != NULL);
+	ASSERT(valid != NULL);
+
+	mutex_enter(&cache->lock);
+	ent = ent_find(cache, path);
+	if (ent != NULL && filesz(path) == (ssize_t)ent->size &&
+	    (*ent->valid.etag != 0 || *ent->valid.last_mod != 0)) {
+		*valid = ent->valid;
+		res = B_TRUE;
+	}
+	mutex_exit(&cache->lock);
+
+	return (res);
+}
+
+/*
+ * Stores a freshly downloaded file. If the contents are identical to
+ * what we already have, the file isn't rewritten, so its modification
+ * time is preserved and anything derived from it remains valid.
+ */
+bool_t
+chart_cache_store(chart_cache_t *cache, const char *path, const void *buf,
+    size_t len, const chart_cache_valid_t *valid)
+{
+	uint64_t hash;
+	cache_ent_t *ent;
+	bool_t same;
+	const char *name;
+
+	ASSERT(cache != NULL);
+	ASSERT(path != NULL);
+	ASSERT(buf != NULL || len == 0);
+	/* valid can be NULL */
+
+	name = rel_name(cache, path);
+	if (name == NULL)
+		return (write_file(path, buf, len));
+
+	hash = crc64(buf, len);
+	mutex_enter(&cache->lock);
+	ent = ent_find(cache, path);
+	same = (ent != NULL && ent->hash == hash && ent->size == len &&
+	    filesz(path) == (ssize_t)len);
+	mutex_exit(&cache->lock);
+
+	if (!same && !write_file(path, buf, len))
+		return (B_FALSE);
+
+	mutex_enter(&cache->lock);
+	ent = ent_get(cache, path);
+	if (ent != NULL) {
+		cache->used -= ent->size;
+		ent->size = len;
+		cache->used += ent->size;
+		ent->hash = hash;
+		ent->vtime = time(NULL);
+		if (valid != NULL)
+			ent->valid = *valid;
+		else
+			memset(&ent->valid, 0, sizeof (ent->valid));
+		ent_touch(cache, ent);
+		evict(cache);
+		maybe_flush(cache);
+	}
+	mutex_exit(&cache->lock);
+
+	return (B_TRUE);
+}
+
+/*
+ * Called when the server confirmed our copy of the file is current
+ * (HTTP 304). Servers may send updated validators along with a 304.
+ */
+void
+chart_cache_revalidated(chart_cache_t *cache, const char *path,
+    const chart_cache_valid_t *valid)
+{
+	cache_ent_t *ent;
+
+	ASSERT(cache != NULL);
+	ASSERT(path != NULL);
+	/* valid can be NULL */
+
+	mutex_enter(&cache->lock);
+	ent = ent_get(cache, path);
+	if (ent != NULL) {
+		ent->vtime = time(NULL);
+		if (valid != NULL && *valid->etag != 0) {
+			lacf_strlcpy(ent->valid.etag, valid->etag,
+			    sizeof (ent->valid.etag));
+		}
+		if (valid != NULL && *valid->last_mod != 0) {
+			lacf_strlcpy(ent->valid.last_mod, valid->last_mod,
+			    sizeof (ent->valid.last_mod));
+		}
+		ent_touch(cache, ent);
+		evict(cache);
+		maybe_flush(cache);
+	}
+	mutex_exit(&cache->lock);
+}
+
+/*
+ * Returns the path of the directory holding the data derived from a
+ * cached file. The directory is removed when the file is evicted.
+ */
+char *
+chart_cache_derived_path(const char *path)
+{
+	ASSERT(path != NULL);
+	return (sprintf_alloc("%s%s", path, DERIVED_SUFFIX));
+}
+
+void
+chart_cache_add_derived(chart_cache_t *cache, const char *path,
+    uint64_t bytes)
+{
+	cache_ent_t *ent;
+
+	ASSERT(cache != NULL);
+	ASSERT(path != NULL);
+
+	mutex_enter(&cache->lock);
+	ent = ent_get(cache, path);
+	if (ent != NULL) {
+		ent->derived += bytes;
+		cache->used += bytes;
+		ent_touch(cache, ent);
+		evict(cache);
+		maybe_flush(cache);
+	}
+	mutex_exit(&cache->lock);
+}
+
+void
+chart_cache_drop_derived(chart_cache_t *cache, const char *path)
+{
+	char *derived = chart_cache_derived_path(path);
+	cache_ent_t *ent;
+
+	ASSERT(cache != NULL);
+
+	mutex_enter(&cache->lock);
+	if (file_exists(derived, NULL))
+		remove_directory(derived);
+	ent = ent_find(cache, path);
+	if (ent != NULL && ent->derived != 0) {
+		ASSERT3U(cache->used, >=, ent->derived);
+		cache->used -= ent->derived;
+		ent->derived = 0;
+		cache->dirty = B_TRUE;
+	}
+	mutex_exit(&cache->lock);
+	free(derived);
+}
+
+void
+chart_cache_flush(chart_cache_t *cache)
+{
+	ASSERT(cache != NULL);
+	mutex_enter(&cache->lock);
+	flush_impl(cache);
+	mutex_exit(&cache->lock);
+}
@@ -0,0 +1,86 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#ifndef	_ACF_UTILS_CHART_CACHE_H_
+#define	_ACF_UTILS_CHART_CACHE_H_
+
+#include <stdint.h>
+
+#include "acfutils/types.h"
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/*
+ * Managed on-disk cache of downloaded chart provider files. Files keep
+ * living under their normal paths (as returned by chartdb_mkpath), since
+ * pdftoppm, poppler and cairo need to open them by name. The cache keeps
+ * an index of these files with their size, a hash of their contents, the
+ * time they were last used and validated with the server, and the HTTP
+ * cache validators the server sent along with them. The index is used to:
+ *
+ * 1) reopen recently validated files without contacting the server,
+ * 2) revalidate older files using conditional requests (ETag and
+ *    Last-Modified), rather than our local file modification time,
+ * 3) avoid rewriting a file when a download yields identical contents,
+ *    so data derived from it (the chart tiles) stays valid, and
+ * 4) evict the least recently used files (including the data derived
+ *    from them) once the total size exceeds a disk quota.
+ *
+ * Files outside of the cache's directory are ignored by all functions.
+ * All functions are thread-safe.
+ */
+typedef struct chart_cache_s chart_cache_t;
+
+/* Validators from an HTTP response, used for conditional requests */
+typedef struct {
+	char	etag[128];
+	char	last_mod[64];
+} chart_cache_valid_t;
+
+#define	CHART_CACHE_MIN_QUOTA	(64ull << 20)	/* bytes */
+
+chart_cache_t *chart_cache_alloc(const char *dir, uint64_t quota);
+void chart_cache_open(chart_cache_t *cache);
+void chart_cache_free(chart_cache_t *cache);
+void chart_cache_set_quota(chart_cache_t *cache, uint64_t quota);
+void chart_cache_get_usage(chart_cache_t *cache, uint64_t *used,
+    uint64_t *quota);
+
+bool_t chart_cache_is_fresh(chart_cache_t *cache, const char *path);
+void chart_cache_touch(chart_cache_t *cache, const char *path);
+bool_t chart_cache_get_valid(chart_cache_t *cache, const char *path,
+    chart_cache_valid_t *valid);
+bool_t chart_cache_store(chart_cache_t *cache, const char *path,
+    const void *buf, size_t len, const chart_cache_valid_t *valid);
+void chart_cache_revalidated(chart_cache_t *cache, const char *path,
+    const chart_cache_valid_t *valid);
+
+char *chart_cache_derived_path(const char *path);
+void chart_cache_add_derived(chart_cache_t *cache, const char *path,
+    uint64_t bytes);
+void chart_cache_drop_derived(chart_cache_t *cache, const char *path);
+
+void chart_cache_flush(chart_cache_t *cache);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* _ACF_UTILS_CHART_CACHE_H_ */
@@ -400,7 +400,7 @@ chart_autorouter_fini(chartdb_t *cdb)
 }
 
 bool_t
-chart_autorouter_get_chart(chart_t *chart)
+chart_autorouter_get_chart(chart_t *chart, bool_t night)
 {
 	chartdb_t *cdb;
 	chart_arpt_t *arpt;
@@ -410,6 +410,8 @@ chart_autorouter_get_chart(chart_t *chart)
 	CURL *curl = NULL;
 	const chart_prov_info_login_t *login;
 
+	/* Charts are inverted for night mode by chartdb */
+	LACF_UNUSED(night);
 	ASSERT(chart->arpt != NULL);
 	arpt = chart->arpt;
 	ASSERT(arpt->db != NULL);
@@ -36,7 +36,7 @@ extern "C" {
 
 bool_t chart_autorouter_init(chartdb_t *cdb);
 void chart_autorouter_fini(chartdb_t *cdb);
-bool_t chart_autorouter_get_chart(chart_t *chart);
+bool_t chart_autorouter_get_chart(chart_t *chart, bool_t night);
 void chart_autorouter_arpt_lazyload(chart_arpt_t *arpt);
 bool_t chart_autorouter_test_conn(const chart_prov_info_login_t *creds,
     const char *proxy);
@@ -34,6 +34,11 @@
 #define	LOW_SPD_LIM	4096L		/* bytes/s */
 #define	LOW_SPD_TIME	30L		/* seconds */
 
+static bool_t download_impl(CURL **curl_p, chart_cache_t *cache,
+    const char *proxy, const char *url, const char *filepath,
+    const char *method, const chart_prov_info_login_t *login, int timeout,
+    const char *error_prefix, chart_dl_info_t *raw_output);
+
 void
 chart_dl_info_init(chart_dl_info_t *info, chartdb_t *cdb, const char *url)
 {
@@ -99,6 +104,64 @@ append_if_mod_since_hdr(struct curl_slist *hdrs, const char *path)
 	return (hdrs);
 }
 
+/*
+ * Sends the cache validators we got from the server the last time, so
+ * the server can answer with a "304 Not Modified" if our copy is current.
+ */
+static struct curl_slist *
+append_cond_hdrs(struct curl_slist *hdrs, const chart_cache_valid_t *valid)
+{
+	char buf[256];
+
+	if (*valid->etag != 0) {
+		snprintf(buf, sizeof (buf), "If-None-Match: %s", valid->etag);
+		hdrs = curl_slist_append(hdrs, buf);
+	}
+	if (*valid->last_mod != 0) {
+		snprintf(buf, sizeof (buf), "If-Modified-Since: %s",
+		    valid->last_mod);
+		hdrs = curl_slist_append(hdrs, buf);
+	}
+	return (hdrs);
+}
+
+static void
+hdr_value(const char *buf, size_t len, const char *name, char *out,
+    size_t cap)
+{
+	size_t l = strlen(name);
+
+	if (len <= l || lacf_strncasecmp(buf, name, l) != 0)
+		return;
+	buf += l;
+	len -= l;
+	while (len > 0 && isspace((unsigned char)*buf)) {
+		buf++;
+		len--;
+	}
+	while (len > 0 && isspace((unsigned char)buf[len - 1]))
+		len--;
+	lacf_strlcpy(out, buf, MIN(len + 1, cap));
+}
+
+static size_t
+dl_hdr_cb(char *buf, size_t size, size_t nitems, void *userdata)
+{
+	chart_cache_valid_t *valid = userdata;
+	size_t len = size * nitems;
+
+	/* Every response (e.g. after a redirect) starts with a status line */
+	if (len >= 5 && strncmp(buf, "HTTP/", 5) == 0) {
+		memset(valid, 0, sizeof (*valid));
+	} else {
+		hdr_value(buf, len, "ETag:", valid->etag,
+		    sizeof (valid->etag));
+		hdr_value(buf, len, "Last-Modified:", valid->last_mod,
+		    sizeof (valid->last_mod));
+	}
+	return (len);
+}
+
 static bool_t
 write_dl(chart_dl_info_t *dl_info, const char *filepath, const char *url,
     const char *error_prefix)
@@ -139,8 +202,8 @@ chart_download_multi(CURL **curl_p, chartdb_t *cdb, const char *url,
 			proxy = safe_strdup(cdb->proxy);
 		mutex_exit(&cdb->lock);
 	}
-	res = chart_download_multi2(curl_p, proxy, url, filepath, method,
-	    login, timeout, error_prefix, raw_output);
+	res = download_impl(curl_p, cdb != NULL ? cdb->cache : NULL, proxy,
+	    url, filepath, method, login, timeout, error_prefix, raw_output);
 	LACF_DESTROY(proxy);
 
 	return (res);
@@ -151,16 +214,32 @@ chart_download_multi2(CURL **curl_p, const char *proxy, const char *url,
     const char *filepath, const char *method,
     const chart_prov_info_login_t *login, int timeout,
     const char *error_prefix, chart_dl_info_t *raw_output)
+{
+	return (download_impl(curl_p, NULL, proxy, url, filepath, method,
+	    login, timeout, error_prefix, raw_output));
+}
+
+/*
+ * If `cache' is provided, files downloaded into the chart cache are
+ * stored and revalidated through it. Otherwise we fall back to a plain
+ * If-Modified-Since check based on the local file's modification time.
+ */
+static bool_t
+download_impl(CURL **curl_p, chart_cache_t *cache, const char *proxy,
+    const char *url, const char *filepath, const char *method,
+    const chart_prov_info_login_t *login, int timeout,
+    const char *error_prefix, chart_dl_info_t *raw_output)
 {
 	CURL *curl;
 	struct curl_slist *hdrs = NULL;
 	chart_dl_info_t dl_info = { .cdb = NULL };
+	chart_cache_valid_t valid_old, valid_new;
 	CURLcode res;
 	long code = 0;
 	bool_t result = B_TRUE;
 
 	ASSERT(curl_p != NULL);
-	/* cdb can be NULL */
+	/* cache can be NULL */
 	ASSERT(url != NULL);
 	/* filepath can be NULL */
 	/* method can be NULL */
@@ -199,8 +278,16 @@ chart_download_multi2(CURL **curl_p, const char *proxy, const char *url,
 	else
 		curl_easy_setopt(curl, CURLOPT_HTTPGET, 1L);
 
-	if (filepath != NULL)
-		hdrs = append_if_mod_since_hdr(hdrs, filepath);
+	memset(&valid_new, 0, sizeof (valid_new));
+	if (filepath != NULL) {
+		if (cache != NULL &&
+		    chart_cache_get_valid(cache, filepath, &valid_old))
+			hdrs = append_cond_hdrs(hdrs, &valid_old);
+		else
+			hdrs = append_if_mod_since_hdr(hdrs, filepath);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, dl_hdr_cb);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &valid_new);
+	}
 
 	curl_easy_setopt(curl, CURLOPT_URL, url);
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &dl_info);
@@ -214,7 +301,10 @@ chart_download_multi2(CURL **curl_p, const char *proxy, const char *url,
 	 */
 	if (res == CURLE_OK && (code == 200 || code == 207) &&
 	    dl_info.bufsz != 0) {
-		if (filepath != NULL) {
+		if (filepath != NULL && cache != NULL) {
+			result = chart_cache_store(cache, filepath,
+			    dl_info.buf, dl_info.bufsz, &valid_new);
+		} else if (filepath != NULL) {
 			result = write_dl(&dl_info, filepath, url,
 			    error_prefix);
 		}
@@ -230,8 +320,15 @@ chart_download_multi2(CURL **curl_p, const char *proxy, const char *url,
 			logMsg("%s %s: HTTP error %ld", error_prefix, url,
 			    code);
 			result = B_FALSE;
+		} else if (filepath != NULL && cache != NULL) {
+			chart_cache_revalidated(cache, filepath, &valid_new);
 		}
 	}
+	if (filepath != NULL) {
+		/* `valid_new' is going out of scope, the handle is reused */
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, NULL);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);
+	}
 	if (hdrs != NULL) {
 		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
 		curl_slist_free_all(hdrs);
@@ -300,15 +397,8 @@ word_subst(char *str, const char **subst)
 bool_t
 chartdb_want_to_stop(chartdb_t *cdb)
 {
-	bool_t result;
-
 	ASSERT(cdb != NULL);
-
-	mutex_enter(&cdb->lock);
-	result = (list_head(&cdb->loader_queue) == &cdb->loader_cmd_purge);
-	mutex_exit(&cdb->lock);
-
-	return (result);
+	return (!cdb->loader.run);
 }
 
 void *
@@ -315,7 +315,7 @@ chart_faa_fini(chartdb_t *cdb)
 }
 
 bool_t
-chart_faa_get_chart(chart_t *chart)
+chart_faa_get_chart(chart_t *chart, bool_t night)
 {
 	chartdb_t *cdb;
 	chart_arpt_t *arpt;
@@ -323,6 +323,8 @@ chart_faa_get_chart(chart_t *chart)
 	bool_t result;
 	char url[128];
 
+	/* Charts are inverted for night mode by chartdb */
+	LACF_UNUSED(night);
 	ASSERT(chart->arpt != NULL);
 	arpt = chart->arpt;
 	ASSERT(arpt->db != NULL);
@@ -36,7 +36,7 @@ extern "C" {
 
 bool_t chart_faa_init(chartdb_t *cdb);
 void chart_faa_fini(chartdb_t *cdb);
-bool_t chart_faa_get_chart(chart_t *chart);
+bool_t chart_faa_get_chart(chart_t *chart, bool_t night);
 
 #ifdef	__cplusplus
 }
@@ -823,7 +823,7 @@ chart_navigraph_fini(chartdb_t *cdb)
 }
 
 bool_t
-chart_navigraph_get_chart(chart_t *chart)
+chart_navigraph_get_chart(chart_t *chart, bool_t night)
 {
 	chartdb_t *cdb;
 	chart_arpt_t *arpt;
@@ -840,7 +840,7 @@ chart_navigraph_get_chart(chart_t *chart)
 		mutex_exit(&nav->lock);
 		return (B_FALSE);
 	}
-	if (!chart->night || chart->filename_night == NULL) {
+	if (!night || chart->filename_night == NULL) {
 		snprintf(url, sizeof (url), "https://api.navigraph.com/v1/"
 		    "charts/airports/%s/signedurls/%s", arpt->icao,
 		    chart->filename);
@@ -864,7 +864,8 @@ chart_navigraph_get_chart(chart_t *chart)
 }
 
 void
-chart_navigraph_watermark_chart(chart_t *chart, cairo_surface_t *surf)
+chart_navigraph_watermark_chart(chart_t *chart, cairo_surface_t *surf,
+    bool_t night)
 {
 	navigraph_t *nav;
 	cairo_t *cr;
@@ -881,7 +882,7 @@ chart_navigraph_watermark_chart(chart_t *chart, cairo_surface_t *surf)
 
 	cr = cairo_create(surf);
 	cairo_set_font_size(cr, WMARK_FONT_SIZE);
-	if (chart->night)
+	if (night)
 		cairo_set_source_rgb(cr, 1, 1, 1);
 	else
 		cairo_set_source_rgb(cr, 0, 0, 0);
@@ -34,7 +34,9 @@
 #include <curl/curl.h>
 #include <libxml/parser.h>
 #include <libxml/xpath.h>
-#include <png.h>
+#ifdef	ACFUTILS_POPPLER
+#include <poppler.h>
+#endif
 
 #if	IBM
 #include <windows.h>
@@ -50,7 +52,9 @@
 #include "acfutils/mt_cairo_render.h"
 #include "acfutils/png.h"
 #include "acfutils/stat.h"
+#include "acfutils/taskq.h"
 #include "acfutils/thread.h"
+#include "acfutils/time.h"
 #include "acfutils/worker.h"
 
 #include "chartdb_impl.h"
@@ -64,6 +68,16 @@
 #define	RETRY_INTVAL	30	/* seconds */
 #define	WRITE_BUFSZ	4096	/* bytes */
 #define	READ_BUFSZ	4096	/* bytes */
+#define	LOADER_THR_STOP_DELAY	SEC2USEC(10)
+#define	PDF_BAND_MIN_HEIGHT	128	/* pixels */
+#define	PDF_PROGRESS_INTVAL	100000	/* microseconds */
+#define	DISK_CACHE_LIMIT_DFL	(1ull << 30)	/* bytes */
+/*
+ * Tiles drawn or loaded this recently are considered to be on screen
+ * and aren't evicted, otherwise a viewport needing more than the load
+ * limit would keep evicting and reloading its own tiles.
+ */
+#define	TILE_ON_SCREEN_TIME	SEC2USEC(2)
 
 #define	DESTROY_HANDLE(__handle__)	\
 	do { \
@@ -102,6 +116,7 @@ static chart_prov_t prov[NUM_PROVIDERS] = {
 static chart_arpt_t *arpt_find(chartdb_t *cdb, const char *icao);
 static char *download_metar(chartdb_t *cdb, const char *icao);
 static char *download_taf(chartdb_t *cdb, const char *icao);
+static void loader_proc(void *userinfo, void *thr_info, void *task);
 
 #if	IBM
 
@@ -164,6 +179,15 @@ arpt_compar(const void *a, const void *b)
 	return (1);
 }
 
+static void
+chart_pdf_close(chart_t *chart)
+{
+#ifdef	ACFUTILS_POPPLER
+	chartdb_pdf_close(chart->pdf_doc);
+#endif
+	chart->pdf_doc = NULL;
+}
+
 void
 chartdb_chart_destroy(chart_t *chart)
 {
@@ -171,6 +195,7 @@ chartdb_chart_destroy(chart_t *chart)
 
 	if (chart->surf != NULL)
 		cairo_surface_destroy(chart->surf);
+	chart_pdf_close(chart);
 	if (chart->png_data != NULL) {
 		memset(chart->png_data, 0, chart->png_data_len);
 		free(chart->png_data);
@@ -242,6 +267,28 @@ out:
 	free(dpath);
 }
 
+static void *
+loader_thr_init(void *userinfo)
+{
+	LACF_UNUSED(userinfo);
+	thread_set_name("chartdb-loader");
+	/* Network downloads can raise SIGPIPE on broken sockets */
+	lacf_mask_sigpipe();
+	return (NULL);
+}
+
+static void
+loader_discard(void *userinfo, void *task)
+{
+	/*
+	 * Tasks submitted to the loader taskq are just tokens telling a
+	 * loader thread to go pick up the next request from loader_queues.
+	 * The requests themselves are torn down in chartdb_fini.
+	 */
+	LACF_UNUSED(userinfo);
+	LACF_UNUSED(task);
+}
+
 static bool_t
 loader_init(void *userinfo)
 {
@@ -252,37 +299,119 @@ loader_init(void *userinfo)
 
 	/* Expunge outdated AIRACs */
 	remove_old_airacs(cdb);
+	chart_cache_open(cdb->cache);
 
 	if (!prov[cdb->prov].init(cdb))
 		return (B_FALSE);
 
 	mutex_enter(&cdb->lock);
 	cdb->init_complete = B_TRUE;
+	ASSERT3P(cdb->loader_tq, ==, NULL);
+	cdb->loader_tq = taskq_alloc(0, cdb->loader_threads,
+	    LOADER_THR_STOP_DELAY, loader_thr_init, NULL, loader_proc,
+	    loader_discard, cdb);
+	/* Kick off any requests which were submitted during init */
+	for (int prio = 0; prio < CHARTDB_NUM_LOAD_PRIOS; prio++) {
+		for (unsigned i = 0, n = list_count(&cdb->loader_queues[prio]);
+		    i < n; i++) {
+			taskq_submit(cdb->loader_tq, NULL);
+		}
+	}
 	mutex_exit(&cdb->lock);
 
 	return (B_TRUE);
 }
 
+static chartdb_load_prio_t
+load_req_prio(load_req_type_t type)
+{
+	switch (type) {
+	case LOAD_REQ_CHART:
+	case LOAD_REQ_LEVEL:
+	case LOAD_REQ_TILE:
+		return (CHARTDB_LOAD_PRIO_VISIBLE);
+	case LOAD_REQ_PREFETCH:
+		return (CHARTDB_LOAD_PRIO_PREFETCH);
+	case LOAD_REQ_METAR:
+	case LOAD_REQ_TAF:
+		return (CHARTDB_LOAD_PRIO_METAR_TAF);
+	default:
+		ASSERT3U(type, ==, LOAD_REQ_ARPT);
+		return (CHARTDB_LOAD_PRIO_ARPT);
+	}
+}
+
+/*
+ * Queues a background request. A request which is already queued under
+ * a lower priority class (such as a prefetch of a chart which is now
+ * being displayed) is moved over to the new class. Requests which are
+ * already being processed are left alone.
+ */
 static void
-loader_purge(chartdb_t *cdb)
+loader_submit(chartdb_t *cdb, load_req_t *req, load_req_type_t type,
+    chart_t *chart, chart_arpt_t *arpt)
 {
-	for (chart_arpt_t *arpt = avl_first(&cdb->arpts); arpt != NULL;
-	    arpt = AVL_NEXT(&cdb->arpts, arpt)) {
-		for (chart_t *chart = avl_first(&arpt->charts); chart != NULL;
-		    chart = AVL_NEXT(&arpt->charts, chart)) {
-			if (chart->surf != NULL) {
-				cairo_surface_destroy(chart->surf);
-				chart->surf = NULL;
-			}
-			if (chart->png_data != NULL) {
-				free(chart->png_data);
-				chart->png_data = NULL;
-				chart->png_data_len = 0;
-			}
+	chartdb_load_prio_t prio = load_req_prio(type);
+
+	ASSERT(cdb != NULL);
+	ASSERT(req != NULL);
+	ASSERT_MUTEX_HELD(&cdb->lock);
+
+	if (req->running)
+		return;
+	if (list_link_active(&req->node)) {
+		chartdb_load_prio_t old_prio = load_req_prio(req->type);
+
+		if (prio < old_prio) {
+			list_remove(&cdb->loader_queues[old_prio], req);
+			req->type = type;
+			list_insert_tail(&cdb->loader_queues[prio], req);
 		}
+		/* The request already has a taskq token outstanding */
+		return;
+	}
+	req->type = type;
+	req->chart = chart;
+	req->arpt = arpt;
+	req->submit_t = microclock();
+	req->canceled = B_FALSE;
+	list_insert_tail(&cdb->loader_queues[prio], req);
+	if (cdb->loader_tq != NULL)
+		taskq_submit(cdb->loader_tq, NULL);
+}
+
+/*
+ * Cancels a request. A queued request is simply dropped from its queue
+ * (its taskq token will find nothing to do). A running request is only
+ * flagged, so that its result gets discarded once it completes.
+ */
+static void
+loader_cancel(chartdb_t *cdb, load_req_t *req)
+{
+	ASSERT(cdb != NULL);
+	ASSERT(req != NULL);
+	ASSERT_MUTEX_HELD(&cdb->lock);
+
+	if (list_link_active(&req->node)) {
+		chartdb_load_prio_t prio = load_req_prio(req->type);
+
+		list_remove(&cdb->loader_queues[prio], req);
+		cdb->load_stats[prio].canceled++;
+	} else if (req->running) {
+		req->canceled = B_TRUE;
+	}
+}
+
+static void
+chart_unload(chart_t *chart)
+{
+	CAIRO_SURFACE_DESTROY(chart->surf);
+	chart_pdf_close(chart);
+	if (chart->png_data != NULL) {
+		free(chart->png_data);
+		chart->png_data = NULL;
+		chart->png_data_len = 0;
 	}
-	while (list_remove_head(&cdb->load_seq) != NULL)
-		;
 }
 
 chart_arpt_t *
@@ -912,84 +1041,283 @@ errout:
 	return (NULL);
 }
 
-static void
-invert_surface(cairo_surface_t *surf)
+#ifdef	ACFUTILS_POPPLER
+
+void *
+chartdb_pdf_open(const char *path, int *num_pages)
 {
-	uint8_t *data = cairo_image_surface_get_data(surf);
-	int stride = cairo_image_surface_get_stride(surf);
-	int width = cairo_image_surface_get_width(surf);
-	int height = cairo_image_surface_get_height(surf);
+	GError *err = NULL;
+	char *uri;
+	PopplerDocument *doc;
 
-	cairo_surface_flush(surf);
+	ASSERT(path != NULL);
+	/* num_pages can be NULL */
 
-	switch (cairo_image_surface_get_format(surf)) {
-	case CAIRO_FORMAT_ARGB32:
-	case CAIRO_FORMAT_RGB24:
-		for (int y = 0; y < height; y++) {
-			uint8_t *p = data + y * stride;
-
-			for (int x = 0; x < width; x++) {
-#if	__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
-				p[1] = 255 - p[1];
-				p[2] = 255 - p[2];
-				p[3] = 255 - p[3];
-#else
-				p[0] = 255 - p[0];
-				p[1] = 255 - p[1];
-				p[2] = 255 - p[2];
-#endif
-				p += 4;
-			}
+	uri = g_filename_to_uri(path, NULL, &err);
+	if (uri == NULL) {
+		logMsg("Error opening PDF %s: %s", path, err->message);
+		g_error_free(err);
+		return (NULL);
+	}
+	doc = poppler_document_new_from_file(uri, NULL, &err);
+	g_free(uri);
+	if (doc == NULL) {
+		logMsg("Error opening PDF %s: %s", path, err->message);
+		g_error_free(err);
+		return (NULL);
+	}
+	if (num_pages != NULL)
+		*num_pages = poppler_document_get_n_pages(doc);
+
+	return (doc);
+}
+
+void
+chartdb_pdf_close(void *doc)
+{
+	if (doc != NULL)
+		g_object_unref(doc);
+}
+
+/*
+ * Renders a page of a PDF straight into a cairo image surface. The
+ * resolution matches what pdftoppm produces (100 * zoom DPI).
+ *
+ * The page is rendered in horizontal bands from the top down, with
+ * each band twice as tall as the previous one. Cairo culls drawing
+ * outside of the band's clip, so the first band is ready quickly,
+ * letting the caller show the top of the chart early, while the total
+ * cost stays within a few re-parses of the page's content stream. The
+ * band callback can also abort the render once it has been superseded.
+ */
+cairo_surface_t *
+chartdb_pdf_render(void *doc, int page_nr, double zoom,
+    chartdb_pdf_band_cb_t band_cb, void *userinfo)
+{
+	PopplerPage *page;
+	cairo_surface_t *surf;
+	double pg_w, pg_h, scale;
+	int w, h, band_h = PDF_BAND_MIN_HEIGHT;
+
+	ASSERT(doc != NULL);
+	/* band_cb can be NULL */
+
+	page = poppler_document_get_page(doc, page_nr);
+	if (page == NULL) {
+		logMsg("Error rendering PDF: page %d doesn't exist",
+		    page_nr + 1);
+		return (NULL);
+	}
+	zoom = clamp(zoom, 0.1, 10.0);
+	scale = (int)(100 * zoom) / 72.0;
+	poppler_page_get_size(page, &pg_w, &pg_h);
+	w = ceil(pg_w * scale);
+	h = ceil(pg_h * scale);
+	surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+	if (cairo_surface_status(surf) != CAIRO_STATUS_SUCCESS) {
+		logMsg("Error rendering PDF: can't create %dx%d surface: %s",
+		    w, h, cairo_status_to_string(cairo_surface_status(surf)));
+		cairo_surface_destroy(surf);
+		g_object_unref(page);
+		return (NULL);
+	}
+	for (int y = 0; y < h; y += band_h, band_h *= 2) {
+		cairo_t *cr = cairo_create(surf);
+
+		band_h = MIN(band_h, h - y);
+		cairo_rectangle(cr, 0, y, w, band_h);
+		cairo_clip(cr);
+		/* pdftoppm renders onto an opaque white paper background */
+		cairo_set_source_rgb(cr, 1, 1, 1);
+		cairo_paint(cr);
+		cairo_scale(cr, scale, scale);
+		poppler_page_render(page, cr);
+		cairo_destroy(cr);
+		cairo_surface_flush(surf);
+
+		if (band_cb != NULL && !band_cb(surf, y + band_h, userinfo)) {
+			cairo_surface_destroy(surf);
+			surf = NULL;
+			break;
 		}
-		break;
-	default:
+	}
+	g_object_unref(page);
+
+	return (surf);
+}
+
+#endif	/* ACFUTILS_POPPLER */
+
+static void
+invert_surface(cairo_surface_t *surf)
+{
+	if (!cairo_utils_invert_surface(surf)) {
 		logMsg("Unable to invert surface colors: unsupported "
 		    "format %x", cairo_image_surface_get_format(surf));
-		break;
 	}
-	cairo_surface_mark_dirty(surf);
 }
 
+#ifdef	ACFUTILS_POPPLER
+
+typedef struct {
+	chartdb_t	*cdb;
+	chart_t		*chart;
+	int		page;
+	bool_t		night;
+	uint64_t	last_pub_t;
+} pdf_progress_t;
+
+/*
+ * Band callback of chartdb_pdf_render. Publishes a snapshot of the
+ * partially rendered page as the chart's surface, so the top of the
+ * chart shows up before the whole page is done. To limit the cost of
+ * the copies, snapshots are published at most every PDF_PROGRESS_INTVAL.
+ * The final surface is installed by loader_load as usual.
+ */
+static bool_t
+chart_pdf_progress(cairo_surface_t *surf, int rows_done, void *userinfo)
+{
+	pdf_progress_t *prog = userinfo;
+	chartdb_t *cdb = prog->cdb;
+	chart_t *chart = prog->chart;
+	uint64_t now = microclock();
+	cairo_surface_t *snap;
+	cairo_t *cr;
+	bool_t canceled, for_display;
+
+	mutex_enter(&cdb->lock);
+	canceled = chart->load_req.canceled;
+	/* Pyramid levels are never displayed as a whole */
+	for_display = (chart->load_req.type == LOAD_REQ_CHART);
+	mutex_exit(&cdb->lock);
+	if (canceled)
+		return (B_FALSE);
+	if (!for_display || rows_done >= cairo_image_surface_get_height(surf) ||
+	    (prog->last_pub_t != 0 &&
+	    now - prog->last_pub_t < PDF_PROGRESS_INTVAL))
+		return (B_TRUE);
+	prog->last_pub_t = now;
+
+	snap = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+	    cairo_image_surface_get_width(surf),
+	    cairo_image_surface_get_height(surf));
+	cr = cairo_create(snap);
+	cairo_set_source_surface(cr, surf, 0, 0);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+	if (prog->night && chart->filename_night == NULL)
+		invert_surface(snap);
+
+	mutex_enter(&cdb->lock);
+	if (!chart->load_req.canceled) {
+		CAIRO_SURFACE_DESTROY(chart->surf);
+		chart->surf = snap;
+		chart->cur_page = prog->page;
+		snap = NULL;
+	}
+	mutex_exit(&cdb->lock);
+	CAIRO_SURFACE_DESTROY(snap);
+
+	return (B_TRUE);
+}
+
+static cairo_surface_t *
+chart_get_surface_pdf(chartdb_t *cdb, chart_t *chart, const char *path,
+    int page, double zoom, bool_t night)
+{
+	pdf_progress_t prog = {
+	    .cdb = cdb, .chart = chart, .page = page, .night = night
+	};
+	cairo_surface_t *surf;
+
+	if (chart->pdf_doc == NULL) {
+		int num_pages;
+
+		chart->pdf_doc = chartdb_pdf_open(path, &num_pages);
+		if (chart->pdf_doc == NULL) {
+			mutex_enter(&cdb->lock);
+			chart->load_error = B_TRUE;
+			mutex_exit(&cdb->lock);
+			return (NULL);
+		}
+		chart->num_pages = num_pages;
+	}
+	surf = chartdb_pdf_render(chart->pdf_doc, page, zoom,
+	    chart_pdf_progress, &prog);
+	if (surf == NULL) {
+		mutex_enter(&cdb->lock);
+		/* An aborted render isn't an error, we'll be resubmitted */
+		if (!chart->load_req.canceled)
+			chart->load_error = B_TRUE;
+		mutex_exit(&cdb->lock);
+	}
+	return (surf);
+}
+
+#endif	/* ACFUTILS_POPPLER */
+
+typedef struct {
+	const uint8_t	*buf;
+	size_t		len;
+	size_t		off;
+} png_stream_t;
+
+static cairo_status_t
+png_stream_read(void *userinfo, unsigned char *data, unsigned len)
+{
+	png_stream_t *ps = userinfo;
+
+	if (ps->len - ps->off < len)
+		return (CAIRO_STATUS_READ_ERROR);
+	memcpy(data, &ps->buf[ps->off], len);
+	ps->off += len;
+
+	return (CAIRO_STATUS_SUCCESS);
+}
+
+/*
+ * Decodes the chart's in-memory PNG. cairo decodes straight into the
+ * new surface's buffer (premultiplying alpha as it goes), so the whole
+ * image never exists in a second buffer which would need copying.
+ */
 static cairo_surface_t *
 chart_get_surface_nocache(chartdb_t *cdb, chart_t *chart)
 {
-	int width, height;
-	uint8_t *png_pixels;
+	png_stream_t ps;
 	cairo_surface_t *surf;
-	uint32_t *surf_data;
 
 	ASSERT(cdb != NULL);
 	ASSERT(chart != NULL);
 
 	if (chart->png_data == NULL)
 		return (NULL);
-	png_pixels = png_load_from_buffer_cairo_argb32(chart->png_data,
-	    chart->png_data_len, &width, &height);
-	if (png_pixels == NULL)
+	ps = (png_stream_t){ .buf = chart->png_data,
+	    .len = chart->png_data_len };
+	surf = cairo_image_surface_create_from_png_stream(png_stream_read, &ps);
+	if (cairo_surface_status(surf) != CAIRO_STATUS_SUCCESS) {
+		logMsg("Can't decode chart %s: %s", chart->name,
+		    cairo_status_to_string(cairo_surface_status(surf)));
+		cairo_surface_destroy(surf);
 		return (NULL);
-	surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-	surf_data = (uint32_t *)cairo_image_surface_get_data(surf);
-	ASSERT(surf_data != NULL);
-	memcpy(surf_data, png_pixels, width * height * 4);
-	cairo_surface_mark_dirty(surf);
-
-	ZERO_FREE_N(png_pixels, width * height * 4);
-
+	}
 	return (surf);
 }
 
 static bool_t
-chart_needs_get(chartdb_t *cdb, chart_t *chart)
+chart_needs_get(chartdb_t *cdb, chart_t *chart, bool_t night)
 {
 	ASSERT(cdb != NULL);
 	ASSERT(chart != NULL);
 	if (!cdb->disallow_caching) {
 		/*
-		 * If we use caching, try to redownload the chart once,
-		 * or redownload if the file doesn't exist on disk.
+		 * If we use caching, revalidate the chart with the server
+		 * once, unless the disk cache says it has been validated
+		 * recently. Redownload if the file doesn't exist on disk.
 		 */
 		char *path = chartdb_mkpath(chart);
-		bool_t result = (!chart->refreshed || !file_exists(path, NULL));
+		bool_t result = (!file_exists(path, NULL) ||
+		    (!chart->refreshed &&
+		    !chart_cache_is_fresh(cdb->cache, path)));
 		free(path);
 		return (result);
 	} else {
@@ -1001,211 +1329,851 @@ chart_needs_get(chartdb_t *cdb, chart_t *chart)
 		 */
 		return (chart->png_data == NULL ||
 		    (chart->filename_night != NULL &&
-		    chart->night_prev != chart->night));
+		    chart->night_prev != night));
 	}
 }
 
-static cairo_surface_t *
-chart_get_surface(chartdb_t *cdb, chart_t *chart)
+static int
+level_compar(const void *a, const void *b)
 {
-	char *path = NULL, *ext = NULL;
-	cairo_surface_t *surf = NULL;
-
-	ASSERT(cdb != NULL);
-	ASSERT(chart != NULL);
+	const chart_level_t *la = a, *lb = b;
 
-	if (chart->load_cb != NULL)
-		return (chart->load_cb(chart));
-	if (chart_needs_get(cdb, chart)) {
-		chart->refreshed = B_TRUE;
-		if (!prov[cdb->prov].get_chart(chart)) {
-			mutex_enter(&cdb->lock);
-			chart->load_error = B_TRUE;
-			mutex_exit(&cdb->lock);
-			goto out;
-		}
-	}
-	chart->night_prev = chart->night;
-	if (cdb->disallow_caching) {
-		surf = chart_get_surface_nocache(cdb, chart);
-		goto out;
-	}
-	path = chartdb_mkpath(chart);
-	ext = strrchr(path, '.');
-	if (ext != NULL &&
-	    (strcmp(&ext[1], "pdf") == 0 || strcmp(&ext[1], "PDF") == 0)) {
-		if (cdb->pdfinfo_path == NULL ||
-		    cdb->pdftoppm_path == NULL) {
-			logMsg("Attempted to load PDF chart, but this chart "
-			    "DB instance doesn't support PDF conversion");
-			mutex_enter(&cdb->lock);
-			chart->load_error = B_TRUE;
-			mutex_exit(&cdb->lock);
-			goto out;
-		}
-		if (chart->num_pages == -1) {
-			chart->num_pages = chartdb_pdf_count_pages_file(
-			    cdb->pdfinfo_path, path);
-		}
-		if (chart->num_pages == -1) {
-			mutex_enter(&cdb->lock);
-			chart->load_error = B_TRUE;
-			mutex_exit(&cdb->lock);
-			goto out;
-		}
-		path = chartdb_pdf_convert_file(cdb->pdftoppm_path, path,
-		    chart->load_page, chart->zoom);
-		if (path == NULL) {
-			mutex_enter(&cdb->lock);
-			chart->load_page = chart->cur_page;
-			chart->load_error = B_TRUE;
-			mutex_exit(&cdb->lock);
-			goto out;
-		}
-	}
-	surf = cairo_image_surface_create_from_png(path);
-out:
-	free(path);
-	return (surf);
+	if ((uintptr_t)la->chart < (uintptr_t)lb->chart)
+		return (-1);
+	if ((uintptr_t)la->chart > (uintptr_t)lb->chart)
+		return (1);
+	if (la->page < lb->page)
+		return (-1);
+	if (la->page > lb->page)
+		return (1);
+	if (la->level < lb->level)
+		return (-1);
+	if (la->level > lb->level)
+		return (1);
+	if (la->night < lb->night)
+		return (-1);
+	if (la->night > lb->night)
+		return (1);
+	return (0);
 }
 
-static void
-loader_load(chartdb_t *cdb, chart_t *chart)
+static int
+tile_compar(const void *a, const void *b)
 {
-	cairo_surface_t *surf = chart_get_surface(cdb, chart);
-	cairo_status_t st;
+	const chart_tile_t *ta = a, *tb = b;
 
-	if (surf == NULL)
-		return;
-	if ((st = cairo_surface_status(surf)) == CAIRO_STATUS_SUCCESS) {
-		/*
-		 * If night mode was selected and this provider doesn't
-		 * explicitly support supplying night charts, simply invert
-		 * the surface's colors.
-		 */
-		if (chart->night && chart->filename_night == NULL)
-			invert_surface(surf);
-		if (prov[cdb->prov].watermark_chart != NULL)
-			prov[cdb->prov].watermark_chart(chart, surf);
-		mutex_enter(&cdb->lock);
-		CAIRO_SURFACE_DESTROY(chart->surf);
-		chart->surf = surf;
-		chart->cur_page = chart->load_page;
-		mutex_exit(&cdb->lock);
-	} else {
-		logMsg("Can't load chart %s PNG file %s", chart->name,
-		    cairo_status_to_string(st));
-		mutex_enter(&cdb->lock);
-		chart->load_error = B_TRUE;
-		mutex_exit(&cdb->lock);
-	}
+	if ((uintptr_t)ta->level < (uintptr_t)tb->level)
+		return (-1);
+	if ((uintptr_t)ta->level > (uintptr_t)tb->level)
+		return (1);
+	if (ta->night < tb->night)
+		return (-1);
+	if (ta->night > tb->night)
+		return (1);
+	if (ta->y < tb->y)
+		return (-1);
+	if (ta->y > tb->y)
+		return (1);
+	if (ta->x < tb->x)
+		return (-1);
+	if (ta->x > tb->x)
+		return (1);
+	return (0);
 }
 
-static uint64_t
-chart_mem_usage(chartdb_t *cdb)
+static bool_t
+chart_is_pdf(const chart_t *chart)
 {
-	uint64_t total = 0;
+	const char *ext;
 
-	for (chart_t *c = list_head(&cdb->load_seq); c != NULL;
-	    c = list_next(&cdb->load_seq, c)) {
-		if (c->surf != NULL) {
-			unsigned w = cairo_image_surface_get_stride(c->surf);
-			unsigned h = cairo_image_surface_get_height(c->surf);
+	if (chart->load_cb != NULL || chart->filename == NULL)
+		return (B_FALSE);
+	ext = strrchr(chart->filename, '.');
+	return (ext != NULL &&
+	    (strcmp(&ext[1], "pdf") == 0 || strcmp(&ext[1], "PDF") == 0));
+}
 
-			total += w * h * 4;
-		}
-		total += c->png_data_len;
+static char *
+chart_tiles_dir(chart_t *chart)
+{
+	char *path = chartdb_mkpath(chart);
+	char *dir = chart_cache_derived_path(path);
+
+	free(path);
+	return (dir);
+}
+
+static char *
+level_dir(chart_level_t *lvl)
+{
+	char *tiles_dir = chart_tiles_dir(lvl->chart);
+	char *dir, name[32];
+
+	snprintf(name, sizeof (name), "p%d_l%d%s", lvl->page, lvl->level,
+	    lvl->night ? "_night" : "");
+	dir = mkpathname(tiles_dir, name, NULL);
+	free(tiles_dir);
+
+	return (dir);
+}
+
+static uint64_t
+surf_mem(cairo_surface_t *surf)
+{
+	return ((uint64_t)cairo_image_surface_get_stride(surf) *
+	    cairo_image_surface_get_height(surf));
+}
+
+static void
+tile_set_surf(chartdb_t *cdb, chart_tile_t *tile, cairo_surface_t *surf)
+{
+	ASSERT_MUTEX_HELD(&cdb->lock);
+
+	if (tile->surf != NULL) {
+		ASSERT3U(cdb->tile_mem, >=, surf_mem(tile->surf));
+		cdb->tile_mem -= surf_mem(tile->surf);
+		list_remove(&cdb->tile_lru, tile);
+		cairo_surface_destroy(tile->surf);
+	}
+	tile->surf = surf;
+	if (surf != NULL) {
+		cdb->tile_mem += surf_mem(surf);
+		tile->used_t = microclock();
+		list_insert_head(&cdb->tile_lru, tile);
 	}
+}
 
-	return (total);
+static void
+tile_free(chartdb_t *cdb, chart_tile_t *tile)
+{
+	ASSERT_MUTEX_HELD(&cdb->lock);
+	ASSERT(!tile->load_req.running);
+	ASSERT(!list_link_active(&tile->load_req.node));
+
+	tile_set_surf(cdb, tile, NULL);
+	avl_remove(&cdb->tiles, tile);
+	free(tile);
 }
 
-static bool_t
-loader(void *userinfo)
+static chart_tile_t *
+tile_get(chartdb_t *cdb, chart_level_t *lvl, bool_t night, int x, int y)
 {
-	chartdb_t *cdb = userinfo;
-	chart_t *chart;
-	chart_arpt_t *arpt;
+	chart_tile_t srch = { .level = lvl, .night = night, .x = x, .y = y };
+	chart_tile_t *tile;
+	avl_index_t where;
 
-	mutex_enter(&cdb->lock);
-	while ((arpt = list_remove_head(&cdb->loader_arpt_queue)) != NULL) {
-		if (arpt->load_complete ||
-		    prov[cdb->prov].arpt_lazyload == NULL)
+	ASSERT_MUTEX_HELD(&cdb->lock);
+
+	tile = avl_find(&cdb->tiles, &srch, &where);
+	if (tile == NULL) {
+		tile = safe_calloc(1, sizeof (*tile));
+		tile->level = lvl;
+		tile->night = night;
+		tile->x = x;
+		tile->y = y;
+		avl_insert(&cdb->tiles, tile, where);
+	}
+	return (tile);
+}
+
+/*
+ * Drops a chart's tiles from memory. Tiles being loaded are canceled.
+ * If `invalidate' is set, the chart's levels must be regenerated.
+ */
+static void
+chart_tiles_drop(chartdb_t *cdb, chart_t *chart, bool_t invalidate)
+{
+	ASSERT_MUTEX_HELD(&cdb->lock);
+
+	for (chart_tile_t *tile = avl_first(&cdb->tiles), *next;
+	    tile != NULL; tile = next) {
+		next = AVL_NEXT(&cdb->tiles, tile);
+		if (chart != NULL && tile->level->chart != chart)
 			continue;
-		mutex_exit(&cdb->lock);
-		prov[cdb->prov].arpt_lazyload(arpt);
-		mutex_enter(&cdb->lock);
+		loader_cancel(cdb, &tile->load_req);
+		if (!tile->load_req.running)
+			tile_free(cdb, tile);
+	}
+	for (chart_level_t *lvl = avl_first(&cdb->levels); lvl != NULL;
+	    lvl = AVL_NEXT(&cdb->levels, lvl)) {
+		if (chart != NULL && lvl->chart != chart)
+			continue;
+		/* In-memory only levels are gone along with their tiles */
+		if (invalidate || cdb->disallow_caching)
+			lvl->ready = B_FALSE;
 	}
-	while ((chart = list_remove_head(&cdb->loader_queue)) != NULL) {
-		if (chart == &cdb->loader_cmd_purge) {
-			loader_purge(cdb);
-		} else if (chart == &cdb->loader_cmd_metar) {
-			char *metar;
+}
 
-			chart->arpt->metar_load_t = time(NULL);
-			mutex_exit(&cdb->lock);
-			metar = download_metar(cdb, chart->arpt->icao);
-			mutex_enter(&cdb->lock);
-			if (chart->arpt->metar != NULL)
-				free(chart->arpt->metar);
-			chart->arpt->metar = metar;
-			if (metar == NULL) {
-				chart->arpt->metar_load_t = time(NULL) -
-				    (MAX_METAR_AGE - RETRY_INTVAL);
+/*
+ * Called when the chart's file has been replaced by a new version.
+ */
+static void
+chart_tiles_invalidate(chartdb_t *cdb, chart_t *chart)
+{
+	char *path = chartdb_mkpath(chart);
+
+	chart_cache_drop_derived(cdb->cache, path);
+	free(path);
+
+	mutex_enter(&cdb->lock);
+	chart_tiles_drop(cdb, chart, B_TRUE);
+	mutex_exit(&cdb->lock);
+}
+
+static bool_t
+level_read_meta(const char *dir, int *w, int *h)
+{
+	char *str = file2str(dir, "level.txt", NULL);
+	bool_t result = (str != NULL && sscanf(str, "%d %d", w, h) == 2 &&
+	    *w > 0 && *h > 0);
+
+	free(str);
+	return (result);
+}
+
+/*
+ * Writes out the tiles of a level. `bytes' is set to the amount of disk
+ * space used, which is charged to the chart in the disk cache. Tiles are
+ * cache files which get read back soon, so they are encoded straight
+ * from the level surface with the fast PNG encoder settings.
+ */
+static bool_t
+level_write_tiles(const char *dir, cairo_surface_t *surf, uint64_t *bytes)
+{
+	uint8_t *data = cairo_image_surface_get_data(surf);
+	cairo_format_t fmt = cairo_image_surface_get_format(surf);
+	int stride = cairo_image_surface_get_stride(surf);
+	int w = cairo_image_surface_get_width(surf);
+	int h = cairo_image_surface_get_height(surf);
+	char *path;
+	FILE *fp;
+
+	ASSERT(fmt == CAIRO_FORMAT_ARGB32 || fmt == CAIRO_FORMAT_RGB24);
+	cairo_surface_flush(surf);
+	*bytes = 0;
+	if (fmt == CAIRO_FORMAT_RGB24) {
+		/*
+		 * The top byte of RGB24 pixels is undefined. Make them
+		 * opaque, so we can write them out as ARGB32.
+		 */
+		for (int y = 0; y < h; y++) {
+			uint32_t *row = (uint32_t *)&data[y * stride];
+
+			for (int x = 0; x < w; x++)
+				row[x] |= 0xff000000u;
+		}
+		cairo_surface_mark_dirty(surf);
+	}
+
+	/* Get rid of any previous incomplete attempt */
+	if (file_exists(dir, NULL))
+		remove_directory(dir);
+	if (!create_directory_recursive(dir))
+		return (B_FALSE);
+	for (int y = 0; y < h; y += CHART_TILE_SZ) {
+		for (int x = 0; x < w; x += CHART_TILE_SZ) {
+			int tw = MIN(CHART_TILE_SZ, w - x);
+			int th = MIN(CHART_TILE_SZ, h - y);
+			char name[32];
+
+			snprintf(name, sizeof (name), "%d_%d.png",
+			    x / CHART_TILE_SZ, y / CHART_TILE_SZ);
+			path = mkpathname(dir, name, NULL);
+			/* Encodes straight from the level surface, no copy */
+			if (!png_write_to_file_fmt(path, tw, th,
+			    &data[y * stride + x * 4], stride,
+			    PNG_PIXFMT_ARGB32, PNG_ENC_FAST)) {
+				free(path);
+				return (B_FALSE);
 			}
-		} else if (chart == &cdb->loader_cmd_taf) {
-			char *taf;
+			*bytes += MAX(filesz(path), 0);
+			free(path);
+		}
+	}
+	/* Written last, marks the level as complete */
+	path = mkpathname(dir, "level.txt", NULL);
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		logMsg("Error writing chart tile index %s: %s", path,
+		    strerror(errno));
+		free(path);
+		return (B_FALSE);
+	}
+	fprintf(fp, "%d %d\n", w, h);
+	fclose(fp);
+	*bytes += MAX(filesz(path), 0);
+	free(path);
+
+	return (B_TRUE);
+}
+
+static cairo_surface_t *
+surf_copy_rect(cairo_surface_t *src, int x, int y, int w, int h)
+{
+	cairo_surface_t *dst = cairo_image_surface_create(
+	    CAIRO_FORMAT_ARGB32, w, h);
+	cairo_t *cr = cairo_create(dst);
+
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(cr, src, -x, -y);
+	cairo_paint(cr);
+	cairo_destroy(cr);
 
-			chart->arpt->taf_load_t = time(NULL);
+	return (dst);
+}
+
+static cairo_surface_t *
+surf_downscale(cairo_surface_t *src, double scale)
+{
+	int w = MAX(cairo_image_surface_get_width(src) * scale, 1);
+	int h = MAX(cairo_image_surface_get_height(src) * scale, 1);
+	cairo_surface_t *dst = cairo_image_surface_create(
+	    CAIRO_FORMAT_ARGB32, w, h);
+	cairo_t *cr = cairo_create(dst);
+
+	cairo_scale(cr, scale, scale);
+	cairo_set_source_surface(cr, src, 0, 0);
+	cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+
+	return (dst);
+}
+
+/*
+ * Downloads the chart if it is missing or hasn't been refreshed yet
+ * this session. If a new version of the chart was downloaded, any tiles
+ * generated from the old one are thrown away.
+ */
+static bool_t
+chart_refresh(chartdb_t *cdb, chart_t *chart, bool_t night)
+{
+	struct stat st_old, st_new;
+	bool_t had_file, result;
+	char *path;
+
+	if (!chart_needs_get(cdb, chart, night)) {
+		if (!cdb->disallow_caching) {
+			/* Keep the chart's cache entry from being evicted */
+			path = chartdb_mkpath(chart);
+			chart_cache_touch(cdb->cache, path);
+			free(path);
+		}
+		return (B_TRUE);
+	}
+	chart->refreshed = B_TRUE;
+	/* The file is about to be replaced */
+	chart_pdf_close(chart);
+	if (cdb->disallow_caching)
+		return (prov[cdb->prov].get_chart(chart, night));
+
+	path = chartdb_mkpath(chart);
+	had_file = (stat(path, &st_old) == 0);
+	result = prov[cdb->prov].get_chart(chart, night);
+	if (result && (!had_file || stat(path, &st_new) != 0 ||
+	    st_new.st_mtime != st_old.st_mtime ||
+	    st_new.st_size != st_old.st_size))
+		chart_tiles_invalidate(cdb, chart);
+	free(path);
+
+	return (result);
+}
+
+/*
+ * Loads the chart's `page' rendered at `zoom' (PDFs only). `night' only
+ * selects the night image of providers which have them, inverting the
+ * colors is up to the caller.
+ */
+static cairo_surface_t *
+chart_get_surface(chartdb_t *cdb, chart_t *chart, int page, double zoom,
+    bool_t night)
+{
+	char *path = NULL, *ext = NULL;
+	cairo_surface_t *surf = NULL;
+
+	ASSERT(cdb != NULL);
+	ASSERT(chart != NULL);
+
+	if (chart->load_cb != NULL)
+		return (chart->load_cb(chart));
+	if (!chart_refresh(cdb, chart, night)) {
+		mutex_enter(&cdb->lock);
+		chart->load_error = B_TRUE;
+		mutex_exit(&cdb->lock);
+		goto out;
+	}
+	chart->night_prev = night;
+	if (cdb->disallow_caching) {
+		surf = chart_get_surface_nocache(cdb, chart);
+		goto out;
+	}
+	path = chartdb_mkpath(chart);
+	ext = strrchr(path, '.');
+	if (ext != NULL &&
+	    (strcmp(&ext[1], "pdf") == 0 || strcmp(&ext[1], "PDF") == 0)) {
+#ifdef	ACFUTILS_POPPLER
+		surf = chart_get_surface_pdf(cdb, chart, path, page, zoom,
+		    night);
+		goto out;
+#else	/* !ACFUTILS_POPPLER */
+		if (cdb->pdfinfo_path == NULL ||
+		    cdb->pdftoppm_path == NULL) {
+			logMsg("Attempted to load PDF chart, but this chart "
+			    "DB instance doesn't support PDF conversion");
+			mutex_enter(&cdb->lock);
+			chart->load_error = B_TRUE;
 			mutex_exit(&cdb->lock);
-			taf = download_taf(cdb, chart->arpt->icao);
+			goto out;
+		}
+		if (chart->num_pages == -1) {
+			chart->num_pages = chartdb_pdf_count_pages_file(
+			    cdb->pdfinfo_path, path);
+		}
+		if (chart->num_pages == -1) {
 			mutex_enter(&cdb->lock);
-			if (chart->arpt->taf != NULL)
-				free(chart->arpt->taf);
-			chart->arpt->taf = taf;
-			if (taf == NULL) {
-				chart->arpt->taf_load_t = time(NULL) -
-				    (MAX_TAF_AGE - RETRY_INTVAL);
-			}
-		} else {
+			chart->load_error = B_TRUE;
 			mutex_exit(&cdb->lock);
-			loader_load(cdb, chart);
+			goto out;
+		}
+		path = chartdb_pdf_convert_file(cdb->pdftoppm_path, path,
+		    page, zoom);
+		if (path == NULL) {
 			mutex_enter(&cdb->lock);
-			/* Move to the head of the load sequence list */
-			if (list_link_active(&chart->load_seq_node))
-				list_remove(&cdb->load_seq, chart);
-			list_insert_head(&cdb->load_seq, chart);
-
-			while (list_count(&cdb->load_seq) > 1 &&
-			    chart_mem_usage(cdb) > cdb->load_limit) {
-				chart_t *c = list_tail(&cdb->load_seq);
-
-				if (c->surf != NULL) {
-					cairo_surface_destroy(c->surf);
-					c->surf = NULL;
-				}
-				if (c->png_data != NULL) {
-					free(c->png_data);
-					c->png_data = NULL;
-					c->png_data_len = 0;
-				}
-				list_remove(&cdb->load_seq, c);
+			chart->load_error = B_TRUE;
+			mutex_exit(&cdb->lock);
+			goto out;
+		}
+#endif	/* !ACFUTILS_POPPLER */
+	}
+	surf = cairo_image_surface_create_from_png(path);
+out:
+	free(path);
+	return (surf);
+}
+
+static void
+loader_load(chartdb_t *cdb, chart_t *chart)
+{
+	/* Stable while we're running, see chartdb_get_chart_surface */
+	int page = chart->load_page;
+	bool_t night = chart->night;
+	cairo_surface_t *surf = chart_get_surface(cdb, chart, page,
+	    chart->zoom, night);
+	cairo_status_t st;
+
+	if (surf == NULL) {
+		mutex_enter(&cdb->lock);
+		/* Keep reporting the page we're still showing */
+		if (chart->load_error)
+			chart->load_page = chart->cur_page;
+		mutex_exit(&cdb->lock);
+		return;
+	}
+	if ((st = cairo_surface_status(surf)) == CAIRO_STATUS_SUCCESS) {
+		/*
+		 * If night mode was selected and this provider doesn't
+		 * explicitly support supplying night charts, simply invert
+		 * the surface's colors.
+		 */
+		if (night && chart->filename_night == NULL)
+			invert_surface(surf);
+		if (prov[cdb->prov].watermark_chart != NULL)
+			prov[cdb->prov].watermark_chart(chart, surf, night);
+		mutex_enter(&cdb->lock);
+		if (!chart->load_req.canceled) {
+			CAIRO_SURFACE_DESTROY(chart->surf);
+			chart->surf = surf;
+			chart->cur_page = page;
+		} else {
+			/* Superseded while we were loading, throw it away */
+			cairo_surface_destroy(surf);
+		}
+		mutex_exit(&cdb->lock);
+	} else {
+		logMsg("Can't load chart %s PNG file %s", chart->name,
+		    cairo_status_to_string(st));
+		mutex_enter(&cdb->lock);
+		chart->load_error = B_TRUE;
+		mutex_exit(&cdb->lock);
+		cairo_surface_destroy(surf);
+	}
+}
+
+static void
+loader_prefetch(chartdb_t *cdb, chart_t *chart)
+{
+	if (cdb->disallow_caching || chart->load_cb != NULL)
+		return;
+	/*
+	 * Same as chart_get_surface, only try once. If the download fails,
+	 * chart_needs_get will notice the file is missing and retry it
+	 * when the chart is displayed.
+	 */
+	(void) chart_refresh(cdb, chart, B_FALSE);
+}
+
+/*
+ * Generates the tiles of a pyramid level. We simply render the level's
+ * whole page through chart_get_surface and chop it up. `night' is the
+ * display mode the level was requested for, which in-memory levels are
+ * generated in.
+ */
+static void
+loader_build_level(chartdb_t *cdb, chart_t *chart, chart_level_t *lvl,
+    bool_t night)
+{
+	char *dir = NULL;
+	cairo_surface_t *surf;
+	cairo_status_t st;
+	int w = 0, h = 0;
+	bool_t ok = B_FALSE;
+
+	if (!cdb->disallow_caching) {
+		if (chart->load_cb == NULL &&
+		    !chart_refresh(cdb, chart, lvl->night))
+			goto out;
+		/* A previous session might have left the level on disk */
+		dir = level_dir(lvl);
+		if (level_read_meta(dir, &w, &h)) {
+			ok = B_TRUE;
+			goto out;
+		}
+	}
+	surf = chart_get_surface(cdb, chart, lvl->page, ldexp(1, lvl->level),
+	    night);
+	if (surf == NULL)
+		goto out;
+	if ((st = cairo_surface_status(surf)) != CAIRO_STATUS_SUCCESS) {
+		logMsg("Can't load chart %s PNG file %s", chart->name,
+		    cairo_status_to_string(st));
+		cairo_surface_destroy(surf);
+		goto out;
+	}
+	if (lvl->level < 0 && !chart_is_pdf(chart)) {
+		cairo_surface_t *scaled = surf_downscale(surf,
+		    ldexp(1, lvl->level));
+
+		cairo_surface_destroy(surf);
+		surf = scaled;
+	}
+	w = cairo_image_surface_get_width(surf);
+	h = cairo_image_surface_get_height(surf);
+
+	if (dir != NULL) {
+		uint64_t bytes;
+
+		ok = level_write_tiles(dir, surf, &bytes);
+		if (ok) {
+			char *path = chartdb_mkpath(chart);
+
+			chart_cache_add_derived(cdb->cache, path, bytes);
+			free(path);
+		}
+	} else {
+		if (night && chart->filename_night == NULL)
+			invert_surface(surf);
+		if (prov[cdb->prov].watermark_chart != NULL)
+			prov[cdb->prov].watermark_chart(chart, surf, night);
+		for (int y = 0; y < h; y += CHART_TILE_SZ) {
+			for (int x = 0; x < w; x += CHART_TILE_SZ) {
+				cairo_surface_t *tile_surf = surf_copy_rect(
+				    surf, x, y, MIN(CHART_TILE_SZ, w - x),
+				    MIN(CHART_TILE_SZ, h - y));
+				chart_tile_t *tile;
+
+				mutex_enter(&cdb->lock);
+				tile = tile_get(cdb, lvl, night,
+				    x / CHART_TILE_SZ, y / CHART_TILE_SZ);
+				tile_set_surf(cdb, tile, tile_surf);
+				mutex_exit(&cdb->lock);
 			}
 		}
+		ok = B_TRUE;
 	}
+	cairo_surface_destroy(surf);
+out:
+	mutex_enter(&cdb->lock);
+	lvl->ready = ok;
+	lvl->error = !ok;
+	lvl->w = w;
+	lvl->h = h;
 	mutex_exit(&cdb->lock);
+	free(dir);
+}
 
-	return (B_TRUE);
+/*
+ * Loads a tile of a level from disk. The tile's size follows from the
+ * level's, so we can decode it straight into a new surface's buffer.
+ */
+static void
+loader_load_tile(chartdb_t *cdb, chart_tile_t *tile)
+{
+	chart_level_t *lvl = tile->level;
+	char *dir = level_dir(lvl), *path, name[32];
+	cairo_surface_t *surf;
+	int w, h;
+
+	ASSERT(!cdb->disallow_caching);
+
+	mutex_enter(&cdb->lock);
+	w = MIN(CHART_TILE_SZ, lvl->w - tile->x * CHART_TILE_SZ);
+	h = MIN(CHART_TILE_SZ, lvl->h - tile->y * CHART_TILE_SZ);
+	mutex_exit(&cdb->lock);
+	if (w <= 0 || h <= 0) {
+		/* The level has been regenerated smaller in the meantime */
+		free(dir);
+		return;
+	}
+
+	snprintf(name, sizeof (name), "%d_%d.png", tile->x, tile->y);
+	path = mkpathname(dir, name, NULL);
+	surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+	if (cairo_surface_status(surf) == CAIRO_STATUS_SUCCESS &&
+	    png_load_from_file_into(path, PNG_PIXFMT_ARGB32, w, h,
+	    cairo_image_surface_get_data(surf),
+	    cairo_image_surface_get_stride(surf))) {
+		cairo_surface_mark_dirty(surf);
+		if (tile->night && !lvl->night)
+			invert_surface(surf);
+		mutex_enter(&cdb->lock);
+		if (!tile->load_req.canceled) {
+			tile_set_surf(cdb, tile, surf);
+			surf = NULL;
+		}
+		mutex_exit(&cdb->lock);
+	} else {
+		char *meta = mkpathname(dir, "level.txt", NULL);
+
+		/*
+		 * Somebody cleaned out our cache, regenerate the level.
+		 * png_load_from_file_into has logged the reason.
+		 */
+		logMsg("Error loading chart tile %s", path);
+		remove_file(meta, B_TRUE);
+		free(meta);
+		mutex_enter(&cdb->lock);
+		lvl->ready = B_FALSE;
+		mutex_exit(&cdb->lock);
+	}
+	CAIRO_SURFACE_DESTROY(surf);
+	free(path);
+	free(dir);
+}
+
+static uint64_t
+chart_mem_usage(chartdb_t *cdb)
+{
+	uint64_t total = 0;
+
+	for (chart_t *c = list_head(&cdb->load_seq); c != NULL;
+	    c = list_next(&cdb->load_seq, c)) {
+		if (c->surf != NULL) {
+			unsigned w = cairo_image_surface_get_stride(c->surf);
+			unsigned h = cairo_image_surface_get_height(c->surf);
+
+			total += w * h * 4;
+		}
+		total += c->png_data_len;
+	}
+	total += cdb->tile_mem;
+
+	return (total);
 }
 
+/*
+ * Unloads the least recently used tiles and then the least recently
+ * loaded charts until we're back under the load limit. Tiles which are
+ * on screen (see TILE_ON_SCREEN_TIME) are kept. The most recent chart is
+ * always kept, as are any charts which a loader thread is currently
+ * working on.
+ */
+static void
+loader_evict(chartdb_t *cdb)
+{
+	chart_t *chart;
+	chart_tile_t *tile;
+	uint64_t now = microclock();
+
+	ASSERT_MUTEX_HELD(&cdb->lock);
+
+	/*
+	 * The LRU is ordered by used_t, so once we hit an on-screen tile,
+	 * all the remaining ones are on screen as well. Evicted tiles of
+	 * in-memory levels are regenerated by chartdb_draw_chart_viewport
+	 * if they come back into view.
+	 */
+	while (chart_mem_usage(cdb) > cdb->load_limit &&
+	    (tile = list_tail(&cdb->tile_lru)) != NULL &&
+	    now - tile->used_t >= TILE_ON_SCREEN_TIME) {
+		tile_free(cdb, tile);
+	}
+	chart = list_tail(&cdb->load_seq);
+	while (chart != NULL && chart != list_head(&cdb->load_seq) &&
+	    chart_mem_usage(cdb) > cdb->load_limit) {
+		chart_t *prev = list_prev(&cdb->load_seq, chart);
+
+		if (!chart->load_req.running) {
+			chart_unload(chart);
+			list_remove(&cdb->load_seq, chart);
+		}
+		chart = prev;
+	}
+}
+
+static void
+loader_metar_taf(chartdb_t *cdb, chart_arpt_t *arpt, bool_t metar)
+{
+	char *str;
+
+	ASSERT_MUTEX_HELD(&cdb->lock);
+
+	if (metar)
+		arpt->metar_load_t = time(NULL);
+	else
+		arpt->taf_load_t = time(NULL);
+	mutex_exit(&cdb->lock);
+	str = (metar ? download_metar(cdb, arpt->icao) :
+	    download_taf(cdb, arpt->icao));
+	mutex_enter(&cdb->lock);
+	if (metar) {
+		free(arpt->metar);
+		arpt->metar = str;
+		if (str == NULL) {
+			arpt->metar_load_t = time(NULL) -
+			    (MAX_METAR_AGE - RETRY_INTVAL);
+		}
+	} else {
+		free(arpt->taf);
+		arpt->taf = str;
+		if (str == NULL) {
+			arpt->taf_load_t = time(NULL) -
+			    (MAX_TAF_AGE - RETRY_INTVAL);
+		}
+	}
+}
+
+/*
+ * Runs on the loader taskq. Each submitted task is a token for exactly
+ * one queued request, but since requests can be canceled or promoted to
+ * a higher priority while queued, we don't bind the token to a specific
+ * request. Instead, we always grab the oldest request of the highest
+ * priority class available, or do nothing if all queues are empty.
+ */
 static void
-loader_fini(void *userinfo)
+loader_proc(void *userinfo, void *thr_info, void *task)
 {
 	chartdb_t *cdb = userinfo;
+	chartdb_load_prio_t prio;
+	chartdb_load_stats_t *stats;
+	load_req_t *req = NULL;
+	chart_tile_t *tile = NULL;
+	uint64_t start, wait_t, run_t;
 
 	ASSERT(cdb != NULL);
-	ASSERT3U(cdb->prov, <, NUM_PROVIDERS);
-	prov[cdb->prov].fini(cdb);
+	LACF_UNUSED(thr_info);
+	LACF_UNUSED(task);
+
+	mutex_enter(&cdb->lock);
+	for (prio = 0; prio < CHARTDB_NUM_LOAD_PRIOS; prio++) {
+		req = list_remove_head(&cdb->loader_queues[prio]);
+		if (req != NULL)
+			break;
+	}
+	if (req == NULL) {
+		mutex_exit(&cdb->lock);
+		return;
+	}
+	stats = &cdb->load_stats[prio];
+	start = microclock();
+	wait_t = start - req->submit_t;
+	stats->wait_us_total += wait_t;
+	stats->wait_us_max = MAX(stats->wait_us_max, wait_t);
+	ASSERT(!req->running);
+	req->running = B_TRUE;
+
+	switch (req->type) {
+	case LOAD_REQ_CHART:
+	case LOAD_REQ_PREFETCH:
+	case LOAD_REQ_LEVEL:
+		ASSERT(req->chart != NULL);
+		mutex_exit(&cdb->lock);
+		if (req->type == LOAD_REQ_CHART)
+			loader_load(cdb, req->chart);
+		else if (req->type == LOAD_REQ_PREFETCH)
+			loader_prefetch(cdb, req->chart);
+		else
+			loader_build_level(cdb, req->chart, req->level,
+			    req->night);
+		mutex_enter(&cdb->lock);
+		/* Move to the head of the load sequence list */
+		if (list_link_active(&req->chart->load_seq_node))
+			list_remove(&cdb->load_seq, req->chart);
+		list_insert_head(&cdb->load_seq, req->chart);
+		req->running = B_FALSE;
+		loader_evict(cdb);
+		break;
+	case LOAD_REQ_METAR:
+	case LOAD_REQ_TAF:
+		ASSERT(req->arpt != NULL);
+		loader_metar_taf(cdb, req->arpt, req->type == LOAD_REQ_METAR);
+		req->running = B_FALSE;
+		break;
+	case LOAD_REQ_ARPT:
+		ASSERT(req->arpt != NULL);
+		if (!req->arpt->load_complete &&
+		    prov[cdb->prov].arpt_lazyload != NULL) {
+			mutex_exit(&cdb->lock);
+			prov[cdb->prov].arpt_lazyload(req->arpt);
+			mutex_enter(&cdb->lock);
+		}
+		req->running = B_FALSE;
+		break;
+	case LOAD_REQ_TILE:
+		tile = req->tile;
+		ASSERT(tile != NULL);
+		mutex_exit(&cdb->lock);
+		loader_load_tile(cdb, tile);
+		mutex_enter(&cdb->lock);
+		req->running = B_FALSE;
+		break;
+	}
+
+	run_t = microclock() - start;
+	stats->run_us_total += run_t;
+	stats->run_us_max = MAX(stats->run_us_max, run_t);
+	if (req->canceled) {
+		stats->canceled++;
+		req->canceled = B_FALSE;
+	} else {
+		stats->completed++;
+	}
+	/*
+	 * Tiles which failed to load or were canceled aren't kept around.
+	 * The request is part of the tile, so this must come last.
+	 */
+	if (tile != NULL) {
+		if (tile->surf == NULL)
+			tile_free(cdb, tile);
+		else
+			loader_evict(cdb);
+	}
+	mutex_exit(&cdb->lock);
+}
+
+static bool_t
+loader(void *userinfo)
+{
+	chartdb_t *cdb = userinfo;
+
+	/*
+	 * All the loading happens on the loader taskq, we only get woken
+	 * up by chartdb_set_load_limit to apply the new limit.
+	 */
+	mutex_enter(&cdb->lock);
+	loader_evict(cdb);
+	mutex_exit(&cdb->lock);
+
+	return (B_TRUE);
 }
 
 chartdb_t *
@@ -1215,6 +2183,7 @@ chartdb_init(const char *cache_path, const char *pdftoppm_path,
 {
 	chartdb_t *cdb;
 	chart_prov_id_t pid;
+	char *cache_dir;
 
 	ASSERT(cache_path != NULL);
 	/* pdftoppm_path can be NULL */
@@ -1260,15 +2229,26 @@ chartdb_init(const char *cache_path, const char *pdftoppm_path,
 	/* Default to 1/32 of physical memory, but no more than 256MB */
 	cdb->load_limit = MIN(physmem() >> 5, 256 << 20);
 	lacf_strlcpy(cdb->prov_name, provider_name, sizeof (cdb->prov_name));
+	cache_dir = mkpathname(cache_path, provider_name, NULL);
+	cdb->cache = chart_cache_alloc(cache_dir, DISK_CACHE_LIMIT_DFL);
+	free(cache_dir);
 
-	list_create(&cdb->loader_queue, sizeof (chart_t),
-	    offsetof(chart_t, loader_node));
-	list_create(&cdb->loader_arpt_queue, sizeof (chart_arpt_t),
-	    offsetof(chart_arpt_t, loader_node));
+	cdb->loader_threads = clampi(lacf_get_num_cpus(), 2, 4);
+
+	for (int prio = 0; prio < CHARTDB_NUM_LOAD_PRIOS; prio++) {
+		list_create(&cdb->loader_queues[prio], sizeof (load_req_t),
+		    offsetof(load_req_t, node));
+	}
 	list_create(&cdb->load_seq, sizeof (chart_t),
 	    offsetof(chart_t, load_seq_node));
-
-	worker_init2(&cdb->loader, loader_init, loader, loader_fini, 0, cdb,
+	avl_create(&cdb->levels, level_compar, sizeof (chart_level_t),
+	    offsetof(chart_level_t, node));
+	avl_create(&cdb->tiles, tile_compar, sizeof (chart_tile_t),
+	    offsetof(chart_tile_t, node));
+	list_create(&cdb->tile_lru, sizeof (chart_tile_t),
+	    offsetof(chart_tile_t, lru_node));
+
+	worker_init2(&cdb->loader, loader_init, loader, NULL, 0, cdb,
 	    "chartdb");
 
 	return (cdb);
@@ -1279,18 +2259,46 @@ chartdb_fini(chartdb_t *cdb)
 {
 	void *cookie;
 	chart_arpt_t *arpt;
+	chart_tile_t *tile;
+	chart_level_t *lvl;
 
+	/*
+	 * Stopping the worker first also aborts any downloads in progress
+	 * on the loader taskq (see chart_dl_info_t), so taskq_free won't
+	 * have to wait for them to time out.
+	 */
 	worker_fini(&cdb->loader);
+	if (cdb->loader_tq != NULL) {
+		taskq_free(cdb->loader_tq);
+		cdb->loader_tq = NULL;
+	}
+	if (cdb->init_complete) {
+		ASSERT3U(cdb->prov, <, NUM_PROVIDERS);
+		prov[cdb->prov].fini(cdb);
+	}
+	chart_cache_free(cdb->cache);
 
 	while(list_remove_head(&cdb->load_seq) != NULL)
 		;
 	list_destroy(&cdb->load_seq);
-	while(list_remove_head(&cdb->loader_queue) != NULL)
-		;
-	list_destroy(&cdb->loader_queue);
-	while(list_remove_head(&cdb->loader_arpt_queue) != NULL)
+	for (int prio = 0; prio < CHARTDB_NUM_LOAD_PRIOS; prio++) {
+		while(list_remove_head(&cdb->loader_queues[prio]) != NULL)
+			;
+		list_destroy(&cdb->loader_queues[prio]);
+	}
+	while (list_remove_head(&cdb->tile_lru) != NULL)
 		;
-	list_destroy(&cdb->loader_arpt_queue);
+	list_destroy(&cdb->tile_lru);
+	cookie = NULL;
+	while ((tile = avl_destroy_nodes(&cdb->tiles, &cookie)) != NULL) {
+		CAIRO_SURFACE_DESTROY(tile->surf);
+		free(tile);
+	}
+	avl_destroy(&cdb->tiles);
+	cookie = NULL;
+	while ((lvl = avl_destroy_nodes(&cdb->levels, &cookie)) != NULL)
+		free(lvl);
+	avl_destroy(&cdb->levels);
 
 	cookie = NULL;
 	while ((arpt = avl_destroy_nodes(&cdb->arpts, &cookie)) != NULL)
@@ -1349,10 +2357,30 @@ void
 chartdb_set_load_limit(chartdb_t *cdb, uint64_t bytes)
 {
 	bytes = MAX(bytes, 16 << 20);
+	mutex_enter(&cdb->lock);
 	if (cdb->load_limit != bytes) {
 		cdb->load_limit = bytes;
 		worker_wake_up(&cdb->loader);
 	}
+	mutex_exit(&cdb->lock);
+}
+
+void
+chartdb_set_disk_cache_limit(chartdb_t *cdb, uint64_t bytes)
+{
+	ASSERT(cdb != NULL);
+	chart_cache_set_quota(cdb->cache, bytes);
+}
+
+uint64_t
+chartdb_get_disk_cache_usage(chartdb_t *cdb)
+{
+	uint64_t used;
+
+	ASSERT(cdb != NULL);
+	chart_cache_get_usage(cdb->cache, &used, NULL);
+
+	return (used);
 }
 
 void
@@ -1360,15 +2388,52 @@ chartdb_purge(chartdb_t *cdb)
 {
 	mutex_enter(&cdb->lock);
 
-	/* purge the queue */
-	while (list_remove_head(&cdb->loader_queue) != NULL)
-		;
-	list_insert_tail(&cdb->loader_queue, &cdb->loader_cmd_purge);
-	worker_wake_up(&cdb->loader);
+	for (chart_arpt_t *arpt = avl_first(&cdb->arpts); arpt != NULL;
+	    arpt = AVL_NEXT(&cdb->arpts, arpt)) {
+		for (chart_t *chart = avl_first(&arpt->charts); chart != NULL;
+		    chart = AVL_NEXT(&arpt->charts, chart)) {
+			loader_cancel(cdb, &chart->load_req);
+			/* Running loads own the chart, they'll be evicted */
+			if (chart->load_req.running)
+				continue;
+			chart_unload(chart);
+			if (list_link_active(&chart->load_seq_node))
+				list_remove(&cdb->load_seq, chart);
+		}
+	}
+	chart_tiles_drop(cdb, NULL, B_FALSE);
 
 	mutex_exit(&cdb->lock);
 }
 
+void
+chartdb_set_loader_threads(chartdb_t *cdb, unsigned n_threads)
+{
+	ASSERT(cdb != NULL);
+	ASSERT(n_threads != 0);
+
+	mutex_enter(&cdb->lock);
+	cdb->loader_threads = n_threads;
+	if (cdb->loader_tq != NULL)
+		taskq_set_num_threads_max(cdb->loader_tq, n_threads);
+	mutex_exit(&cdb->lock);
+}
+
+void
+chartdb_get_load_stats(chartdb_t *cdb,
+    chartdb_load_stats_t stats[CHARTDB_NUM_LOAD_PRIOS])
+{
+	ASSERT(cdb != NULL);
+	ASSERT(stats != NULL);
+
+	mutex_enter(&cdb->lock);
+	for (int prio = 0; prio < CHARTDB_NUM_LOAD_PRIOS; prio++) {
+		stats[prio] = cdb->load_stats[prio];
+		stats[prio].queued = list_count(&cdb->loader_queues[prio]);
+	}
+	mutex_exit(&cdb->lock);
+}
+
 void
 chartdb_set_proxy(chartdb_t *cdb, const char *proxy)
 {
@@ -1420,17 +2485,8 @@ chartdb_get_chart_names(chartdb_t *cdb, const char *icao, chart_type_t type,
 		return (NULL);
 	}
 	if (!arpt->load_complete) {
-		if (!list_link_active(&arpt->loader_node)) {
-			list_insert_tail(&cdb->loader_arpt_queue, arpt);
-			/*
-			 * If an airport change has been detected, dump
-			 * everything the loader is doing and try and get
-			 * the airport load in as quickly as possible.
-			 */
-			while (list_remove_head(&cdb->loader_queue) != NULL)
-				;
-			worker_wake_up(&cdb->loader);
-		}
+		loader_submit(cdb, &arpt->lazyload_req, LOAD_REQ_ARPT,
+		    NULL, arpt);
 		mutex_exit(&cdb->lock);
 		*num_charts = 0;
 		return (NULL);
@@ -1657,20 +2713,25 @@ chartdb_get_chart_surface(chartdb_t *cdb, const char *icao,
 		return (B_FALSE);
 	}
 
-	if ((chart->surf == NULL || chart->zoom != zoom ||
-	    chart->night != night || chart->cur_page != page) &&
-	    !list_link_active(&chart->loader_node)) {
+	if (chart->load_req.running) {
+		/*
+		 * If the caller has moved on to a different view than the
+		 * one being loaded, discard the in-flight load. We'll
+		 * resubmit once it finishes and we get polled again.
+		 * A running prefetch simply gets to finish first.
+		 */
+		if (chart->load_req.type == LOAD_REQ_CHART &&
+		    (chart->zoom != zoom || chart->night != night ||
+		    chart->load_page != page))
+			chart->load_req.canceled = B_TRUE;
+	} else if (chart->surf == NULL || chart->zoom != zoom ||
+	    chart->night != night || chart->cur_page != page) {
 		chart->zoom = zoom;
 		chart->load_page = page;
 		chart->night = night;
 		CAIRO_SURFACE_DESTROY(chart->surf);
-		/*
-		 * Dump everything else in the queue so we get in first.
-		 */
-		while (list_remove_head(&cdb->loader_queue) != NULL)
-			;
-		list_insert_tail(&cdb->loader_queue, chart);
-		worker_wake_up(&cdb->loader);
+		loader_submit(cdb, &chart->load_req, LOAD_REQ_CHART, chart,
+		    chart->arpt);
 	}
 
 	if (chart->surf != NULL && page == chart->cur_page &&
@@ -1687,6 +2748,235 @@ chartdb_get_chart_surface(chartdb_t *cdb, const char *icao,
 	return (B_TRUE);
 }
 
+bool_t
+chartdb_prefetch_chart(chartdb_t *cdb, const char *icao,
+    const char *chart_name)
+{
+	chart_t *chart;
+
+	ASSERT(cdb != NULL);
+	ASSERT(icao != NULL);
+	ASSERT(chart_name != NULL);
+
+	mutex_enter(&cdb->lock);
+	chart = chart_find(cdb, icao, chart_name);
+	if (cdb->disallow_caching || chart == NULL || chart->load_error) {
+		mutex_exit(&cdb->lock);
+		return (B_FALSE);
+	}
+	/* Never demotes a chart which is already queued for display */
+	loader_submit(cdb, &chart->load_req, LOAD_REQ_PREFETCH, chart,
+	    chart->arpt);
+	mutex_exit(&cdb->lock);
+
+	return (B_TRUE);
+}
+
+static chart_level_t *
+level_get(chartdb_t *cdb, chart_t *chart, int page, int level, bool_t night)
+{
+	chart_level_t srch = {
+	    .chart = chart, .page = page, .level = level, .night = night
+	};
+	chart_level_t *lvl;
+	avl_index_t where;
+
+	ASSERT_MUTEX_HELD(&cdb->lock);
+
+	lvl = avl_find(&cdb->levels, &srch, &where);
+	if (lvl == NULL) {
+		lvl = safe_calloc(1, sizeof (*lvl));
+		*lvl = srch;
+		avl_insert(&cdb->levels, lvl, where);
+	}
+	return (lvl);
+}
+
+/*
+ * Level generation needs the chart's loading machinery, so it goes
+ * through the chart's own request. If a surface load of the chart is
+ * pending, we simply wait for it to finish and get polled again. The
+ * level's page, zoom & night travel with the request, leaving the
+ * chart's fields to chartdb_get_chart_surface().
+ */
+static void
+level_submit(chartdb_t *cdb, chart_t *chart, chart_level_t *lvl,
+    bool_t night)
+{
+	load_req_t *req = &chart->load_req;
+
+	ASSERT_MUTEX_HELD(&cdb->lock);
+
+	if (req->running ||
+	    (list_link_active(&req->node) && req->type != LOAD_REQ_LEVEL))
+		return;
+	req->level = lvl;
+	req->night = night;
+	loader_submit(cdb, req, LOAD_REQ_LEVEL, chart, chart->arpt);
+}
+
+/*
+ * Cancels queued loads of the chart's tiles which are no longer visible.
+ * Several viewports can show the same chart, so besides the tiles in the
+ * calling viewport's range, we also keep any tile which another viewport
+ * has asked for recently (see TILE_ON_SCREEN_TIME).
+ */
+static void
+tiles_cancel_stale(chartdb_t *cdb, const chart_level_t *lvl, bool_t night,
+    int x0, int y0, int x1, int y1)
+{
+	list_t *queue = &cdb->loader_queues[CHARTDB_LOAD_PRIO_VISIBLE];
+	uint64_t now = microclock();
+
+	ASSERT_MUTEX_HELD(&cdb->lock);
+
+	for (load_req_t *req = list_head(queue), *next; req != NULL;
+	    req = next) {
+		chart_tile_t *tile = req->tile;
+
+		next = list_next(queue, req);
+		if (req->type != LOAD_REQ_TILE ||
+		    tile->level->chart != lvl->chart)
+			continue;
+		if (tile->level == lvl && tile->night == night &&
+		    tile->x >= x0 && tile->x < x1 &&
+		    tile->y >= y0 && tile->y < y1)
+			continue;
+		if (now - tile->used_t < TILE_ON_SCREEN_TIME)
+			continue;
+		loader_cancel(cdb, req);
+		tile_free(cdb, tile);
+	}
+}
+
+bool_t
+chartdb_draw_chart_viewport(chartdb_t *cdb, const char *icao,
+    const char *chart_name, const chart_viewport_t *vp, cairo_t *cr,
+    chart_viewport_status_t *status)
+{
+	chart_t *chart;
+	chart_level_t *lvl;
+	chart_viewport_status_t st = { .num_pages = -1, .complete = B_TRUE };
+	double zoom, scale;
+	int level, x0, y0, x1, y1, n_tiles = 0;
+	uint64_t now;
+	struct {
+		cairo_surface_t	*surf;
+		int		x, y;
+	} *tiles = NULL;
+
+	ASSERT(cdb != NULL);
+	ASSERT(icao != NULL);
+	ASSERT(chart_name != NULL);
+	ASSERT(vp != NULL);
+	ASSERT(cr != NULL);
+	/* status can be NULL */
+
+	mutex_enter(&cdb->lock);
+
+	chart = chart_find(cdb, icao, chart_name);
+	if (chart == NULL || chart->load_error) {
+		mutex_exit(&cdb->lock);
+		return (B_FALSE);
+	}
+	st.num_pages = chart->num_pages;
+	/*
+	 * Use the next level up from the requested zoom and scale it down,
+	 * so the chart never looks blurry.
+	 */
+	zoom = clamp(vp->zoom, 0.1, 10.0);
+	level = clampi(ceil(log2(zoom) - 0.01), CHART_LEVEL_MIN,
+	    chart_is_pdf(chart) ? CHART_LEVEL_MAX : 0);
+	scale = zoom / ldexp(1, level);
+	lvl = level_get(cdb, chart, vp->page, level,
+	    vp->night && chart->filename_night != NULL);
+	if (lvl->error) {
+		mutex_exit(&cdb->lock);
+		return (B_FALSE);
+	}
+	if (!lvl->ready) {
+		level_submit(cdb, chart, lvl, vp->night);
+		mutex_exit(&cdb->lock);
+		st.complete = B_FALSE;
+		if (status != NULL)
+			*status = st;
+		return (B_TRUE);
+	}
+	st.width = lvl->w * scale;
+	st.height = lvl->h * scale;
+
+	/* Range of tiles covering the viewport */
+	x0 = clampi(floor(vp->x / scale / CHART_TILE_SZ), 0, INT32_MAX);
+	y0 = clampi(floor(vp->y / scale / CHART_TILE_SZ), 0, INT32_MAX);
+	x1 = MIN(ceil((vp->x + vp->w) / scale / CHART_TILE_SZ),
+	    ceil(lvl->w / (double)CHART_TILE_SZ));
+	y1 = MIN(ceil((vp->y + vp->h) / scale / CHART_TILE_SZ),
+	    ceil(lvl->h / (double)CHART_TILE_SZ));
+	tiles_cancel_stale(cdb, lvl, vp->night, x0, y0, x1, y1);
+	now = microclock();
+
+	if (x1 > x0 && y1 > y0) {
+		tiles = safe_calloc((x1 - x0) * (y1 - y0), sizeof (*tiles));
+	}
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			chart_tile_t *tile = tile_get(cdb, lvl, vp->night,
+			    x, y);
+
+			/* Keeps queued tiles from being canceled, too */
+			tile->used_t = now;
+			if (tile->surf != NULL) {
+				/* Move to the head of the LRU */
+				list_remove(&cdb->tile_lru, tile);
+				list_insert_head(&cdb->tile_lru, tile);
+				/* The tile can go away once we unlock */
+				tiles[n_tiles].surf = cairo_surface_reference(
+				    tile->surf);
+				tiles[n_tiles].x = x * CHART_TILE_SZ;
+				tiles[n_tiles].y = y * CHART_TILE_SZ;
+				n_tiles++;
+				continue;
+			}
+			st.complete = B_FALSE;
+			if (cdb->disallow_caching) {
+				/* Evicted from an in-memory level */
+				tile_free(cdb, tile);
+				lvl->ready = B_FALSE;
+				level_submit(cdb, chart, lvl, vp->night);
+			} else {
+				tile->load_req.tile = tile;
+				loader_submit(cdb, &tile->load_req,
+				    LOAD_REQ_TILE, chart, chart->arpt);
+			}
+		}
+	}
+	mutex_exit(&cdb->lock);
+
+	cairo_save(cr);
+	cairo_translate(cr, -vp->x, -vp->y);
+	cairo_scale(cr, scale, scale);
+	for (int i = 0; i < n_tiles; i++) {
+		cairo_surface_t *surf = tiles[i].surf;
+
+		cairo_set_source_surface(cr, surf, tiles[i].x, tiles[i].y);
+		/* Avoids seams between tiles when scaling */
+		cairo_pattern_set_extend(cairo_get_source(cr),
+		    CAIRO_EXTEND_PAD);
+		cairo_rectangle(cr, tiles[i].x, tiles[i].y,
+		    cairo_image_surface_get_width(surf),
+		    cairo_image_surface_get_height(surf));
+		cairo_fill(cr);
+		cairo_surface_destroy(surf);
+	}
+	cairo_restore(cr);
+
+	free(tiles);
+	if (status != NULL)
+		*status = st;
+
+	return (B_TRUE);
+}
+
 static char *
 get_metar_taf_common(chartdb_t *cdb, const char *icao, bool_t metar)
 {
@@ -1717,26 +3007,16 @@ get_metar_taf_common(chartdb_t *cdb, const char *icao, bool_t metar)
 			result = safe_strdup(arpt->taf);
 	} else {
 		if (metar) {
-			if (!list_link_active(
-			    &cdb->loader_cmd_metar.loader_node)) {
-				/* Initiate async download of METAR */
-				cdb->loader_cmd_metar.arpt = arpt;
-				list_insert_tail(&cdb->loader_queue,
-				    &cdb->loader_cmd_metar);
-				worker_wake_up(&cdb->loader);
-			}
+			/* Initiate async download of METAR */
+			loader_submit(cdb, &arpt->metar_req, LOAD_REQ_METAR,
+			    NULL, arpt);
 			/* If we have an old METAR, return that for now */
 			if (arpt->metar != NULL)
 				result = safe_strdup(arpt->metar);
 		} else {
-			if (!list_link_active(
-			    &cdb->loader_cmd_taf.loader_node)) {
-				/* Initiate async download of TAF */
-				cdb->loader_cmd_taf.arpt = arpt;
-				list_insert_tail(&cdb->loader_queue,
-				    &cdb->loader_cmd_taf);
-				worker_wake_up(&cdb->loader);
-			}
+			/* Initiate async download of TAF */
+			loader_submit(cdb, &arpt->taf_req, LOAD_REQ_TAF,
+			    NULL, arpt);
 			/* If we have an old TAF, return that for now */
 			if (arpt->taf != NULL)
 				result = safe_strdup(arpt->taf);
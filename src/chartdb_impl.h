@@ -25,18 +25,58 @@
 #include "acfutils/avl.h"
 #include "acfutils/chartdb.h"
 #include "acfutils/list.h"
+#include "acfutils/taskq.h"
 #include "acfutils/thread.h"
 #include "acfutils/worker.h"
 
+#include "chart_cache.h"
+
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
 typedef struct chart_arpt_s chart_arpt_t;
 typedef struct chart_s chart_t;
+typedef struct chart_level_s chart_level_t;
+typedef struct chart_tile_s chart_tile_t;
 
 typedef cairo_surface_t *(*chart_load_cb_t)(chart_t *chart);
 
+#define	CHART_TILE_SZ		256	/* pixels */
+#define	CHART_LEVEL_MIN		-3	/* 1/8 zoom */
+#define	CHART_LEVEL_MAX		3	/* 8x zoom */
+
+typedef enum {
+	LOAD_REQ_CHART,		/* load a chart surface for display */
+	LOAD_REQ_PREFETCH,	/* download a chart into the disk cache */
+	LOAD_REQ_METAR,
+	LOAD_REQ_TAF,
+	LOAD_REQ_ARPT,		/* lazy-load an airport's chart list */
+	LOAD_REQ_LEVEL,		/* generate the tiles of a chart level */
+	LOAD_REQ_TILE		/* load a tile of a pyramid level */
+} load_req_type_t;
+
+/*
+ * Background loader request. These are embedded in the chart_t,
+ * chart_arpt_t and chart_tile_t they apply to, so there can only ever be
+ * one request of a kind pending for any chart, airport or tile. All
+ * fields are protected by chartdb_t->lock.
+ */
+typedef struct {
+	load_req_type_t		type;
+	chart_t			*chart;
+	chart_arpt_t		*arpt;
+	chart_level_t		*level;		/* LOAD_REQ_LEVEL */
+	bool_t			night;		/* LOAD_REQ_LEVEL */
+	chart_tile_t		*tile;		/* LOAD_REQ_TILE */
+	uint64_t		submit_t;	/* microclock() */
+	/* Set while a loader thread is processing the request */
+	bool_t			running;
+	/* Results of a running request are to be discarded */
+	bool_t			canceled;
+	list_node_t		node;
+} load_req_t;
+
 typedef enum {
 	PROV_AERONAV_FAA_GOV,
 	PROV_AUTOROUTER_AERO,
@@ -73,8 +113,23 @@ struct chart_s {
 	void		*png_data;
 	size_t		png_data_len;
 
+	/*
+	 * The zoom, load_page & night fields describe the surface wanted
+	 * by chartdb_get_chart_surface() and are only changed while no
+	 * request is running. Pyramid levels carry their own page, zoom
+	 * & night in the request and chart_level_t. While the request is
+	 * running, the loader thread owns the chart's surface, night_prev
+	 * and the provider's png_data.
+	 */
+	load_req_t	load_req;
+	/*
+	 * Open PDF document when built with ACFUTILS_POPPLER, so switching
+	 * pages or zoom levels doesn't need to parse the file again. Owned
+	 * by the loader thread, same as the surface.
+	 */
+	void		*pdf_doc;
+
 	avl_node_t	node;
-	list_node_t	loader_node;
 	list_node_t	load_seq_node;
 };
 
@@ -93,18 +148,70 @@ struct chart_arpt_s {
 	char		*codename;
 	bool_t		load_complete;
 
+	load_req_t	lazyload_req;
+	load_req_t	metar_req;
+	load_req_t	taf_req;
+
+	avl_node_t	node;
+};
+
+/*
+ * One level of the tile pyramid of a chart page. Level `n' is rendered
+ * at a zoom of 2^n. Raster charts only have their native resolution
+ * (level 0) and levels below it. Tiles are CHART_TILE_SZ pixels square,
+ * except at the right and bottom edges. For cacheable charts, the tiles
+ * of a level are stored on disk and loaded individually as needed. For
+ * charts which can't be cached, all tiles of a level are generated in
+ * memory and the level must be regenerated once any of them is evicted.
+ * Levels are created on demand and live until the database is destroyed.
+ * Protected by chartdb_t->lock.
+ */
+struct chart_level_s {
+	/* immutable once created */
+	chart_t		*chart;
+	int		page;
+	int		level;
+	bool_t		night;	/* made from the night image */
+
+	bool_t		ready;	/* tiles exist, w & h are valid */
+	bool_t		error;
+	int		w, h;	/* size of the whole level in pixels */
 	avl_node_t	node;
-	list_node_t	loader_node;
+};
+
+/*
+ * A tile of a chart_level_t in memory. Tiles of charts without a night
+ * image are stored on disk in day colors and inverted when loaded, so
+ * the same level can be displayed in both day & night mode. Protected
+ * by chartdb_t->lock.
+ */
+struct chart_tile_s {
+	/* immutable once created */
+	chart_level_t	*level;
+	bool_t		night;
+	int		x, y;	/* tile column & row */
+
+	cairo_surface_t	*surf;	/* NULL until loaded */
+	uint64_t	used_t;	/* microclock() of last load or request */
+	load_req_t	load_req;
+	avl_node_t	node;
+	list_node_t	lru_node;	/* only while surf != NULL */
 };
 
 struct chartdb_s {
 	mutex_t		lock;
+	/*
+	 * Runs the chart provider's initialization and then starts the
+	 * loader taskq, whose threads process the loader_queues.
+	 */
 	worker_t	loader;
-	bool_t		loader_stop;	/* set only once on exit */
+	taskq_t		*loader_tq;	/* protected by `lock' */
+	unsigned	loader_threads;	/* protected by `lock' */
 
 	/* immutable once created */
 	unsigned	airac;
 	char		*path;
+	chart_cache_t	*cache;		/* internally synchronized */
 	char		*pdftoppm_path;
 	char		*pdfinfo_path;
 	chart_prov_id_t	prov;
@@ -123,26 +230,26 @@ struct chartdb_s {
 	bool_t			init_complete;
 
 	/* protected by `lock' */
-	list_t		loader_queue;
-	list_t		loader_arpt_queue;
+	list_t		loader_queues[CHARTDB_NUM_LOAD_PRIOS];
+	chartdb_load_stats_t	load_stats[CHARTDB_NUM_LOAD_PRIOS];
 	list_t		load_seq;
 	uint64_t	load_limit;
+	avl_tree_t	levels;
+	avl_tree_t	tiles;
+	list_t		tile_lru;
+	uint64_t	tile_mem;	/* bytes */
 
 	/* protected by `lock' */
 	char		*proxy;
-
-	chart_t		loader_cmd_purge;
-	chart_t		loader_cmd_metar;
-	chart_t		loader_cmd_taf;
 };
 
 typedef struct {
 	const char	*name;
 	bool_t		(*init)(chartdb_t *cdb);
 	void		(*fini)(chartdb_t *cdb);
-	bool_t		(*get_chart)(chart_t *chart);
+	bool_t		(*get_chart)(chart_t *chart, bool_t night);
 	void		(*watermark_chart)(chart_t *chart,
-	    cairo_surface_t *surf);
+	    cairo_surface_t *surf, bool_t night);
 	chart_arpt_t 	*(*arpt_lazy_discover)(chartdb_t *cdb, const char *icao);
 	void		(*arpt_lazyload)(chart_arpt_t *arpt);
 	bool_t		(*test_conn)(const chart_prov_info_login_t *creds,
@@ -165,6 +272,21 @@ int chartdb_pdf_count_pages_file(const char *pdfinfo_path, const char *path);
 int chartdb_pdf_count_pages_direct(const char *pdfinfo_path,
     const uint8_t *buf, size_t len);
 
+#ifdef	ACFUTILS_POPPLER
+/*
+ * Called after each band of a PDF page has been rendered. `rows_done' is
+ * the number of rows from the top of the surface which are complete.
+ * Return B_FALSE to abort rendering.
+ */
+typedef bool_t (*chartdb_pdf_band_cb_t)(cairo_surface_t *surf,
+    int rows_done, void *userinfo);
+
+void *chartdb_pdf_open(const char *path, int *num_pages);
+void chartdb_pdf_close(void *doc);
+cairo_surface_t *chartdb_pdf_render(void *doc, int page, double zoom,
+    chartdb_pdf_band_cb_t band_cb, void *userinfo);
+#endif	/* ACFUTILS_POPPLER */
+
 #ifdef	__cplusplus
 }
 #endif
@@ -847,6 +847,22 @@ geo2sph(geo_pos3_t pos, const ellip_t *ellip)
 	return (res);
 }
 
+static inline void
+geo2ecef_impl(double lat, double lon, double elev, double a, double ecc2,
+    double *x, double *y, double *z)
+{
+	double	lat_r = DEG2RAD(lat);
+	double	lon_r = DEG2RAD(lon);
+	double	sin_lat = sin(lat_r), cos_lat = cos(lat_r);
+	double	sin_lon = sin(lon_r), cos_lon = cos(lon_r);
+	/* curvature of the prime vertical */
+	double	Rc = a / sqrt(1 - ecc2 * POW2(sin_lat));
+
+	*x = (Rc + elev) * cos_lat * cos_lon;
+	*y = (Rc + elev) * cos_lat * sin_lon;
+	*z = (Rc * (1 - ecc2) + elev) * sin_lat;
+}
+
 /**
  * Converts a series of geographic coordinates on an ellipsoid into
  * Euclidian coordinates in the ECEF coordinate system.
@@ -860,22 +876,47 @@ geo2sph(geo_pos3_t pos, const ellip_t *ellip)
 vect3_t
 geo2ecef_mtr(geo_pos3_t pos, const ellip_t *ellip)
 {
-	double	lat_r = DEG2RAD(pos.lat);
-	double	lon_r = DEG2RAD(pos.lon);
-	double	Rc;	/* curvature of the prime vertical */
 	vect3_t	res;
-	double	sin_lat = sin(lat_r), cos_lat = cos(lat_r);
-	double	sin_lon = sin(lon_r), cos_lon = cos(lon_r);
-
-	Rc = ellip->a / sqrt(1 - ellip->ecc2 * POW2(sin_lat));
 
-	res.x = (Rc + pos.elev) * cos_lat * cos_lon;
-	res.y = (Rc + pos.elev) * cos_lat * sin_lon;
-	res.z = (Rc * (1 - ellip->ecc2) + pos.elev) * sin_lat;
+	geo2ecef_impl(pos.lat, pos.lon, pos.elev, ellip->a, ellip->ecc2,
+	    &res.x, &res.y, &res.z);
 
 	return (res);
 }
 
+/**
+ * Array version of geo2ecef_mtr(). The coordinates are passed in
+ * structure-of-arrays form, which lets the compiler vectorize the
+ * conversion and keeps all ellipsoid parameters in registers for the
+ * duration of the loop. This is substantially faster than calling
+ * geo2ecef_mtr() in a loop when converting large numbers of points.
+ *
+ * @param lat Array of `n` latitudes in degrees.
+ * @param lon Array of `n` longitudes in degrees.
+ * @param elev Array of `n` elevations in meters.
+ * @param n Number of points to convert.
+ * @param ellip Definition of the ellipsoid on which the points exist.
+ * @param x Output array of `n` ECEF X coordinates in meters.
+ * @param y Output array of `n` ECEF Y coordinates in meters.
+ * @param z Output array of `n` ECEF Z coordinates in meters.
+ * @see geo2ecef_mtr()
+ */
+void
+geo2ecef_mtr_v(const double *lat, const double *lon, const double *elev,
+    size_t n, const ellip_t *ellip, double *restrict x, double *restrict y,
+    double *restrict z)
+{
+	const double a = ellip->a, ecc2 = ellip->ecc2;
+
+	ASSERT(n == 0 || (lat != NULL && lon != NULL && elev != NULL));
+	ASSERT(n == 0 || (x != NULL && y != NULL && z != NULL));
+
+	for (size_t i = 0; i < n; i++) {
+		geo2ecef_impl(lat[i], lon[i], elev[i], a, ecc2,
+		    &x[i], &y[i], &z[i]);
+	}
+}
+
 /**
  * Same as geo2ecef_mtr(), but the elevation component of `pos` is
  * assumed to be in feet.
@@ -977,6 +1018,135 @@ ecef2geo(vect3_t pos, const ellip_t *ellip)
 	return (res);
 }
 
+/**
+ * Array version of ecef2geo(). Produces identical results to calling
+ * ecef2geo() on each point. If you can tolerate the (tiny) error of
+ * ecef2geo_fast(), ecef2geo_fast_v() is considerably quicker.
+ *
+ * @param x Array of `n` ECEF X coordinates in meters.
+ * @param y Array of `n` ECEF Y coordinates in meters.
+ * @param z Array of `n` ECEF Z coordinates in meters.
+ * @param n Number of points to convert.
+ * @param ellip Definition of the ellipsoid to which to convert the points.
+ * @param lat Output array of `n` latitudes in degrees.
+ * @param lon Output array of `n` longitudes in degrees.
+ * @param elev Output array of `n` elevations in meters.
+ * @see ecef2geo()
+ */
+void
+ecef2geo_v(const double *x, const double *y, const double *z, size_t n,
+    const ellip_t *ellip, double *restrict lat, double *restrict lon,
+    double *restrict elev)
+{
+	ASSERT(n == 0 || (x != NULL && y != NULL && z != NULL));
+	ASSERT(n == 0 || (lat != NULL && lon != NULL && elev != NULL));
+
+	for (size_t i = 0; i < n; i++) {
+		geo_pos3_t p = ecef2geo(VECT3(x[i], y[i], z[i]), ellip);
+		lat[i] = p.lat;
+		lon[i] = p.lon;
+		elev[i] = p.elev;
+	}
+}
+
+/*
+ * Number of iterations of Bowring's method performed by ecef2geo_fast().
+ * Each iteration improves the latitude error by roughly 3 orders of
+ * magnitude. Two iterations reach the limits of double precision for
+ * all practical altitudes.
+ */
+#define	ECEF2GEO_FAST_ITER	2
+
+static inline void
+ecef2geo_fast_impl(double x, double y, double z, double a, double b,
+    double ecc2, double *lat, double *lon, double *elev)
+{
+	/* second eccentricity squared */
+	const double	ep2 = (POW2(a) - POW2(b)) / POW2(b);
+	double		p = sqrt(POW2(x) + POW2(y));
+	double		sin_beta, cos_beta, sin_lat = 0, cos_lat = 1, l;
+	double		num = z, den = p;
+
+	/*
+	 * The parametric (reduced) latitude `beta' and geodetic latitude
+	 * are carried around as normalized sine/cosine pairs, so that each
+	 * iteration only costs a couple of multiplications and a sqrt.
+	 */
+	sin_beta = z;
+	cos_beta = (b / a) * p;
+	l = sqrt(POW2(sin_beta) + POW2(cos_beta));
+	sin_beta /= l;
+	cos_beta /= l;
+
+	for (int i = 0; i < ECEF2GEO_FAST_ITER; i++) {
+		num = z + ep2 * b * POW3(sin_beta);
+		den = p - ecc2 * a * POW3(cos_beta);
+		l = sqrt(POW2(num) + POW2(den));
+		sin_lat = num / l;
+		cos_lat = den / l;
+		/* tan(beta) = (b / a) * tan(lat) */
+		sin_beta = (b / a) * sin_lat;
+		cos_beta = cos_lat;
+		l = sqrt(POW2(sin_beta) + POW2(cos_beta));
+		sin_beta /= l;
+		cos_beta /= l;
+	}
+	*lat = RAD2DEG(atan2(num, den));
+	*lon = RAD2DEG(atan2(y, x));
+	if (*lon >= 180.0)
+		*lon -= 360.0;
+	/* h = p.cos(lat) + z.sin(lat) - a^2 / N */
+	*elev = p * cos_lat + z * sin_lat -
+	    a * sqrt(1 - ecc2 * POW2(sin_lat));
+}
+
+/**
+ * Faster alternative to ecef2geo(). Rather than solving the quartic
+ * equation in closed form (which requires cube roots and several
+ * transcendental functions), this uses two iterations of Bowring's
+ * method, which only need a few square roots and two atan2() calls.
+ *
+ * Precision: for points between 10 km below and 1000 km above the
+ * surface of the WGS-84 ellipsoid, the result round-trips geo2ecef_mtr()
+ * to within 1e-12 degrees of latitude & longitude and 1 micrometer of
+ * elevation. That is actually tighter than ecef2geo() itself, which
+ * loses a few digits of latitude close to the poles. Accuracy gradually
+ * degrades further out into space. The point at the center of the
+ * ellipsoid produces NAN.
+ *
+ * @see ecef2geo()
+ */
+geo_pos3_t
+ecef2geo_fast(vect3_t pos, const ellip_t *ellip)
+{
+	geo_pos3_t res;
+
+	ecef2geo_fast_impl(pos.x, pos.y, pos.z, ellip->a, ellip->b,
+	    ellip->ecc2, &res.lat, &res.lon, &res.elev);
+
+	return (res);
+}
+
+/**
+ * Array version of ecef2geo_fast(). See ecef2geo_v() for a description
+ * of the arguments and ecef2geo_fast() for the precision achieved.
+ */
+void
+ecef2geo_fast_v(const double *x, const double *y, const double *z, size_t n,
+    const ellip_t *ellip, double *restrict lat, double *restrict lon,
+    double *restrict elev)
+{
+	const double a = ellip->a, b = ellip->b, ecc2 = ellip->ecc2;
+
+	ASSERT(n == 0 || (x != NULL && y != NULL && z != NULL));
+	ASSERT(n == 0 || (lat != NULL && lon != NULL && elev != NULL));
+
+	for (size_t i = 0; i < n; i++) {
+		ecef2geo_fast_impl(x[i], y[i], z[i], a, b, ecc2,
+		    &lat[i], &lon[i], &elev[i]);
+	}
+}
+
 /**
  * Converts a 3-space coordinate vector from ECEF coordinate space into
  * geocentric coordinates on an EARTH_MSL-radius sphere. This basically
@@ -1770,6 +1940,75 @@ geo2fpp(geo_pos2_t pos, const fpp_t *fpp)
 	return (VECT2(res_v.x * fpp->scale.x, res_v.y * fpp->scale.y));
 }
 
+/**
+ * Array version of geo2fpp(). The sphere translation and plane rotation
+ * matrices of the projection are folded into a single 3x3 matrix up
+ * front, so each point only needs the ECEF conversion, one matrix-vector
+ * product and the final perspective division. Points which cannot be
+ * projected produce NAN in both output arrays (equivalent to geo2fpp()
+ * returning NULL_VECT2).
+ *
+ * @param lat Array of `n` latitudes in degrees.
+ * @param lon Array of `n` longitudes in degrees.
+ * @param n Number of points to project.
+ * @param fpp Projection to use.
+ * @param x Output array of `n` projected X coordinates.
+ * @param y Output array of `n` projected Y coordinates.
+ */
+void
+geo2fpp_v(const double *lat, const double *lon, size_t n, const fpp_t *fpp,
+    double *restrict x, double *restrict y)
+{
+	const double *S = fpp->xlate.sph_matrix;
+	const double *R = fpp->xlate.rot_matrix;
+	const double a = (fpp->ellip != NULL ? fpp->ellip->a : 0);
+	const double ecc2 = (fpp->ellip != NULL ? fpp->ellip->ecc2 : 0);
+	const double dist = fpp->dist;
+	const bool_t persp = isfinite(dist);
+	const double scale_x = fpp->scale.x, scale_y = fpp->scale.y;
+	double M[3][3];
+
+	ASSERT(n == 0 || (lat != NULL && lon != NULL));
+	ASSERT(n == 0 || (x != NULL && y != NULL));
+	ASSERT(!fpp->xlate.inv);
+	/*
+	 * Row 0 (depth) is just the sphere translation, rows 1 & 2 (the
+	 * projection plane coordinates) additionally get the plane rotation.
+	 */
+	for (int c = 0; c < 3; c++) {
+		M[0][c] = S[c];
+		M[1][c] = R[0] * S[3 + c] + R[1] * S[6 + c];
+		M[2][c] = R[2] * S[3 + c] + R[3] * S[6 + c];
+	}
+	for (size_t i = 0; i < n; i++) {
+		double ex, ey, ez, px, py, pz;
+
+		if (fpp->ellip != NULL) {
+			geo2ecef_impl(lat[i], lon[i], 0, a, ecc2,
+			    &ex, &ey, &ez);
+		} else {
+			vect3_t v = sph2ecef(GEO_POS3(lat[i], lon[i], 0));
+			ex = v.x;
+			ey = v.y;
+			ez = v.z;
+		}
+		px = M[0][0] * ex + M[0][1] * ey + M[0][2] * ez;
+		py = M[1][0] * ex + M[1][1] * ey + M[1][2] * ez;
+		pz = M[2][0] * ex + M[2][1] * ey + M[2][2] * ez;
+		if (persp) {
+			if (dist < 0.0 && px <= dist + EARTH_MSL) {
+				x[i] = NAN;
+				y[i] = NAN;
+				continue;
+			}
+			py = dist * (py / (dist + EARTH_MSL - px));
+			pz = dist * (pz / (dist + EARTH_MSL - px));
+		}
+		x[i] = py * scale_x;
+		y[i] = pz * scale_y;
+	}
+}
+
 /**
  * Back-projects a point from a projection surface into spherical coordinate
  * space. N.B. since projection loses some information about the original
@@ -35,6 +35,7 @@
 #include <acfutils/safe_alloc.h>
 #include <acfutils/shader.h>
 #include <acfutils/thread.h>
+#include <acfutils/time.h>
 
 #ifdef	_USE_MATH_DEFINES
 #undef	_USE_MATH_DEFINES
@@ -44,31 +45,31 @@
 
 TEXSZ_MK_TOKEN(glutils_quads_vbo);
 TEXSZ_MK_TOKEN(glutils_lines_vbo);
+TEXSZ_MK_TOKEN(glutils_batch_vbo);
 
 typedef struct {
 	GLfloat	pos[3];
 	GLfloat	tex0[2];
 } vtx_t;
 
-typedef struct {
-	const void	*instance;
-	char		allocd_at[32];
-	int64_t		bytes;
-	avl_node_t	node;
-} texsz_instance_t;
+#define	TEXSZ_FILENAME_MAX	64
 
 typedef struct {
-	const char	*token;
-	int64_t		bytes;
-	avl_tree_t	instances;
-	avl_node_t	node;
-} texsz_alloc_t;
+	const glutils_texsz_token_t	*token;
+	const void			*instance;
+	char				filename[TEXSZ_FILENAME_MAX];
+	int				line;
+	int64_t				bytes;
+	avl_node_t			node;
+} texsz_instance_t;
 
 static struct {
-	bool_t		inited;
-	mutex_t		lock;
-	int64_t		bytes;
-	avl_tree_t	allocs;
+	bool_t			inited;
+	unsigned		sample_rate;
+	/* protects the `tokens' list and `instances' */
+	mutex_t			lock;
+	glutils_texsz_token_t	*tokens;
+	avl_tree_t		instances;
 } texsz = { .inited = B_FALSE };
 
 typedef enum {
@@ -85,15 +86,21 @@ typedef struct  {
 	};
 	void			*buf[2];
 	size_t			buf_sz[2];
-	avl_node_t		tree_node;
+	uint64_t		hash;
+	list_node_t		bucket_node;
 	list_node_t		lru_node;
 } cache_entry_t;
 
+/* Initial number of hash buckets, must be a power of 2 */
+#define	CACHE_MIN_BUCKETS	64
+
 struct glutils_cache_s {
-	avl_tree_t	tree;
-	list_t		lru;
-	size_t		sz;
-	size_t		cap;
+	list_t			*buckets;
+	size_t			num_buckets;
+	list_t			lru;
+	size_t			sz;
+	size_t			cap;
+	glutils_cache_stats_t	stats;
 };
 
 static bool_t inited = B_FALSE;
@@ -395,31 +402,92 @@ glutils_draw_quads(glutils_quads_t *quads, GLint prog)
 	    &quads->setup, quads->num_vtx + quads->num_vtx / 2, prog);
 }
 
-static int
-cache_compar(const void *a, const void *b)
+/*
+ * Hashes the contents of the vertex buffers of a cache entry, 8 bytes at
+ * a time. Two buffers with the same hash still need to be compared in
+ * full, but that only happens for the (almost certain) lookup hit.
+ */
+static uint64_t
+cache_hash(cache_entry_type_t type, const void *buf[2],
+    const size_t buf_sz[2])
 {
-	const cache_entry_t *ca = a, *cb = b;
+	uint64_t h = 0x9e3779b97f4a7c15ull * (type + 1);
 
-	if (ca->type < cb->type)
-		return (-1);
-	if (ca->type > cb->type)
-		return (1);
 	for (int i = 0; i < 2; i++) {
-		if (ca->buf_sz[i] < cb->buf_sz[i])
-			return (-1);
-		if (ca->buf_sz[i] > cb->buf_sz[i])
-			return (1);
+		const uint8_t *p = buf[i];
+		size_t n = buf_sz[i];
+		uint64_t v;
+
+		h = (h ^ n) * 0xff51afd7ed558ccdull;
+		for (; n >= sizeof (v); p += sizeof (v), n -= sizeof (v)) {
+			memcpy(&v, p, sizeof (v));
+			h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+			h ^= h >> 29;
+		}
+		if (n != 0) {
+			v = 0;
+			memcpy(&v, p, n);
+			h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+			h ^= h >> 29;
+		}
 	}
-	for (int i = 0; i < 2; i++) {
-		int res = memcmp(ca->buf[i], cb->buf[i], cb->buf_sz[i]);
+	h ^= h >> 32;
+
+	return (h);
+}
+
+static inline list_t *
+cache_bucket(const glutils_cache_t *cache, uint64_t hash)
+{
+	return (&cache->buckets[hash & (cache->num_buckets - 1)]);
+}
+
+static void
+cache_alloc_buckets(glutils_cache_t *cache, size_t num_buckets)
+{
+	ASSERT(cache != NULL);
+	ASSERT0(num_buckets & (num_buckets - 1));
 
-		if (res < 0)
-			return (-1);
-		if (res > 0)
-			return (1);
+	cache->num_buckets = num_buckets;
+	cache->buckets = safe_calloc(num_buckets, sizeof (*cache->buckets));
+	for (size_t i = 0; i < num_buckets; i++) {
+		list_create(&cache->buckets[i], sizeof (cache_entry_t),
+		    offsetof(cache_entry_t, bucket_node));
 	}
+}
 
-	return (0);
+static void
+cache_free_buckets(glutils_cache_t *cache)
+{
+	ASSERT(cache != NULL);
+
+	for (size_t i = 0; i < cache->num_buckets; i++) {
+		while (list_remove_head(&cache->buckets[i]) != NULL)
+			;
+		list_destroy(&cache->buckets[i]);
+	}
+	free(cache->buckets);
+	cache->buckets = NULL;
+	cache->num_buckets = 0;
+}
+
+/*
+ * Doubles the number of hash buckets once the cache holds more entries
+ * than it has buckets, to keep the bucket chains short.
+ */
+static void
+cache_maybe_grow(glutils_cache_t *cache)
+{
+	ASSERT(cache != NULL);
+
+	if (list_count(&cache->lru) <= cache->num_buckets)
+		return;
+	cache_free_buckets(cache);
+	cache_alloc_buckets(cache, cache->num_buckets * 2);
+	for (cache_entry_t *ce = list_head(&cache->lru); ce != NULL;
+	    ce = list_next(&cache->lru, ce)) {
+		list_insert_tail(cache_bucket(cache, ce->hash), ce);
+	}
 }
 
 /**
@@ -443,8 +511,7 @@ glutils_cache_new(size_t cap_bytes)
 
 	ASSERT(cap_bytes != 0);
 
-	avl_create(&cache->tree, cache_compar, sizeof (cache_entry_t),
-	    offsetof(cache_entry_t, tree_node));
+	cache_alloc_buckets(cache, CACHE_MIN_BUCKETS);
 	list_create(&cache->lru, sizeof (cache_entry_t),
 	    offsetof(cache_entry_t, lru_node));
 	cache->cap = cap_bytes;
@@ -484,20 +551,14 @@ void
 glutils_cache_destroy(glutils_cache_t *cache)
 {
 	cache_entry_t *ce;
-	void *cookie;
 
 	if (cache == NULL)
 		return;
 
-	/* The entries are retained in the tree, so we'll just empty the lru */
+	cache_free_buckets(cache);
 	while ((ce = list_remove_head(&cache->lru)) != NULL)
-		;
-	list_destroy(&cache->lru);
-
-	cookie = NULL;
-	while ((ce = avl_destroy_nodes(&cache->tree, &cookie)) != NULL)
 		free_cache_entry(ce);
-	avl_destroy(&cache->tree);
+	list_destroy(&cache->lru);
 
 	free(cache);
 }
@@ -518,9 +579,10 @@ trim_cache(glutils_cache_t *cache, size_t extra_needed)
 
 		if (ce == NULL)
 			break;
-		avl_remove(&cache->tree, ce);
+		list_remove(cache_bucket(cache, ce->hash), ce);
 		ASSERT3U(cache->sz, >=, ce->buf_sz[0] + ce->buf_sz[1]);
 		cache->sz -= (ce->buf_sz[0] + ce->buf_sz[1]);
+		cache->stats.evictions++;
 		free_cache_entry(ce);
 	}
 }
@@ -529,9 +591,9 @@ trim_cache(glutils_cache_t *cache, size_t extra_needed)
  * Adds a new cache entry.
  */
 static cache_entry_t *
-cache_add_entry(glutils_cache_t *cache, avl_index_t where,
-    cache_entry_type_t type, const void *buf0, size_t buf0_sz,
-    const void *buf1, size_t buf1_sz, size_t num_pts)
+cache_add_entry(glutils_cache_t *cache, uint64_t hash, cache_entry_type_t type,
+    const void *buf0, size_t buf0_sz, const void *buf1, size_t buf1_sz,
+    size_t num_pts)
 {
 	cache_entry_t *ce = safe_calloc(1, sizeof (*ce));
 
@@ -539,6 +601,7 @@ cache_add_entry(glutils_cache_t *cache, avl_index_t where,
 	ASSERT(buf0 != NULL);
 
 	ce->type = type;
+	ce->hash = hash;
 
 	ce->buf_sz[0] = buf0_sz;
 	ce->buf[0] = safe_malloc(buf0_sz);
@@ -562,8 +625,10 @@ cache_add_entry(glutils_cache_t *cache, avl_index_t where,
 	default:
 		VERIFY(0);
 	}
-	avl_insert(&cache->tree, ce, where);
+	list_insert_head(cache_bucket(cache, hash), ce);
 	list_insert_head(&cache->lru, ce);
+	cache->sz += buf0_sz + ce->buf_sz[1];
+	cache_maybe_grow(cache);
 
 	return (ce);
 }
@@ -574,28 +639,39 @@ glutils_cache_get_common(glutils_cache_t *cache, cache_entry_type_t type,
 {
 	size_t p_sz = (type == CACHE_ENTRY_2D_QUADS ? sizeof (vect2_t) :
 	    sizeof (vect3_t));
-	const cache_entry_t srch = {
-	    .type = type,
-	    .buf = { (void *)p, (void *)t },
-	    .buf_sz = {
-		p_sz * num_pts,
-		t != NULL ? sizeof (vect2_t) * num_pts : 0
-	    }
+	const void *buf[2] = { p, t };
+	const size_t buf_sz[2] = {
+	    p_sz * num_pts, t != NULL ? sizeof (vect2_t) * num_pts : 0
 	};
 	cache_entry_t *ce;
-	avl_index_t where;
-	size_t bytes = srch.buf_sz[0] + srch.buf_sz[1];
+	list_t *bucket;
+	uint64_t hash, start = nanoclock(), t_lookup;
 
 	ASSERT(cache != NULL);
 	ASSERT(p != NULL);
 	ASSERT(num_pts != 0);
 
-	ce = avl_find(&cache->tree, &srch, &where);
+	hash = cache_hash(type, buf, buf_sz);
+	bucket = cache_bucket(cache, hash);
+	for (ce = list_head(bucket); ce != NULL; ce = list_next(bucket, ce)) {
+		if (ce->hash == hash && ce->type == type &&
+		    ce->buf_sz[0] == buf_sz[0] && ce->buf_sz[1] == buf_sz[1] &&
+		    memcmp(ce->buf[0], p, buf_sz[0]) == 0 &&
+		    (t == NULL || memcmp(ce->buf[1], t, buf_sz[1]) == 0))
+			break;
+	}
+	t_lookup = nanoclock() - start;
+	cache->stats.lookup_ns_total += t_lookup;
+	cache->stats.lookup_ns_max = MAX(cache->stats.lookup_ns_max,
+	    t_lookup);
+
 	if (ce == NULL) {
-		trim_cache(cache, bytes);
-		ce = cache_add_entry(cache, where, type, p, srch.buf_sz[0],
-		    t, srch.buf_sz[1], num_pts);
+		cache->stats.misses++;
+		trim_cache(cache, buf_sz[0] + buf_sz[1]);
+		ce = cache_add_entry(cache, hash, type, p, buf_sz[0],
+		    t, buf_sz[1], num_pts);
 	} else {
+		cache->stats.hits++;
 		list_remove(&cache->lru, ce);
 		list_insert_head(&cache->lru, ce);
 	}
@@ -605,6 +681,32 @@ glutils_cache_get_common(glutils_cache_t *cache, cache_entry_type_t type,
 		return (&ce->lines);
 }
 
+/**
+ * Retrieves the lookup statistics of a glutils object cache.
+ * @see glutils_cache_stats_t
+ */
+void
+glutils_cache_get_stats(const glutils_cache_t *cache,
+    glutils_cache_stats_t *stats)
+{
+	ASSERT(cache != NULL);
+	ASSERT(stats != NULL);
+
+	*stats = cache->stats;
+	stats->entries = list_count(&cache->lru);
+	stats->bytes = cache->sz;
+}
+
+/**
+ * Zeroes the lookup statistics of a glutils object cache.
+ */
+void
+glutils_cache_reset_stats(glutils_cache_t *cache)
+{
+	ASSERT(cache != NULL);
+	memset(&cache->stats, 0, sizeof (cache->stats));
+}
+
 /**
  * Same as glutils_cache_get_3D_quads(), but for 2D quads.
  * @see glutils_cache_get_3D_quads()
@@ -770,23 +872,14 @@ glutils_vp2pvm(GLfloat pvm[16])
 }
 
 static int
-texsz_alloc_compar(const void *a, const void *b)
+texsz_instance_compar(const void *a, const void *b)
 {
-	const texsz_alloc_t *ta = a, *tb = b;
+	const texsz_instance_t *ta = a, *tb = b;
 
 	if (ta->token < tb->token)
 		return (-1);
 	if (ta->token > tb->token)
 		return (1);
-
-	return (0);
-}
-
-static int
-texsz_instance_compar(const void *a, const void *b)
-{
-	const texsz_instance_t *ta = a, *tb = b;
-
 	if (ta->instance < tb->instance)
 		return (-1);
 	if (ta->instance > tb->instance)
@@ -808,16 +901,39 @@ texsz_instance_compar(const void *a, const void *b)
  * will cause an assertion failure, with debug information about where the
  * allocation took place.
  *
+ * This tracks every instance passed to the `TEXSZ_*_INSTANCE` macros.
+ * Use glutils_texsz_init_sampled() to reduce the overhead of that.
+ *
  * For more information about the system, see TEXSZ_MK_TOKEN().
  */
 API_EXPORT void
 glutils_texsz_init(void)
+{
+	glutils_texsz_init_sampled(1);
+}
+
+/**
+ * Same as glutils_texsz_init(), but lets you limit per-instance tracking,
+ * which requires taking a global lock on every allocation and free.
+ * Per-token byte counts are always exact.
+ *
+ * @param inst_sample_rate Controls which instances passed to the
+ *	`TEXSZ_*_INSTANCE` macros are tracked individually. 0 disables
+ *	per-instance tracking entirely, 1 tracks all instances and N
+ *	tracks roughly one in every N instances. The choice is made by
+ *	hashing the instance pointer, so an instance is either always or
+ *	never tracked. When a leak is detected, only the tracked
+ *	instances of the leaking token can be listed.
+ */
+API_EXPORT void
+glutils_texsz_init_sampled(unsigned inst_sample_rate)
 {
 	texsz.inited = B_TRUE;
+	texsz.sample_rate = inst_sample_rate;
 	mutex_init(&texsz.lock);
-	texsz.bytes = 0;
-	avl_create(&texsz.allocs, texsz_alloc_compar,
-	    sizeof (texsz_alloc_t), offsetof(texsz_alloc_t, node));
+	texsz.tokens = NULL;
+	avl_create(&texsz.instances, texsz_instance_compar,
+	    sizeof (texsz_instance_t), offsetof(texsz_instance_t, node));
 }
 
 /**
@@ -833,100 +949,131 @@ API_EXPORT void
 glutils_texsz_fini(void)
 {
 	void *cookie;
-	texsz_alloc_t *ta;
+	texsz_instance_t *ti;
+	glutils_texsz_token_t *token, *token_next;
 
 	if (!texsz.inited)
 		return;
-	mutex_destroy(&texsz.lock);
-	cookie = NULL;
-	while ((ta = avl_destroy_nodes(&texsz.allocs, &cookie)) != NULL) {
-		void *cookie2 = NULL;
-		texsz_instance_t *ti;
-
-		ASSERT(ta->token != NULL);
-		if (ta->bytes != 0) {
-			for (ti = avl_first(&ta->instances); ti != NULL;
-			    ti = AVL_NEXT(&ta->instances, ti)) {
-				logMsg("%s:  %p  %ld  (at: %s)\n", ta->token,
-				    ti->instance, (long)ti->bytes,
-				    ti->allocd_at);
-			}
-			VERIFY_MSG(0, "Texture allocation leak: "
-			    "%s leaked %ld bytes", ta->token, (long)ta->bytes);
+	for (token = texsz.tokens; token != NULL; token = token->next) {
+		ASSERT(token->name != NULL);
+		if (token->bytes == 0)
+			continue;
+		for (ti = avl_first(&texsz.instances); ti != NULL;
+		    ti = AVL_NEXT(&texsz.instances, ti)) {
+			if (ti->token != token)
+				continue;
+			logMsg("%s:  %p  %ld  (at: %s:%d)\n", token->name,
+			    ti->instance, (long)ti->bytes,
+			    ti->filename[0] != '\0' ? ti->filename : "?",
+			    ti->line);
 		}
-		cookie2 = NULL;
-		while ((ti = avl_destroy_nodes(&ta->instances, &cookie2)) !=
-		    NULL)
-			free(ti);
-		avl_destroy(&ta->instances);
-		free(ta);
+		VERIFY_MSG(0, "Texture allocation leak: %s leaked %ld bytes",
+		    token->name, (long)token->bytes);
 	}
-	avl_destroy(&texsz.allocs);
+	cookie = NULL;
+	while ((ti = avl_destroy_nodes(&texsz.instances, &cookie)) != NULL)
+		free(ti);
+	avl_destroy(&texsz.instances);
+	/* Allow the tokens to register again after a re-init */
+	for (token = texsz.tokens; token != NULL; token = token_next) {
+		token_next = token->next;
+		token->next = NULL;
+		atomic_set_32(&token->registered, 0);
+	}
+	texsz.tokens = NULL;
+	mutex_destroy(&texsz.lock);
+	texsz.inited = B_FALSE;
 }
 
-static inline void
-texsz_incr(const char *token, const void *instance, const char *filename,
-    int line, int64_t bytes)
+static void
+texsz_register(glutils_texsz_token_t *token)
 {
-	texsz_alloc_t srch = { .token = token };
-	texsz_alloc_t *ta;
+	mutex_enter(&texsz.lock);
+	if (!token->registered) {
+		token->next = texsz.tokens;
+		texsz.tokens = token;
+		atomic_set_32(&token->registered, 1);
+	}
+	mutex_exit(&texsz.lock);
+}
+
+static inline bool_t
+texsz_inst_sampled(const void *instance)
+{
+	uint64_t h;
+
+	if (texsz.sample_rate <= 1)
+		return (texsz.sample_rate == 1);
+	/* Fibonacci hashing, allocators align pointers to 16 bytes */
+	h = ((uintptr_t)instance >> 4) * 0x9E3779B97F4A7C15llu;
+	return ((h >> 32) % texsz.sample_rate == 0);
+}
+
+static void
+texsz_incr_instance(const glutils_texsz_token_t *token,
+    const void *instance, const char *filename, int line, int64_t bytes)
+{
+	texsz_instance_t srch = { .token = token, .instance = instance };
+	texsz_instance_t *ti;
 	avl_index_t where;
 
 	mutex_enter(&texsz.lock);
-
-	ASSERT_MSG(texsz.bytes + bytes >= 0, "Texture size accounting error "
-	    "(incr %ld bytes)", (long)bytes);
-	texsz.bytes += bytes;
-	ta = avl_find(&texsz.allocs, &srch, &where);
-	if (ta == NULL) {
-		ta = safe_calloc(1, sizeof (*ta));
-		ta->token = token;
-		avl_create(&ta->instances, texsz_instance_compar,
-		    sizeof (texsz_instance_t),
-		    offsetof(texsz_instance_t, node));
-		avl_insert(&texsz.allocs, ta, where);
-	}
-	ASSERT_MSG(ta->bytes + bytes >= 0, "Texture size accounting zone "
-	    "underflow error (incr %ld bytes in zone %s instance %p)",
-	    (long)bytes, ta->token, instance);
-	ta->bytes += bytes;
-
-	if (instance != NULL) {
-		texsz_instance_t srch_ti = { .instance = instance };
-		texsz_instance_t *ti;
-		avl_index_t where_ti;
-
-		ti = avl_find(&ta->instances, &srch_ti, &where_ti);
-		if (ti == NULL) {
-			ASSERT_MSG(bytes >= 0, "Texture size accounting error "
-			    "(incr %ld bytes in zone %s instance %p, but "
-			    "instance is empty).", (long)bytes, ta->token,
-			    instance);
-			ti = safe_calloc(1, sizeof (*ti));
-			ti->instance = instance;
-			avl_insert(&ta->instances, ti, where_ti);
-		}
-		ASSERT_MSG(ti->bytes + bytes >= 0, "Texture size accounting "
-		    "instance underflow error (incr %ld bytes in zone %s "
-		    "instance %p)", (long)bytes, ta->token, instance);
-		ti->bytes += bytes;
-		if (filename != NULL && snprintf(ti->allocd_at,
-		    sizeof (ti->allocd_at), "%s:%d", filename, line) >=
-		    (int)sizeof (ti->allocd_at)) {
-			int l = strlen(filename);
-			int off = MAX(l - 26, 0);
-			snprintf(ti->allocd_at, sizeof (ti->allocd_at),
-			    "%s:%d", &filename[off], line);
-		}
-		if (ti->bytes == 0) {
-			avl_remove(&ta->instances, ti);
-			free(ti);
+	ti = avl_find(&texsz.instances, &srch, &where);
+	if (ti == NULL) {
+		ASSERT_MSG(bytes >= 0, "Texture size accounting error "
+		    "(incr %ld bytes in zone %s instance %p, but "
+		    "instance is empty).", (long)bytes, token->name,
+		    instance);
+		ti = safe_calloc(1, sizeof (*ti));
+		ti->token = token;
+		ti->instance = instance;
+		if (filename != NULL) {
+			size_t l = strlen(filename);
+
+			/* keep the tail, that's the informative part */
+			lacf_strlcpy(ti->filename, &filename[l >=
+			    sizeof (ti->filename) ? l - sizeof (ti->filename) +
+			    1 : 0], sizeof (ti->filename));
+			ti->line = line;
 		}
+		avl_insert(&texsz.instances, ti, where);
+	}
+	ASSERT_MSG(ti->bytes + bytes >= 0, "Texture size accounting "
+	    "instance underflow error (incr %ld bytes in zone %s "
+	    "instance %p)", (long)bytes, token->name, instance);
+	ti->bytes += bytes;
+	if (ti->bytes == 0) {
+		avl_remove(&texsz.instances, ti);
+		free(ti);
 	}
-
 	mutex_exit(&texsz.lock);
 }
 
+static inline void
+texsz_incr(glutils_texsz_token_t *token, const void *instance,
+    const char *filename, int line, int64_t bytes)
+{
+	int64_t total;
+
+	ASSERT(token != NULL);
+
+	if (!token->registered)
+		texsz_register(token);
+	total = atomic_add_64(&token->bytes, bytes);
+#ifdef	_USE_STDATOMICS
+	/* atomic_fetch_add returns the value before the addition */
+	total += bytes;
+#endif
+	ASSERT_MSG(total >= 0, "Texture size accounting zone underflow "
+	    "error (incr %ld bytes in zone %s instance %p)", (long)bytes,
+	    token->name, instance);
+	UNUSED(total);
+	if (instance != NULL && texsz_inst_sampled(instance)) {
+		texsz_incr_instance(token, instance, filename, line,
+		    bytes);
+	}
+}
+
 static inline int64_t
 texsz_bytes(GLenum format, GLenum type, unsigned w, unsigned h)
 {
@@ -981,7 +1128,7 @@ texsz_bytes(GLenum format, GLenum type, unsigned w, unsigned h)
  * @see TEXSZ_ALLOC_INSTANCE()
  */
 API_EXPORT void
-glutils_texsz_alloc(const char *token, const void *instance,
+glutils_texsz_alloc(glutils_texsz_token_t *token, const void *instance,
     const char *filename, int line, GLenum format, GLenum type,
     unsigned w, unsigned h)
 {
@@ -997,7 +1144,7 @@ glutils_texsz_alloc(const char *token, const void *instance,
  * @see TEXSZ_FREE_INSTANCE()
  */
 API_EXPORT void
-glutils_texsz_free(const char *token, const void *instance,
+glutils_texsz_free(glutils_texsz_token_t *token, const void *instance,
     GLenum format, GLenum type, unsigned w, unsigned h)
 {
 	ASSERT(texsz.inited);
@@ -1011,8 +1158,8 @@ glutils_texsz_free(const char *token, const void *instance,
  * @see TEXSZ_ALLOC_BYTES_INSTANCE()
  */
 API_EXPORT void
-glutils_texsz_alloc_bytes(const char *token, const void *instance,
-    const char *filename, int line, int64_t bytes)
+glutils_texsz_alloc_bytes(glutils_texsz_token_t *token,
+    const void *instance, const char *filename, int line, int64_t bytes)
 {
 	ASSERT(texsz.inited);
 	texsz_incr(token, instance, filename, line, bytes);
@@ -1025,7 +1172,8 @@ glutils_texsz_alloc_bytes(const char *token, const void *instance,
  * @see TEXSZ_FREE_BYTES_INSTANCE()
  */
 API_EXPORT void
-glutils_texsz_free_bytes(const char *token, const void *instance, int64_t bytes)
+glutils_texsz_free_bytes(glutils_texsz_token_t *token,
+    const void *instance, int64_t bytes)
 {
 	ASSERT(texsz.inited);
 	texsz_incr(token, instance, NULL, -1, -bytes);
@@ -1038,8 +1186,17 @@ glutils_texsz_free_bytes(const char *token, const void *instance, int64_t bytes)
 API_EXPORT uint64_t
 glutils_texsz_get(void)
 {
+	int64_t bytes = 0;
+
 	ASSERT(texsz.inited);
-	return (texsz.bytes);
+	mutex_enter(&texsz.lock);
+	for (const glutils_texsz_token_t *token = texsz.tokens;
+	    token != NULL; token = token->next)
+		bytes += token->bytes;
+	mutex_exit(&texsz.lock);
+	ASSERT3S(bytes, >=, 0);
+
+	return (bytes);
 }
 
 /**
@@ -1052,11 +1209,13 @@ API_EXPORT void
 glutils_texsz_enum(glutils_texsz_enum_cb_t cb, void *userinfo)
 {
 	ASSERT(cb != NULL);
+	ASSERT(texsz.inited);
 
-	for (texsz_alloc_t *ta = avl_first(&texsz.allocs); ta != NULL;
-	    ta = AVL_NEXT(&texsz.allocs, ta)) {
-		cb(ta->token, ta->bytes, userinfo);
-	}
+	mutex_enter(&texsz.lock);
+	for (const glutils_texsz_token_t *token = texsz.tokens;
+	    token != NULL; token = token->next)
+		cb(token->name, token->bytes, userinfo);
+	mutex_exit(&texsz.lock);
 }
 
 /**
@@ -1387,6 +1546,446 @@ glutils_nl_draw(glutils_nl_t *nl, float width, GLuint prog)
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
+/*
+ * Number of segments the vertex ring of a glutils_batch_t is split into.
+ * Each segment gets a fence once we're done writing it, so we never
+ * overwrite vertex data the GPU might still be reading from.
+ */
+#define	BATCH_SEGS	4
+
+/**
+ * A glutils_batch_t accumulates quads and lines from many callers into a
+ * single ring buffer of vertices and draws them in as few draw calls as
+ * possible. This is meant for drawing lots of small objects (e.g. map
+ * symbols), which would otherwise be draw-call bound if each one was
+ * drawn as a separate glutils_quads_t or glutils_lines_t.
+ *
+ * Usage:
+ * 1. Allocate the batch using glutils_batch_alloc().
+ * 2. Every frame, set up your shader program and call
+ *	glutils_batch_begin() with it.
+ * 3. Add any number of objects using glutils_batch_add_2D_quads(),
+ *	glutils_batch_add_3D_quads(), glutils_batch_add_2D_lines() and
+ *	glutils_batch_add_3D_lines().
+ * 4. Call glutils_batch_end(). This draws whatever is still pending.
+ *
+ * The batch draws pending objects whenever it has to (e.g. when switching
+ * between quads and lines), so the shader program state must not change
+ * while objects are being added. If you need to change a uniform or bind
+ * a different texture in between objects, call glutils_batch_flush()
+ * before doing so.
+ *
+ * If the driver supports `GL_ARB_buffer_storage`, the ring buffer is
+ * persistently mapped and objects are written directly into GPU-visible
+ * memory. Otherwise, they are staged in main memory and uploaded using
+ * glBufferSubData() in each draw.
+ */
+struct glutils_batch_s {
+	size_t			cap;	/* in vertices */
+	size_t			seg_sz;
+	GLuint			vao;
+	GLuint			vbo;
+	GLuint			ibo;
+	vtx_t			*vtx;	/* mapped ring or staging copy */
+	bool_t			persistent;
+	GLsync			fences[BATCH_SEGS];
+	unsigned		seg;	/* segment we're writing into */
+
+	bool_t			active;
+	GLint			pos_loc;
+	GLint			tex0_loc;
+
+	GLenum			mode;	/* of the pending vertices */
+	size_t			start;	/* first pending vertex */
+	size_t			head;	/* next vertex to write */
+
+	glutils_batch_stats_t	stats;
+};
+
+/**
+ * Allocates a new glutils_batch_t.
+ * @param num_vtx Number of vertices the batch's ring buffer should hold.
+ *	This is rounded up as necessary. The ring is split into 4 segments
+ *	and objects larger than a segment are split into multiple draws,
+ *	so for best results, size it to hold at least a few frames' worth
+ *	of vertices.
+ * @return The new batch. Use glutils_batch_free() to free it.
+ * @see glutils_batch_t
+ */
+glutils_batch_t *
+glutils_batch_alloc(size_t num_vtx)
+{
+	glutils_batch_t *batch = safe_calloc(1, sizeof (*batch));
+	GLint old_vao = 0;
+	size_t bytes;
+
+	ASSERT(num_vtx != 0);
+
+	batch->cap = ((num_vtx + 4 * BATCH_SEGS - 1) / (4 * BATCH_SEGS)) *
+	    (4 * BATCH_SEGS);
+	batch->seg_sz = batch->cap / BATCH_SEGS;
+	bytes = batch->cap * sizeof (vtx_t);
+
+	if (GLEW_VERSION_3_0 && curthread_id != main_thread) {
+		glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &old_vao);
+		glGenVertexArrays(1, &batch->vao);
+		VERIFY(batch->vao != 0);
+		glBindVertexArray(batch->vao);
+	}
+	glGenBuffers(1, &batch->vbo);
+	VERIFY(batch->vbo != 0);
+	glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+	if (GLEW_ARB_buffer_storage) {
+		const GLbitfield flags = GL_MAP_WRITE_BIT |
+		    GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		glBufferStorage(GL_ARRAY_BUFFER, bytes, NULL, flags);
+		batch->vtx = glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, flags);
+		VERIFY(batch->vtx != NULL);
+		batch->persistent = B_TRUE;
+	} else {
+		glBufferData(GL_ARRAY_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+		batch->vtx = safe_malloc(bytes);
+	}
+	batch->ibo = glutils_make_quads_IBO(batch->cap);
+	IF_TEXSZ(TEXSZ_ALLOC_BYTES_INSTANCE(glutils_batch_vbo, batch,
+	    NULL, -1, bytes));
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	if (batch->vao != 0)
+		glBindVertexArray(old_vao);
+
+	return (batch);
+}
+
+/**
+ * Frees a glutils_batch_t previously allocated using glutils_batch_alloc().
+ * The batch must not be between glutils_batch_begin() and
+ * glutils_batch_end().
+ */
+void
+glutils_batch_free(glutils_batch_t *batch)
+{
+	if (batch == NULL)
+		return;
+	ASSERT(!batch->active);
+
+	for (int i = 0; i < BATCH_SEGS; i++) {
+		if (batch->fences[i] != NULL)
+			glDeleteSync(batch->fences[i]);
+	}
+	if (batch->persistent) {
+		glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	} else {
+		free(batch->vtx);
+	}
+	IF_TEXSZ(TEXSZ_FREE_BYTES_INSTANCE(glutils_batch_vbo, batch,
+	    batch->cap * sizeof (vtx_t)));
+	glDeleteBuffers(1, &batch->vbo);
+	glDeleteBuffers(1, &batch->ibo);
+	if (batch->vao != 0)
+		glDeleteVertexArrays(1, &batch->vao);
+
+	free(batch);
+}
+
+/**
+ * Starts drawing a batch of objects. Objects added to the batch after
+ * this call are drawn using `prog`, which must already be bound using
+ * glUseProgram() and must follow the same rules regarding its inputs as
+ * the program passed to glutils_draw_quads(). Call glutils_batch_end()
+ * when done adding objects.
+ */
+void
+glutils_batch_begin(glutils_batch_t *batch, GLint prog)
+{
+	ASSERT(batch != NULL);
+	ASSERT(prog != 0);
+	ASSERT(!batch->active);
+
+	if (batch->vao != 0)
+		glBindVertexArray(batch->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, batch->vbo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, batch->ibo);
+
+	batch->pos_loc = glGetAttribLocation(prog, "vtx_pos");
+	batch->tex0_loc = glGetAttribLocation(prog, "vtx_tex0");
+	glutils_enable_vtx_attr_ptr(batch->pos_loc, 3, GL_FLOAT, GL_FALSE,
+	    sizeof (vtx_t), offsetof(vtx_t, pos));
+	glutils_enable_vtx_attr_ptr(batch->tex0_loc, 2, GL_FLOAT, GL_FALSE,
+	    sizeof (vtx_t), offsetof(vtx_t, tex0));
+
+	batch->active = B_TRUE;
+	batch->mode = GL_NONE;
+}
+
+/**
+ * Draws all objects added to the batch since the last draw. You only
+ * need to call this if you want to change the state of the shader
+ * program between adding objects. glutils_batch_end() flushes the
+ * batch automatically.
+ */
+void
+glutils_batch_flush(glutils_batch_t *batch)
+{
+	size_t n;
+
+	ASSERT(batch != NULL);
+	ASSERT(batch->active);
+
+	n = batch->head - batch->start;
+	if (n == 0)
+		return;
+	if (!batch->persistent) {
+		glBufferSubData(GL_ARRAY_BUFFER, batch->start * sizeof (vtx_t),
+		    n * sizeof (vtx_t), &batch->vtx[batch->start]);
+	}
+	if (batch->mode == GL_TRIANGLES) {
+		/* 6 indices for every 4 vertices, see glutils_draw_quads() */
+		ASSERT0(batch->start & 3);
+		ASSERT0(n & 3);
+		glDrawElements(GL_TRIANGLES, n + n / 2, GL_UNSIGNED_INT,
+		    (void *)((batch->start + batch->start / 2) *
+		    sizeof (GLuint)));
+	} else {
+		ASSERT3U(batch->mode, ==, GL_LINES);
+		glDrawArrays(GL_LINES, batch->start, n);
+	}
+	batch->start = batch->head;
+	batch->stats.draws++;
+	batch->stats.vertices += n;
+}
+
+/**
+ * Draws all objects still pending in the batch and restores the vertex
+ * array state. After this call, the batch can be used with a different
+ * shader program by calling glutils_batch_begin() again.
+ */
+void
+glutils_batch_end(glutils_batch_t *batch)
+{
+	ASSERT(batch != NULL);
+	ASSERT(batch->active);
+
+	glutils_batch_flush(batch);
+	if (batch->vao != 0) {
+		glBindVertexArray(0);
+	} else {
+		glutils_disable_vtx_attr_ptr(batch->pos_loc);
+		glutils_disable_vtx_attr_ptr(batch->tex0_loc);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	batch->active = B_FALSE;
+}
+
+/*
+ * Moves on to the next segment of the ring. Everything written into the
+ * current segment is drawn and fenced, and if the GPU might still be
+ * reading the next segment from the previous trip around the ring, we
+ * wait for it.
+ */
+static void
+batch_next_seg(glutils_batch_t *batch)
+{
+	enum { SEG_TIMEOUT = 1000000 /* ns */ };
+	GLsync fence;
+
+	ASSERT(batch != NULL);
+
+	glutils_batch_flush(batch);
+	ASSERT3P(batch->fences[batch->seg], ==, NULL);
+	batch->fences[batch->seg] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE,
+	    0);
+	batch->seg = (batch->seg + 1) % BATCH_SEGS;
+	batch->head = batch->start = batch->seg * batch->seg_sz;
+
+	fence = batch->fences[batch->seg];
+	if (fence == NULL)
+		return;
+	if (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) ==
+	    GL_TIMEOUT_EXPIRED) {
+		batch->stats.stalls++;
+		while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+		    SEG_TIMEOUT) == GL_TIMEOUT_EXPIRED)
+			;
+	}
+	glDeleteSync(fence);
+	batch->fences[batch->seg] = NULL;
+}
+
+/*
+ * Makes room for up to `n` vertices of primitive type `mode` in the
+ * ring. Returns how many vertices can be written at batch->head, which
+ * is at least `granule` and a multiple of it.
+ */
+static size_t
+batch_reserve(glutils_batch_t *batch, GLenum mode, size_t n, size_t granule)
+{
+	size_t seg_end, avail;
+
+	ASSERT(batch != NULL);
+	ASSERT(batch->active);
+	ASSERT(n >= granule);
+
+	if (batch->mode != mode) {
+		glutils_batch_flush(batch);
+		batch->mode = mode;
+	}
+	seg_end = (batch->seg + 1) * batch->seg_sz;
+	if (mode == GL_TRIANGLES && (batch->head & 3) != 0) {
+		/* Quads must start on an index boundary of the IBO */
+		batch->head = (batch->head + 3) & ~(size_t)3;
+		batch->start = batch->head;
+	}
+	if (batch->head >= seg_end) {
+		batch_next_seg(batch);
+		seg_end = (batch->seg + 1) * batch->seg_sz;
+	}
+	avail = seg_end - batch->head;
+	ASSERT3U(avail, >=, granule);
+
+	return (MIN(n, avail - avail % granule));
+}
+
+static void
+batch_add_quads(glutils_batch_t *batch, const vect2_t *p2, const vect3_t *p3,
+    const vect2_t *t, size_t num_pts)
+{
+	ASSERT(batch != NULL);
+	ASSERT(p2 != NULL || p3 != NULL);
+	ASSERT0(num_pts & 3);
+
+	batch->stats.objects++;
+	for (size_t i = 0; i < num_pts;) {
+		size_t n = batch_reserve(batch, GL_TRIANGLES, num_pts - i, 4);
+		vtx_t *v = &batch->vtx[batch->head];
+
+		for (size_t j = 0; j < n; j++, i++) {
+			vect3_t p = (p3 != NULL ? p3[i] :
+			    VECT3(p2[i].x, p2[i].y, 0));
+
+			v[j].pos[0] = p.x;
+			v[j].pos[1] = p.y;
+			v[j].pos[2] = p.z;
+			v[j].tex0[0] = (t != NULL ? t[i].x : 0);
+			v[j].tex0[1] = (t != NULL ? t[i].y : 0);
+		}
+		batch->head += n;
+	}
+}
+
+/*
+ * Line strips are converted into separate line segments, so multiple
+ * strips can be drawn in a single GL_LINES draw.
+ */
+static void
+batch_add_lines(glutils_batch_t *batch, const vect2_t *p2, const vect3_t *p3,
+    size_t num_pts)
+{
+	ASSERT(batch != NULL);
+	ASSERT(p2 != NULL || p3 != NULL);
+	ASSERT3U(num_pts, >=, 2);
+
+	batch->stats.objects++;
+	for (size_t i = 0; i + 1 < num_pts;) {
+		size_t n = batch_reserve(batch, GL_LINES,
+		    2 * (num_pts - 1 - i), 2);
+		vtx_t *v = &batch->vtx[batch->head];
+
+		for (size_t j = 0; j < n; j++) {
+			size_t k = i + (j + 1) / 2;
+			vect3_t p = (p3 != NULL ? p3[k] :
+			    VECT3(p2[k].x, p2[k].y, 0));
+
+			v[j].pos[0] = p.x;
+			v[j].pos[1] = p.y;
+			v[j].pos[2] = p.z;
+			v[j].tex0[0] = 0;
+			v[j].tex0[1] = 0;
+		}
+		i += n / 2;
+		batch->head += n;
+	}
+}
+
+/**
+ * Same as glutils_batch_add_3D_quads(), but for 2D quads. The Z
+ * coordinate of the vertices is always zero.
+ */
+void
+glutils_batch_add_2D_quads(glutils_batch_t *batch, const vect2_t *p,
+    const vect2_t *t, size_t num_pts)
+{
+	ASSERT(p != NULL);
+	batch_add_quads(batch, p, NULL, t, num_pts);
+}
+
+/**
+ * Adds quads to a batch. The arguments have the same meaning as in
+ * glutils_init_3D_quads(), but unlike a glutils_quads_t, the vertex data
+ * isn't retained past the next glutils_batch_end(), so the quads need
+ * to be added again in every frame.
+ */
+void
+glutils_batch_add_3D_quads(glutils_batch_t *batch, const vect3_t *p,
+    const vect2_t *t, size_t num_pts)
+{
+	ASSERT(p != NULL);
+	batch_add_quads(batch, NULL, p, t, num_pts);
+}
+
+/**
+ * Same as glutils_batch_add_3D_lines(), but for 2D line strips. The Z
+ * coordinate of the vertices is always zero.
+ */
+void
+glutils_batch_add_2D_lines(glutils_batch_t *batch, const vect2_t *p,
+    size_t num_pts)
+{
+	ASSERT(p != NULL);
+	batch_add_lines(batch, p, NULL, num_pts);
+}
+
+/**
+ * Adds a line strip to a batch. The arguments have the same meaning as
+ * in glutils_init_3D_lines(). The `vtx_tex0` input of the shader program
+ * is always (0,0) for lines.
+ */
+void
+glutils_batch_add_3D_lines(glutils_batch_t *batch, const vect3_t *p,
+    size_t num_pts)
+{
+	ASSERT(p != NULL);
+	batch_add_lines(batch, NULL, p, num_pts);
+}
+
+/**
+ * Retrieves the drawing statistics of a batch.
+ * @see glutils_batch_stats_t
+ */
+void
+glutils_batch_get_stats(const glutils_batch_t *batch,
+    glutils_batch_stats_t *stats)
+{
+	ASSERT(batch != NULL);
+	ASSERT(stats != NULL);
+	*stats = batch->stats;
+}
+
+/**
+ * Zeroes the drawing statistics of a batch.
+ */
+void
+glutils_batch_reset_stats(glutils_batch_t *batch)
+{
+	ASSERT(batch != NULL);
+	memset(&batch->stats, 0, sizeof (batch->stats));
+}
+
 /**
  * Utility function to convert between `libpng` image color types and
  * bit depths to a matching OpenGL texture format, suitable for directly
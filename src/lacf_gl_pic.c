@@ -16,29 +16,72 @@
  * Copyright 2023 Saso Kiselkov. All rights reserved.
  */
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
 #include <XPLMGraphics.h>
 
+#include "acfutils/avl.h"
 #include "acfutils/dr.h"
 #include "acfutils/geom.h"
 #include "acfutils/glew.h"
 #include "acfutils/glutils.h"
+#include "acfutils/helpers.h"
 #include "acfutils/png.h"
+#include "acfutils/safe_alloc.h"
 #include "acfutils/shader.h"
+#include "acfutils/taskq.h"
+#include "acfutils/thread.h"
+#include "acfutils/time.h"
 
 #include "acfutils/lacf_gl_pic.h"
 
 #define	LACF_GL_PIC_CACHE_SIZE	(1 << 10)	/* 1 KiB */
+#define	DECODE_THR_STOP_DELAY	SEC2USEC(2)
+
+/*
+ * A background PNG decode, either for an asynchronous lacf_gl_pic_t or
+ * from lacf_gl_pic_preload_dir(). Except for `path', the fields are
+ * protected by decoder.lock. Once `done' is set, the decoder thread no
+ * longer touches the request, unless it has been orphaned (in which case
+ * the decoder thread frees it).
+ */
+typedef struct {
+	char		*path;
+	uint8_t		*pixels;
+	int		w, h;
+	bool_t		done;
+	bool_t		orphaned;
+	avl_node_t	node;		/* decoder.preloaded */
+} decode_t;
+
+/*
+ * The decoder taskq exists while it has any references. Every
+ * asynchronous lacf_gl_pic_t and every entry in `preloaded' holds one.
+ */
+static struct {
+	bool_t		inited;
+	mutex_t		lock;
+	taskq_t		*tq;
+	unsigned	refcnt;
+	avl_tree_t	preloaded;
+} decoder = { .inited = B_FALSE };
 
 struct lacf_gl_pic_s {
 	char		*path;
 	GLuint		tex;
-	uint8_t		*pixels;
 	int		w, h;
 	double		in_use;
 	glutils_cache_t	*cache;
 	dr_t		proj_matrix;
 	dr_t		mv_matrix;
 	GLuint		shader;
+
+	bool_t		async;
+	bool_t		failed;
+	decode_t	*decode;
+	lacf_gl_pic_t	*placeholder;
 };
 
 static const char *vert_shader =
@@ -62,26 +105,320 @@ static const char *frag_shader =
     "   gl_FragColor.a *= alpha;\n"
     "}\n";
 
+static int
+decode_compar(const void *a, const void *b)
+{
+	const decode_t *da = a, *db = b;
+	int res = strcmp(da->path, db->path);
+
+	if (res < 0)
+		return (-1);
+	if (res > 0)
+		return (1);
+	return (0);
+}
+
+static void
+decoder_init(void)
+{
+	if (decoder.inited)
+		return;
+	mutex_init(&decoder.lock);
+	avl_create(&decoder.preloaded, decode_compar, sizeof (decode_t),
+	    offsetof(decode_t, node));
+	decoder.inited = B_TRUE;
+}
+
+static void
+decode_free(decode_t *d)
+{
+	ASSERT(d != NULL);
+	if (d->pixels != NULL)
+		lacf_free(d->pixels);
+	free(d->path);
+	free(d);
+}
+
+static void
+decode_proc(void *userinfo, void *thr_info, void *task)
+{
+	decode_t *d = task;
+	uint8_t *pixels;
+	int w = 0, h = 0;
+
+	LACF_UNUSED(userinfo);
+	LACF_UNUSED(thr_info);
+	ASSERT(d != NULL);
+
+	mutex_enter(&decoder.lock);
+	if (d->orphaned) {
+		decode_free(d);
+		mutex_exit(&decoder.lock);
+		return;
+	}
+	mutex_exit(&decoder.lock);
+
+	pixels = png_load_from_file_rgba(d->path, &w, &h);
+
+	mutex_enter(&decoder.lock);
+	d->pixels = pixels;
+	d->w = w;
+	d->h = h;
+	d->done = B_TRUE;
+	if (d->orphaned)
+		decode_free(d);
+	mutex_exit(&decoder.lock);
+}
+
+static void
+decode_discard(void *userinfo, void *task)
+{
+	decode_t *d = task;
+
+	LACF_UNUSED(userinfo);
+	ASSERT(d != NULL);
+	/* With no references left, nobody can be waiting for the result */
+	ASSERT(d->orphaned);
+	decode_free(d);
+}
+
+static void
+decoder_hold(void)
+{
+	decoder_init();
+	mutex_enter(&decoder.lock);
+	if (decoder.refcnt++ == 0) {
+		ASSERT3P(decoder.tq, ==, NULL);
+		decoder.tq = taskq_alloc(0, lacf_get_num_cpus(),
+		    DECODE_THR_STOP_DELAY, NULL, NULL, decode_proc,
+		    decode_discard, NULL);
+	}
+	mutex_exit(&decoder.lock);
+}
+
+static void
+decoder_rele(void)
+{
+	taskq_t *tq = NULL;
+
+	mutex_enter(&decoder.lock);
+	ASSERT(decoder.refcnt != 0);
+	if (--decoder.refcnt == 0) {
+		tq = decoder.tq;
+		decoder.tq = NULL;
+	}
+	mutex_exit(&decoder.lock);
+	/* The decoder threads need decoder.lock to finish up */
+	if (tq != NULL)
+		taskq_free(tq);
+}
+
+/*
+ * Starts decoding `path' in the background. The caller must hold a
+ * decoder reference.
+ */
+static decode_t *
+decode_submit(const char *path)
+{
+	decode_t *d = safe_calloc(1, sizeof (*d));
+
+	ASSERT(path != NULL);
+	d->path = safe_strdup(path);
+
+	mutex_enter(&decoder.lock);
+	ASSERT(decoder.refcnt != 0);
+	taskq_submit(decoder.tq, d);
+	mutex_exit(&decoder.lock);
+
+	return (d);
+}
+
 static bool_t
-load_image(lacf_gl_pic_t *pic)
+decode_is_done(decode_t *d)
 {
-	uint8_t *buf;
+	bool_t done;
 
-	ASSERT(pic != NULL);
-	ASSERT0(pic->tex);
-	ASSERT(pic->path != NULL);
+	ASSERT(d != NULL);
+	mutex_enter(&decoder.lock);
+	done = d->done;
+	mutex_exit(&decoder.lock);
 
-	buf = png_load_from_file_rgba(pic->path, &pic->w, &pic->h);
-	if (buf == NULL)
+	return (done);
+}
+
+/*
+ * Drops a decode the caller no longer wants the result of. If the
+ * decoder thread isn't done with it yet, it frees it when it is.
+ */
+static void
+decode_abandon(decode_t *d)
+{
+	ASSERT(d != NULL);
+
+	mutex_enter(&decoder.lock);
+	if (d->done)
+		decode_free(d);
+	else
+		d->orphaned = B_TRUE;
+	mutex_exit(&decoder.lock);
+}
+
+/*
+ * Hands the preloaded decode of `path' (if any) over to `pic'. An
+ * asynchronous image takes over the decode even if it isn't finished,
+ * whereas a synchronous one doesn't wait for it. The decoder reference
+ * of the preload cache entry is dropped only after that, since dropping
+ * the last reference discards any decodes which haven't been orphaned.
+ */
+static void
+preload_take(lacf_gl_pic_t *pic)
+{
+	const decode_t srch = { .path = pic->path };
+	decode_t *d;
+
+	ASSERT3P(pic->decode, ==, NULL);
+
+	if (!decoder.inited)
+		return;
+	mutex_enter(&decoder.lock);
+	d = avl_find(&decoder.preloaded, &srch, NULL);
+	if (d != NULL)
+		avl_remove(&decoder.preloaded, d);
+	mutex_exit(&decoder.lock);
+	if (d == NULL)
+		return;
+
+	if (pic->async || decode_is_done(d))
+		pic->decode = d;
+	else
+		decode_abandon(d);
+	decoder_rele();
+}
+
+/*
+ * Reads the image dimensions from the IHDR chunk of a PNG file, which
+ * must immediately follow the PNG signature.
+ */
+static bool_t
+png_read_dims(const char *path, int *w, int *h)
+{
+	static const uint8_t sig[8] = {
+	    0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'
+	};
+	uint8_t hdr[24];
+	FILE *fp = fopen(path, "rb");
+	bool_t res;
+
+	if (fp == NULL)
 		return (B_FALSE);
+	res = (fread(hdr, 1, sizeof (hdr), fp) == sizeof (hdr) &&
+	    memcmp(hdr, sig, sizeof (sig)) == 0 &&
+	    memcmp(&hdr[12], "IHDR", 4) == 0);
+	fclose(fp);
+	if (res) {
+		*w = (hdr[16] << 24) | (hdr[17] << 16) | (hdr[18] << 8) |
+		    hdr[19];
+		*h = (hdr[20] << 24) | (hdr[21] << 16) | (hdr[22] << 8) |
+		    hdr[23];
+	}
+
+	return (res);
+}
+
+static void
+upload_image(lacf_gl_pic_t *pic, const uint8_t *pixels)
+{
+	size_t sz = (size_t)pic->w * pic->h * 4;
+	void *buf = NULL;
+	GLuint pbo = 0;
+
+	ASSERT(pic != NULL);
+	ASSERT0(pic->tex);
+	ASSERT(pixels != NULL);
 
 	glGenTextures(1, &pic->tex);
 	ASSERT(pic->tex != 0);
 	glBindTexture(GL_TEXTURE_2D, pic->tex);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pic->w, pic->h, 0, GL_RGBA,
-	    GL_UNSIGNED_BYTE, buf);
+	/*
+	 * Asynchronous images go through a pixel buffer object, so the
+	 * driver can perform the transfer to the texture in the background,
+	 * rather than stalling the drawing thread until it's done.
+	 */
+	if (pic->async && GLEW_VERSION_2_1) {
+		glGenBuffers(1, &pbo);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, sz, NULL, GL_STREAM_DRAW);
+		buf = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+	}
+	if (buf != NULL) {
+		memcpy(buf, pixels, sz);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pic->w, pic->h, 0,
+		    GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	} else {
+		if (pbo != 0)
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pic->w, pic->h, 0,
+		    GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+	}
+	if (pbo != 0) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(1, &pbo);
+	}
+}
+
+/*
+ * Makes sure the image is loaded into a texture. Asynchronous images
+ * are decoded in the background, so this returns B_FALSE until the
+ * decode is done. Images from lacf_gl_pic_preload_dir() are picked up
+ * from the preload cache.
+ */
+static bool_t
+load_image(lacf_gl_pic_t *pic)
+{
+	uint8_t *buf;
+
+	ASSERT(pic != NULL);
+	ASSERT(pic->path != NULL);
+
+	if (pic->tex != 0)
+		return (B_TRUE);
+	if (pic->failed)
+		return (B_FALSE);
+
+	if (pic->decode == NULL) {
+		preload_take(pic);
+		if (pic->decode == NULL && pic->async)
+			pic->decode = decode_submit(pic->path);
+	}
+	if (pic->decode != NULL) {
+		decode_t *d = pic->decode;
+
+		if (decode_is_done(d)) {
+			pic->decode = NULL;
+			if (d->pixels != NULL) {
+				pic->w = d->w;
+				pic->h = d->h;
+				upload_image(pic, d->pixels);
+			} else if (pic->async) {
+				/* Don't resubmit a broken image every frame */
+				pic->failed = B_TRUE;
+			}
+			decode_free(d);
+			if (pic->tex != 0 || pic->async)
+				return (pic->tex != 0);
+		} else {
+			ASSERT(pic->async);
+			return (B_FALSE);
+		}
+	}
+
+	buf = png_load_from_file_rgba(pic->path, &pic->w, &pic->h);
+	if (buf == NULL)
+		return (B_FALSE);
+	upload_image(pic, buf);
 	lacf_free(buf);
 
 	return (B_TRUE);
@@ -141,17 +478,155 @@ lacf_gl_pic_destroy(lacf_gl_pic_t *pic)
 	if (pic == NULL)
 		return;
 	lacf_gl_pic_unload(pic);
+	if (pic->async)
+		decoder_rele();
 	free(pic->path);
 	ZERO_FREE(pic);
 }
 
+/**
+ * Switches the image between synchronous (the default) and asynchronous
+ * loading. A synchronous image is decoded and uploaded on the drawing
+ * thread the first time it is needed, which can cause a visible stall
+ * when showing lots of images for the first time. An asynchronous image
+ * is instead decoded on a background thread, and the drawing functions
+ * draw its placeholder (see lacf_gl_pic_set_placeholder()) or nothing
+ * until the decode is done. The finished image is then uploaded using
+ * a pixel buffer object on the next attempt to draw it.
+ */
+void
+lacf_gl_pic_set_async(lacf_gl_pic_t *pic, bool_t flag)
+{
+	ASSERT(pic != NULL);
+
+	if (pic->async == flag)
+		return;
+	if (flag) {
+		decoder_hold();
+	} else {
+		if (pic->decode != NULL) {
+			decode_abandon(pic->decode);
+			pic->decode = NULL;
+		}
+		decoder_rele();
+	}
+	pic->async = flag;
+	pic->failed = B_FALSE;
+}
+
+/**
+ * @return `B_TRUE` if the image loads asynchronously.
+ * @see lacf_gl_pic_set_async()
+ */
+bool_t
+lacf_gl_pic_get_async(const lacf_gl_pic_t *pic)
+{
+	ASSERT(pic != NULL);
+	return (pic->async);
+}
+
+/**
+ * Sets an image to draw in place of an asynchronous image while it is
+ * still loading (or if it fails to load). The placeholder should be a
+ * small, synchronously loaded image, e.g. a blank panel background. It
+ * is stretched to the size of the image being drawn. The placeholder
+ * isn't owned by `pic` and must stay alive for as long as it is set.
+ * Pass `NULL` to draw nothing while loading (the default).
+ */
+void
+lacf_gl_pic_set_placeholder(lacf_gl_pic_t *pic, lacf_gl_pic_t *placeholder)
+{
+	ASSERT(pic != NULL);
+	ASSERT(placeholder != pic);
+	pic->placeholder = placeholder;
+}
+
+/**
+ * Starts decoding all PNG images in a directory on background threads
+ * and keeps the results in memory. Images later created with
+ * lacf_gl_pic_new_from_dir() (or lacf_gl_pic_new() using the same path
+ * as formed by mkpathname()) from this directory pick up the decoded
+ * image the first time they are loaded, so they only need to be
+ * uploaded to the GPU. Use this to warm up images of a panel before it
+ * is shown for the first time. Preloaded images nobody picked up stay
+ * in memory until lacf_gl_pic_preload_flush() is called.
+ */
+void
+lacf_gl_pic_preload_dir(const char *dirpath)
+{
+	DIR *dp;
+	struct dirent *de;
+
+	ASSERT(dirpath != NULL);
+
+	dp = opendir(dirpath);
+	if (dp == NULL) {
+		logMsg("Can't preload images from %s: %s", dirpath,
+		    strerror(errno));
+		return;
+	}
+	decoder_init();
+	while ((de = readdir(dp)) != NULL) {
+		size_t l = strlen(de->d_name);
+		decode_t srch, *d;
+		avl_index_t where;
+
+		if (l <= 4 || lacf_strcasecmp(&de->d_name[l - 4], ".png") != 0)
+			continue;
+		srch.path = mkpathname(dirpath, de->d_name, NULL);
+
+		mutex_enter(&decoder.lock);
+		if (avl_find(&decoder.preloaded, &srch, &where) == NULL) {
+			decoder_hold();
+			d = decode_submit(srch.path);
+			avl_insert(&decoder.preloaded, d, where);
+		}
+		mutex_exit(&decoder.lock);
+		lacf_free(srch.path);
+	}
+	closedir(dp);
+}
+
+/**
+ * Frees all images decoded by lacf_gl_pic_preload_dir() which haven't
+ * been picked up by an lacf_gl_pic_t yet. Images still being decoded
+ * are freed as soon as their decode finishes.
+ */
+void
+lacf_gl_pic_preload_flush(void)
+{
+	decode_t *d;
+	void *cookie = NULL;
+	unsigned n = 0;
+
+	if (!decoder.inited)
+		return;
+	mutex_enter(&decoder.lock);
+	while ((d = avl_destroy_nodes(&decoder.preloaded, &cookie)) != NULL) {
+		if (d->done)
+			decode_free(d);
+		else
+			d->orphaned = B_TRUE;
+		n++;
+	}
+	avl_create(&decoder.preloaded, decode_compar, sizeof (decode_t),
+	    offsetof(decode_t, node));
+	mutex_exit(&decoder.lock);
+
+	for (unsigned i = 0; i < n; i++)
+		decoder_rele();
+}
+
 /**
  * A newly initialized gl_pic_t is normally lazy-loaded and no disk I/O
  * is performed until the image is to be drawn. This function allows you
  * to pre-load the image into VRAM before it is needed.
  * @return `B_TRUE` if loading the image was successful (or the image was
  *	loaded already). `B_FALSE` if loading the image failed, either
- *	due to disk I/O or an issue with the image format on disk.
+ *	due to disk I/O or an issue with the image format on disk. For
+ *	asynchronous images (see lacf_gl_pic_set_async()), this only
+ *	starts the decode and returns `B_FALSE` until the image has been
+ *	decoded, at which point a subsequent call uploads it.
  */
 bool_t
 lacf_gl_pic_load(lacf_gl_pic_t *pic)
@@ -162,6 +637,17 @@ lacf_gl_pic_load(lacf_gl_pic_t *pic)
 	return (load_image(pic));
 }
 
+/**
+ * @return `B_TRUE` if the image is loaded and can be drawn. Unlike
+ *	lacf_gl_pic_load(), this never starts loading the image.
+ */
+bool_t
+lacf_gl_pic_is_loaded(const lacf_gl_pic_t *pic)
+{
+	ASSERT(pic != NULL);
+	return (pic->tex != 0);
+}
+
 /**
  * If the image was loaded, unloads the image and frees GPU-side VRAM
  * buffers. This can be used to reduce the memory footprint of images
@@ -177,6 +663,11 @@ lacf_gl_pic_unload(lacf_gl_pic_t *pic)
 {
 	ASSERT(pic != NULL);
 
+	if (pic->decode != NULL) {
+		decode_abandon(pic->decode);
+		pic->decode = NULL;
+	}
+	pic->failed = B_FALSE;
 	if (pic->tex != 0) {
 		glDeleteTextures(1, &pic->tex);
 		pic->tex = 0;
@@ -191,6 +682,23 @@ lacf_gl_pic_unload(lacf_gl_pic_t *pic)
 	}
 }
 
+/*
+ * Asynchronous images don't wait for their decode to determine their
+ * dimensions. We just start the decode and peek at the PNG header.
+ */
+static void
+load_dims(lacf_gl_pic_t *pic)
+{
+	ASSERT(pic != NULL);
+
+	if (load_image(pic) || !pic->async)
+		return;
+	if (!png_read_dims(pic->path, &pic->w, &pic->h)) {
+		pic->w = 0;
+		pic->h = 0;
+	}
+}
+
 /**
  * @return The pixel width of the image. This may need to perform disk
  *	I/O to load the image and determine its dimensions. If loading
@@ -201,7 +709,7 @@ lacf_gl_pic_get_width(lacf_gl_pic_t *pic)
 {
 	ASSERT(pic != NULL);
 	if (pic->w == 0)
-		load_image(pic);
+		load_dims(pic);
 	return (pic->w);
 }
 
@@ -215,7 +723,7 @@ lacf_gl_pic_get_height(lacf_gl_pic_t *pic)
 {
 	ASSERT(pic != NULL);
 	if (pic->h == 0)
-		load_image(pic);
+		load_dims(pic);
 	return (pic->h);
 }
 
@@ -301,8 +809,14 @@ lacf_gl_pic_draw_custom(lacf_gl_pic_t *pic, vect2_t pos, vect2_t size,
 
 	ASSERT(pic != NULL);
 
-	if (pic->tex == 0 && !load_image(pic))
+	if (pic->tex == 0 && !load_image(pic)) {
+		if (pic->placeholder == NULL)
+			return;
+		if (IS_NULL_VECT(size) && lacf_gl_pic_get_width(pic) != 0)
+			size = VECT2(pic->w, pic->h);
+		lacf_gl_pic_draw_custom(pic->placeholder, pos, size, prog);
 		return;
+	}
 	if (IS_NULL_VECT(size))
 		size = VECT2(pic->w, pic->h);
 	if (pic->cache == NULL)
@@ -251,6 +251,225 @@ fx_lin_multi_inv3(double y, const struct vect2_s *points, size_t n_points,
 	return (out);
 }
 
+struct fx_lin_curve_s {
+	size_t	n_points;
+	double	*xs;
+	double	*ys;
+	double	*slopes;	/* n_points - 1 segment slopes */
+	/*
+	 * Uniform lookup grid over the X range of the curve. Bucket `i'
+	 * holds the index of the segment containing the start of the
+	 * bucket, so the segment for any X in the bucket lies between
+	 * buckets[i] and buckets[i + 1] (inclusive).
+	 */
+	size_t	n_buckets;
+	size_t	*buckets;	/* n_buckets + 1 elements */
+	double	bucket_scale;	/* 1 / bucket width */
+};
+
+/**
+ * Same as fx_lin_curve_alloc2(), but takes a NULL_VECT2-terminated list
+ * of points, just like fx_lin_multi().
+ */
+fx_lin_curve_t *
+fx_lin_curve_alloc(const struct vect2_s *points)
+{
+	return (fx_lin_curve_alloc2(points, count_points_sentinel(points)));
+}
+
+/**
+ * Constructs a compiled multi-segment linear function. The curve is
+ * defined the same way as for fx_lin_multi2(), as a series of X-Y points
+ * with strictly increasing X coordinates. The points are copied, so the
+ * `points` array doesn't need to remain valid after this call.
+ * @param points Sequence of points defining the function.
+ * @param n_points Number of points in `points`. This MUST be at least 2.
+ * @return The compiled curve. Use fx_lin_curve_eval() to evaluate it and
+ *	release it using fx_lin_curve_free() when you're done with it.
+ */
+fx_lin_curve_t *
+fx_lin_curve_alloc2(const struct vect2_s *points, size_t n_points)
+{
+	fx_lin_curve_t *curve = safe_calloc(1, sizeof (*curve));
+	double x_min, x_max;
+
+	ASSERT(points != NULL);
+	ASSERT3U(n_points, >=, 2);
+
+	curve->n_points = n_points;
+	curve->xs = safe_malloc(n_points * sizeof (*curve->xs));
+	curve->ys = safe_malloc(n_points * sizeof (*curve->ys));
+	curve->slopes = safe_malloc((n_points - 1) * sizeof (*curve->slopes));
+	for (size_t i = 0; i < n_points; i++) {
+		curve->xs[i] = points[i].x;
+		curve->ys[i] = points[i].y;
+		if (i > 0) {
+			ASSERT3F(points[i - 1].x, <, points[i].x);
+			curve->slopes[i - 1] = (points[i].y - points[i - 1].y) /
+			    (points[i].x - points[i - 1].x);
+		}
+	}
+	/*
+	 * One bucket per segment keeps the table small and gives O(1)
+	 * lookups for evenly spaced points. Unevenly spaced curves fall
+	 * back to a binary search within the bucket's segment range.
+	 */
+	x_min = curve->xs[0];
+	x_max = curve->xs[n_points - 1];
+	curve->n_buckets = n_points - 1;
+	curve->buckets = safe_malloc((curve->n_buckets + 1) *
+	    sizeof (*curve->buckets));
+	curve->bucket_scale = curve->n_buckets / (x_max - x_min);
+	for (size_t i = 0, seg = 0; i <= curve->n_buckets; i++) {
+		double x = x_min + i / curve->bucket_scale;
+
+		while (seg + 2 < n_points && x > curve->xs[seg + 1])
+			seg++;
+		curve->buckets[i] = seg;
+	}
+
+	return (curve);
+}
+
+/**
+ * Frees a curve previously allocated using fx_lin_curve_alloc() or
+ * fx_lin_curve_alloc2().
+ */
+void
+fx_lin_curve_free(fx_lin_curve_t *curve)
+{
+	if (curve == NULL)
+		return;
+	free(curve->xs);
+	free(curve->ys);
+	free(curve->slopes);
+	free(curve->buckets);
+	free(curve);
+}
+
+/*
+ * Locates the segment containing `x', which must be within the X range
+ * of the curve. Same as fx_lin_multi2(), a point exactly on the boundary
+ * between two segments belongs to the left one.
+ */
+static inline size_t
+curve_find_seg(const fx_lin_curve_t *curve, double x)
+{
+	const double *xs = curve->xs;
+	double fb = (x - xs[0]) * curve->bucket_scale;
+	size_t b = MIN((size_t)MAX(fb, 0), curve->n_buckets - 1);
+	/*
+	 * Widen the range by one segment on each side to guard against
+	 * `fb' rounding into a neighboring bucket.
+	 */
+	size_t lo = curve->buckets[b], hi = curve->buckets[b + 1];
+
+	lo = (lo > 0 ? lo - 1 : 0);
+	hi = MIN(hi + 1, curve->n_points - 2);
+	/* Find the first segment in [lo, hi] whose end point is >= x */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (x <= xs[mid + 1])
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return (lo);
+}
+
+static inline double
+curve_eval_seg(const fx_lin_curve_t *curve, size_t seg, double x)
+{
+	return (curve->ys[seg] + (x - curve->xs[seg]) * curve->slopes[seg]);
+}
+
+/**
+ * Evaluates a compiled multi-segment linear function. Behaves identically
+ * to fx_lin_multi2() called with the points the curve was constructed
+ * from, including how the `extrapolate` argument handles values of `x`
+ * outside of the curve's range.
+ */
+double
+fx_lin_curve_eval(const fx_lin_curve_t *curve, double x, bool_t extrapolate)
+{
+	size_t last;
+
+	ASSERT(curve != NULL);
+	last = curve->n_points - 1;
+
+	if (isnan(x))
+		return (NAN);
+	if (x < curve->xs[0])
+		return (extrapolate ? curve_eval_seg(curve, 0, x) : NAN);
+	if (x > curve->xs[last]) {
+		return (extrapolate ? curve_eval_seg(curve, last - 1, x) :
+		    NAN);
+	}
+	return (curve_eval_seg(curve, curve_find_seg(curve, x), x));
+}
+
+/**
+ * Same as fx_lin_curve_eval(), but additionally takes a caller-owned
+ * segment hint. If `x` falls within the segment previously used, or the
+ * one immediately following it, the lookup is skipped entirely. This
+ * makes monotonic sweeps over the curve (e.g. a slowly changing input
+ * evaluated every frame) very cheap. The hint is kept by the caller, so
+ * the same curve can be safely shared between multiple threads.
+ * @param hint Segment hint. Initialize this to 0 before the first call
+ *	and then pass the same variable to subsequent calls.
+ */
+double
+fx_lin_curve_eval_hint(const fx_lin_curve_t *curve, double x,
+    bool_t extrapolate, size_t *hint)
+{
+	const double *xs;
+	size_t seg, last;
+
+	ASSERT(curve != NULL);
+	ASSERT(hint != NULL);
+	xs = curve->xs;
+	last = curve->n_points - 1;
+
+	if (isnan(x))
+		return (NAN);
+	if (x < xs[0])
+		return (extrapolate ? curve_eval_seg(curve, 0, x) : NAN);
+	if (x > xs[last])
+		return (extrapolate ? curve_eval_seg(curve, last - 1, x) : NAN);
+
+	seg = *hint;
+	if (seg >= last || x > xs[seg + 1] || (seg > 0 && x <= xs[seg])) {
+		if (seg + 2 <= last && x > xs[seg + 1] && x <= xs[seg + 2])
+			seg++;
+		else
+			seg = curve_find_seg(curve, x);
+	}
+	*hint = seg;
+
+	return (curve_eval_seg(curve, seg, x));
+}
+
+/**
+ * Batch version of fx_lin_curve_eval(). Evaluates the curve for each of
+ * the `n` input values in `x` and stores the results in `out`. Segment
+ * lookups reuse the previous result, so sorted (or mostly sorted) inputs
+ * are processed fastest.
+ */
+void
+fx_lin_curve_eval_v(const fx_lin_curve_t *curve, const double *x, size_t n,
+    bool_t extrapolate, double *out)
+{
+	size_t hint = 0;
+
+	ASSERT(curve != NULL);
+	ASSERT(x != NULL || n == 0);
+	ASSERT(out != NULL || n == 0);
+
+	for (size_t i = 0; i < n; i++)
+		out[i] = fx_lin_curve_eval_hint(curve, x[i], extrapolate, &hint);
+}
+
 /**
  * Given a series of X-Y coordinates, this function initializes a polynomial
  * interpolator that smoothly passes through all the input points. When you
@@ -27,6 +27,7 @@
 #include <XPLMUtilities.h>
 
 #include "acfutils/assert.h"
+#include "acfutils/avl.h"
 #include "acfutils/dr.h"
 #include "acfutils/geom.h"
 #include "acfutils/glctx.h"
@@ -54,6 +55,9 @@
 TEXSZ_MK_TOKEN(mt_cairo_render_tex);
 TEXSZ_MK_TOKEN(mt_cairo_render_pbo);
 
+#define	MAX_DAMAGE_RECTS	16	/* beyond, merged into a bounding box */
+#define	DAMAGE_TILE		64	/* pixels, for MTCR_DAMAGE_AUTO */
+
 typedef struct {
 	GLfloat		pos[3];
 	GLfloat		tex0[2];
@@ -64,6 +68,16 @@ typedef struct {
 	cairo_surface_t		*surf;
 } render_surf_t;
 
+/*
+ * A set of changed surface regions. If `full' is set, the rects are
+ * ignored and the whole surface is considered changed.
+ */
+typedef struct {
+	bool_t			full;
+	unsigned		n;
+	mtcr_rect_t		rects[MAX_DAMAGE_RECTS];
+} damage_t;
+
 struct mt_cairo_render_s {
 	char			*init_filename;
 	int			init_line;
@@ -85,6 +99,7 @@ struct mt_cairo_render_s {
 	render_surf_t		rs[2];
 	bool_t			dirty;	/* changed the surface, reupload */
 	bool_t			texed;	/* has glTexImage2D been applied? */
+	bool_t			tex_valid; /* texture holds a complete frame */
 	GLuint			tex;
 	GLuint			pbo;
 	GLint			filter;
@@ -95,11 +110,53 @@ struct mt_cairo_render_s {
 	thread_t		thr;
 	condvar_t		cv;
 	condvar_t		render_done_cv;
+	unsigned		render_done_waiters;
 	bool_t			one_shot_block;
 	mutex_t			lock;
 	bool_t			started;
 	bool_t			shutdown;
 	bool_t			fg_mode;
+	bool_t			registered;
+	list_node_t		registry_node;
+
+	/* Protected by lock */
+	mtcr_stats_t		stats;
+	uint64_t		frame_target;	/* scheduled start of frame */
+	uint64_t		ul_pending_t;	/* oldest frame not uploaded */
+	bool_t			skip_unchanged;
+
+	/*
+	 * Damage tracking. frame_dmg and the tile hashes are only touched
+	 * by the thread rendering the frame. The rest is protected by lock:
+	 * ul_dmg has yet to be copied to the PBO, tex_dmg has been copied
+	 * to the PBO, but not yet applied to the texture.
+	 */
+	mtcr_damage_mode_t	dmg_mode;
+	damage_t		frame_dmg;
+	damage_t		ul_dmg;
+	damage_t		tex_dmg;
+	uint64_t		*tile_hash;
+	unsigned		tiles_x, tiles_y;
+	bool_t			tile_hash_valid;
+	struct {
+		uint64_t	win_start;
+		uint64_t	win_bytes;
+		uint64_t	rate;	/* bytes per second */
+	} ul_bytes;
+
+	/*
+	 * When driven by a shared render pool instead of our own thread.
+	 * The `pool' pointer itself is protected by lock, the remaining
+	 * fields by pool->lock.
+	 */
+	mt_cairo_render_pool_t	*pool;
+	avl_node_t		pool_node;
+	uint64_t		pool_next;	/* deadline, microclock() */
+	uint64_t		pool_seq;	/* FIFO among equal deadlines */
+	bool_t			pool_active;	/* schedulable */
+	bool_t			pool_queued;	/* in pool->sched */
+	bool_t			pool_busy;	/* being rendered */
+	bool_t			pool_req;	/* render again once done */
 
 	/* Only accessed from OpenGL drawing thread, so no locking req'd */
 	struct {
@@ -133,6 +190,18 @@ struct mt_cairo_uploader_s {
 	thread_t	worker;
 };
 
+struct mt_cairo_render_pool_s {
+	mutex_t		lock;
+	condvar_t	cv;		/* schedule changed or shutdown */
+	condvar_t	cv_done;	/* a pool thread finished a frame */
+	avl_tree_t	sched;		/* renderers ordered by deadline */
+	uint64_t	seq;
+	uint64_t	refcnt;
+	bool_t		shutdown;
+	unsigned	num_thr;
+	thread_t	*thr;
+};
+
 static const char *vert_shader =
     "#version 120\n"
     "#extension GL_EXT_gpu_shader4 : require\n"
@@ -196,6 +265,17 @@ static bool_t glob_inited = B_FALSE;
 static bool_t coherent = B_FALSE;
 static thread_id_t mtcr_main_thread;
 
+/*
+ * Live renderers, for mt_cairo_render_enum(). Renderers only join the
+ * list if it was enabled using mt_cairo_render_set_registry_enabled()
+ * at the time they were created.
+ */
+static struct {
+	bool_t		enabled;
+	mutex_t		lock;
+	list_t		list;
+} registry;
+
 static struct {
 	dr_t	viewport;
 	dr_t	proj_matrix;
@@ -284,14 +364,361 @@ mtul_submit_mtcr(mt_cairo_uploader_t *mtul, mt_cairo_render_t *mtcr)
 	mutex_exit(&mtul->lock);
 }
 
+static unsigned
+mtcr_get_bpp(const mt_cairo_render_t *mtcr)
+{
+	ASSERT(mtcr != NULL);
+	return (!IS_NULL_VECT(mtcr->monochrome) ? 1 : 4);
+}
+
 static size_t
-mtcr_get_surf_sz(const mt_cairo_render_t *mtcr)
+mtcr_get_stride(const mt_cairo_render_t *mtcr)
 {
 	cairo_format_t cr_fmt;
 	ASSERT(mtcr != NULL);
 	cr_fmt = (!IS_NULL_VECT(mtcr->monochrome) ? CAIRO_FORMAT_A8 :
 	    CAIRO_FORMAT_ARGB32);
-	return (cairo_format_stride_for_width(cr_fmt, mtcr->w) * mtcr->h);
+	return (cairo_format_stride_for_width(cr_fmt, mtcr->w));
+}
+
+static size_t
+mtcr_get_surf_sz(const mt_cairo_render_t *mtcr)
+{
+	return (mtcr_get_stride(mtcr) * mtcr->h);
+}
+
+static void
+damage_clear(damage_t *dmg)
+{
+	ASSERT(dmg != NULL);
+	dmg->full = B_FALSE;
+	dmg->n = 0;
+}
+
+static bool_t
+damage_is_empty(const damage_t *dmg)
+{
+	ASSERT(dmg != NULL);
+	return (!dmg->full && dmg->n == 0);
+}
+
+static void
+damage_add(damage_t *dmg, unsigned x, unsigned y, unsigned w, unsigned h)
+{
+	mtcr_rect_t *last;
+
+	ASSERT(dmg != NULL);
+
+	if (dmg->full || w == 0 || h == 0)
+		return;
+	last = (dmg->n != 0 ? &dmg->rects[dmg->n - 1] : NULL);
+	/* Extend the previous rect downward if it's directly above us */
+	if (last != NULL && last->x == x && last->w == w &&
+	    last->y + last->h == y) {
+		last->h += h;
+		return;
+	}
+	if (dmg->n == MAX_DAMAGE_RECTS) {
+		/* Too many rects, collapse everything into a bounding box */
+		unsigned x1 = x, y1 = y, x2 = x + w, y2 = y + h;
+
+		for (unsigned i = 0; i < dmg->n; i++) {
+			const mtcr_rect_t *r = &dmg->rects[i];
+
+			x1 = MIN(x1, r->x);
+			y1 = MIN(y1, r->y);
+			x2 = MAX(x2, r->x + r->w);
+			y2 = MAX(y2, r->y + r->h);
+		}
+		dmg->rects[0] = (mtcr_rect_t){ x1, y1, x2 - x1, y2 - y1 };
+		dmg->n = 1;
+		return;
+	}
+	dmg->rects[dmg->n++] = (mtcr_rect_t){ x, y, w, h };
+}
+
+static void
+damage_merge(damage_t *dst, const damage_t *src)
+{
+	ASSERT(dst != NULL);
+	ASSERT(src != NULL);
+
+	if (src->full) {
+		dst->full = B_TRUE;
+		return;
+	}
+	for (unsigned i = 0; i < src->n; i++) {
+		const mtcr_rect_t *r = &src->rects[i];
+		damage_add(dst, r->x, r->y, r->w, r->h);
+	}
+}
+
+/*
+ * Copies the damaged regions of a surface into an upload buffer of the
+ * same layout. Returns the number of bytes copied.
+ */
+static size_t
+damage_copy(const mt_cairo_render_t *mtcr, const damage_t *dmg,
+    uint8_t *dst, const uint8_t *src)
+{
+	size_t stride = mtcr_get_stride(mtcr);
+	unsigned bpp = mtcr_get_bpp(mtcr);
+	size_t bytes = 0;
+
+	ASSERT(dmg != NULL);
+	ASSERT(dst != NULL);
+	ASSERT(src != NULL);
+
+	if (dmg->full) {
+		memcpy(dst, src, stride * mtcr->h);
+		return (stride * mtcr->h);
+	}
+	for (unsigned i = 0; i < dmg->n; i++) {
+		const mtcr_rect_t *r = &dmg->rects[i];
+		size_t off = r->y * stride + r->x * bpp;
+
+		for (unsigned y = 0; y < r->h; y++, off += stride)
+			memcpy(&dst[off], &src[off], r->w * bpp);
+		bytes += (size_t)r->w * r->h * bpp;
+	}
+	return (bytes);
+}
+
+static inline uint64_t
+tile_hash_word(uint64_t h, uint64_t v)
+{
+	h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+	return (h ^ (h >> 32));
+}
+
+/*
+ * Implements MTCR_DAMAGE_AUTO. Hashes the rendered surface in tiles of
+ * DAMAGE_TILE x DAMAGE_TILE pixels and marks tiles whose hash changed
+ * since the previous frame as damaged. Adjacent changed tiles in a row
+ * of tiles become a single rectangle.
+ */
+static void
+damage_auto(mt_cairo_render_t *mtcr, render_surf_t *rs)
+{
+	size_t stride = mtcr_get_stride(mtcr);
+	unsigned bpp = mtcr_get_bpp(mtcr);
+	const uint8_t *data;
+	uint64_t *row;
+
+	ASSERT(mtcr != NULL);
+	ASSERT(rs != NULL);
+
+	if (mtcr->tile_hash == NULL) {
+		mtcr->tiles_x = (mtcr->w + DAMAGE_TILE - 1) / DAMAGE_TILE;
+		mtcr->tiles_y = (mtcr->h + DAMAGE_TILE - 1) / DAMAGE_TILE;
+		/* The extra row is scratch space for the tile row in work */
+		mtcr->tile_hash = safe_calloc(mtcr->tiles_x *
+		    (mtcr->tiles_y + 1), sizeof (*mtcr->tile_hash));
+		mtcr->tile_hash_valid = B_FALSE;
+	}
+	row = &mtcr->tile_hash[mtcr->tiles_x * mtcr->tiles_y];
+	data = cairo_image_surface_get_data(rs->surf);
+
+	for (unsigned ty = 0; ty < mtcr->tiles_y; ty++) {
+		unsigned y1 = ty * DAMAGE_TILE;
+		unsigned y2 = MIN(y1 + DAMAGE_TILE, mtcr->h);
+		uint64_t *old = &mtcr->tile_hash[ty * mtcr->tiles_x];
+		int run = -1;
+
+		memset(row, 0, mtcr->tiles_x * sizeof (*row));
+		for (unsigned y = y1; y < y2; y++) {
+			const uint8_t *p = data + y * stride;
+
+			for (unsigned tx = 0; tx < mtcr->tiles_x; tx++) {
+				unsigned b = tx * DAMAGE_TILE * bpp;
+				unsigned e = MIN((tx + 1) * DAMAGE_TILE,
+				    mtcr->w) * bpp;
+				uint64_t h = row[tx];
+
+				for (; b + 8 <= e; b += 8) {
+					uint64_t v;
+					memcpy(&v, &p[b], sizeof (v));
+					h = tile_hash_word(h, v);
+				}
+				for (; b < e; b++)
+					h = tile_hash_word(h, p[b]);
+				row[tx] = h;
+			}
+		}
+		for (unsigned tx = 0; tx <= mtcr->tiles_x; tx++) {
+			bool_t changed = (tx < mtcr->tiles_x &&
+			    row[tx] != old[tx]);
+
+			if (changed && run == -1) {
+				run = tx;
+			} else if (!changed && run != -1) {
+				unsigned x1 = run * DAMAGE_TILE;
+
+				damage_add(&mtcr->frame_dmg, x1, y1,
+				    MIN(tx * DAMAGE_TILE, mtcr->w) - x1,
+				    y2 - y1);
+				run = -1;
+			}
+		}
+		memcpy(old, row, mtcr->tiles_x * sizeof (*row));
+	}
+	/* Nothing to compare against on the first frame */
+	if (!mtcr->tile_hash_valid) {
+		mtcr->frame_dmg.full = B_TRUE;
+		mtcr->tile_hash_valid = B_TRUE;
+	}
+}
+
+static void
+account_render_time(mt_cairo_render_t *mtcr, uint64_t start, uint64_t end)
+{
+	mtcr_stats_t *st;
+	uint64_t t = end - start;
+	unsigned bucket = 0;
+
+	ASSERT(mtcr != NULL);
+	ASSERT_MUTEX_HELD(&mtcr->lock);
+	st = &mtcr->stats;
+
+	st->frames++;
+	st->render_time_total += t;
+	st->render_time_max = MAX(st->render_time_max, t);
+	while (bucket + 1 < MTCR_STATS_HIST_BUCKETS &&
+	    t >= ((uint64_t)MTCR_STATS_HIST_BASE << bucket))
+		bucket++;
+	st->render_time_hist[bucket]++;
+	/*
+	 * A frame_target in the future means we were woken up early to
+	 * render a frame on request, which isn't a scheduled frame.
+	 */
+	if (mtcr->frame_target != 0 && start >= mtcr->frame_target) {
+		uint64_t late = start - mtcr->frame_target;
+
+		st->sched_frames++;
+		st->sched_late_total += late;
+		st->sched_late_max = MAX(st->sched_late_max, late);
+		if (mtcr->fps > 0 &&
+		    end > mtcr->frame_target + SEC2USEC(1.0 / mtcr->fps))
+			st->deadline_misses++;
+	}
+	mtcr->frame_target = 0;
+}
+
+/*
+ * Called when the data of all rendered frames has been uploaded.
+ */
+static void
+account_upload_done(mt_cairo_render_t *mtcr)
+{
+	mtcr_stats_t *st;
+
+	ASSERT(mtcr != NULL);
+	ASSERT_MUTEX_HELD(&mtcr->lock);
+	st = &mtcr->stats;
+
+	if (mtcr->ul_pending_t != 0) {
+		uint64_t t = microclock() - mtcr->ul_pending_t;
+
+		st->uploads++;
+		st->upload_latency_total += t;
+		st->upload_latency_max = MAX(st->upload_latency_max, t);
+		mtcr->ul_pending_t = 0;
+	}
+}
+
+static void
+account_upload(mt_cairo_render_t *mtcr, uint64_t bytes)
+{
+	uint64_t now = microclock();
+
+	ASSERT(mtcr != NULL);
+	ASSERT_MUTEX_HELD(&mtcr->lock);
+
+	mtcr->stats.upload_bytes += bytes;
+	mtcr->ul_bytes.win_bytes += bytes;
+	if (now - mtcr->ul_bytes.win_start >= SEC2USEC(1)) {
+		if (mtcr->ul_bytes.win_start != 0) {
+			mtcr->ul_bytes.rate = (mtcr->ul_bytes.win_bytes *
+			    1000000) / (now - mtcr->ul_bytes.win_start);
+		}
+		mtcr->ul_bytes.win_start = now;
+		mtcr->ul_bytes.win_bytes = 0;
+	}
+}
+
+/*
+ * Current upload rate, averaged over roughly the last second.
+ */
+static uint64_t
+upload_rate(const mt_cairo_render_t *mtcr)
+{
+	uint64_t win = microclock() - mtcr->ul_bytes.win_start;
+
+	ASSERT_MUTEX_HELD(&mtcr->lock);
+	if (mtcr->ul_bytes.win_start == 0)
+		return (0);
+	/* Nothing uploaded in a while, report the current window */
+	if (win >= SEC2USEC(2))
+		return ((mtcr->ul_bytes.win_bytes * 1000000) / win);
+	return (mtcr->ul_bytes.rate);
+}
+
+/*
+ * Runs the rendering callback on `rs' and adds the damage of the new
+ * frame to ul_dmg. Must be called with mtcr->lock held, but drops it
+ * while rendering. Returns B_FALSE if the frame is identical to the
+ * previous one and skip_unchanged is set, in which case the frame must
+ * not be presented.
+ */
+static bool_t
+render_frame(mt_cairo_render_t *mtcr, render_surf_t *rs)
+{
+	mtcr_damage_mode_t mode;
+	bool_t skip_unchanged, hash;
+	uint64_t start, end;
+
+	ASSERT(mtcr != NULL);
+	ASSERT(rs != NULL);
+	ASSERT_MUTEX_HELD(&mtcr->lock);
+
+	mode = mtcr->dmg_mode;
+	skip_unchanged = mtcr->skip_unchanged;
+	/*
+	 * In manual mode, the damage declared by the callback tells us
+	 * whether anything changed. Otherwise we need the tile hashes.
+	 */
+	hash = (mode == MTCR_DAMAGE_AUTO ||
+	    (mode == MTCR_DAMAGE_FULL && skip_unchanged));
+	mutex_exit(&mtcr->lock);
+
+	damage_clear(&mtcr->frame_dmg);
+	start = microclock();
+	mtcr->render_cb(rs->cr, mtcr->w, mtcr->h, mtcr->userinfo);
+	cairo_surface_flush(rs->surf);
+	end = microclock();
+	if (hash)
+		damage_auto(mtcr, rs);
+	else
+		mtcr->tile_hash_valid = B_FALSE;
+
+	mutex_enter(&mtcr->lock);
+	account_render_time(mtcr, start, end);
+	if (skip_unchanged && damage_is_empty(&mtcr->frame_dmg) &&
+	    mtcr->present_rs != -1) {
+		mtcr->stats.frames_skipped++;
+		/* Don't leave mt_cairo_render_once_wait() hanging */
+		if (mtcr->render_done_waiters != 0)
+			cv_broadcast(&mtcr->render_done_cv);
+		return (B_FALSE);
+	}
+	if (mode == MTCR_DAMAGE_FULL)
+		mtcr->ul_dmg.full = B_TRUE;
+	else
+		damage_merge(&mtcr->ul_dmg, &mtcr->frame_dmg);
+	if (mtcr->ul_pending_t == 0)
+		mtcr->ul_pending_t = end;
+
+	return (B_TRUE);
 }
 
 static void
@@ -305,17 +732,21 @@ worker_render_once(mt_cairo_render_t *mtcr)
 	ASSERT_MUTEX_HELD(&mtcr->lock);
 
 	if (mtcr->coherent_data != NULL) {
-		size_t sz = mtcr_get_surf_sz(mtcr);
-
 		rs = &mtcr->rs[0];
-		mutex_exit(&mtcr->lock);
-
-		mtcr->render_cb(rs->cr, mtcr->w, mtcr->h, mtcr->userinfo);
-		cairo_surface_flush(rs->surf);
-
-		mutex_enter(&mtcr->lock);
-		memcpy(mtcr->coherent_data,
-		    cairo_image_surface_get_data(rs->surf), sz);
+		if (!render_frame(mtcr, rs))
+			return;
+		/*
+		 * The coherent buffer is persistent, so once it holds a
+		 * complete frame, we only need to refresh what changed.
+		 */
+		if (!mtcr->tex_valid)
+			mtcr->ul_dmg.full = B_TRUE;
+		account_upload(mtcr, damage_copy(mtcr, &mtcr->ul_dmg,
+		    mtcr->coherent_data, cairo_image_surface_get_data(
+		    rs->surf)));
+		damage_merge(&mtcr->tex_dmg, &mtcr->ul_dmg);
+		damage_clear(&mtcr->ul_dmg);
+		account_upload_done(mtcr);
 		mtcr->dirty = B_TRUE;
 		mtcr->texed = B_FALSE;
 		mtcr->present_rs = mtcr->render_rs;
@@ -324,12 +755,13 @@ worker_render_once(mt_cairo_render_t *mtcr)
 		ASSERT3S(mtcr->render_rs, >=, 0);
 		ASSERT3S(mtcr->render_rs, <, ARRAY_NUM_ELEM(mtcr->rs));
 		rs = &mtcr->rs[mtcr->render_rs];
-		mutex_exit(&mtcr->lock);
-
-		mtcr->render_cb(rs->cr, mtcr->w, mtcr->h, mtcr->userinfo);
-		cairo_surface_flush(rs->surf);
-
-		mutex_enter(&mtcr->lock);
+		/*
+		 * A skipped frame is identical to the one being presented,
+		 * so we can simply render the next frame into the same
+		 * surface again.
+		 */
+		if (!render_frame(mtcr, rs))
+			return;
 		mtcr->dirty = B_TRUE;
 
 		mtul = mtcr->mtul;
@@ -370,7 +802,6 @@ worker(void *arg)
 	thread_set_name(name);
 
 	mutex_enter(&mtcr->lock);
-	mtcr->render_rs = 0;
 	/*
 	 * Render the first frame immediately to make sure we have something
 	 * to show ASAP.
@@ -390,6 +821,7 @@ worker(void *arg)
 					next_time = recalc_sleep_time(mtcr);
 				}
 				cv_timedwait(&mtcr->cv, &mtcr->lock, next_time);
+				mtcr->frame_target = next_time;
 				/*
 				 * Recalc the next frame time now to maintain
 				 * near as possible constant framerate that
@@ -408,6 +840,198 @@ worker(void *arg)
 	mutex_exit(&mtcr->lock);
 }
 
+static int
+pool_sched_compar(const void *a, const void *b)
+{
+	const mt_cairo_render_t *ma = a, *mb = b;
+
+	if (ma->pool_next < mb->pool_next)
+		return (-1);
+	if (ma->pool_next > mb->pool_next)
+		return (1);
+	if (ma->pool_seq < mb->pool_seq)
+		return (-1);
+	if (ma->pool_seq > mb->pool_seq)
+		return (1);
+	return (0);
+}
+
+/*
+ * (Re)schedules a renderer to be rendered by the pool at `next'. Renderers
+ * with equal deadlines are served in the order they were scheduled in, so
+ * an overloaded pool degrades into round-robin, rather than starving some
+ * renderers.
+ */
+static void
+pool_sched(mt_cairo_render_pool_t *pool, mt_cairo_render_t *mtcr,
+    uint64_t next)
+{
+	ASSERT(pool != NULL);
+	ASSERT(mtcr != NULL);
+	ASSERT_MUTEX_HELD(&pool->lock);
+	ASSERT(mtcr->pool_active);
+	ASSERT(!mtcr->pool_busy);
+
+	if (mtcr->pool_queued)
+		avl_remove(&pool->sched, mtcr);
+	mtcr->pool_next = next;
+	mtcr->pool_seq = pool->seq++;
+	avl_add(&pool->sched, mtcr);
+	mtcr->pool_queued = B_TRUE;
+	/* Sleeping threads might need to wake up earlier now */
+	if (avl_first(&pool->sched) == mtcr)
+		cv_broadcast(&pool->cv);
+}
+
+/*
+ * Requests an immediate frame from a pool-driven renderer. This is the
+ * pool equivalent of signalling mtcr->cv for a dedicated worker thread.
+ */
+static void
+pool_kick(mt_cairo_render_t *mtcr)
+{
+	mt_cairo_render_pool_t *pool;
+
+	ASSERT(mtcr != NULL);
+	ASSERT_MUTEX_HELD(&mtcr->lock);
+	pool = mtcr->pool;
+	ASSERT(pool != NULL);
+
+	mutex_enter(&pool->lock);
+	if (mtcr->pool_busy)
+		mtcr->pool_req = B_TRUE;
+	else if (mtcr->pool_active)
+		pool_sched(pool, mtcr, microclock());
+	mutex_exit(&pool->lock);
+}
+
+/*
+ * Shared render pool thread. Picks the renderer with the earliest deadline
+ * and renders a frame of it. The next deadline is computed from the time
+ * the frame was started, so the framerate isn't affected by render time,
+ * same as in worker().
+ */
+static void
+pool_worker(void *arg)
+{
+	mt_cairo_render_pool_t *pool;
+
+	ASSERT(arg != NULL);
+	pool = arg;
+	thread_set_name("mtcr_pool");
+
+	mutex_enter(&pool->lock);
+	while (!pool->shutdown) {
+		mt_cairo_render_t *mtcr = avl_first(&pool->sched);
+		uint64_t now = microclock(), next = 0, target;
+
+		if (mtcr == NULL) {
+			cv_wait(&pool->cv, &pool->lock);
+			continue;
+		}
+		if (mtcr->pool_next > now) {
+			cv_timedwait(&pool->cv, &pool->lock, mtcr->pool_next);
+			continue;
+		}
+		avl_remove(&pool->sched, mtcr);
+		target = mtcr->pool_next;
+		mtcr->pool_queued = B_FALSE;
+		mtcr->pool_busy = B_TRUE;
+		mtcr->pool_req = B_FALSE;
+		mutex_exit(&pool->lock);
+
+		mutex_enter(&mtcr->lock);
+		ASSERT(mtcr->render_cb != NULL);
+		mtcr->frame_target = target;
+		worker_render_once(mtcr);
+		if (mtcr->fps > 0)
+			next = now + SEC2USEC(1.0 / mtcr->fps);
+		mutex_exit(&mtcr->lock);
+
+		mutex_enter(&pool->lock);
+		mtcr->pool_busy = B_FALSE;
+		if (mtcr->pool_active) {
+			if (mtcr->pool_req)
+				pool_sched(pool, mtcr, microclock());
+			else if (next != 0)
+				pool_sched(pool, mtcr, next);
+		}
+		cv_broadcast(&pool->cv_done);
+	}
+	mutex_exit(&pool->lock);
+}
+
+/*
+ * Starts background rendering, either on a dedicated worker thread, or
+ * using the shared render pool the renderer was attached to.
+ */
+static void
+worker_start(mt_cairo_render_t *mtcr)
+{
+	mt_cairo_render_pool_t *pool;
+
+	ASSERT(mtcr != NULL);
+	ASSERT(!mtcr->started);
+	ASSERT(!mtcr->fg_mode);
+
+	mutex_enter(&mtcr->lock);
+	mtcr->shutdown = B_FALSE;
+	if (mtcr->render_rs == -1)
+		mtcr->render_rs = 0;
+	pool = mtcr->pool;
+	if (pool != NULL) {
+		mutex_enter(&pool->lock);
+		mtcr->pool_active = B_TRUE;
+		/*
+		 * Render the first frame immediately to make sure we have
+		 * something to show ASAP.
+		 */
+		if (mtcr->fps > 0)
+			pool_sched(pool, mtcr, microclock());
+		mutex_exit(&pool->lock);
+	}
+	mutex_exit(&mtcr->lock);
+
+	if (pool == NULL)
+		VERIFY(thread_create(&mtcr->thr, worker, mtcr));
+	mtcr->started = B_TRUE;
+}
+
+/*
+ * Stops background rendering started by worker_start(). After this
+ * returns, no frame is being rendered in the background.
+ */
+static void
+worker_stop(mt_cairo_render_t *mtcr)
+{
+	mt_cairo_render_pool_t *pool;
+
+	ASSERT(mtcr != NULL);
+
+	if (!mtcr->started)
+		return;
+	pool = mtcr->pool;
+	if (pool != NULL) {
+		mutex_enter(&pool->lock);
+		mtcr->pool_active = B_FALSE;
+		if (mtcr->pool_queued) {
+			avl_remove(&pool->sched, mtcr);
+			mtcr->pool_queued = B_FALSE;
+		}
+		while (mtcr->pool_busy)
+			cv_wait(&pool->cv_done, &pool->lock);
+		mtcr->pool_req = B_FALSE;
+		mutex_exit(&pool->lock);
+	} else {
+		mutex_enter(&mtcr->lock);
+		mtcr->shutdown = B_TRUE;
+		cv_broadcast(&mtcr->cv);
+		mutex_exit(&mtcr->lock);
+		thread_join(&mtcr->thr);
+	}
+	mtcr->started = B_FALSE;
+}
+
 /**
  * Performs global initialization of the mt_cairo_render backend logic.
  * @param want_coherent_mem If set to `B_TRUE`, this enables the use of
@@ -444,6 +1068,9 @@ mt_cairo_render_glob_init(bool_t want_coherent_mem)
 	 */
 	coherent = ((want_coherent_mem || glutils_in_zink_mode()) &&
 	    GLEW_ARB_buffer_storage);
+	mutex_init(&registry.lock);
+	list_create(&registry.list, sizeof (mt_cairo_render_t),
+	    offsetof(mt_cairo_render_t, registry_node));
 	glob_inited = B_TRUE;
 }
 
@@ -516,6 +1143,10 @@ mtcr_gl_init(mt_cairo_render_t *mtcr)
 	    mtcr->init_filename, mtcr->init_line, gl_fmt,
 	    GL_UNSIGNED_BYTE, mtcr->w, mtcr->h));
 	mtcr->texed = B_FALSE;
+	mtcr->tex_valid = B_FALSE;
+	damage_clear(&mtcr->ul_dmg);
+	damage_clear(&mtcr->tex_dmg);
+	mtcr->tile_hash_valid = B_FALSE;
 }
 
 /*
@@ -644,8 +1275,14 @@ mt_cairo_render_init_impl(const char *filename, int line,
 		mtcr->create_ctx = glctx_get_current();
 	mtcr->use_ffp = check_use_ffp(mtcr);
 
-	VERIFY(thread_create(&mtcr->thr, worker, mtcr));
-	mtcr->started = B_TRUE;
+	worker_start(mtcr);
+
+	if (registry.enabled) {
+		mutex_enter(&registry.lock);
+		list_insert_tail(&registry.list, mtcr);
+		mutex_exit(&registry.lock);
+		mtcr->registered = B_TRUE;
+	}
 
 	return (mtcr);
 }
@@ -657,12 +1294,18 @@ mt_cairo_render_init_impl(const char *filename, int line,
 void
 mt_cairo_render_fini(mt_cairo_render_t *mtcr)
 {
-	if (mtcr->started) {
-		mutex_enter(&mtcr->lock);
-		mtcr->shutdown = B_TRUE;
-		cv_broadcast(&mtcr->cv);
-		mutex_exit(&mtcr->lock);
-		thread_join(&mtcr->thr);
+	if (mtcr->registered) {
+		mutex_enter(&registry.lock);
+		list_remove(&registry.list, mtcr);
+		mutex_exit(&registry.lock);
+	}
+
+	worker_stop(mtcr);
+	if (mtcr->pool != NULL) {
+		mutex_enter(&mtcr->pool->lock);
+		ASSERT(mtcr->pool->refcnt != 0);
+		mtcr->pool->refcnt--;
+		mutex_exit(&mtcr->pool->lock);
 	}
 	if (mtcr->mtul != NULL) {
 		mutex_enter(&mtcr->mtul->lock);
@@ -677,6 +1320,7 @@ mt_cairo_render_fini(mt_cairo_render_t *mtcr)
 	mtcr_gl_fini(mtcr);
 
 	free(mtcr->init_filename);
+	free(mtcr->tile_hash);
 
 	mutex_destroy(&mtcr->lock);
 	cv_destroy(&mtcr->cv);
@@ -698,7 +1342,10 @@ mt_cairo_render_set_fps(mt_cairo_render_t *mtcr, double fps)
 		ASSERT(!mtcr->fg_mode);
 		mutex_enter(&mtcr->lock);
 		mtcr->fps = fps;
-		cv_broadcast(&mtcr->cv);
+		if (mtcr->pool != NULL)
+			pool_kick(mtcr);
+		else
+			cv_broadcast(&mtcr->cv);
 		mutex_exit(&mtcr->lock);
 	}
 }
@@ -737,16 +1384,11 @@ mt_cairo_render_enable_fg_mode(mt_cairo_render_t *mtcr)
 	ASSERT(mtcr != NULL);
 	ASSERT3F(mtcr->fps, ==, 0);
 	ASSERT(mtcr->started);
+	ASSERT3P(mtcr->pool, ==, NULL);
 
 	if (!mtcr->fg_mode) {
-		mutex_enter(&mtcr->lock);
-		mtcr->shutdown = B_TRUE;
-		cv_broadcast(&mtcr->cv);
-		mutex_exit(&mtcr->lock);
-		thread_join(&mtcr->thr);
-
+		worker_stop(mtcr);
 		mtcr->fg_mode = B_TRUE;
-		mtcr->started = B_FALSE;
 	}
 }
 
@@ -909,13 +1551,7 @@ mt_cairo_render_set_monochrome(mt_cairo_render_t *mtcr, vect3_t color)
 	/*
 	 * Stop the worker thread.
 	 */
-	if (mtcr->started) {
-		mutex_enter(&mtcr->lock);
-		mtcr->shutdown = B_TRUE;
-		cv_broadcast(&mtcr->cv);
-		mutex_exit(&mtcr->lock);
-		thread_join(&mtcr->thr);
-	}
+	worker_stop(mtcr);
 	for (size_t i = 0; i < ARRAY_NUM_ELEM(mtcr->rs); i++)
 		cr_destroy(mtcr, &mtcr->rs[i]);
 	mtcr_gl_fini(mtcr);
@@ -937,11 +1573,8 @@ mt_cairo_render_set_monochrome(mt_cairo_render_t *mtcr, vect3_t color)
 	/*
 	 * Restart the worker if not in FG mode.
 	 */
-	if (!mtcr->fg_mode) {
-		mtcr->shutdown = B_FALSE;
-		VERIFY(thread_create(&mtcr->thr, worker, mtcr));
-		mtcr->started = B_TRUE;
-	}
+	if (!mtcr->fg_mode)
+		worker_start(mtcr);
 }
 
 /**
@@ -977,7 +1610,10 @@ mt_cairo_render_once(mt_cairo_render_t *mtcr)
 	ASSERT(mtcr != NULL);
 	ASSERT0(mtcr->fg_mode);
 	mutex_enter(&mtcr->lock);
-	cv_broadcast(&mtcr->cv);
+	if (mtcr->pool != NULL)
+		pool_kick(mtcr);
+	else
+		cv_broadcast(&mtcr->cv);
 	mutex_exit(&mtcr->lock);
 }
 
@@ -1002,11 +1638,20 @@ mt_cairo_render_once_wait(mt_cairo_render_t *mtcr)
 			mtcr->render_rs = 0;
 		worker_render_once(mtcr);
 		mutex_exit(&mtcr->lock);
+	} else if (mtcr->pool != NULL) {
+		mutex_enter(&mtcr->lock);
+		pool_kick(mtcr);
+		mtcr->render_done_waiters++;
+		cv_wait(&mtcr->render_done_cv, &mtcr->lock);
+		mtcr->render_done_waiters--;
+		mutex_exit(&mtcr->lock);
 	} else {
 		mutex_enter(&mtcr->lock);
 		mtcr->one_shot_block = B_TRUE;
 		cv_broadcast(&mtcr->cv);
+		mtcr->render_done_waiters++;
 		cv_wait(&mtcr->render_done_cv, &mtcr->lock);
+		mtcr->render_done_waiters--;
 		mtcr->one_shot_block = B_FALSE;
 		mutex_exit(&mtcr->lock);
 	}
@@ -1031,7 +1676,10 @@ mtcr_gl_formats(const mt_cairo_render_t *mtcr, GLint *intfmt, GLint *format)
 /*
  * Uploads a finished cairo surface render to the provided texture & PBO.
  * The upload is normally done async via the PBO, but if that fails, the
- * upload is performed synchronously.
+ * upload is performed synchronously. Only the damaged parts of the surface
+ * are copied. Since the PBO is orphaned on every upload, it must receive
+ * all damage which hasn't been applied to the texture yet, not just the
+ * damage of the latest frame.
  */
 static void
 rs_upload(mt_cairo_render_t *mtcr, render_surf_t *rs)
@@ -1047,6 +1695,14 @@ rs_upload(mt_cairo_render_t *mtcr, render_surf_t *rs)
 	ASSERT(rs->surf != NULL);
 	ASSERT(mtcr->tex != 0);
 	ASSERT(mtcr->pbo != 0);
+	ASSERT_MUTEX_HELD(&mtcr->lock);
+
+	damage_merge(&mtcr->tex_dmg, &mtcr->ul_dmg);
+	damage_clear(&mtcr->ul_dmg);
+	if (!mtcr->tex_valid)
+		mtcr->tex_dmg.full = B_TRUE;
+	if (damage_is_empty(&mtcr->tex_dmg))
+		return;
 
 	sz = mtcr_get_surf_sz(mtcr);
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mtcr->pbo);
@@ -1055,7 +1711,8 @@ rs_upload(mt_cairo_render_t *mtcr, render_surf_t *rs)
 	src = cairo_image_surface_get_data(rs->surf);
 	dest = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
 	if (dest != NULL) {
-		memcpy(dest, src, sz);
+		account_upload(mtcr, damage_copy(mtcr, &mtcr->tex_dmg,
+		    dest, src));
 		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
 		/*
 		 * We MUSTN'T call glTexImage2D yet, because if we're running
@@ -1078,6 +1735,9 @@ rs_upload(mt_cairo_render_t *mtcr, render_surf_t *rs)
 		glTexImage2D(GL_TEXTURE_2D, 0, intfmt, mtcr->w, mtcr->h, 0,
 		    format, GL_UNSIGNED_BYTE, src);
 		mtcr->texed = B_TRUE;
+		mtcr->tex_valid = B_TRUE;
+		damage_clear(&mtcr->tex_dmg);
+		account_upload(mtcr, sz);
 		glBindTexture(GL_TEXTURE_2D, 0);
 	}
 	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
@@ -1107,9 +1767,27 @@ mtcr_tex_apply(mt_cairo_render_t *mtcr, bool_t bind)
 		glBindTexture(GL_TEXTURE_2D, mtcr->tex);
 		ASSERT(mtcr->pbo != 0);
 		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, mtcr->pbo);
-		glTexImage2D(GL_TEXTURE_2D, 0, intfmt, mtcr->w, mtcr->h, 0,
-		    format, GL_UNSIGNED_BYTE, NULL);
+		if (mtcr->tex_dmg.full || !mtcr->tex_valid) {
+			glTexImage2D(GL_TEXTURE_2D, 0, intfmt, mtcr->w,
+			    mtcr->h, 0, format, GL_UNSIGNED_BYTE, NULL);
+		} else if (mtcr->tex_dmg.n != 0) {
+			size_t stride = mtcr_get_stride(mtcr);
+			unsigned bpp = mtcr_get_bpp(mtcr);
+
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, stride / bpp);
+			for (unsigned i = 0; i < mtcr->tex_dmg.n; i++) {
+				const mtcr_rect_t *r = &mtcr->tex_dmg.rects[i];
+
+				glTexSubImage2D(GL_TEXTURE_2D, 0, r->x, r->y,
+				    r->w, r->h, format, GL_UNSIGNED_BYTE,
+				    (void *)(uintptr_t)(r->y * stride +
+				    r->x * bpp));
+			}
+			glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		}
 		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		damage_clear(&mtcr->tex_dmg);
+		mtcr->tex_valid = B_TRUE;
 		mtcr->texed = B_TRUE;
 		if (!bind)
 			glBindTexture(GL_TEXTURE_2D, 0);
@@ -1139,6 +1817,7 @@ bind_cur_tex(mt_cairo_render_t *mtcr)
 	if (mtcr->dirty && mtcr->mtul == NULL) {
 		rs_upload(mtcr, &mtcr->rs[mtcr->present_rs]);
 		mtcr->dirty = B_FALSE;
+		account_upload_done(mtcr);
 	}
 	/* NOW we can safely update the texture */
 	mtcr_tex_apply(mtcr, B_TRUE);
@@ -1469,6 +2148,62 @@ mt_cairo_render_get_uploader(mt_cairo_render_t *mtcr)
 	return (mtul);
 }
 
+/**
+ * Configures the mt_cairo_render_t instance to be driven by a shared
+ * render pool, instead of its own worker thread. See
+ * mt_cairo_render_pool_init() for more information.
+ *
+ * @param mtcr Renderer to attach to the pool.
+ * @param pool Pool to attach the renderer to. If you pass NULL here,
+ *	the renderer goes back to using its own worker thread.
+ * @note Renderers in foreground mode (see mt_cairo_render_enable_fg_mode())
+ *	cannot be attached to a pool.
+ */
+void
+mt_cairo_render_set_pool(mt_cairo_render_t *mtcr,
+    mt_cairo_render_pool_t *pool)
+{
+	ASSERT(mtcr != NULL);
+	ASSERT0(mtcr->fg_mode);
+
+	if (pool == mtcr->pool)
+		return;
+	worker_stop(mtcr);
+	if (mtcr->pool != NULL) {
+		mutex_enter(&mtcr->pool->lock);
+		ASSERT(mtcr->pool->refcnt != 0);
+		mtcr->pool->refcnt--;
+		mutex_exit(&mtcr->pool->lock);
+	}
+	if (pool != NULL) {
+		mutex_enter(&pool->lock);
+		pool->refcnt++;
+		mutex_exit(&pool->lock);
+	}
+	mutex_enter(&mtcr->lock);
+	mtcr->pool = pool;
+	mutex_exit(&mtcr->lock);
+	worker_start(mtcr);
+}
+
+/**
+ * Returns the shared render pool driving an mt_cairo_render_t, or NULL
+ * if the renderer uses its own worker thread.
+ */
+mt_cairo_render_pool_t *
+mt_cairo_render_get_pool(mt_cairo_render_t *mtcr)
+{
+	mt_cairo_render_pool_t *pool;
+
+	ASSERT(mtcr != NULL);
+
+	mutex_enter(&mtcr->lock);
+	pool = mtcr->pool;
+	mutex_exit(&mtcr->lock);
+
+	return (pool);
+}
+
 /**
  * @return The OpenGL texture object of the surface that has currently
  * completed rendering. If no surface is ready yet, returns 0 instead.
@@ -1483,8 +2218,9 @@ mt_cairo_render_get_tex(mt_cairo_render_t *mtcr)
 	if (mtcr->present_rs != -1) {
 		/* Upload & apply the texture if it has changed */
 		if (mtcr->dirty && mtcr->mtul == NULL) {
-			rs_upload(mtcr, &mtcr->rs[!mtcr->present_rs]);
+			rs_upload(mtcr, &mtcr->rs[mtcr->present_rs]);
 			mtcr->dirty = B_FALSE;
+			account_upload_done(mtcr);
 		}
 		mtcr_tex_apply(mtcr, B_FALSE);
 		tex = mtcr->tex;
@@ -1520,6 +2256,309 @@ mt_cairo_render_get_height(mt_cairo_render_t *mtcr)
 	return (mtcr->h);
 }
 
+/**
+ * Sets how the renderer determines which parts of the surface need to be
+ * uploaded to the GPU after a frame has been rendered.
+ * @param mode One of:
+ *	- `MTCR_DAMAGE_FULL`: the whole surface is uploaded after every
+ *	  frame. This is the default.
+ *	- `MTCR_DAMAGE_MANUAL`: the rendering callback declares which parts
+ *	  of the surface it has changed compared to the previous frame by
+ *	  calling mt_cairo_render_add_damage(). Only those parts are
+ *	  uploaded. If the callback doesn't declare any damage, nothing
+ *	  is uploaded.
+ *	- `MTCR_DAMAGE_AUTO`: after every frame, the surface is compared to
+ *	  the previous frame in tiles of 64x64 pixels and only the changed
+ *	  tiles are uploaded. This costs a read of the whole surface, which
+ *	  is much cheaper than uploading it, so this is a good choice for
+ *	  displays which only change small parts of the image per frame.
+ */
+void
+mt_cairo_render_set_damage_mode(mt_cairo_render_t *mtcr,
+    mtcr_damage_mode_t mode)
+{
+	ASSERT(mtcr != NULL);
+	ASSERT3U(mode, <=, MTCR_DAMAGE_AUTO);
+
+	mutex_enter(&mtcr->lock);
+	if (mtcr->dmg_mode != mode) {
+		mtcr->dmg_mode = mode;
+		/* Resync, in case we're switching mid-frame */
+		mtcr->ul_dmg.full = B_TRUE;
+	}
+	mutex_exit(&mtcr->lock);
+}
+
+/**
+ * @return The damage tracking mode of the renderer.
+ * @see mt_cairo_render_set_damage_mode()
+ */
+mtcr_damage_mode_t
+mt_cairo_render_get_damage_mode(mt_cairo_render_t *mtcr)
+{
+	mtcr_damage_mode_t mode;
+
+	ASSERT(mtcr != NULL);
+
+	mutex_enter(&mtcr->lock);
+	mode = mtcr->dmg_mode;
+	mutex_exit(&mtcr->lock);
+
+	return (mode);
+}
+
+/**
+ * Declares a rectangle of the surface as changed in the frame being
+ * rendered. This is only used in `MTCR_DAMAGE_MANUAL` mode (see
+ * mt_cairo_render_set_damage_mode()) and must ONLY be called from the
+ * rendering callback. The rectangle is in surface pixel coordinates and
+ * is clipped to the surface. Fractional coordinates are rounded outward.
+ * @note The renderer is double-buffered, so the surface passed to the
+ *	rendering callback generally doesn't contain the previous frame.
+ *	Unless you redraw the whole surface every frame, you will need to
+ *	keep track of the contents of both buffers yourself.
+ */
+void
+mt_cairo_render_add_damage(mt_cairo_render_t *mtcr, double x, double y,
+    double w, double h)
+{
+	double x1, y1, x2, y2;
+
+	ASSERT(mtcr != NULL);
+
+	x1 = clamp(floor(x), 0, mtcr->w);
+	y1 = clamp(floor(y), 0, mtcr->h);
+	x2 = clamp(ceil(x + w), 0, mtcr->w);
+	y2 = clamp(ceil(y + h), 0, mtcr->h);
+	if (x2 > x1 && y2 > y1)
+		damage_add(&mtcr->frame_dmg, x1, y1, x2 - x1, y2 - y1);
+}
+
+/**
+ * Enables or disables skipping of unchanged frames. When enabled, every
+ * newly rendered frame is compared to the previous one and if they are
+ * identical, the frame is dropped: it isn't uploaded to the GPU, the
+ * surfaces aren't swapped and threads waiting for a new frame aren't
+ * woken up (except for callers of mt_cairo_render_once_wait()). This
+ * saves a lot of work on displays which mostly show static content.
+ *
+ * How frames are compared depends on the damage tracking mode (see
+ * mt_cairo_render_set_damage_mode()). In `MTCR_DAMAGE_MANUAL` mode, a
+ * frame is unchanged if the rendering callback hasn't declared any
+ * damage. In the other modes, the frame is compared to the previous
+ * one in tiles, as in `MTCR_DAMAGE_AUTO` mode. The default is disabled.
+ */
+void
+mt_cairo_render_set_skip_unchanged(mt_cairo_render_t *mtcr, bool_t flag)
+{
+	ASSERT(mtcr != NULL);
+
+	mutex_enter(&mtcr->lock);
+	mtcr->skip_unchanged = flag;
+	mutex_exit(&mtcr->lock);
+}
+
+/**
+ * @return `B_TRUE` if the renderer skips unchanged frames.
+ * @see mt_cairo_render_set_skip_unchanged()
+ */
+bool_t
+mt_cairo_render_get_skip_unchanged(mt_cairo_render_t *mtcr)
+{
+	bool_t flag;
+
+	ASSERT(mtcr != NULL);
+
+	mutex_enter(&mtcr->lock);
+	flag = mtcr->skip_unchanged;
+	mutex_exit(&mtcr->lock);
+
+	return (flag);
+}
+
+/**
+ * Retrieves how many frames the renderer has rendered and presented and
+ * how many it has skipped, because they were identical to the previous
+ * frame (see mt_cairo_render_set_skip_unchanged()). All output arguments
+ * are optional.
+ */
+void
+mt_cairo_render_get_frame_counts(mt_cairo_render_t *mtcr,
+    uint64_t *rendered, uint64_t *skipped)
+{
+	ASSERT(mtcr != NULL);
+
+	mutex_enter(&mtcr->lock);
+	if (rendered != NULL) {
+		*rendered = mtcr->stats.frames -
+		    mtcr->stats.frames_skipped;
+	}
+	if (skipped != NULL)
+		*skipped = mtcr->stats.frames_skipped;
+	mutex_exit(&mtcr->lock);
+}
+
+/**
+ * Retrieves how much surface data the renderer has uploaded to the GPU.
+ * All output arguments are optional.
+ * @param total_bytes Total number of bytes uploaded since the renderer
+ *	was created.
+ * @param bytes_per_sec Upload rate in bytes per second, averaged over
+ *	roughly the last second.
+ */
+void
+mt_cairo_render_get_upload_stats(mt_cairo_render_t *mtcr,
+    uint64_t *total_bytes, uint64_t *bytes_per_sec)
+{
+	ASSERT(mtcr != NULL);
+
+	mutex_enter(&mtcr->lock);
+	if (total_bytes != NULL)
+		*total_bytes = mtcr->stats.upload_bytes;
+	if (bytes_per_sec != NULL)
+		*bytes_per_sec = upload_rate(mtcr);
+	mutex_exit(&mtcr->lock);
+}
+
+/**
+ * Retrieves how much time the renderer has spent in its rendering
+ * callback since it was created. All output arguments are optional.
+ * @param frames Number of frames rendered.
+ * @param total_us Total time spent rendering in microseconds. Divide
+ *	this by `frames` to get the average render time of a frame.
+ * @param max_us Render time of the slowest frame in microseconds.
+ */
+void
+mt_cairo_render_get_render_time(mt_cairo_render_t *mtcr, uint64_t *frames,
+    uint64_t *total_us, uint64_t *max_us)
+{
+	ASSERT(mtcr != NULL);
+
+	mutex_enter(&mtcr->lock);
+	if (frames != NULL)
+		*frames = mtcr->stats.frames;
+	if (total_us != NULL)
+		*total_us = mtcr->stats.render_time_total;
+	if (max_us != NULL)
+		*max_us = mtcr->stats.render_time_max;
+	mutex_exit(&mtcr->lock);
+}
+
+/**
+ * Retrieves a snapshot of the renderer's performance statistics.
+ * @see mtcr_stats_t
+ * @see mt_cairo_render_reset_stats()
+ */
+void
+mt_cairo_render_get_stats(mt_cairo_render_t *mtcr, mtcr_stats_t *stats)
+{
+	ASSERT(mtcr != NULL);
+	ASSERT(stats != NULL);
+
+	mutex_enter(&mtcr->lock);
+	*stats = mtcr->stats;
+	stats->upload_bytes_per_sec = upload_rate(mtcr);
+	mutex_exit(&mtcr->lock);
+}
+
+/**
+ * Zeroes all performance statistics of the renderer, including the
+ * counters returned by mt_cairo_render_get_render_time(),
+ * mt_cairo_render_get_frame_counts() and
+ * mt_cairo_render_get_upload_stats().
+ */
+void
+mt_cairo_render_reset_stats(mt_cairo_render_t *mtcr)
+{
+	ASSERT(mtcr != NULL);
+
+	mutex_enter(&mtcr->lock);
+	memset(&mtcr->stats, 0, sizeof (mtcr->stats));
+	memset(&mtcr->ul_bytes, 0, sizeof (mtcr->ul_bytes));
+	mutex_exit(&mtcr->lock);
+}
+
+/**
+ * Enables or disables the global renderer registry used by
+ * mt_cairo_render_enum() and mt_cairo_render_dump_stats(). The registry
+ * is disabled by default, so renderers don't have to take a global lock
+ * on creation and destruction unless somebody wants to enumerate them.
+ * Per-renderer statistics (mt_cairo_render_get_stats()) are always
+ * collected and don't depend on this setting.
+ * @note This only affects renderers created after the call. Renderers
+ *	which were already registered stay on the registry until they
+ *	are destroyed, while renderers created while the registry was
+ *	disabled are never enumerated. Call this from the main thread
+ *	after mt_cairo_render_glob_init() and before creating any
+ *	renderers you want to enumerate.
+ */
+void
+mt_cairo_render_set_registry_enabled(bool_t flag)
+{
+	ASSERT(glob_inited);
+	registry.enabled = flag;
+}
+
+/**
+ * Calls `cb` for every live mt_cairo_render_t instance created while
+ * the registry was enabled (see mt_cairo_render_set_registry_enabled()).
+ * The callback must not create or destroy renderers, but may call any
+ * other function on the renderer it is passed (e.g.
+ * mt_cairo_render_get_stats()).
+ */
+void
+mt_cairo_render_enum(mt_cairo_render_enum_cb_t cb, void *userinfo)
+{
+	ASSERT(cb != NULL);
+
+	if (!glob_inited)
+		return;
+	mutex_enter(&registry.lock);
+	for (mt_cairo_render_t *mtcr = list_head(&registry.list); mtcr != NULL;
+	    mtcr = list_next(&registry.list, mtcr)) {
+		cb(mtcr, mtcr->init_filename, mtcr->init_line, userinfo);
+	}
+	mutex_exit(&registry.lock);
+}
+
+static void
+dump_stats_cb(mt_cairo_render_t *mtcr, const char *filename, int line,
+    void *userinfo)
+{
+	mtcr_stats_t st;
+
+	LACF_UNUSED(userinfo);
+
+	mt_cairo_render_get_stats(mtcr, &st);
+	logMsg("mtcr %p (%s:%d): %dx%d @ %.1f fps; frames: %llu "
+	    "(%llu skipped); render avg/max: %.2f/%.2f ms; late avg/max: "
+	    "%.2f/%.2f ms, %llu missed; upload avg/max: %.2f/%.2f ms, "
+	    "%.1f kB/s", mtcr, filename, line, mtcr->w, mtcr->h, mtcr->fps,
+	    (unsigned long long)st.frames,
+	    (unsigned long long)st.frames_skipped,
+	    st.frames != 0 ? st.render_time_total / (st.frames * 1000.0) : 0,
+	    st.render_time_max / 1000.0,
+	    st.sched_frames != 0 ?
+	    st.sched_late_total / (st.sched_frames * 1000.0) : 0,
+	    st.sched_late_max / 1000.0,
+	    (unsigned long long)st.deadline_misses,
+	    st.uploads != 0 ?
+	    st.upload_latency_total / (st.uploads * 1000.0) : 0,
+	    st.upload_latency_max / 1000.0,
+	    st.upload_bytes_per_sec / 1024.0);
+}
+
+/**
+ * Logs the performance statistics of all live mt_cairo_render_t
+ * instances on the registry using logMsg(), one line per renderer.
+ * @see mt_cairo_render_set_registry_enabled()
+ */
+void
+mt_cairo_render_dump_stats(void)
+{
+	mt_cairo_render_enum(dump_stats_cb, NULL);
+}
+
 void
 mt_cairo_render_blit_back2front(mt_cairo_render_t *mtcr,
     const mtcr_rect_t *rects, size_t num)
@@ -1600,6 +2639,7 @@ mtul_try_complete_ul(mt_cairo_render_t *mtcr, list_t *ul_inprog_list)
 	mtcr->dirty = B_FALSE;
 	mtcr->texed = B_FALSE;
 	mtcr->present_rs = mtcr->render_rs;
+	account_upload_done(mtcr);
 	cv_broadcast(&mtcr->render_done_cv);
 	mutex_exit(&mtcr->lock);
 
@@ -1814,3 +2854,89 @@ mt_cairo_uploader_fini(mt_cairo_uploader_t *mtul)
 	memset(mtul, 0, sizeof (*mtul));
 	ZERO_FREE(mtul);
 }
+
+/**
+ * Creates a shared render pool. Normally, every mt_cairo_render_t runs
+ * its own worker thread, which sleeps until it is time to render the
+ * next frame. Applications with dozens of renderers thus end up with
+ * dozens of mostly idle threads, which tend to wake up at the same time
+ * and oversubscribe the CPU. A render pool instead drives any number of
+ * renderers from a fixed number of threads. Renderers are rendered in
+ * order of their frame deadlines (as determined by their fps setting)
+ * and when the pool can't keep up, renderers take turns, so no renderer
+ * is starved. Use mt_cairo_render_get_render_time() to find out which
+ * renderers take up the most time.
+ *
+ * Renderers are attached to the pool using mt_cairo_render_set_pool():
+ *```
+ *	mt_cairo_render_pool_t *pool = mt_cairo_render_pool_init(0);
+ *	mt_cairo_render_t *mtcr1 = mt_cairo_render_init(...);
+ *	mt_cairo_render_set_pool(mtcr1, pool);
+ *	mt_cairo_render_t *mtcr2 = mt_cairo_render_init(...);
+ *	mt_cairo_render_set_pool(mtcr2, pool);
+ *	// ...use the renderers as normal...
+ *	mt_cairo_render_fini(mtcr2);
+ *	mt_cairo_render_fini(mtcr1);
+ *	mt_cairo_render_pool_fini(pool);	<- pool fini must go last
+ *```
+ * Please note that since rendering callbacks of different renderers
+ * can now run on the same thread, a slow callback delays other renderers
+ * of the pool, and a callback must never block waiting on another
+ * renderer of the same pool.
+ *
+ * @param num_threads Number of rendering threads in the pool. Pass 0
+ *	to use one thread per CPU core.
+ */
+mt_cairo_render_pool_t *
+mt_cairo_render_pool_init(unsigned num_threads)
+{
+	mt_cairo_render_pool_t *pool = safe_calloc(1, sizeof (*pool));
+
+	if (num_threads == 0)
+		num_threads = lacf_get_num_cpus();
+	num_threads = MAX(num_threads, 1);
+
+	mutex_init(&pool->lock);
+	cv_init(&pool->cv);
+	cv_init(&pool->cv_done);
+	avl_create(&pool->sched, pool_sched_compar,
+	    sizeof (mt_cairo_render_t), offsetof(mt_cairo_render_t,
+	    pool_node));
+	pool->num_thr = num_threads;
+	pool->thr = safe_calloc(num_threads, sizeof (*pool->thr));
+	for (unsigned i = 0; i < num_threads; i++)
+		VERIFY(thread_create(&pool->thr[i], pool_worker, pool));
+
+	return (pool);
+}
+
+/**
+ * Frees a shared render pool. This must be called after all
+ * mt_cairo_render_t instances using it have either been destroyed, or
+ * have been detached from it by a call to
+ * mt_cairo_render_set_pool(mtcr, NULL).
+ */
+void
+mt_cairo_render_pool_fini(mt_cairo_render_pool_t *pool)
+{
+	if (pool == NULL)
+		return;
+
+	ASSERT0(pool->refcnt);
+	ASSERT0(avl_numnodes(&pool->sched));
+
+	mutex_enter(&pool->lock);
+	pool->shutdown = B_TRUE;
+	cv_broadcast(&pool->cv);
+	mutex_exit(&pool->lock);
+	for (unsigned i = 0; i < pool->num_thr; i++)
+		thread_join(&pool->thr[i]);
+	free(pool->thr);
+
+	avl_destroy(&pool->sched);
+	mutex_destroy(&pool->lock);
+	cv_destroy(&pool->cv);
+	cv_destroy(&pool->cv_done);
+
+	ZERO_FREE(pool);
+}
@@ -20,19 +20,30 @@
 #include <string.h>
 #include <errno.h>
 
+#if	IBM
+#include <windows.h>
+#else	/* !IBM */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif	/* !IBM */
+
 #include <curl/curl.h>
 
 #include "acfutils/assert.h"
 #include "acfutils/avl.h"
-#include "acfutils/compress.h"
-#include "acfutils/list.h"
+#include "acfutils/math.h"
 #include "acfutils/odb.h"
 #include "acfutils/perf.h"
 #include "acfutils/safe_alloc.h"
+#include "acfutils/taskq.h"
 #include "acfutils/thread.h"
 #include "acfutils/time.h"
 
 #include "chart_prov_common.h"
+#include "zip/zip.h"
 
 #define	DEFAULT_UNLOAD_DELAY	60		/* seconds */
 
@@ -40,10 +51,76 @@
 #define	LOW_SPD_LIM		4096L		/* bytes/s */
 #define	LOW_SPD_TIME		30L		/* seconds */
 
-#define	REALLOC_STEP		(8 << 20)	/* 1 MiB */
+/*
+ * The DOF import is a streaming pipeline. The downloaded ZIP file is
+ * decompressed incrementally into IMPORT_CHUNK_SZ chunks (cut on line
+ * boundaries), which are parsed and sorted into tiles in parallel on a
+ * taskq. At most IMPORT_JOBS_PER_CPU chunks per CPU are in flight at
+ * any time, so the decompressor stalls if the parsers can't keep up.
+ * The DOF file is ordered by state, not by position, so tiles don't
+ * fill up in order and can't be written out while parsing is still
+ * going on. Instead, once more than IMPORT_MAX_MEM_OBST obstacles are
+ * held in memory, all tiles are appended to per-tile spill files (see
+ * import_spill()). The tiles are then written out in parallel into a
+ * temporary directory, which replaces the old tile cache once it is
+ * complete, reading back each tile's spill file as it goes.
+ *
+ * Peak memory use is thus independent of the size of the DOF file:
+ * 2 x IMPORT_MAX_MEM_OBST obstacles (~24 MiB, the arrays grow by
+ * doubling), plus IMPORT_JOBS_PER_CPU chunks per CPU, plus the largest
+ * tile for each CPU during the write phase.
+ */
+#define	IMPORT_CHUNK_SZ		(1 << 20)	/* 1 MiB */
+#define	IMPORT_JOBS_PER_CPU	2
+#define	IMPORT_MAX_MEM_OBST	(1 << 18)
+#define	IMPORT_SPILL_SUFFIX	".spill"
+#define	IMPORT_THR_STOP_DELAY	SEC2USEC(1)
 
 #define	FAA_DOF_URL	"https://aeronav.faa.gov/Obst_Data/DAILY_DOF_CSV.ZIP"
 
+/*
+ * Packed binary tile format. The tile cache stores each 1x1 degree tile
+ * as a single file, which is mmap'd on load. The file consists of an
+ * odb_tile_hdr_t, followed by a spatial index and the obstacle data in
+ * SoA form (see tile_layout()). Obstacle positions are quantized
+ * relative to the tile's SW corner, so the format is only ~12 bytes
+ * per obstacle. Obstacles are sorted by the grid cell they fall into
+ * and cell_start[] holds the index of the first obstacle of each cell
+ * (plus a final entry holding the total number of obstacles), so any
+ * geographic sub-area of the tile can be scanned without visiting
+ * every obstacle in it. The files are a local cache, so they are
+ * written in host byte order (a byte order mismatch fails the magic
+ * number check and causes the tile to be ignored).
+ */
+#define	ODB_TILE_MAGIC		0x4244444fu	/* "ODDB" little-endian */
+#define	ODB_TILE_VERSION	1
+#define	ODB_TILE_SUFFIX		".bin"
+#define	ODB_GRID_SZ		16		/* cells per tile side */
+#define	ODB_POS_QUANT		65535.0		/* lat/lon steps per deg */
+#define	ODB_ELEV_QUANT		2.0		/* elev steps per meter */
+#define	ODB_AGL_QUANT		10.0		/* AGL steps per meter */
+
+typedef struct {
+	uint32_t	magic;
+	uint32_t	version;
+	int32_t		lat, lon;
+	uint32_t	n_obst;
+	uint32_t	grid_sz;
+	uint32_t	reserved[2];
+} odb_tile_hdr_t;
+
+typedef struct {
+	size_t		cell_start;	/* uint32_t[grid_sz^2 + 1] */
+	size_t		lat;		/* uint16_t[n_obst] */
+	size_t		lon;		/* uint16_t[n_obst] */
+	size_t		elev;		/* int16_t[n_obst] */
+	size_t		agl;		/* uint16_t[n_obst] */
+	size_t		quant;		/* uint16_t[n_obst] */
+	size_t		type;		/* uint8_t[n_obst] */
+	size_t		light;		/* uint8_t[n_obst] */
+	size_t		total;
+} odb_tile_layout_t;
+
 enum {
 	ODB_REGION_US,		/* USA */
 	NUM_ODB_REGIONS
@@ -51,9 +128,8 @@ enum {
 
 typedef struct {
 	odb_t		*odb;
-	uint8_t		*buf;
-	size_t		bufsz;
-	size_t		bufcap;
+	FILE		*fp;
+	size_t		bytes;
 } dl_info_t;
 
 typedef struct {
@@ -62,15 +138,85 @@ typedef struct {
 	float		agl;
 	obst_light_t	light;
 	unsigned	quant;
-
-	list_node_t	node;
 } obst_t;
 
+/*
+ * Tile being constructed during a database import. Obstacles are simply
+ * accumulated into an array and then packed when the tile is written
+ * out. If `spilled' is set, more of the tile's obstacles are in its
+ * spill file. lat & lon MUST be the first members, see tile_compar().
+ */
+typedef struct {
+	int		lat, lon;
+	obst_t		*obst;
+	size_t		n_obst;
+	size_t		cap;
+	bool_t		spilled;
+	avl_node_t	node;
+} import_tile_t;
+
+typedef enum {
+	IMPORT_JOB_PARSE,
+	IMPORT_JOB_WRITE
+} import_job_type_t;
+
+typedef struct {
+	import_job_type_t	type;
+	char			*buf;		/* IMPORT_JOB_PARSE */
+	size_t			len;		/* IMPORT_JOB_PARSE */
+	import_tile_t		*itile;		/* IMPORT_JOB_WRITE */
+} import_job_t;
+
 typedef struct {
 	odb_t		*odb;
+	const char	*cc;
+	char		*tmpdir;
+	char		*spilldir;
+	taskq_t		*tq;
+
+	mutex_t		lock;
+	condvar_t	cv;
+	unsigned	jobs_pending;
+	unsigned	max_jobs;
+	bool_t		failed;
+	avl_tree_t	tiles;		/* import_tile_t, protected by lock */
+	size_t		n_obst;		/* protected by lock */
+	size_t		n_mem_obst;	/* not spilled yet, protected by lock */
+
+	/* Partial chunk being assembled from the decompressor output */
+	char		*chunk;
+	size_t		chunk_len;
+} dof_import_t;
+
+/*
+ * Packed tile loaded from the tile cache. The data arrays point into
+ * `buf', which is either an mmap'd tile file or a malloc'd buffer (for
+ * tiles converted from the legacy CSV cache format, or loaded while a
+ * refresh is being swapped in). The contents are immutable once the
+ * tile is loaded, so readers can query it without holding any locks,
+ * as long as they hold a reference to it (see tile_get()). lat & lon
+ * MUST be the first members, see tile_compar().
+ */
+typedef struct {
 	int		lat, lon;
-	time_t		access_t;
-	list_t		obst;
+	odb_t		*odb;
+	unsigned	refcnt;		/* protected by odb->tiles_lock */
+
+	void		*buf;
+	size_t		bufsz;
+	bool_t		mapped;
+
+	unsigned	n_obst;
+	unsigned	grid_sz;
+	const uint32_t	*cell_start;
+	const uint16_t	*lat_q;
+	const uint16_t	*lon_q;
+	const int16_t	*elev_q;
+	const uint16_t	*agl_q;
+	const uint16_t	*quant;
+	const uint8_t	*type;
+	const uint8_t	*light;
+
 	avl_node_t	node;
 } odb_tile_t;
 
@@ -79,8 +225,23 @@ struct odb_s {
 	char		*cainfo;
 	unsigned	unload_delay;
 
+	/*
+	 * tiles_lock only protects the tile index and reference counts,
+	 * and is only ever held briefly. Loading tiles and querying them
+	 * happens outside of it, so readers don't serialize on each other
+	 * or stall while a refresh is in progress. A refresh retires all
+	 * loaded tiles at once by bumping tiles_gen (see
+	 * import_swap_tiles()). Tiles which are still in use by readers
+	 * are freed once their last reference is dropped.
+	 */
 	mutex_t		tiles_lock;
+	condvar_t	tiles_cv;
 	avl_tree_t	tiles;
+	unsigned	tiles_gen;
+	/* Directory to load tiles from while a refresh is being swapped in */
+	const char	*swap_dir;
+	unsigned	n_loading[2];	/* tiles being loaded, by gen parity */
+	unsigned	n_retired;	/* retired tiles not yet freed */
 
 	mutex_t		refresh_lock;
 	thread_t	refresh_thr;
@@ -92,16 +253,20 @@ struct odb_s {
 	char		*proxy;
 };
 
-static void add_obst_to_odb(obst_type_t type, geo_pos3_t pos, float agl,
-    obst_light_t light, unsigned quant, void *userinfo);
-static odb_tile_t *load_tile(odb_t *odb, int lat, int lon,
-    bool_t load_from_db);
 static void odb_flush_tiles(odb_t *odb);
 
+/*
+ * Shared by odb_tile_t and import_tile_t, both of which start with
+ * the tile's integer lat & lon.
+ */
+typedef struct {
+	int	lat, lon;
+} tile_key_t;
+
 static int
 tile_compar(const void *a, const void *b)
 {
-	const odb_tile_t *ta = a, *tb = b;
+	const tile_key_t *ta = a, *tb = b;
 
 	if (ta->lat < tb->lat)
 		return (-1);
@@ -217,54 +382,83 @@ light2dof(obst_light_t light)
 	}
 }
 
+/*
+ * Parses a single line of an FAA DOF CSV file, delimited by `line' and
+ * `end' (excluding the newline). The fields are parsed in place, without
+ * copying or splitting the line.
+ * @return B_TRUE if the line contained a valid obstacle record.
+ */
+static bool_t
+dof_parse_line(const char *line, const char *end, obst_t *obst)
+{
+	enum { N_FIELDS = 19 };
+	const char *fields[N_FIELDS];
+	size_t lens[N_FIELDS];
+	unsigned n = 0;
+	char type[32];
+	double agl, amsl;
+	int quant;
+
+	ASSERT(line != NULL);
+	ASSERT(end != NULL);
+	ASSERT(obst != NULL);
+
+	while (line < end && isspace((unsigned char)*line))
+		line++;
+	for (const char *p = line; n < N_FIELDS;) {
+		const char *comma = memchr(p, ',', end - p);
+
+		fields[n] = p;
+		lens[n] = (comma != NULL ? comma : end) - p;
+		n++;
+		if (comma == NULL)
+			break;
+		p = comma + 1;
+	}
+	/* Skip short lines and the header line */
+	if (n < N_FIELDS || (lens[0] == 3 && strncmp(fields[0], "OAS", 3) == 0))
+		return (B_FALSE);
+
+	/*
+	 * All the numeric fields are followed by a comma, which terminates
+	 * the conversion.
+	 */
+	quant = atoi(fields[10]);
+	agl = FEET2MET(atof(fields[11]));
+	amsl = FEET2MET(atof(fields[12]));
+	lacf_strlcpy(type, fields[9], MIN(sizeof (type), lens[9] + 1));
+	obst->type = dof2type(type);
+	obst->light = dof2light(lens[13] != 0 ? fields[13] : "");
+	obst->pos.lat = atof(fields[5]);
+	obst->pos.lon = atof(fields[6]);
+	obst->pos.elev = amsl - agl;
+	obst->agl = agl;
+	obst->quant = quant;
+
+	return (is_valid_lat(obst->pos.lat) && is_valid_lon(obst->pos.lon) &&
+	    agl >= 0 && is_valid_alt_m(agl) && is_valid_alt_m(amsl) &&
+	    quant > 0);
+}
+
 static bool_t
 odb_proc_us_dof_impl(const char *buf, size_t len, add_obst_cb_t cb,
     void *userinfo)
 {
+	const char *end = buf + len;
+
 	ASSERT(buf != NULL);
 	ASSERT(cb != NULL);
 
-	for (const char *line_start = buf, *line_end = buf;
-	    line_start < buf + len; line_start = line_end + 1) {
-		char **comps;
-		size_t n_comps;
-		obst_type_t type;
-		obst_light_t light;
-		geo_pos3_t pos;
-		float agl, amsl;
-		unsigned quant;
-		char line[256];
-
-		line_end = strchr(line_start, '\n');
-		if (line_end == NULL)
-			line_end = buf + len;
-		lacf_strlcpy(line, line_start, MIN((int)sizeof (line),
-		    (line_end - line_start) + 1));
-
-		strip_space(line);
-
-		comps = strsplit(line, ",", B_FALSE, &n_comps);
-
-		if (n_comps < 19 || strcmp(comps[0], "OAS") == 0)
-			goto next;
-
-		quant = atoi(comps[10]);
-		agl = FEET2MET(atof(comps[11]));
-		amsl = FEET2MET(atof(comps[12]));
-		type = dof2type(comps[9]);
-		light = dof2light(comps[13]);
-		pos.lat = atof(comps[5]);
-		pos.lon = atof(comps[6]);
-		pos.elev = amsl - agl;
-
-		if (!is_valid_lat(pos.lat) || !is_valid_lon(pos.lon) ||
-		    agl < 0 || !is_valid_alt_m(agl) || !is_valid_alt_m(amsl) ||
-		    quant == 0)
-			goto next;
-
-		cb(type, pos, agl, light, quant, userinfo);
-next:
-		free_strlist(comps, n_comps);
+	for (const char *line = buf; line < end;) {
+		const char *nl = memchr(line, '\n', end - line);
+		const char *line_end = (nl != NULL ? nl : end);
+		obst_t obst;
+
+		if (dof_parse_line(line, line_end, &obst)) {
+			cb(obst.type, obst.pos, obst.agl, obst.light,
+			    obst.quant, userinfo);
+		}
+		line = line_end + 1;
 	}
 
 	return (B_TRUE);
@@ -287,20 +481,387 @@ odb_proc_us_dof(const char *path, add_obst_cb_t cb, void *userinfo)
 	return (res);
 }
 
+static import_tile_t *
+import_tile_alloc(int lat, int lon)
+{
+	import_tile_t *itile = safe_calloc(1, sizeof (*itile));
+
+	itile->lat = lat;
+	itile->lon = lon;
+
+	return (itile);
+}
+
 static void
-free_tile(odb_tile_t *tile)
+import_tile_add(import_tile_t *itile, const obst_t *obst)
+{
+	ASSERT(itile != NULL);
+	ASSERT(obst != NULL);
+
+	if (itile->n_obst == itile->cap) {
+		itile->cap = MAX(itile->cap * 2, 64);
+		itile->obst = safe_realloc(itile->obst, itile->cap *
+		    sizeof (*itile->obst));
+	}
+	itile->obst[itile->n_obst++] = *obst;
+}
+
+static void
+free_import_tile(import_tile_t *itile)
+{
+	ASSERT(itile != NULL);
+
+	free(itile->obst);
+	memset(itile, 0, sizeof (*itile));
+	free(itile);
+}
+
+/*
+ * Maps a packed tile file into memory read-only. Returns NULL if the
+ * file doesn't exist (which is normal for tiles without obstacles) or
+ * cannot be mapped.
+ */
+static void *
+map_tile_file(const char *path, size_t *bufsz)
+{
+#if	IBM
+	int l = strlen(path) + 1;
+	WCHAR *pathW = safe_calloc(l, sizeof (*pathW));
+	HANDLE fh, mh;
+	LARGE_INTEGER sz;
+	void *buf = NULL;
+
+	ASSERT(bufsz != NULL);
+
+	MultiByteToWideChar(CP_UTF8, 0, path, -1, pathW, l);
+	fh = CreateFileW(pathW, GENERIC_READ, FILE_SHARE_READ, NULL,
+	    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	free(pathW);
+	if (fh == INVALID_HANDLE_VALUE)
+		return (NULL);
+	if (!GetFileSizeEx(fh, &sz) || sz.QuadPart == 0) {
+		CloseHandle(fh);
+		return (NULL);
+	}
+	mh = CreateFileMappingW(fh, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mh != NULL) {
+		buf = MapViewOfFile(mh, FILE_MAP_READ, 0, 0, 0);
+		CloseHandle(mh);
+	}
+	CloseHandle(fh);
+	if (buf == NULL) {
+		win_perror(GetLastError(), "Error mapping obstacle database "
+		    "tile %s", path);
+		return (NULL);
+	}
+	*bufsz = sz.QuadPart;
+
+	return (buf);
+#else	/* !IBM */
+	int fd;
+	struct stat st;
+	void *buf;
+
+	ASSERT(bufsz != NULL);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT) {
+			logMsg("Error opening obstacle database tile %s: %s",
+			    path, strerror(errno));
+		}
+		return (NULL);
+	}
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return (NULL);
+	}
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		logMsg("Error mapping obstacle database tile %s: %s",
+		    path, strerror(errno));
+		return (NULL);
+	}
+	*bufsz = st.st_size;
+
+	return (buf);
+#endif	/* !IBM */
+}
+
+static void
+unmap_tile_file(void *buf, size_t bufsz)
 {
-	obst_t *obst;
+	ASSERT(buf != NULL);
+#if	IBM
+	LACF_UNUSED(bufsz);
+	UnmapViewOfFile(buf);
+#else	/* !IBM */
+	munmap(buf, bufsz);
+#endif	/* !IBM */
+}
 
+static void
+free_tile(odb_tile_t *tile)
+{
 	ASSERT(tile != NULL);
 
-	while ((obst = list_remove_head(&tile->obst)) != NULL)
-		free(obst);
-	list_destroy(&tile->obst);
+	if (tile->buf != NULL) {
+		if (tile->mapped)
+			unmap_tile_file(tile->buf, tile->bufsz);
+		else
+			free(tile->buf);
+	}
 	memset(tile, 0, sizeof (*tile));
 	free(tile);
 }
 
+static void
+tile_layout(size_t n_obst, unsigned grid_sz, odb_tile_layout_t *l)
+{
+	size_t off = sizeof (odb_tile_hdr_t);
+
+	ASSERT(l != NULL);
+
+	l->cell_start = off;
+	off += (grid_sz * grid_sz + 1) * sizeof (uint32_t);
+	l->lat = off;
+	off += n_obst * sizeof (uint16_t);
+	l->lon = off;
+	off += n_obst * sizeof (uint16_t);
+	l->elev = off;
+	off += n_obst * sizeof (int16_t);
+	l->agl = off;
+	off += n_obst * sizeof (uint16_t);
+	l->quant = off;
+	off += n_obst * sizeof (uint16_t);
+	l->type = off;
+	off += n_obst * sizeof (uint8_t);
+	l->light = off;
+	off += n_obst * sizeof (uint8_t);
+	l->total = off;
+}
+
+static inline uint16_t
+quant_pos(double deg, int tile_deg)
+{
+	return (clamp(round((deg - tile_deg) * ODB_POS_QUANT), 0, UINT16_MAX));
+}
+
+static inline double
+unquant_pos(uint16_t q, int tile_deg)
+{
+	return (tile_deg + q / ODB_POS_QUANT);
+}
+
+static inline unsigned
+pos2cell(uint16_t q, unsigned grid_sz)
+{
+	return (((unsigned)q * grid_sz) >> 16);
+}
+
+/*
+ * Packs the obstacles of an import tile into the binary tile format.
+ * Returns a malloc'd buffer containing the tile file's contents.
+ */
+static void *
+pack_import_tile(const import_tile_t *itile, size_t *bufsz)
+{
+	enum { N_CELLS = ODB_GRID_SZ * ODB_GRID_SZ };
+	size_t n_obst;
+	uint32_t fill[N_CELLS];
+	odb_tile_layout_t l;
+	uint8_t *buf;
+	odb_tile_hdr_t *hdr;
+	uint32_t *cell_start;
+	uint16_t *lat_q, *lon_q, *agl_q, *quant;
+	int16_t *elev_q;
+	uint8_t *type, *light;
+
+	ASSERT(itile != NULL);
+	ASSERT(bufsz != NULL);
+
+	n_obst = itile->n_obst;
+	VERIFY3U(n_obst, <=, UINT32_MAX);
+	tile_layout(n_obst, ODB_GRID_SZ, &l);
+	buf = safe_calloc(1, l.total);
+
+	hdr = (odb_tile_hdr_t *)buf;
+	hdr->magic = ODB_TILE_MAGIC;
+	hdr->version = ODB_TILE_VERSION;
+	hdr->lat = itile->lat;
+	hdr->lon = itile->lon;
+	hdr->n_obst = n_obst;
+	hdr->grid_sz = ODB_GRID_SZ;
+
+	cell_start = (uint32_t *)(buf + l.cell_start);
+	lat_q = (uint16_t *)(buf + l.lat);
+	lon_q = (uint16_t *)(buf + l.lon);
+	elev_q = (int16_t *)(buf + l.elev);
+	agl_q = (uint16_t *)(buf + l.agl);
+	quant = (uint16_t *)(buf + l.quant);
+	type = buf + l.type;
+	light = buf + l.light;
+
+	/* Count the obstacles in each cell and build the cell index */
+	for (size_t j = 0; j < n_obst; j++) {
+		const obst_t *obst = &itile->obst[j];
+		unsigned row = pos2cell(quant_pos(obst->pos.lat, itile->lat),
+		    ODB_GRID_SZ);
+		unsigned col = pos2cell(quant_pos(obst->pos.lon, itile->lon),
+		    ODB_GRID_SZ);
+		cell_start[row * ODB_GRID_SZ + col + 1]++;
+	}
+	for (unsigned i = 0; i < N_CELLS; i++) {
+		cell_start[i + 1] += cell_start[i];
+		fill[i] = cell_start[i];
+	}
+	ASSERT3U(cell_start[N_CELLS], ==, n_obst);
+	/* Scatter the obstacles into their cells */
+	for (size_t j = 0; j < n_obst; j++) {
+		const obst_t *obst = &itile->obst[j];
+		uint16_t la = quant_pos(obst->pos.lat, itile->lat);
+		uint16_t lo = quant_pos(obst->pos.lon, itile->lon);
+		unsigned i = fill[pos2cell(la, ODB_GRID_SZ) * ODB_GRID_SZ +
+		    pos2cell(lo, ODB_GRID_SZ)]++;
+
+		lat_q[i] = la;
+		lon_q[i] = lo;
+		elev_q[i] = clamp(round(obst->pos.elev * ODB_ELEV_QUANT),
+		    INT16_MIN, INT16_MAX);
+		agl_q[i] = clamp(round(obst->agl * ODB_AGL_QUANT), 0,
+		    UINT16_MAX);
+		quant[i] = MIN(obst->quant, UINT16_MAX);
+		type[i] = obst->type;
+		light[i] = obst->light;
+	}
+	*bufsz = l.total;
+
+	return (buf);
+}
+
+/*
+ * Validates the contents of a tile file and sets up the tile's data
+ * pointers to point into it. On success, the tile takes ownership of
+ * `buf'.
+ */
+static bool_t
+tile_attach(odb_tile_t *tile, void *buf, size_t bufsz, bool_t mapped)
+{
+	const odb_tile_hdr_t *hdr = buf;
+	const uint8_t *p = buf;
+	const uint32_t *cell_start;
+	odb_tile_layout_t l;
+	unsigned n_cells;
+
+	ASSERT(tile != NULL);
+	ASSERT(buf != NULL);
+	ASSERT3P(tile->buf, ==, NULL);
+
+	if (bufsz < sizeof (*hdr) || hdr->magic != ODB_TILE_MAGIC ||
+	    hdr->version != ODB_TILE_VERSION || hdr->lat != tile->lat ||
+	    hdr->lon != tile->lon || hdr->grid_sz == 0 ||
+	    hdr->grid_sz > 256)
+		return (B_FALSE);
+	tile_layout(hdr->n_obst, hdr->grid_sz, &l);
+	if (l.total != bufsz)
+		return (B_FALSE);
+	n_cells = hdr->grid_sz * hdr->grid_sz;
+	cell_start = (const uint32_t *)(p + l.cell_start);
+	if (cell_start[0] != 0 || cell_start[n_cells] != hdr->n_obst)
+		return (B_FALSE);
+	for (unsigned i = 0; i < n_cells; i++) {
+		if (cell_start[i] > cell_start[i + 1])
+			return (B_FALSE);
+	}
+
+	tile->buf = buf;
+	tile->bufsz = bufsz;
+	tile->mapped = mapped;
+	tile->n_obst = hdr->n_obst;
+	tile->grid_sz = hdr->grid_sz;
+	tile->cell_start = cell_start;
+	tile->lat_q = (const uint16_t *)(p + l.lat);
+	tile->lon_q = (const uint16_t *)(p + l.lon);
+	tile->elev_q = (const int16_t *)(p + l.elev);
+	tile->agl_q = (const uint16_t *)(p + l.agl);
+	tile->quant = (const uint16_t *)(p + l.quant);
+	tile->type = p + l.type;
+	tile->light = p + l.light;
+
+	return (B_TRUE);
+}
+
+static void
+tile_get_obst(const odb_tile_t *tile, unsigned i, obst_t *obst)
+{
+	ASSERT(tile != NULL);
+	ASSERT3U(i, <, tile->n_obst);
+	ASSERT(obst != NULL);
+
+	obst->type = tile->type[i];
+	obst->pos = GEO_POS3(unquant_pos(tile->lat_q[i], tile->lat),
+	    unquant_pos(tile->lon_q[i], tile->lon),
+	    tile->elev_q[i] / ODB_ELEV_QUANT);
+	obst->agl = tile->agl_q[i] / ODB_AGL_QUANT;
+	obst->light = tile->light[i];
+	obst->quant = tile->quant[i];
+}
+
+typedef void (*tile_obst_cb_t)(const odb_tile_t *tile, unsigned i,
+    void *userinfo);
+
+/*
+ * Calls `cb' for every obstacle in the tile lying within the lat/lon
+ * box given in degrees and which is at least `min_agl' meters tall.
+ * Only the grid cells overlapping the box are visited.
+ */
+static void
+tile_query_box(const odb_tile_t *tile, double lat_min, double lon_min,
+    double lat_max, double lon_max, double min_agl, tile_obst_cb_t cb,
+    void *userinfo)
+{
+	uint16_t lat_q_min, lat_q_max, lon_q_min, lon_q_max;
+	unsigned row_min, row_max, col_min, col_max;
+	/* Round down, so we never exclude an obstacle due to quantization */
+	unsigned agl_q_min = clamp(floor(min_agl * ODB_AGL_QUANT), 0,
+	    UINT16_MAX);
+
+	ASSERT(tile != NULL);
+	ASSERT(cb != NULL);
+
+	if (tile->n_obst == 0 || lat_max < tile->lat ||
+	    lat_min > tile->lat + 1 || lon_max < tile->lon ||
+	    lon_min > tile->lon + 1)
+		return;
+
+	lat_q_min = quant_pos(lat_min, tile->lat);
+	lat_q_max = quant_pos(lat_max, tile->lat);
+	lon_q_min = quant_pos(lon_min, tile->lon);
+	lon_q_max = quant_pos(lon_max, tile->lon);
+	row_min = pos2cell(lat_q_min, tile->grid_sz);
+	row_max = pos2cell(lat_q_max, tile->grid_sz);
+	col_min = pos2cell(lon_q_min, tile->grid_sz);
+	col_max = pos2cell(lon_q_max, tile->grid_sz);
+
+	for (unsigned row = row_min; row <= row_max; row++) {
+		/* Cells in a row are contiguous in the obstacle arrays */
+		unsigned start = tile->cell_start[row * tile->grid_sz +
+		    col_min];
+		unsigned end = tile->cell_start[row * tile->grid_sz +
+		    col_max + 1];
+
+		for (unsigned i = start; i < end; i++) {
+			if (tile->agl_q[i] >= agl_q_min &&
+			    tile->lat_q[i] >= lat_q_min &&
+			    tile->lat_q[i] <= lat_q_max &&
+			    tile->lon_q[i] >= lon_q_min &&
+			    tile->lon_q[i] <= lon_q_max)
+				cb(tile, i, userinfo);
+		}
+	}
+}
+
 odb_t *
 odb_init(const char *xpdir, const char *cainfo)
 {
@@ -315,6 +876,7 @@ odb_init(const char *xpdir, const char *cainfo)
 	odb->unload_delay = DEFAULT_UNLOAD_DELAY;
 
 	mutex_init(&odb->tiles_lock);
+	cv_init(&odb->tiles_cv);
 	avl_create(&odb->tiles, tile_compar, sizeof (odb_tile_t),
 	    offsetof(odb_tile_t, node));
 
@@ -337,11 +899,9 @@ odb_fini(odb_t *odb)
 	}
 	mutex_destroy(&odb->refresh_lock);
 
-	mutex_enter(&odb->tiles_lock);
 	odb_flush_tiles(odb);
-	mutex_exit(&odb->tiles_lock);
-
 	avl_destroy(&odb->tiles);
+	cv_destroy(&odb->tiles_cv);
 	mutex_destroy(&odb->tiles_lock);
 
 	free(odb->proxy);
@@ -410,33 +970,55 @@ dl_write(char *ptr, size_t size, size_t nmemb, void *userdata)
 	/* Respond to an early termination request */
 	if (!dl_info->odb->refresh_run)
 		return (0);
+	if (fwrite(ptr, 1, bytes, dl_info->fp) != bytes)
+		return (0);
+	dl_info->bytes += bytes;
+
+	return (bytes);
+}
+
+static bool_t
+write_tile_file(const char *path, const void *buf, size_t bufsz)
+{
+	FILE *fp;
+
+	ASSERT(path != NULL);
+	ASSERT(buf != NULL);
 
-	if (dl_info->bufcap < dl_info->bufsz + bytes) {
-		do {
-			dl_info->bufcap += REALLOC_STEP;
-		} while (dl_info->bufcap < dl_info->bufsz + bytes);
-		dl_info->buf = realloc(dl_info->buf, dl_info->bufcap);
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		logMsg("Error writing obstacle database tile %s: %s",
+		    path, strerror(errno));
+		return (B_FALSE);
+	}
+	if (fwrite(buf, 1, bufsz, fp) != bufsz) {
+		logMsg("Error writing obstacle database tile %s: %s",
+		    path, strerror(errno));
+		fclose(fp);
+		remove_file(path, B_TRUE);
+		return (B_FALSE);
 	}
-	memcpy(&dl_info->buf[dl_info->bufsz], ptr, bytes);
-	dl_info->bufsz += bytes;
+	fclose(fp);
 
-	return (bytes);
+	return (B_TRUE);
 }
 
 static bool_t
-write_tile(odb_t *odb, odb_tile_t *tile, const char *cc)
+write_tile(const char *dir, const import_tile_t *itile)
 {
 	char subpath[32];
-	char *path, *dirpath, *p;
-	FILE *fp = NULL;
+	char *tilepath, *path, *dirpath, *p;
+	void *buf = NULL;
+	size_t bufsz;
 	bool_t res = B_FALSE;
 
-	ASSERT(odb != NULL);
-	ASSERT(tile != NULL);
-	ASSERT(cc != NULL);
+	ASSERT(dir != NULL);
+	ASSERT(itile != NULL);
 
-	latlon2path(tile->lat, tile->lon, subpath);
-	path = mkpathname(odb->cache_dir, cc, subpath, NULL);
+	latlon2path(itile->lat, itile->lon, subpath);
+	tilepath = mkpathname(dir, subpath, NULL);
+	path = sprintf_alloc("%s" ODB_TILE_SUFFIX, tilepath);
+	lacf_free(tilepath);
 	dirpath = strdup(path);
 	VERIFY(dirpath != NULL);
 
@@ -447,56 +1029,65 @@ write_tile(odb_t *odb, odb_tile_t *tile, const char *cc)
 
 	if (!create_directory_recursive(dirpath))
 		goto errout;
-	fp = fopen(path, "wb");
-	if (fp == NULL) {
-		logMsg("Error writing obstacle database tile %s: %s",
-		    path, strerror (errno));
-		goto errout;
-	}
-	for (obst_t *obst = list_head(&tile->obst); obst != NULL;
-	    obst = list_next(&tile->obst, obst)) {
-		fprintf(fp, ",,US,,,%f,%f,,,%s,%d,%.0f,%.0f,%c,1A,,,,\n",
-		    obst->pos.lat, obst->pos.lon, type2dof(obst->type),
-		    obst->quant, MET2FEET(obst->agl),
-		    MET2FEET(obst->pos.elev + obst->agl),
-		    light2dof(obst->light));
-	}
-
-	res = B_TRUE;
+	buf = pack_import_tile(itile, &bufsz);
+	res = write_tile_file(path, buf, bufsz);
 errout:
-	if (fp != NULL)
-		fclose(fp);
-	lacf_free(path);
+	free(buf);
+	free(path);
 	free(dirpath);
 
 	return (res);
 }
 
+/*
+ * Frees all loaded tiles. Only used on shutdown, when there can be no
+ * more readers holding on to tiles.
+ */
 static void
-odb_write_tiles(odb_t *odb, const char *cc)
+odb_flush_tiles(odb_t *odb)
 {
+	void *cookie = NULL;
+	odb_tile_t *tile;
+
 	ASSERT(odb != NULL);
-	ASSERT_MUTEX_HELD(&odb->tiles_lock);
-	ASSERT(cc != NULL);
+	ASSERT3U(odb->n_retired, ==, 0);
 
-	for (odb_tile_t *tile = avl_first(&odb->tiles); tile != NULL;
-	    tile = AVL_NEXT(&odb->tiles, tile)) {
-		if (!write_tile(odb, tile, cc))
-			break;
+	while ((tile = avl_destroy_nodes(&odb->tiles, &cookie)) != NULL) {
+		ASSERT3U(tile->refcnt, ==, 1);
+		free_tile(tile);
 	}
 }
 
-static void
-odb_flush_tiles(odb_t *odb)
+/*
+ * Removes all tiles from the tile index and drops the index's reference
+ * to them. Tiles still referenced by readers are freed by tile_rele().
+ * Returns a malloc'd array of the tiles which are now unreferenced and
+ * must be freed by the caller (after dropping tiles_lock).
+ */
+static odb_tile_t **
+odb_retire_tiles(odb_t *odb, size_t *n_free)
 {
+	odb_tile_t **free_tiles;
 	void *cookie = NULL;
 	odb_tile_t *tile;
 
 	ASSERT(odb != NULL);
 	ASSERT_MUTEX_HELD(&odb->tiles_lock);
+	ASSERT(n_free != NULL);
+
+	free_tiles = safe_calloc(MAX(avl_numnodes(&odb->tiles), 1),
+	    sizeof (*free_tiles));
+	*n_free = 0;
+	while ((tile = avl_destroy_nodes(&odb->tiles, &cookie)) != NULL) {
+		ASSERT(tile->refcnt != 0);
+		tile->refcnt--;
+		if (tile->refcnt == 0)
+			free_tiles[(*n_free)++] = tile;
+		else
+			odb->n_retired++;
+	}
 
-	while ((tile = avl_destroy_nodes(&odb->tiles, &cookie)) != NULL)
-		free_tile(tile);
+	return (free_tiles);
 }
 
 static void
@@ -523,71 +1114,560 @@ errout:
 	LACF_DESTROY(path);
 }
 
-static void
-odb_refresh_us_decompress(odb_t *odb, dl_info_t *dl_info)
+#if	IBM
+static bool_t
+rename_dir(const char *src, const char *dst)
 {
-	size_t len;
-	void *buf;
-
-	ASSERT(odb != NULL);
-	ASSERT(dl_info != NULL);
+	int l_src = strlen(src) + 1, l_dst = strlen(dst) + 1;
+	WCHAR *srcW = safe_calloc(l_src, sizeof (*srcW));
+	WCHAR *dstW = safe_calloc(l_dst, sizeof (*dstW));
+	bool_t res;
 
-	if (dl_info->bufsz == 0) {
-		logMsg("Error updating obstacle database from %s: "
-		    "server didn't send any data", FAA_DOF_URL);
-		return;
+	MultiByteToWideChar(CP_UTF8, 0, src, -1, srcW, l_src);
+	MultiByteToWideChar(CP_UTF8, 0, dst, -1, dstW, l_dst);
+	res = MoveFileExW(srcW, dstW, 0);
+	if (!res) {
+		win_perror(GetLastError(), "Error renaming %s to %s",
+		    src, dst);
 	}
-	buf = decompress_zip(dl_info->buf, dl_info->bufsz, &len);
-	if (buf != NULL) {
-		char *subpath = mkpathname(odb->cache_dir, "US", NULL);
-		/*
-		 * The downloaded DOF is HUUUGE, so DON'T lock here.
-		 * add_obst_to_odb will lock the database when it's
-		 * ready to add a single obstacle instead.
-		 */
-		odb_proc_us_dof_impl(buf, len, add_obst_to_odb, odb);
+	free(srcW);
+	free(dstW);
 
-		mutex_enter(&odb->tiles_lock);
+	return (res);
+}
+#else	/* !IBM */
+static bool_t
+rename_dir(const char *src, const char *dst)
+{
+	if (rename(src, dst) != 0) {
+		logMsg("Error renaming %s to %s: %s", src, dst,
+		    strerror(errno));
+		return (B_FALSE);
+	}
+	return (B_TRUE);
+}
+#endif	/* !IBM */
 
-		if (file_exists(subpath, NULL))
-			remove_directory(subpath);
-		create_directory_recursive(odb->cache_dir);
-		odb_write_tiles(odb, "US");
-		odb_flush_tiles(odb);
-		write_odb_refresh_date(odb, "US");
+static void
+import_submit(dof_import_t *imp, import_job_t *job)
+{
+	ASSERT(imp != NULL);
+	ASSERT(job != NULL);
 
-		lacf_free(subpath);
-		odb->refresh_times[ODB_REGION_US] = time(NULL);
+	mutex_enter(&imp->lock);
+	while (imp->jobs_pending >= imp->max_jobs)
+		cv_wait(&imp->cv, &imp->lock);
+	imp->jobs_pending++;
+	mutex_exit(&imp->lock);
 
-		mutex_exit(&odb->tiles_lock);
-	} else {
-		logMsg("Error updating obstacle database from %s: "
-		    "failed to decompress downloaded ZIP file", FAA_DOF_URL);
-		odb->refresh_times[ODB_REGION_US] = -1u;
-	}
-	free(buf);
+	taskq_submit(imp->tq, job);
 }
 
 static void
-odb_refresh_us(odb_t *odb)
+import_wait(dof_import_t *imp)
 {
-	CURL *curl;
-	CURLcode res;
-	dl_info_t dl_info = { .odb = odb };
-	time_t refresh_date;
+	ASSERT(imp != NULL);
 
-	thread_set_name("odb-refresh-us");
+	mutex_enter(&imp->lock);
+	while (imp->jobs_pending != 0)
+		cv_wait(&imp->cv, &imp->lock);
+	mutex_exit(&imp->lock);
+}
 
-	ASSERT(odb != NULL);
+static char *
+spill_path(const dof_import_t *imp, const import_tile_t *itile)
+{
+	return (sprintf_alloc("%s%c%+03d%+04d" IMPORT_SPILL_SUFFIX,
+	    imp->spilldir, DIRSEP, itile->lat, itile->lon));
+}
 
-	curl = curl_easy_init();
-	VERIFY(curl != NULL);
+static bool_t
+write_spill(const dof_import_t *imp, const import_tile_t *itile)
+{
+	char *path = spill_path(imp, itile);
+	FILE *fp = fopen(path, "ab");
+	bool_t res = B_FALSE;
 
-	logMsg("Downloading new obstacle data from \"%s\" for region \"US\"",
-	    FAA_DOF_URL);
-	curl_easy_setopt(curl, CURLOPT_URL, FAA_DOF_URL);
-	chart_setup_curl(curl, odb->cainfo);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, dl_write);
+	if (fp == NULL) {
+		logMsg("Error importing obstacle database: can't open %s: %s",
+		    path, strerror(errno));
+		goto out;
+	}
+	res = (fwrite(itile->obst, sizeof (*itile->obst), itile->n_obst,
+	    fp) == itile->n_obst);
+	if (fclose(fp) != 0)
+		res = B_FALSE;
+	if (!res) {
+		logMsg("Error importing obstacle database: error writing "
+		    "%s: %s", path, strerror(errno));
+	}
+out:
+	free(path);
+	return (res);
+}
+
+/*
+ * Appends the in-memory obstacles of all import tiles to their spill
+ * files and frees them. Called with imp->lock held, so the parsers
+ * stall until the spill is done.
+ */
+static void
+import_spill(dof_import_t *imp)
+{
+	ASSERT(imp != NULL);
+	ASSERT_MUTEX_HELD(&imp->lock);
+
+	for (import_tile_t *itile = avl_first(&imp->tiles); itile != NULL;
+	    itile = AVL_NEXT(&imp->tiles, itile)) {
+		if (itile->n_obst == 0)
+			continue;
+		if (!imp->failed && !write_spill(imp, itile))
+			imp->failed = B_TRUE;
+		itile->spilled = B_TRUE;
+		LACF_DESTROY(itile->obst);
+		itile->n_obst = 0;
+		itile->cap = 0;
+	}
+	imp->n_mem_obst = 0;
+}
+
+/*
+ * Reads back the spilled obstacles of an import tile and adds them to
+ * the ones still in memory.
+ */
+static bool_t
+import_unspill(const dof_import_t *imp, import_tile_t *itile)
+{
+	char *path = spill_path(imp, itile);
+	size_t len, n;
+	obst_t *obst = file2buf(path, &len);
+
+	if (obst == NULL || len % sizeof (*obst) != 0) {
+		logMsg("Error importing obstacle database: error reading %s",
+		    path);
+		free(obst);
+		free(path);
+		return (B_FALSE);
+	}
+	free(path);
+	n = len / sizeof (*obst);
+	obst = safe_realloc(obst, (n + itile->n_obst) * sizeof (*obst));
+	if (itile->n_obst != 0) {
+		memcpy(&obst[n], itile->obst,
+		    itile->n_obst * sizeof (*obst));
+	}
+	free(itile->obst);
+	itile->obst = obst;
+	itile->n_obst += n;
+	itile->cap = itile->n_obst;
+	itile->spilled = B_FALSE;
+
+	return (B_TRUE);
+}
+
+/*
+ * Parses a chunk of complete DOF lines and sorts the obstacles into the
+ * import tiles. Parsing happens without holding any locks, the lock is
+ * only taken once to add the entire chunk's worth of obstacles.
+ */
+static void
+import_parse_chunk(dof_import_t *imp, const char *buf, size_t len)
+{
+	const char *end = buf + len;
+	obst_t *obst = NULL;
+	size_t n_obst = 0, cap = 0;
+	import_tile_t *itile = NULL;
+
+	for (const char *line = buf; line < end;) {
+		const char *nl = memchr(line, '\n', end - line);
+		const char *line_end = (nl != NULL ? nl : end);
+
+		if (n_obst == cap) {
+			cap = MAX(cap * 2, 1024);
+			obst = safe_realloc(obst, cap * sizeof (*obst));
+		}
+		if (dof_parse_line(line, line_end, &obst[n_obst]))
+			n_obst++;
+		line = line_end + 1;
+	}
+
+	mutex_enter(&imp->lock);
+	for (size_t i = 0; i < n_obst; i++) {
+		tile_key_t srch = {
+		    .lat = floor(obst[i].pos.lat),
+		    .lon = floor(obst[i].pos.lon)
+		};
+		avl_index_t where;
+
+		/* Consecutive obstacles are usually close to each other */
+		if (itile == NULL || itile->lat != srch.lat ||
+		    itile->lon != srch.lon) {
+			itile = avl_find(&imp->tiles, &srch, &where);
+			if (itile == NULL) {
+				itile = import_tile_alloc(srch.lat, srch.lon);
+				avl_insert(&imp->tiles, itile, where);
+			}
+		}
+		import_tile_add(itile, &obst[i]);
+	}
+	imp->n_obst += n_obst;
+	imp->n_mem_obst += n_obst;
+	if (imp->n_mem_obst > IMPORT_MAX_MEM_OBST)
+		import_spill(imp);
+	mutex_exit(&imp->lock);
+
+	free(obst);
+}
+
+static void
+import_proc(void *userinfo, void *thr_info, void *task)
+{
+	dof_import_t *imp = userinfo;
+	import_job_t *job = task;
+
+	UNUSED(thr_info);
+	ASSERT(imp != NULL);
+	ASSERT(job != NULL);
+
+	switch (job->type) {
+	case IMPORT_JOB_PARSE:
+		import_parse_chunk(imp, job->buf, job->len);
+		free(job->buf);
+		break;
+	case IMPORT_JOB_WRITE:
+		if ((job->itile->spilled && !import_unspill(imp, job->itile)) ||
+		    !write_tile(imp->tmpdir, job->itile)) {
+			mutex_enter(&imp->lock);
+			imp->failed = B_TRUE;
+			mutex_exit(&imp->lock);
+		}
+		/* Keep at most one tile per job in memory */
+		LACF_DESTROY(job->itile->obst);
+		break;
+	}
+	free(job);
+
+	mutex_enter(&imp->lock);
+	ASSERT(imp->jobs_pending != 0);
+	imp->jobs_pending--;
+	cv_broadcast(&imp->cv);
+	mutex_exit(&imp->lock);
+}
+
+static void
+import_discard(void *userinfo, void *task)
+{
+	import_job_t *job = task;
+
+	UNUSED(userinfo);
+	ASSERT(job != NULL);
+	/*
+	 * We always wait for all jobs to complete before freeing the taskq,
+	 * so there can never be any left over.
+	 */
+	VERIFY_FAIL();
+}
+
+/*
+ * Hands off the complete lines in the current chunk to a parse job and
+ * carries any trailing partial line over into a new chunk.
+ */
+static void
+import_flush_chunk(dof_import_t *imp, bool_t last)
+{
+	import_job_t *job;
+	size_t cut = imp->chunk_len;
+
+	if (!last) {
+		while (cut > 0 && imp->chunk[cut - 1] != '\n')
+			cut--;
+		/* Absurdly long line, just split it */
+		if (cut == 0)
+			cut = imp->chunk_len;
+	}
+	job = safe_calloc(1, sizeof (*job));
+	job->type = IMPORT_JOB_PARSE;
+	job->buf = imp->chunk;
+	job->len = cut;
+
+	imp->chunk = safe_malloc(IMPORT_CHUNK_SZ);
+	imp->chunk_len = imp->chunk_len - cut;
+	memcpy(imp->chunk, job->buf + cut, imp->chunk_len);
+
+	import_submit(imp, job);
+}
+
+static size_t
+import_unzip_cb(void *arg, uint64_t offset, const void *data, size_t size)
+{
+	dof_import_t *imp = arg;
+	const char *p = data;
+
+	UNUSED(offset);
+	ASSERT(imp != NULL);
+	ASSERT(data != NULL || size == 0);
+
+	/* Respond to an early termination request */
+	if (!imp->odb->refresh_run)
+		return (0);
+	for (size_t left = size; left > 0;) {
+		size_t n = MIN(left, IMPORT_CHUNK_SZ - imp->chunk_len);
+
+		memcpy(&imp->chunk[imp->chunk_len], p, n);
+		imp->chunk_len += n;
+		p += n;
+		left -= n;
+		if (imp->chunk_len == IMPORT_CHUNK_SZ)
+			import_flush_chunk(imp, B_FALSE);
+	}
+
+	return (size);
+}
+
+/*
+ * Locates the CSV file in the DOF archive and opens it as the current
+ * entry.
+ */
+static bool_t
+open_dof_entry(struct zip_t *zip)
+{
+	ssize_t n = zip_entries_total(zip);
+
+	for (ssize_t i = 0; i < n; i++) {
+		const char *name;
+
+		if (zip_entry_openbyindex(zip, i) != 0)
+			continue;
+		name = zip_entry_name(zip);
+		if (name != NULL && strlen(name) > 4 &&
+		    lacf_strcasecmp(&name[strlen(name) - 4], ".csv") == 0)
+			return (B_TRUE);
+		zip_entry_close(zip);
+	}
+	return (B_FALSE);
+}
+
+/*
+ * Decompresses and parses the DOF CSV file in `zip' into imp->tiles.
+ */
+static bool_t
+import_parse_dof(dof_import_t *imp, struct zip_t *zip)
+{
+	int err;
+
+	if (!open_dof_entry(zip)) {
+		logMsg("Error importing obstacle database: DOF archive "
+		    "doesn't contain a CSV file");
+		return (B_FALSE);
+	}
+	if (file_exists(imp->spilldir, NULL))
+		remove_directory(imp->spilldir);
+	if (!create_directory_recursive(imp->spilldir))
+		return (B_FALSE);
+	imp->chunk = safe_malloc(IMPORT_CHUNK_SZ);
+	err = zip_entry_extract(zip, import_unzip_cb, imp);
+	zip_entry_close(zip);
+	if (err == 0 && imp->chunk_len != 0) {
+		import_flush_chunk(imp, B_TRUE);
+	}
+	import_wait(imp);
+	LACF_DESTROY(imp->chunk);
+
+	if (err != 0) {
+		if (imp->odb->refresh_run) {
+			logMsg("Error importing obstacle database: "
+			    "error decompressing DOF archive: %s",
+			    zip_strerror(err));
+		}
+		return (B_FALSE);
+	}
+	return (!imp->failed);
+}
+
+/*
+ * Writes all imported tiles into imp->tmpdir in parallel.
+ */
+static bool_t
+import_write_tiles(dof_import_t *imp)
+{
+	if (file_exists(imp->tmpdir, NULL))
+		remove_directory(imp->tmpdir);
+	if (!create_directory_recursive(imp->tmpdir))
+		return (B_FALSE);
+	/*
+	 * No more parse jobs are running, so the tile tree is stable
+	 * and can be walked without holding the lock.
+	 */
+	for (import_tile_t *itile = avl_first(&imp->tiles);
+	    itile != NULL; itile = AVL_NEXT(&imp->tiles, itile)) {
+		import_job_t *job = safe_calloc(1, sizeof (*job));
+
+		job->type = IMPORT_JOB_WRITE;
+		job->itile = itile;
+		import_submit(imp, job);
+	}
+	import_wait(imp);
+
+	return (!imp->failed);
+}
+
+/*
+ * Replaces the country's tile cache with the newly written tiles. The
+ * new tiles are published atomically: from the moment the old tiles are
+ * retired, readers load tiles straight out of the import directory,
+ * while the retired tiles remain valid for readers which are still
+ * using them. Once the last of those is gone, the old tile files are
+ * no longer in use and can be replaced.
+ */
+static void
+import_swap_tiles(dof_import_t *imp)
+{
+	odb_t *odb = imp->odb;
+	char *ccpath = mkpathname(odb->cache_dir, imp->cc, NULL);
+	odb_tile_t **free_tiles;
+	size_t n_free;
+	unsigned gen;
+	bool_t renamed;
+
+	mutex_enter(&odb->tiles_lock);
+	gen = odb->tiles_gen++;
+	odb->swap_dir = imp->tmpdir;
+	free_tiles = odb_retire_tiles(odb, &n_free);
+	mutex_exit(&odb->tiles_lock);
+
+	for (size_t i = 0; i < n_free; i++)
+		free_tile(free_tiles[i]);
+	free(free_tiles);
+
+	/*
+	 * Wait for readers to drop the retired tiles and for any loads of
+	 * the old tiles to complete. Tiles may still be mapping the old
+	 * tile files, which would prevent their removal on Windows.
+	 */
+	mutex_enter(&odb->tiles_lock);
+	while (odb->n_retired != 0 || odb->n_loading[gen & 1] != 0)
+		cv_wait(&odb->tiles_cv, &odb->tiles_lock);
+	mutex_exit(&odb->tiles_lock);
+
+	if (file_exists(ccpath, NULL))
+		remove_directory(ccpath);
+
+	/*
+	 * Tiles loaded from swap_dir aren't mapped, so they don't need to
+	 * be retired, but in-flight loads can still have files in it open.
+	 * Holding tiles_lock prevents new loads from starting until the
+	 * new tiles have been moved into place.
+	 */
+	mutex_enter(&odb->tiles_lock);
+	while (odb->n_loading[odb->tiles_gen & 1] != 0)
+		cv_wait(&odb->tiles_cv, &odb->tiles_lock);
+	renamed = rename_dir(imp->tmpdir, ccpath);
+	odb->swap_dir = NULL;
+	mutex_exit(&odb->tiles_lock);
+
+	if (renamed) {
+		write_odb_refresh_date(odb, imp->cc);
+		odb->refresh_times[ODB_REGION_US] = time(NULL);
+	}
+	lacf_free(ccpath);
+}
+
+/*
+ * Imports a DOF ZIP archive stored in `path' into the tile cache of
+ * country `cc'. The caller must have set odb->refresh_run, clearing it
+ * aborts the import.
+ */
+static bool_t
+odb_import_dof(odb_t *odb, const char *cc, const char *path)
+{
+	dof_import_t imp = { .odb = odb, .cc = cc };
+	struct zip_t *zip;
+	unsigned num_cpus = lacf_get_num_cpus();
+	bool_t res = B_FALSE;
+	uint64_t start = microclock();
+	void *cookie = NULL;
+	import_tile_t *itile;
+
+	ASSERT(odb != NULL);
+	ASSERT(cc != NULL);
+	ASSERT(path != NULL);
+
+	zip = zip_open(path, 0, 'r');
+	if (zip == NULL) {
+		logMsg("Error importing obstacle database: can't open "
+		    "DOF archive %s", path);
+		return (B_FALSE);
+	}
+	imp.tmpdir = sprintf_alloc("%s%c%s.new", odb->cache_dir, DIRSEP, cc);
+	imp.spilldir = sprintf_alloc("%s%c%s" IMPORT_SPILL_SUFFIX,
+	    odb->cache_dir, DIRSEP, cc);
+	mutex_init(&imp.lock);
+	cv_init(&imp.cv);
+	avl_create(&imp.tiles, tile_compar, sizeof (import_tile_t),
+	    offsetof(import_tile_t, node));
+	imp.max_jobs = num_cpus * IMPORT_JOBS_PER_CPU;
+	imp.tq = taskq_alloc(0, num_cpus, IMPORT_THR_STOP_DELAY, NULL, NULL,
+	    import_proc, import_discard, &imp);
+
+	if (import_parse_dof(&imp, zip) && odb->refresh_run &&
+	    import_write_tiles(&imp) && odb->refresh_run) {
+		import_swap_tiles(&imp);
+		logMsg("Imported %lu obstacles in %lu tiles for region \"%s\" "
+		    "in %.1f s", (unsigned long)imp.n_obst,
+		    (unsigned long)avl_numnodes(&imp.tiles), cc,
+		    USEC2SEC((double)(microclock() - start)));
+		res = B_TRUE;
+	}
+	if (!res && file_exists(imp.tmpdir, NULL))
+		remove_directory(imp.tmpdir);
+	if (file_exists(imp.spilldir, NULL))
+		remove_directory(imp.spilldir);
+
+	taskq_free(imp.tq);
+	while ((itile = avl_destroy_nodes(&imp.tiles, &cookie)) != NULL)
+		free_import_tile(itile);
+	avl_destroy(&imp.tiles);
+	cv_destroy(&imp.cv);
+	mutex_destroy(&imp.lock);
+	free(imp.tmpdir);
+	free(imp.spilldir);
+	zip_close(zip);
+
+	return (res);
+}
+
+static void
+odb_refresh_us(odb_t *odb)
+{
+	CURL *curl;
+	CURLcode res;
+	dl_info_t dl_info = { .odb = odb };
+	time_t refresh_date;
+	char *zippath;
+
+	thread_set_name("odb-refresh-us");
+
+	ASSERT(odb != NULL);
+
+	/* Download to a file, rather than holding the archive in memory */
+	create_directory_recursive(odb->cache_dir);
+	zippath = mkpathname(odb->cache_dir, "US-DOF.zip.part", NULL);
+	dl_info.fp = fopen(zippath, "wb");
+	if (dl_info.fp == NULL) {
+		logMsg("Error updating obstacle database: can't write %s: %s",
+		    zippath, strerror(errno));
+		odb->refresh_times[ODB_REGION_US] = -1u;
+		goto out;
+	}
+
+	curl = curl_easy_init();
+	VERIFY(curl != NULL);
+
+	logMsg("Downloading new obstacle data from \"%s\" for region \"US\"",
+	    FAA_DOF_URL);
+	curl_easy_setopt(curl, CURLOPT_URL, FAA_DOF_URL);
+	chart_setup_curl(curl, odb->cainfo);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, dl_write);
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &dl_info);
 	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, LOW_SPD_TIME);
 	curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, LOW_SPD_LIM);
@@ -607,13 +1687,20 @@ odb_refresh_us(odb_t *odb)
 		    (long)CURL_TIMECOND_IFMODSINCE);
 	}
 	res = curl_easy_perform(curl);
+	fclose(dl_info.fp);
 
 	if (res == CURLE_OK) {
 		long code = 0;
 
 		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
 		if (code == 200) {
-			odb_refresh_us_decompress(odb, &dl_info);
+			if (dl_info.bytes == 0) {
+				logMsg("Error updating obstacle database "
+				    "from %s: server didn't send any data",
+				    FAA_DOF_URL);
+			} else if (!odb_import_dof(odb, "US", zippath)) {
+				odb->refresh_times[ODB_REGION_US] = -1u;
+			}
 		} else if (code == 304) {
 			logMsg("Obstacle database %s unchanged", FAA_DOF_URL);
 			mutex_enter(&odb->tiles_lock);
@@ -631,7 +1718,9 @@ odb_refresh_us(odb_t *odb)
 	}
 
 	curl_easy_cleanup(curl);
-	free(dl_info.buf);
+	remove_file(zippath, B_TRUE);
+out:
+	lacf_free(zippath);
 
 	mutex_enter(&odb->refresh_lock);
 	odb->refresh_run = B_FALSE;
@@ -661,93 +1750,259 @@ odb_refresh_cc(odb_t *odb, const char *cc)
 	return (B_TRUE);
 }
 
-static void
-add_tile_obst(obst_type_t type, geo_pos3_t pos, float agl,
-    obst_light_t light, unsigned quant, void *userinfo)
+/*
+ * Same as odb_refresh_cc(), but rather than downloading the obstacle
+ * data, it is imported from a locally stored file. For the "US" region,
+ * this is the FAA DOF archive (DAILY_DOF_CSV.ZIP). The import runs
+ * synchronously in the calling thread.
+ * @return B_TRUE if the import succeeded, B_FALSE if the region isn't
+ *	supported, the file couldn't be imported, or a refresh of the
+ *	database is already in progress.
+ */
+bool_t
+odb_refresh_cc_from_file(odb_t *odb, const char *cc, const char *path)
 {
-	odb_tile_t *tile;
-	obst_t *obst = safe_calloc(1, sizeof (*obst));
+	bool_t res;
 
-	ASSERT(userinfo != NULL);
-	tile = userinfo;
-	ASSERT(tile->odb != NULL);
-	ASSERT_MUTEX_HELD(&tile->odb->tiles_lock);
+	ASSERT(odb != NULL);
+	ASSERT(cc != NULL);
+	ASSERT(path != NULL);
 
-	obst->type = type;
-	obst->pos = pos;
-	obst->agl = agl;
-	obst->light = light;
-	obst->quant = quant;
+	if (strcmp(cc, "US") != 0)
+		return (B_FALSE);
+	mutex_enter(&odb->refresh_lock);
+	if (odb->refresh_run) {
+		mutex_exit(&odb->refresh_lock);
+		return (B_FALSE);
+	}
+	odb->refresh_run = B_TRUE;
+	mutex_exit(&odb->refresh_lock);
+
+	res = odb_import_dof(odb, cc, path);
 
-	list_insert_tail(&tile->obst, obst);
+	mutex_enter(&odb->refresh_lock);
+	odb->refresh_run = B_FALSE;
+	mutex_exit(&odb->refresh_lock);
+
+	return (res);
 }
 
 static void
-add_obst_to_odb(obst_type_t type, geo_pos3_t pos, float agl,
+add_tile_obst(obst_type_t type, geo_pos3_t pos, float agl,
     obst_light_t light, unsigned quant, void *userinfo)
 {
-	odb_t *odb;
-	odb_tile_t *tile;
+	obst_t obst = {
+	    .type = type, .pos = pos, .agl = agl, .light = light,
+	    .quant = quant
+	};
 
 	ASSERT(userinfo != NULL);
-	odb = userinfo;
+	import_tile_add(userinfo, &obst);
+}
 
-	mutex_enter(&odb->tiles_lock);
-	tile = load_tile(odb, floor(pos.lat), floor(pos.lon), B_FALSE);
-	add_tile_obst(type, pos, agl, light, quant, tile);
-	mutex_exit(&odb->tiles_lock);
+/*
+ * Converts a tile from the legacy CSV tile cache into the packed format
+ * and replaces the CSV file with the packed version.
+ */
+static void
+convert_csv_tile(odb_tile_t *tile, const char *csvpath, const char *binpath)
+{
+	import_tile_t *itile;
+	void *buf;
+	size_t bufsz;
+
+	ASSERT(tile != NULL);
+	ASSERT(csvpath != NULL);
+	ASSERT(binpath != NULL);
+
+	itile = import_tile_alloc(tile->lat, tile->lon);
+	odb_proc_us_dof(csvpath, add_tile_obst, itile);
+	buf = pack_import_tile(itile, &bufsz);
+	free_import_tile(itile);
+
+	VERIFY(tile_attach(tile, buf, bufsz, B_FALSE));
+	if (write_tile_file(binpath, buf, bufsz))
+		remove_file(csvpath, B_TRUE);
 }
 
+/*
+ * Loads a tile from the region's tile cache. If `swap_dir' is not NULL,
+ * the tile is read from there instead of the tile cache, without mapping
+ * the file (see import_swap_tiles()).
+ */
 static void
-odb_populate_tile_us(odb_t *odb, odb_tile_t *tile)
+odb_populate_tile_us(odb_t *odb, odb_tile_t *tile, const char *swap_dir)
 {
 	char tilepath[32];
-	char *path;
+	char *path, *binpath;
+	void *buf;
+	size_t bufsz;
 
 	ASSERT(odb != NULL);
 	ASSERT(tile != NULL);
 
 	latlon2path(tile->lat, tile->lon, tilepath);
+	if (swap_dir != NULL) {
+		path = mkpathname(swap_dir, tilepath, NULL);
+		binpath = sprintf_alloc("%s" ODB_TILE_SUFFIX, path);
+		buf = file2buf(binpath, &bufsz);
+		if (buf != NULL && !tile_attach(tile, buf, bufsz, B_FALSE)) {
+			logMsg("Obstacle database tile %s is corrupt, "
+			    "ignoring it", binpath);
+			free(buf);
+		}
+		goto out;
+	}
 	path = mkpathname(odb->cache_dir, "US", tilepath, NULL);
-	odb_proc_us_dof(path, add_tile_obst, tile);
+	binpath = sprintf_alloc("%s" ODB_TILE_SUFFIX, path);
+
+	buf = map_tile_file(binpath, &bufsz);
+	if (buf != NULL) {
+		if (!tile_attach(tile, buf, bufsz, B_TRUE)) {
+			logMsg("Obstacle database tile %s is corrupt, "
+			    "ignoring it", binpath);
+			unmap_tile_file(buf, bufsz);
+		}
+	} else if (file_exists(path, NULL)) {
+		convert_csv_tile(tile, path, binpath);
+	}
+out:
+	free(binpath);
 	lacf_free(path);
 }
 
 static void
-odb_populate_tile(odb_t *odb, odb_tile_t *tile)
+odb_populate_tile(odb_t *odb, odb_tile_t *tile, const char *swap_dir)
 {
 	ASSERT(odb != NULL);
 	ASSERT(tile != NULL);
-	odb_populate_tile_us(odb, tile);
+	odb_populate_tile_us(odb, tile, swap_dir);
+}
+
+static void
+tile_load_done(odb_t *odb, unsigned gen)
+{
+	ASSERT_MUTEX_HELD(&odb->tiles_lock);
+	ASSERT(odb->n_loading[gen & 1] != 0);
+	odb->n_loading[gen & 1]--;
+	if (odb->n_loading[gen & 1] == 0)
+		cv_broadcast(&odb->tiles_cv);
 }
 
+/*
+ * Returns a reference to the tile at lat/lon, loading it if necessary.
+ * The tile must be released using tile_rele(). tiles_lock is only held
+ * while looking up and inserting the tile, the tile itself is loaded
+ * without holding it. If a refresh retires the loaded tiles while we
+ * were loading the tile, the load is retried.
+ */
 static odb_tile_t *
-load_tile(odb_t *odb, int lat, int lon, bool_t load_from_db)
+tile_get(odb_t *odb, int lat, int lon)
 {
-	odb_tile_t *tile;
-	odb_tile_t srch = { .lat = lat, .lon = lon };
-	avl_index_t where;
+	tile_key_t srch = { .lat = lat, .lon = lon };
 
 	ASSERT(odb != NULL);
-	ASSERT_MUTEX_HELD(&odb->tiles_lock);
 
-	tile = avl_find(&odb->tiles, &srch, &where);
-	if (tile == NULL) {
-		tile = safe_calloc(1, sizeof (*tile));
-		tile->odb = odb;
-		tile->lat = lat;
-		tile->lon = lon;
-		list_create(&tile->obst, sizeof (obst_t),
-		    offsetof(obst_t, node));
+	for (;;) {
+		odb_tile_t *tile, *new_tile;
+		avl_index_t where;
+		unsigned gen;
+		char *swap_dir = NULL;
+
+		mutex_enter(&odb->tiles_lock);
+		tile = avl_find(&odb->tiles, &srch, NULL);
+		if (tile != NULL) {
+			tile->refcnt++;
+			mutex_exit(&odb->tiles_lock);
+			return (tile);
+		}
+		gen = odb->tiles_gen;
+		odb->n_loading[gen & 1]++;
+		if (odb->swap_dir != NULL)
+			swap_dir = safe_strdup(odb->swap_dir);
+		mutex_exit(&odb->tiles_lock);
+
+		new_tile = safe_calloc(1, sizeof (*new_tile));
+		new_tile->odb = odb;
+		new_tile->lat = lat;
+		new_tile->lon = lon;
+		odb_populate_tile(odb, new_tile, swap_dir);
+		free(swap_dir);
+
+		mutex_enter(&odb->tiles_lock);
+		if (gen == odb->tiles_gen) {
+			tile = avl_find(&odb->tiles, &srch, &where);
+			if (tile == NULL) {
+				/* One reference for the index, one for us */
+				new_tile->refcnt = 2;
+				avl_insert(&odb->tiles, new_tile, where);
+				tile_load_done(odb, gen);
+				mutex_exit(&odb->tiles_lock);
+				return (new_tile);
+			}
+			tile->refcnt++;
+		}
+		mutex_exit(&odb->tiles_lock);
+		/*
+		 * Lost a race with another thread loading the same tile,
+		 * or with a refresh. The load only counts as complete once
+		 * the tile's file has been unmapped.
+		 */
+		free_tile(new_tile);
+		mutex_enter(&odb->tiles_lock);
+		tile_load_done(odb, gen);
+		mutex_exit(&odb->tiles_lock);
+		if (tile != NULL)
+			return (tile);
+	}
+}
+
+static void
+tile_rele(odb_tile_t *tile)
+{
+	odb_t *odb;
+
+	ASSERT(tile != NULL);
+	odb = tile->odb;
 
-		if (load_from_db)
-			odb_populate_tile(odb, tile);
-		avl_insert(&odb->tiles, tile, where);
+	mutex_enter(&odb->tiles_lock);
+	ASSERT(tile->refcnt != 0);
+	tile->refcnt--;
+	if (tile->refcnt != 0) {
+		mutex_exit(&odb->tiles_lock);
+		return;
 	}
-	if (load_from_db)
-		tile->access_t = time(NULL);
+	mutex_exit(&odb->tiles_lock);
+	/*
+	 * The tile index holds a reference to all current tiles, so this
+	 * was the last reader of a retired tile. Nobody else can get at it.
+	 */
+	free_tile(tile);
+	mutex_enter(&odb->tiles_lock);
+	ASSERT(odb->n_retired != 0);
+	odb->n_retired--;
+	if (odb->n_retired == 0)
+		cv_broadcast(&odb->tiles_cv);
+	mutex_exit(&odb->tiles_lock);
+}
 
-	return (tile);
+typedef struct {
+	add_obst_cb_t	cb;
+	void		*userinfo;
+} get_obst_info_t;
+
+static void
+get_obstacles_cb(const odb_tile_t *tile, unsigned i, void *userinfo)
+{
+	get_obst_info_t *info;
+	obst_t obst;
+
+	ASSERT(userinfo != NULL);
+	info = userinfo;
+
+	tile_get_obst(tile, i, &obst);
+	info->cb(obst.type, obst.pos, obst.agl, obst.light, obst.quant,
+	    info->userinfo);
 }
 
 bool_t
@@ -755,22 +2010,268 @@ odb_get_obstacles(odb_t *odb, int lat, int lon, add_obst_cb_t cb,
     void *userinfo)
 {
 	odb_tile_t *tile;
+	get_obst_info_t info = { .cb = cb, .userinfo = userinfo };
 
 	ASSERT(odb != NULL);
 	ASSERT(cb != NULL);
 
-	mutex_enter(&odb->tiles_lock);
+	tile = tile_get(odb, lat, lon);
+	tile_query_box(tile, lat, lon, lat + 1, lon + 1, 0, get_obstacles_cb,
+	    &info);
+	tile_rele(tile);
+
+	return (B_TRUE);
+}
+
+/*
+ * Runs tile_query_box() over all tiles overlapping a lat/lon box. The
+ * box may extend past the antimeridian (lon_min < -180 or lon_max > 180)
+ * and is split accordingly.
+ */
+static void
+odb_query_box(odb_t *odb, double lat_min, double lon_min, double lat_max,
+    double lon_max, double min_agl, tile_obst_cb_t cb, void *userinfo)
+{
+	int lat_i_min, lat_i_max, lon_i_min, lon_i_max;
 
-	tile = load_tile(odb, lat, lon, B_TRUE);
-	for (obst_t *obst = list_head(&tile->obst); obst != NULL;
-	    obst = list_next(&tile->obst, obst)) {
-		cb(obst->type, obst->pos, obst->agl, obst->light, obst->quant,
-		    userinfo);
+	ASSERT(odb != NULL);
+	ASSERT3F(lat_min, <=, lat_max);
+	ASSERT3F(lon_min, <=, lon_max);
+
+	lat_i_min = clampi(floor(lat_min), -90, 89);
+	lat_i_max = clampi(floor(lat_max), -90, 89);
+	if (lon_max - lon_min >= 360) {
+		lon_min = -180;
+		lon_max = 180;
+	}
+	lon_i_min = floor(lon_min);
+	lon_i_max = MIN(floor(lon_max), lon_min + 359);
+
+	for (int lat_i = lat_i_min; lat_i <= lat_i_max; lat_i++) {
+		for (int lon_i = lon_i_min; lon_i <= lon_i_max; lon_i++) {
+			int tile_lon = lon_i;
+			odb_tile_t *tile;
+
+			if (tile_lon < -180)
+				tile_lon += 360;
+			else if (tile_lon >= 180)
+				tile_lon -= 360;
+			tile = tile_get(odb, lat_i, tile_lon);
+			tile_query_box(tile, lat_min, lon_min + tile_lon - lon_i,
+			    lat_max, lon_max + tile_lon - lon_i, min_agl,
+			    cb, userinfo);
+			tile_rele(tile);
+		}
 	}
+}
 
-	mutex_exit(&odb->tiles_lock);
+/*
+ * Returns the longitude half-width in degrees of a box enclosing a
+ * spherical cap of angular radius `r' (in radians) centered at `lat'.
+ * Returns 180 if the cap contains a pole.
+ */
+static double
+cap_lon_extent(double lat, double r)
+{
+	double s;
+
+	if (fabs(lat) + RAD2DEG(r) >= 90)
+		return (180);
+	s = sin(r) / cos(DEG2RAD(lat));
+	if (s >= 1)
+		return (180);
+	return (RAD2DEG(asin(s)));
+}
 
-	return (B_TRUE);
+/*
+ * Slack applied to the query bounding boxes to account for the query
+ * distances being computed on the WGS-84 ellipsoid, rather than on a
+ * sphere of radius EARTH_MSL.
+ */
+#define	QUERY_BOX_SLACK		1.01
+
+static inline vect3_t
+obst_ecef(double lat, double lon)
+{
+	return (geo2ecef_mtr(GEO_POS3(lat, lon, 0), &wgs84));
+}
+
+/*
+ * Distances are evaluated the same way as gc_distance(), from the ECEF
+ * chord length between the two points.
+ */
+typedef struct {
+	odb_obst_t	*out;
+	size_t		cap;
+	size_t		n;
+	vect3_t		a, b;		/* center, or corridor endpoints */
+	vect3_t		norm;		/* corridor great circle normal */
+	double		chord_sq;	/* squared chord length of radius */
+	double		cross_lim;	/* max distance from corridor plane */
+	bool_t		corridor;
+} area_query_t;
+
+static bool_t
+area_query_match(const area_query_t *q, vect3_t p)
+{
+	vect3_t pa = vect3_sub(p, q->a);
+
+	if (vect3_dotprod(pa, pa) <= q->chord_sq)
+		return (B_TRUE);
+	if (q->corridor) {
+		vect3_t pb = vect3_sub(p, q->b);
+
+		if (vect3_dotprod(pb, pb) <= q->chord_sq)
+			return (B_TRUE);
+		/* Cross-track distance, only valid between the endpoints */
+		return (fabs(vect3_dotprod(p, q->norm)) <= q->cross_lim &&
+		    vect3_dotprod(vect3_xprod(q->a, p), q->norm) >= 0 &&
+		    vect3_dotprod(vect3_xprod(p, q->b), q->norm) >= 0);
+	}
+	return (B_FALSE);
+}
+
+static void
+area_query_set_radius(area_query_t *q, double r)
+{
+	ASSERT(q != NULL);
+	q->chord_sq = POW2(2 * EARTH_MSL * sin(MIN(r, M_PI) / 2));
+	q->cross_lim = EARTH_MSL * sin(MIN(r, M_PI_2));
+}
+
+static void
+area_query_cb(const odb_tile_t *tile, unsigned i, void *userinfo)
+{
+	area_query_t *q;
+	obst_t obst;
+
+	ASSERT(userinfo != NULL);
+	q = userinfo;
+
+	tile_get_obst(tile, i, &obst);
+	if (!area_query_match(q, obst_ecef(obst.pos.lat, obst.pos.lon)))
+		return;
+	if (q->n < q->cap) {
+		odb_obst_t *o = &q->out[q->n];
+
+		o->type = obst.type;
+		o->pos = obst.pos;
+		o->agl = obst.agl;
+		o->light = obst.light;
+		o->quant = obst.quant;
+	}
+	q->n++;
+}
+
+/*
+ * Locates all obstacles at least `min_agl' meters tall within `radius'
+ * meters of `center', loading tiles as needed. The distance is measured
+ * the same way as gc_distance().
+ * Up to `cap' matching obstacles are copied into `out' (in no particular
+ * order). The results are copies, so the database isn't locked while
+ * the caller works with them.
+ * @return The total number of matching obstacles. If this is greater
+ *	than `cap', the output was truncated and the caller should retry
+ *	with a larger buffer.
+ */
+size_t
+odb_get_obstacles_radius(odb_t *odb, geo_pos2_t center, double radius,
+    double min_agl, odb_obst_t *out, size_t cap)
+{
+	area_query_t q = { .out = out, .cap = cap };
+	double r = radius / EARTH_MSL;
+	double dlat = RAD2DEG(r * QUERY_BOX_SLACK), dlon;
+
+	ASSERT(odb != NULL);
+	ASSERT(is_valid_lat(center.lat));
+	ASSERT(is_valid_lon(center.lon));
+	ASSERT3F(radius, >=, 0);
+	ASSERT(out != NULL || cap == 0);
+
+	q.a = obst_ecef(center.lat, center.lon);
+	area_query_set_radius(&q, r);
+	dlon = cap_lon_extent(center.lat, r * QUERY_BOX_SLACK);
+
+	odb_query_box(odb, MAX(center.lat - dlat, -90),
+	    center.lon - dlon, MIN(center.lat + dlat, 90),
+	    center.lon + dlon, min_agl, area_query_cb, &q);
+
+	return (q.n);
+}
+
+/*
+ * Same as odb_get_obstacles_radius(), but locates obstacles within
+ * `half_width' meters either side of the great circle segment from
+ * `start' to `end' (including the semicircular caps around both
+ * endpoints). Intended for checking the swept path ahead of an aircraft.
+ * The segment must be shorter than half of the Earth's circumference.
+ */
+size_t
+odb_get_obstacles_corridor(odb_t *odb, geo_pos2_t start, geo_pos2_t end,
+    double half_width, double min_agl, odb_obst_t *out, size_t cap)
+{
+	area_query_t q = { .out = out, .cap = cap, .corridor = B_TRUE };
+	double r = half_width / EARTH_MSL;
+	double lat_min, lat_max, lon_min, lon_max, dlon;
+	vect3_t n;
+
+	ASSERT(odb != NULL);
+	ASSERT(is_valid_lat(start.lat));
+	ASSERT(is_valid_lon(start.lon));
+	ASSERT(is_valid_lat(end.lat));
+	ASSERT(is_valid_lon(end.lon));
+	ASSERT3F(half_width, >=, 0);
+	ASSERT(out != NULL || cap == 0);
+
+	q.a = obst_ecef(start.lat, start.lon);
+	q.b = obst_ecef(end.lat, end.lon);
+	area_query_set_radius(&q, r);
+	n = vect3_xprod(vect3_unit(q.a, NULL), vect3_unit(q.b, NULL));
+	if (vect3_abs(n) < 1e-12) {
+		/* Degenerate segment, just use the endpoint caps */
+		return (odb_get_obstacles_radius(odb, start, half_width,
+		    min_agl, out, cap));
+	}
+	q.norm = vect3_unit(n, NULL);
+
+	/*
+	 * Bounding box of the segment. Longitude varies monotonically
+	 * along the segment, so unwrap the end longitude relative to the
+	 * start. Latitude peaks at the great circle's vertex, if that
+	 * lies on the segment.
+	 */
+	lat_min = MIN(start.lat, end.lat);
+	lat_max = MAX(start.lat, end.lat);
+	lon_min = MIN(start.lon, start.lon + normalize_lon(end.lon -
+	    start.lon));
+	lon_max = MAX(start.lon, start.lon + normalize_lon(end.lon -
+	    start.lon));
+	for (int sign = -1; sign <= 1; sign += 2) {
+		/* Northern- (sign=1) or southern-most point of the circle */
+		vect3_t z = VECT3(0, 0, sign);
+		vect3_t v = vect3_sub(z, vect3_scmul(q.norm,
+		    vect3_dotprod(z, q.norm)));
+
+		if (vect3_abs(v) < 1e-12)
+			continue;	/* segment runs along the equator */
+		v = vect3_scmul(vect3_unit(v, NULL), EARTH_MSL);
+		if (vect3_dotprod(vect3_xprod(q.a, v), q.norm) >= 0 &&
+		    vect3_dotprod(vect3_xprod(v, q.b), q.norm) >= 0) {
+			double lat = ecef2geo(v, &wgs84).lat;
+
+			lat_min = MIN(lat_min, lat);
+			lat_max = MAX(lat_max, lat);
+		}
+	}
+	r *= QUERY_BOX_SLACK;
+	dlon = MAX(cap_lon_extent(lat_min, r), cap_lon_extent(lat_max, r));
+	lat_min = MAX(lat_min - RAD2DEG(r), -90);
+	lat_max = MIN(lat_max + RAD2DEG(r), 90);
+
+	odb_query_box(odb, lat_min, lon_min - dlon, lat_max, lon_max + dlon,
+	    min_agl, area_query_cb, &q);
+
+	return (q.n);
 }
 
 void
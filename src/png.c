@@ -28,6 +28,7 @@
 #include <stdio.h>
 
 #include <png.h>
+#include <zlib.h>
 
 #include <acfutils/assert.h>
 #include <acfutils/log.h>
@@ -40,6 +41,29 @@ typedef struct {
 	size_t		cur;
 } bufread_t;
 
+/* Rows per rows_cb call while decoding non-interlaced images */
+#define	DEC_STRIPE_ROWS	64
+/* Size of the chunks png_load_from_file_into() reads from disk */
+#define	DEC_READ_BUFSZ	(64 << 10)
+
+struct png_dec_s {
+	png_structp		pngp;
+	png_infop		infop;
+	png_pixfmt_t		fmt;
+	png_dec_header_cb_t	header_cb;
+	png_dec_rows_cb_t	rows_cb;
+	void			*userinfo;
+
+	uint8_t			*out;
+	size_t			stride;
+	int			w, h;
+	bool_t			interlaced;
+	int			rows_ready;
+	int			rows_done;
+	bool_t			done;
+	bool_t			failed;
+};
+
 /*
  * This is a simplified PNG file loading routine that avoids having to deal
  * with all that libpng nonsense.
@@ -298,21 +322,443 @@ png_load_from_buffer_cairo_argb32(const void *buf, size_t len,
 	}
 }
 
+static size_t
+pixfmt_bpp(png_pixfmt_t fmt)
+{
+	switch (fmt) {
+	case PNG_PIXFMT_RGBA8:
+	case PNG_PIXFMT_ARGB32:
+		return (4);
+	case PNG_PIXFMT_GREY8:
+		return (1);
+	default:
+		VERIFY_FAIL();
+	}
+}
+
+/*
+ * Reads the image dimensions from the IHDR chunk, which must immediately
+ * follow the PNG signature.
+ */
 static bool_t
-png_write_to_file_common(const char *filename, int width, int height,
-    const uint8_t *data, int color_type, int bpp, int bit_depth)
+parse_ihdr(const uint8_t *buf, size_t len, int *width, int *height)
 {
-	volatile bool_t result = B_FALSE;
-	png_structp png_ptr = NULL;
-	volatile png_infop info_ptr = NULL;
-	FILE *fp = fopen(filename, "wb");
+	uint32_t w, h;
+
+	if (len < 24 || png_sig_cmp(buf, 0, 8) != 0 ||
+	    memcmp(&buf[12], "IHDR", 4) != 0)
+		return (B_FALSE);
+	w = ((uint32_t)buf[16] << 24) | (buf[17] << 16) | (buf[18] << 8) |
+	    buf[19];
+	h = ((uint32_t)buf[20] << 24) | (buf[21] << 16) | (buf[22] << 8) |
+	    buf[23];
+	if (w == 0 || h == 0 || w > INT32_MAX || h > INT32_MAX)
+		return (B_FALSE);
+	if (width != NULL)
+		*width = w;
+	if (height != NULL)
+		*height = h;
+
+	return (B_TRUE);
+}
+
+/**
+ * Retrieves the dimensions of a PNG image in memory, without decoding
+ * it. Only the first 24 bytes of the image are needed.
+ * @return `B_TRUE` if `buf` starts with a valid PNG header.
+ */
+bool_t
+png_get_dims_from_buffer(const void *buf, size_t len, int *width,
+    int *height)
+{
+	ASSERT(buf != NULL || len == 0);
+	return (parse_ihdr(buf, len, width, height));
+}
+
+/*
+ * libpng user transform for PNG_PIXFMT_ARGB32. libpng has already
+ * turned the row into 8-bit RGBA, which we premultiply and pack into
+ * native-endian 32-bit pixels in place, just like cairo does.
+ */
+static void
+argb32_transform(png_structp pngp, png_row_infop row_info, png_bytep data)
+{
+	LACF_UNUSED(pngp);
+
+	for (png_uint_32 i = 0; i < row_info->rowbytes; i += 4) {
+		uint8_t *p = &data[i];
+		unsigned a = p[3];
+		uint32_t px;
+
+		if (a == 0xff) {
+			px = 0xff000000u | (p[0] << 16) | (p[1] << 8) | p[2];
+		} else if (a == 0) {
+			px = 0;
+		} else {
+			unsigned r = (p[0] * a + 127) / 255;
+			unsigned g = (p[1] * a + 127) / 255;
+			unsigned b = (p[2] * a + 127) / 255;
+
+			px = (a << 24) | (r << 16) | (g << 8) | b;
+		}
+		memcpy(p, &px, sizeof (px));
+	}
+}
+
+static void
+dec_report_rows(png_dec_t *dec)
+{
+	if (dec->rows_cb != NULL && dec->rows_ready > dec->rows_done) {
+		dec->rows_cb(dec->rows_done, dec->rows_ready - dec->rows_done,
+		    dec->userinfo);
+	}
+	dec->rows_done = dec->rows_ready;
+}
 
+static void
+dec_info_cb(png_structp pngp, png_infop infop)
+{
+	png_dec_t *dec = png_get_progressive_ptr(pngp);
+	int ct = png_get_color_type(pngp, infop);
+	int depth = png_get_bit_depth(pngp, infop);
+	bool_t trns = png_get_valid(pngp, infop, PNG_INFO_tRNS);
+	void *out = NULL;
+	size_t stride = 0;
+
+	if (depth == 16)
+		png_set_scale_16(pngp);
+	if (ct == PNG_COLOR_TYPE_PALETTE)
+		png_set_palette_to_rgb(pngp);
+	if (ct == PNG_COLOR_TYPE_GRAY && depth < 8)
+		png_set_expand_gray_1_2_4_to_8(pngp);
+	if (dec->fmt == PNG_PIXFMT_GREY8) {
+		if ((ct & PNG_COLOR_MASK_COLOR) != 0)
+			png_set_rgb_to_gray_fixed(pngp, 1, -1, -1);
+		if ((ct & PNG_COLOR_MASK_ALPHA) != 0)
+			png_set_strip_alpha(pngp);
+	} else {
+		if (trns)
+			png_set_tRNS_to_alpha(pngp);
+		if (ct == PNG_COLOR_TYPE_GRAY ||
+		    ct == PNG_COLOR_TYPE_GRAY_ALPHA)
+			png_set_gray_to_rgb(pngp);
+		if ((ct & PNG_COLOR_MASK_ALPHA) == 0 && !trns)
+			png_set_filler(pngp, 0xff, PNG_FILLER_AFTER);
+		if (dec->fmt == PNG_PIXFMT_ARGB32)
+			png_set_read_user_transform_fn(pngp, argb32_transform);
+	}
+	dec->interlaced = (png_set_interlace_handling(pngp) > 1);
+	png_read_update_info(pngp, infop);
+
+	dec->w = png_get_image_width(pngp, infop);
+	dec->h = png_get_image_height(pngp, infop);
+	if (png_get_rowbytes(pngp, infop) != dec->w * pixfmt_bpp(dec->fmt))
+		png_error(pngp, "unsupported image format");
+	if (!dec->header_cb(dec->w, dec->h, dec->userinfo, &out, &stride))
+		png_error(pngp, "image rejected by caller");
+	ASSERT(out != NULL);
+	ASSERT3U(stride, >=, dec->w * pixfmt_bpp(dec->fmt));
+	dec->out = out;
+	dec->stride = stride;
+}
+
+static void
+dec_row_cb(png_structp pngp, png_bytep new_row, png_uint_32 row, int pass)
+{
+	png_dec_t *dec = png_get_progressive_ptr(pngp);
+
+	LACF_UNUSED(pass);
+
+	/* Interlaced images can contain no new pixels for this row */
+	if (new_row == NULL)
+		return;
+	ASSERT3U(row, <, (unsigned)dec->h);
+	png_progressive_combine_row(pngp, &dec->out[row * dec->stride],
+	    new_row);
+	/* Interlaced rows are only complete after the last pass */
+	if (!dec->interlaced) {
+		dec->rows_ready = row + 1;
+		if (dec->rows_ready - dec->rows_done >= DEC_STRIPE_ROWS)
+			dec_report_rows(dec);
+	}
+}
+
+static void
+dec_end_cb(png_structp pngp, png_infop infop)
+{
+	png_dec_t *dec = png_get_progressive_ptr(pngp);
+
+	LACF_UNUSED(infop);
+	dec->rows_ready = dec->h;
+	dec_report_rows(dec);
+	dec->done = B_TRUE;
+}
+
+/**
+ * Creates a progressive PNG decoder, which decodes an image straight
+ * into a buffer supplied by the caller, while the image data arrives
+ * in arbitrarily sized pieces using png_dec_feed(). This lets the caller
+ * overlap decoding with I/O and start using the top of a large image
+ * before the rest has been decoded.
+ * @param fmt Pixel format to produce. The image is converted to this
+ *	format regardless of its format in the file.
+ * @param header_cb Mandatory callback, which is called once the image
+ *	header has been decoded. It receives the image dimensions and must
+ *	return a buffer of at least `height` rows of `stride` bytes each,
+ *	where `stride` is at least `width` times the pixel size of `fmt`.
+ *	The buffer must remain valid until the decoder is freed. Return
+ *	`B_FALSE` to reject the image, which fails the decode.
+ * @param rows_cb Optional callback, which is called whenever a stripe
+ *	of rows of the output buffer has been completely decoded. For
+ *	interlaced images, this is only called once after the whole image
+ *	has been decoded.
+ * @return The decoder, which must be freed using png_dec_free().
+ */
+png_dec_t *
+png_dec_alloc(png_pixfmt_t fmt, png_dec_header_cb_t header_cb,
+    png_dec_rows_cb_t rows_cb, void *userinfo)
+{
+	png_dec_t *dec = safe_calloc(1, sizeof (*dec));
+
+	ASSERT(header_cb != NULL);
+	dec->fmt = fmt;
+	dec->header_cb = header_cb;
+	dec->rows_cb = rows_cb;
+	dec->userinfo = userinfo;
+	dec->pngp = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
+	    NULL);
+	VERIFY(dec->pngp != NULL);
+	dec->infop = png_create_info_struct(dec->pngp);
+	VERIFY(dec->infop != NULL);
+	png_set_progressive_read_fn(dec->pngp, dec, dec_info_cb, dec_row_cb,
+	    dec_end_cb);
+
+	return (dec);
+}
+
+/**
+ * Frees a decoder created by png_dec_alloc(). The decode need not be
+ * finished.
+ */
+void
+png_dec_free(png_dec_t *dec)
+{
+	if (dec == NULL)
+		return;
+	png_destroy_read_struct(&dec->pngp, &dec->infop, NULL);
+	free(dec);
+}
+
+/**
+ * Passes the next piece of PNG data to a decoder. Any rows which can be
+ * decoded from it are written into the output buffer before this
+ * function returns.
+ * @return `B_FALSE` if the data is not a valid PNG image, or the image
+ *	was rejected by the header callback. Once this happens, all
+ *	subsequent calls fail as well. Data past the end of the image is
+ *	ignored.
+ */
+bool_t
+png_dec_feed(png_dec_t *dec, const void *buf, size_t len)
+{
+	ASSERT(dec != NULL);
+	ASSERT(buf != NULL || len == 0);
+
+	if (dec->failed)
+		return (B_FALSE);
+	if (dec->done || len == 0)
+		return (B_TRUE);
+	if (setjmp(png_jmpbuf(dec->pngp))) {
+		dec->failed = B_TRUE;
+		return (B_FALSE);
+	}
+	png_process_data(dec->pngp, dec->infop, (png_bytep)buf, len);
+
+	return (B_TRUE);
+}
+
+/**
+ * @return `B_TRUE` once the whole image has been decoded.
+ */
+bool_t
+png_dec_is_done(const png_dec_t *dec)
+{
+	ASSERT(dec != NULL);
+	return (dec->done);
+}
+
+typedef struct {
+	int		w, h;
+	void		*out;
+	size_t		stride;
+} dec_into_t;
+
+static bool_t
+dec_into_header_cb(int width, int height, void *userinfo, void **out,
+    size_t *stride)
+{
+	dec_into_t *di = userinfo;
+
+	if (width != di->w || height != di->h) {
+		logMsg("Error decoding PNG: expected a %dx%d image, got %dx%d",
+		    di->w, di->h, width, height);
+		return (B_FALSE);
+	}
+	*out = di->out;
+	*stride = di->stride;
+
+	return (B_TRUE);
+}
+
+/**
+ * Decodes a PNG image in memory into a buffer supplied by the caller,
+ * without allocating an intermediate copy of the image.
+ * @param fmt Pixel format to convert the image to.
+ * @param width Width of the output buffer in pixels. This must match
+ *	the width of the image (see png_get_dims_from_buffer()).
+ * @param height Height of the output buffer in pixels. This must match
+ *	the height of the image.
+ * @param out Output buffer of `height` rows of `stride` bytes each.
+ * @param stride Distance between the starts of two rows in `out`. For
+ *	example, to decode straight into a cairo image surface, use
+ *	`PNG_PIXFMT_ARGB32` and cairo_image_surface_get_stride().
+ * @return `B_TRUE` if decoding succeeded. On failure, the contents
+ *	of `out` are undefined.
+ */
+bool_t
+png_load_from_buffer_into(const void *buf, size_t len, png_pixfmt_t fmt,
+    int width, int height, void *out, size_t stride)
+{
+	dec_into_t di = {
+	    .w = width, .h = height, .out = out, .stride = stride
+	};
+	png_dec_t *dec = png_dec_alloc(fmt, dec_into_header_cb, NULL, &di);
+	bool_t res;
+
+	ASSERT(buf != NULL);
+	ASSERT(out != NULL);
+
+	res = (png_dec_feed(dec, buf, len) && png_dec_is_done(dec));
+	png_dec_free(dec);
+
+	return (res);
+}
+
+/**
+ * Same as png_load_from_buffer_into(), but reads the image from a file.
+ * The file is decoded progressively, as it is being read.
+ */
+bool_t
+png_load_from_file_into(const char *filename, png_pixfmt_t fmt,
+    int width, int height, void *out, size_t stride)
+{
+	dec_into_t di = {
+	    .w = width, .h = height, .out = out, .stride = stride
+	};
+	png_dec_t *dec;
+	uint8_t *buf;
+	FILE *fp;
+	bool_t res = B_TRUE;
+
+	ASSERT(filename != NULL);
+	ASSERT(out != NULL);
+
+	fp = fopen(filename, "rb");
 	if (fp == NULL) {
-		logMsg("Error writing PNG file %s: %s", filename,
-		    strerror(errno));
-		goto out;
+		logMsg("Cannot open file %s: %s", filename, strerror(errno));
 		return (B_FALSE);
 	}
+	buf = safe_malloc(DEC_READ_BUFSZ);
+	dec = png_dec_alloc(fmt, dec_into_header_cb, NULL, &di);
+	while (res && !png_dec_is_done(dec)) {
+		size_t n = fread(buf, 1, DEC_READ_BUFSZ, fp);
+
+		if (n == 0)
+			break;
+		res = png_dec_feed(dec, buf, n);
+	}
+	if (!png_dec_is_done(dec)) {
+		logMsg("Error decoding PNG file %s: %s", filename,
+		    ferror(fp) ? strerror(errno) : "invalid or truncated "
+		    "image");
+		res = B_FALSE;
+	}
+	png_dec_free(dec);
+	free(buf);
+	fclose(fp);
+
+	return (res);
+}
+
+/*
+ * Encoder settings. -1 in any field leaves the libpng default in place.
+ */
+typedef struct {
+	int	filters;
+	int	level;
+	int	strategy;
+} enc_params_t;
+
+static const enc_params_t enc_default = { -1, -1, -1 };
+/*
+ * The adaptive filter heuristic tries every filter on every row, which
+ * costs more than the compression itself at low zlib levels. SUB alone
+ * does nearly as well on most images.
+ */
+static const enc_params_t enc_fast = { PNG_FILTER_SUB, 1, -1 };
+/*
+ * No single setting gives the smallest files for all content. Higher
+ * zlib levels on top of the adaptive filters don't help (level 9 often
+ * comes out larger than 6), while leaving rows unfiltered and using
+ * plain deflate shrinks images with large flat areas (charts, maps,
+ * instrument panels) by 10% or more, but loses badly on photographic
+ * content. PNG_ENC_SMALL encodes both ways and keeps the smaller file.
+ */
+static const enc_params_t enc_small_trials[] = {
+	{ -1, -1, -1 },
+	{ PNG_FILTER_NONE, 9, Z_DEFAULT_STRATEGY }
+};
+
+typedef struct {
+	uint8_t	*buf;
+	size_t	len;
+	size_t	cap;
+} membuf_t;
+
+static void
+membuf_write(png_structp png_ptr, png_bytep data, png_size_t len)
+{
+	membuf_t *mb = png_get_io_ptr(png_ptr);
+
+	if (mb->len + len > mb->cap) {
+		mb->cap = MAX(mb->cap * 2, mb->len + len);
+		mb->buf = safe_realloc(mb->buf, mb->cap);
+	}
+	memcpy(&mb->buf[mb->len], data, len);
+	mb->len += len;
+}
+
+static void
+membuf_flush(png_structp png_ptr)
+{
+	UNUSED(png_ptr);
+}
+
+/*
+ * Encodes an image either into `fp', or if that is NULL, into `mb'.
+ */
+static bool_t
+png_encode(const char *filename, FILE *fp, membuf_t *mb, int width,
+    int height, const uint8_t *data, size_t stride, png_pixfmt_t fmt,
+    int color_type, int bit_depth, const enc_params_t *params)
+{
+	volatile bool_t result = B_FALSE;
+	png_structp png_ptr = NULL;
+	volatile png_infop info_ptr = NULL;
+	uint8_t *volatile row = NULL;
+
+	ASSERT(fp != NULL || mb != NULL);
+
 	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL,
 	    NULL);
 	if (png_ptr == NULL) {
@@ -333,7 +779,18 @@ png_write_to_file_common(const char *filename, int width, int height,
 		goto out;
 	}
 
-	png_init_io(png_ptr, fp);
+	if (fp != NULL)
+		png_init_io(png_ptr, fp);
+	else
+		png_set_write_fn(png_ptr, mb, membuf_write, membuf_flush);
+	if (params->filters != -1) {
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE,
+		    params->filters);
+	}
+	if (params->level != -1)
+		png_set_compression_level(png_ptr, params->level);
+	if (params->strategy != -1)
+		png_set_compression_strategy(png_ptr, params->strategy);
 
 	/* Write header (8/16 bit color depth) */
 	png_set_IHDR(png_ptr, info_ptr, width, height, bit_depth, color_type,
@@ -341,19 +798,95 @@ png_write_to_file_common(const char *filename, int width, int height,
 	    PNG_FILTER_TYPE_BASE);
 
 	png_write_info(png_ptr, info_ptr);
+	if (fmt == PNG_PIXFMT_ARGB32)
+		row = safe_malloc(width * 4);
 	for (int i = 0; i < height; i++) {
-		png_write_row(png_ptr, &data[i * width * bpp]);
+		const uint8_t *src = &data[i * stride];
+
+		if (fmt == PNG_PIXFMT_ARGB32) {
+			/* Unpremultiply native-endian ARGB into RGBA */
+			for (int x = 0; x < width; x++) {
+				uint32_t px;
+				unsigned a;
+
+				memcpy(&px, &src[x * 4], sizeof (px));
+				a = px >> 24;
+				for (int c = 0; c < 3; c++) {
+					unsigned v = (px >> (16 - 8 * c)) &
+					    0xff;
+
+					row[x * 4 + c] = (a == 0 ? 0 :
+					    MIN((v * 255 + a / 2) / a, 255));
+				}
+				row[x * 4 + 3] = a;
+			}
+			src = row;
+		}
+		png_write_row(png_ptr, src);
 	}
 	png_write_end(png_ptr, NULL);
 
 	result = B_TRUE;
 out:
-	if (info_ptr != NULL)
-		png_free_data(png_ptr, info_ptr, PNG_FREE_ALL, -1);
-	if (png_ptr != NULL)
-		png_destroy_write_struct(&png_ptr, (png_infopp)NULL);
-	if (fp != NULL)
-		fclose(fp);
+	if (png_ptr != NULL) {
+		png_infop info = info_ptr;
+		png_destroy_write_struct(&png_ptr, &info);
+	}
+	free(row);
+
+	return (result);
+}
+
+static bool_t
+png_write_to_file_common(const char *filename, int width, int height,
+    const uint8_t *data, size_t stride, png_pixfmt_t fmt, int color_type,
+    int bit_depth, png_enc_mode_t mode)
+{
+	bool_t result = B_FALSE;
+	membuf_t best = { NULL, 0, 0 };
+	FILE *fp;
+
+	if (mode == PNG_ENC_SMALL) {
+		for (size_t i = 0; i < ARRAY_NUM_ELEM(enc_small_trials); i++) {
+			membuf_t trial = { NULL, 0, 0 };
+
+			if (!png_encode(filename, NULL, &trial, width, height,
+			    data, stride, fmt, color_type, bit_depth,
+			    &enc_small_trials[i])) {
+				free(trial.buf);
+				goto out;
+			}
+			if (best.buf == NULL || trial.len < best.len) {
+				free(best.buf);
+				best = trial;
+			} else {
+				free(trial.buf);
+			}
+		}
+	}
+
+	fp = fopen(filename, "wb");
+	if (fp == NULL) {
+		logMsg("Error writing PNG file %s: %s", filename,
+		    strerror(errno));
+		goto out;
+	}
+	if (mode == PNG_ENC_SMALL) {
+		result = (fwrite(best.buf, 1, best.len, fp) == best.len);
+		if (!result) {
+			logMsg("Error writing PNG file %s: %s", filename,
+			    strerror(errno));
+		}
+	} else {
+		ASSERT(mode == PNG_ENC_DEFAULT || mode == PNG_ENC_FAST);
+		result = png_encode(filename, fp, NULL, width, height, data,
+		    stride, fmt, color_type, bit_depth, mode == PNG_ENC_FAST ?
+		    &enc_fast : &enc_default);
+	}
+	if (fclose(fp) != 0)
+		result = B_FALSE;
+out:
+	free(best.buf);
 
 	return (result);
 }
@@ -363,7 +896,8 @@ png_write_to_file_grey8(const char *filename, int width, int height,
     const void *data)
 {
 	return (png_write_to_file_common(filename, width, height, data,
-	    PNG_COLOR_TYPE_GRAY, 1, 8));
+	    width, PNG_PIXFMT_GREY8, PNG_COLOR_TYPE_GRAY, 8,
+	    PNG_ENC_DEFAULT));
 }
 
 bool_t
@@ -371,7 +905,8 @@ png_write_to_file_grey16(const char *filename, int width, int height,
     const void *data)
 {
 	return (png_write_to_file_common(filename, width, height, data,
-	    PNG_COLOR_TYPE_GRAY, 2, 16));
+	    width * 2, PNG_PIXFMT_GREY8, PNG_COLOR_TYPE_GRAY, 16,
+	    PNG_ENC_DEFAULT));
 }
 
 bool_t
@@ -379,5 +914,30 @@ png_write_to_file_rgba(const char *filename, int width, int height,
     const void *data)
 {
 	return (png_write_to_file_common(filename, width, height, data,
-	    PNG_COLOR_TYPE_RGB_ALPHA, 4, 8));
+	    width * 4, PNG_PIXFMT_RGBA8, PNG_COLOR_TYPE_RGB_ALPHA, 8,
+	    PNG_ENC_DEFAULT));
+}
+
+/**
+ * Writes an 8-bit image to a PNG file.
+ * @param data Image data of `height` rows of `stride` bytes each. For
+ *	`PNG_PIXFMT_ARGB32`, the premultiplied data is converted back to
+ *	straight alpha on the fly.
+ * @param mode Encoder trade-off between speed and file size. Use
+ *	`PNG_ENC_FAST` for files which get written often and read back
+ *	soon, such as cache files.
+ * @return `B_TRUE` on success, `B_FALSE` on failure (the reason is
+ *	written to the log).
+ */
+bool_t
+png_write_to_file_fmt(const char *filename, int width, int height,
+    const void *data, size_t stride, png_pixfmt_t fmt, png_enc_mode_t mode)
+{
+	ASSERT(filename != NULL);
+	ASSERT(data != NULL);
+	ASSERT3U(stride, >=, width * pixfmt_bpp(fmt));
+
+	return (png_write_to_file_common(filename, width, height, data,
+	    stride, fmt, fmt == PNG_PIXFMT_GREY8 ? PNG_COLOR_TYPE_GRAY :
+	    PNG_COLOR_TYPE_RGB_ALPHA, 8, mode));
 }
@@ -28,17 +28,45 @@
 #include <errno.h>
 #include <stdarg.h>
 
+#include "acfutils/crc64.h"
 #include "acfutils/glutils.h"
 #include "acfutils/helpers.h"
 #include "acfutils/log.h"
 #include "acfutils/safe_alloc.h"
 #include "acfutils/shader.h"
 #include "acfutils/stat.h"
+#include "acfutils/thread.h"
+#include "acfutils/time.h"
 
 #define	EXTRA_2D_DEFINES \
 	"#define textureSize2D textureSize\n" \
 	"#define texture2D texture\n"
 
+/*
+ * Bump this whenever a change to this file alters what gets passed to the
+ * driver for the same inputs (e.g. the preamble in construct_defines), so
+ * old program binary cache entries get discarded.
+ */
+#define	PROG_CACHE_VERSION	1
+#define	PROG_CACHE_MAGIC	"LACFPRGB"
+
+typedef struct {
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	format;		/* from glGetProgramBinary */
+	uint64_t	key;		/* hash of the program's inputs */
+	uint64_t	driver;		/* hash of GL vendor/renderer/version */
+	uint64_t	data_crc;
+	uint64_t	len;
+} prog_cache_hdr_t;
+
+static struct {
+	mutex_t			lock;
+	char			*dir;	/* NULL if the cache is disabled */
+	uint64_t		driver;
+	shader_cache_stats_t	stats;
+} prog_cache = { .dir = NULL };
+
 static GLuint shader_from_file(GLenum shader_type, const char *filename,
     const char *entry_pt, const shader_spec_const_t *spec_const);
 static GLuint shader_from_text(GLenum shader_type,
@@ -456,6 +484,348 @@ errout:
 	return (0);
 }
 
+/*
+ * Sets up the program binary cache. This must be called from a thread
+ * with a current OpenGL context, before loading any shaders which should
+ * make use of the cache. If the driver doesn't support retrieving program
+ * binaries, or a graphics debugger is attached (so that it can see the
+ * shader sources), the cache stays disabled and shaders are always
+ * compiled from source.
+ *
+ * @param cachedir Directory in which to store the program binaries. It is
+ *	created if it doesn't exist. The directory is best placed in a per
+ *	user location, since program binaries depend on the driver.
+ *
+ * @return B_TRUE if the cache is enabled, B_FALSE otherwise.
+ */
+API_EXPORT bool_t
+shader_cache_init(const char *cachedir)
+{
+	GLint num_fmts = 0;
+	const char *strs[3];
+
+	ASSERT(cachedir != NULL);
+	ASSERT3P(prog_cache.dir, ==, NULL);
+
+	if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) {
+		logMsg("Shader program cache disabled: driver doesn't "
+		    "support program binaries");
+		return (B_FALSE);
+	}
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &num_fmts);
+	if (num_fmts <= 0) {
+		logMsg("Shader program cache disabled: driver offers no "
+		    "program binary formats");
+		return (B_FALSE);
+	}
+	if (glutils_nsight_debugger_present()) {
+		logMsg("Shader program cache disabled: debugger present");
+		return (B_FALSE);
+	}
+	if (!create_directory_recursive(cachedir))
+		return (B_FALSE);
+
+	crc64_init();
+	crc64_state_init(&prog_cache.driver);
+	strs[0] = (const char *)glGetString(GL_VENDOR);
+	strs[1] = (const char *)glGetString(GL_RENDERER);
+	strs[2] = (const char *)glGetString(GL_VERSION);
+	for (int i = 0; i < 3; i++) {
+		if (strs[i] == NULL)
+			strs[i] = "";
+		prog_cache.driver = crc64_append(prog_cache.driver, strs[i],
+		    strlen(strs[i]) + 1);
+	}
+	mutex_init(&prog_cache.lock);
+	memset(&prog_cache.stats, 0, sizeof (prog_cache.stats));
+	prog_cache.dir = safe_strdup(cachedir);
+
+	return (B_TRUE);
+}
+
+/*
+ * Disables the program binary cache. Safe to call even if
+ * shader_cache_init was never called or failed.
+ */
+API_EXPORT void
+shader_cache_fini(void)
+{
+	if (prog_cache.dir == NULL)
+		return;
+	free(prog_cache.dir);
+	prog_cache.dir = NULL;
+	mutex_destroy(&prog_cache.lock);
+}
+
+/*
+ * Returns the cache's counters accumulated since shader_cache_init.
+ * If the cache is disabled, all counters are zero.
+ */
+API_EXPORT void
+shader_cache_get_stats(shader_cache_stats_t *stats)
+{
+	ASSERT(stats != NULL);
+	if (prog_cache.dir == NULL) {
+		memset(stats, 0, sizeof (*stats));
+		return;
+	}
+	mutex_enter(&prog_cache.lock);
+	*stats = prog_cache.stats;
+	mutex_exit(&prog_cache.lock);
+}
+
+static void
+key_append_str(uint64_t *key, const char *str)
+{
+	/* a lone 0xff distinguishes NULL from an empty string */
+	if (str == NULL)
+		*key = crc64_append(*key, "\xff", 1);
+	else
+		*key = crc64_append(*key, str, strlen(str) + 1);
+}
+
+static void
+key_append_file(uint64_t *key, const char *filename)
+{
+	size_t len;
+	void *buf = file2buf(filename, &len);
+
+	key_append_str(key, filename);
+	if (buf != NULL) {
+		*key = crc64_append(*key, &len, sizeof (len));
+		*key = crc64_append(*key, buf, len);
+		free(buf);
+	} else {
+		key_append_str(key, NULL);
+	}
+}
+
+/*
+ * Which shader ends up being used for a SPIR-V file depends on the driver
+ * (covered by the driver hash) and on which GLSL fallbacks exist, so the
+ * contents of all of the candidates tried by shader_from_spirv_fallback
+ * go into the key.
+ */
+static void
+key_append_spirv_fallbacks(uint64_t *key, GLenum shader_type,
+    const char *filename)
+{
+	static const char *exts[] = {
+	    NULL, "glsl460", "glsl450", "glsl440", "glsl430", "glsl420",
+	    "glsl410", "glsl400", "glsl"
+	};
+	char *alt_filename = safe_calloc(strlen(filename) + 16, 1);
+	char *new_ext;
+
+	strcpy(alt_filename, filename);
+	new_ext = strrchr(alt_filename, '.');
+	ASSERT(new_ext != NULL);
+	new_ext++;
+	for (size_t i = 0; i < ARRAY_NUM_ELEM(exts); i++) {
+		bool_t is_dir;
+
+		if (exts[i] != NULL) {
+			strcpy(new_ext, exts[i]);
+		} else if (shader_type == GL_VERTEX_SHADER) {
+			strcpy(new_ext, "vert");
+		} else if (shader_type == GL_FRAGMENT_SHADER) {
+			strcpy(new_ext, "frag");
+		} else {
+			strcpy(new_ext, "comp");
+		}
+		if (file_exists(alt_filename, &is_dir) && !is_dir)
+			key_append_file(key, alt_filename);
+	}
+	free(alt_filename);
+}
+
+static void
+key_append_shader_file(uint64_t *key, GLenum shader_type,
+    const char *filename, const char *entry_pt,
+    const shader_spec_const_t *spec_const)
+{
+	const char *ext = strrchr(filename, '.');
+
+	*key = crc64_append(*key, &shader_type, sizeof (shader_type));
+	key_append_file(key, filename);
+	if (ext != NULL && strcmp(ext, ".spv") == 0) {
+		key_append_str(key, entry_pt);
+		key_append_spirv_fallbacks(key, shader_type, filename);
+	}
+	for (const shader_spec_const_t *sc = spec_const;
+	    sc != NULL && !sc->is_last; sc++) {
+		*key = crc64_append(*key, &sc->idx, sizeof (sc->idx));
+		*key = crc64_append(*key, &sc->val, sizeof (sc->val));
+		*key = crc64_append(*key, &sc->is_float, sizeof (sc->is_float));
+	}
+}
+
+static void
+key_append_shader_text(uint64_t *key, GLenum shader_type, const char *text)
+{
+	*key = crc64_append(*key, &shader_type, sizeof (shader_type));
+	key_append_str(key, text);
+}
+
+static void
+key_append_binds(uint64_t *key, const shader_attr_bind_t *binds)
+{
+	for (; binds != NULL && binds->name != NULL; binds++) {
+		key_append_str(key, binds->name);
+		*key = crc64_append(*key, &binds->idx, sizeof (binds->idx));
+	}
+}
+
+static char *
+prog_cache_path(uint64_t key)
+{
+	char name[32];
+
+	ASSERT(prog_cache.dir != NULL);
+	snprintf(name, sizeof (name), "%016llx.glprog",
+	    (unsigned long long)key);
+	return (mkpathname(prog_cache.dir, name, NULL));
+}
+
+/*
+ * Attempts to load a program from the cache. Returns the linked program
+ * on success, or 0 if the program isn't cached, or the cache entry is
+ * stale or was rejected by the driver, in which case it is removed.
+ */
+static GLuint
+prog_cache_load(const char *progname, uint64_t key)
+{
+	char *path = prog_cache_path(key);
+	uint64_t start = microclock();
+	prog_cache_hdr_t hdr;
+	const uint8_t *data;
+	uint8_t *buf;
+	size_t len;
+	GLuint prog;
+	GLint linked;
+
+	buf = file2buf(path, &len);
+	if (buf == NULL) {
+		free(path);
+		return (0);
+	}
+	if (len < sizeof (hdr))
+		goto reject;
+	memcpy(&hdr, buf, sizeof (hdr));
+	data = &buf[sizeof (hdr)];
+	if (memcmp(hdr.magic, PROG_CACHE_MAGIC, sizeof (hdr.magic)) != 0 ||
+	    hdr.version != PROG_CACHE_VERSION || hdr.key != key ||
+	    hdr.driver != prog_cache.driver ||
+	    hdr.len != len - sizeof (hdr) || hdr.len > INT32_MAX ||
+	    hdr.data_crc != crc64(data, hdr.len))
+		goto reject;
+
+	prog = glCreateProgram();
+	glProgramBinary(prog, hdr.format, data, hdr.len);
+	glGetProgramiv(prog, GL_LINK_STATUS, &linked);
+	if (linked == GL_FALSE) {
+		/* clear the error left behind by an unsupported format */
+		glGetError();
+		glDeleteProgram(prog);
+		goto reject;
+	}
+	free(buf);
+	free(path);
+
+	mutex_enter(&prog_cache.lock);
+	prog_cache.stats.hits++;
+	prog_cache.stats.hit_us += microclock() - start;
+	mutex_exit(&prog_cache.lock);
+	logMsg("Shader program %s loaded from cache in %.1f ms", progname,
+	    (microclock() - start) / 1000.0);
+
+	return (prog);
+reject:
+	logMsg("Shader program %s: discarding stale cache entry %s",
+	    progname, path);
+	remove_file(path, B_TRUE);
+	free(buf);
+	free(path);
+	mutex_enter(&prog_cache.lock);
+	prog_cache.stats.rejects++;
+	mutex_exit(&prog_cache.lock);
+
+	return (0);
+}
+
+/*
+ * Stores a freshly linked program in the cache. `start' is the time at
+ * which compilation started, for the load-time statistics.
+ */
+static void
+prog_cache_store(const char *progname, uint64_t key, GLuint prog,
+    uint64_t start)
+{
+	char *path = NULL, *tmp_path = NULL;
+	prog_cache_hdr_t hdr;
+	uint8_t *buf = NULL;
+	GLint len = 0;
+	GLenum format;
+	FILE *fp;
+	bool_t stored = B_FALSE;
+	uint64_t compile_us = microclock() - start;
+
+	glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &len);
+	if (len <= 0)
+		goto out;
+	buf = safe_malloc(sizeof (hdr) + len);
+	/* clear error state */
+	glGetError();
+	glGetProgramBinary(prog, len, &len, &format, &buf[sizeof (hdr)]);
+	if (glGetError() != GL_NO_ERROR || len <= 0)
+		goto out;
+
+	memset(&hdr, 0, sizeof (hdr));
+	memcpy(hdr.magic, PROG_CACHE_MAGIC, sizeof (hdr.magic));
+	hdr.version = PROG_CACHE_VERSION;
+	hdr.format = format;
+	hdr.key = key;
+	hdr.driver = prog_cache.driver;
+	hdr.len = len;
+	hdr.data_crc = crc64(&buf[sizeof (hdr)], len);
+	memcpy(buf, &hdr, sizeof (hdr));
+
+	path = prog_cache_path(key);
+	tmp_path = sprintf_alloc("%s.part", path);
+	fp = fopen(tmp_path, "wb");
+	if (fp == NULL) {
+		logMsg("Error writing shader cache %s: %s", tmp_path,
+		    strerror(errno));
+		goto out;
+	}
+	stored = (fwrite(buf, 1, sizeof (hdr) + len, fp) ==
+	    sizeof (hdr) + len);
+	fclose(fp);
+	/*
+	 * Stale entries were removed by prog_cache_load, so a plain rename
+	 * works on Windows too. Losing a race against another instance
+	 * writing the same entry doesn't matter, the contents are the same.
+	 */
+	if (!stored || rename(tmp_path, path) != 0) {
+		logMsg("Error writing shader cache %s: %s", path,
+		    strerror(errno));
+		remove_file(tmp_path, B_TRUE);
+		stored = B_FALSE;
+	}
+out:
+	mutex_enter(&prog_cache.lock);
+	prog_cache.stats.misses++;
+	prog_cache.stats.miss_us += compile_us;
+	if (stored)
+		prog_cache.stats.stores++;
+	mutex_exit(&prog_cache.lock);
+	logMsg("Shader program %s compiled in %.1f ms%s", progname,
+	    compile_us / 1000.0, stored ? ", added to cache" : "");
+	free(buf);
+	free(tmp_path);
+	free(path);
+}
+
 /*
  * Loads, compiles and links a GLSL shader program composed of a vertex
  * shader and fragment shader object.
@@ -503,8 +873,24 @@ static GLuint
 shader_prog_from_file_v(const char *progname, const char *vert_file,
     const char *frag_file, const shader_attr_bind_t *binds)
 {
-	GLuint vert_shader = 0, frag_shader = 0;
-
+	GLuint vert_shader = 0, frag_shader = 0, prog;
+	uint64_t key, start = microclock();
+
+	if (prog_cache.dir != NULL) {
+		crc64_state_init(&key);
+		if (vert_file != NULL) {
+			key_append_shader_file(&key, GL_VERTEX_SHADER,
+			    vert_file, NULL, NULL);
+		}
+		if (frag_file != NULL) {
+			key_append_shader_file(&key, GL_FRAGMENT_SHADER,
+			    frag_file, NULL, NULL);
+		}
+		key_append_binds(&key, binds);
+		prog = prog_cache_load(progname, key);
+		if (prog != 0)
+			return (prog);
+	}
 	if (vert_file != NULL) {
 		vert_shader = shader_from_file(GL_VERTEX_SHADER, vert_file,
 		    NULL, NULL);
@@ -518,7 +904,11 @@ shader_prog_from_file_v(const char *progname, const char *vert_file,
 			goto errout;
 	}
 
-	return (shaders2prog(progname, vert_shader, frag_shader, 0, binds));
+	prog = shaders2prog(progname, vert_shader, frag_shader, 0, binds);
+	if (prog != 0 && prog_cache.dir != NULL)
+		prog_cache_store(progname, key, prog, start);
+
+	return (prog);
 errout:
 	if (vert_shader != 0)
 		glDeleteShader(vert_shader);
@@ -574,8 +964,24 @@ static GLuint
 shader_prog_from_text_v(const char *progname, const char *vert_text,
     const char *frag_text, const shader_attr_bind_t *binds)
 {
-	GLuint vert_shader = 0, frag_shader = 0;
-
+	GLuint vert_shader = 0, frag_shader = 0, prog;
+	uint64_t key, start = microclock();
+
+	if (prog_cache.dir != NULL) {
+		crc64_state_init(&key);
+		if (vert_text != NULL) {
+			key_append_shader_text(&key, GL_VERTEX_SHADER,
+			    vert_text);
+		}
+		if (frag_text != NULL) {
+			key_append_shader_text(&key, GL_FRAGMENT_SHADER,
+			    frag_text);
+		}
+		key_append_binds(&key, binds);
+		prog = prog_cache_load(progname, key);
+		if (prog != 0)
+			return (prog);
+	}
 	if (vert_text != NULL) {
 		vert_shader = shader_from_text(GL_VERTEX_SHADER, vert_text,
 		    NULL, NULL);
@@ -592,7 +998,11 @@ shader_prog_from_text_v(const char *progname, const char *vert_text,
 		}
 	}
 
-	return (shaders2prog(progname, vert_shader, frag_shader, 0, binds));
+	prog = shaders2prog(progname, vert_shader, frag_shader, 0, binds);
+	if (prog != 0 && prog_cache.dir != NULL)
+		prog_cache_store(progname, key, prog, start);
+
+	return (prog);
 }
 
 /*
@@ -630,6 +1040,20 @@ shader_from_file_or_text(GLenum shader_type, const char *dirpath,
 	return (B_TRUE);
 }
 
+static void
+key_append_shader_info(uint64_t *key, GLenum shader_type,
+    const char *dirpath, const shader_info_t *shader_info)
+{
+	if (shader_info->filename != NULL) {
+		char *path = mkpathname(dirpath, shader_info->filename, NULL);
+		key_append_shader_file(key, shader_type, path,
+		    shader_info->entry_pt, shader_info->spec_const);
+		free(path);
+	} else {
+		key_append_shader_text(key, shader_type, shader_info->glsl);
+	}
+}
+
 /*
  * Loads, specializes/compiles and links a shader program a shader_prog_info_t
  * structure. The info structure is a structure designed to allow loading a
@@ -651,12 +1075,32 @@ shader_prog_from_info(const char *dirpath, const shader_prog_info_t *info)
 	GLuint vert_shader = 0, frag_shader = 0, comp_shader = 0;
 	bool_t debugger = glutils_nsight_debugger_present();
 	GLuint prog;
+	uint64_t key, start = microclock();
 
 	/* Caller must have provided at least one! */
 	ASSERT(info->vert != NULL || info->frag != NULL || info->comp != NULL);
 	/* Vertex & fragment shaders aren't allowed in compute shaders. */
 	ASSERT((info->vert == NULL && info->frag == NULL) || info->comp == NULL);
 
+	if (prog_cache.dir != NULL) {
+		crc64_state_init(&key);
+		if (info->vert != NULL) {
+			key_append_shader_info(&key, GL_VERTEX_SHADER,
+			    dirpath, info->vert);
+		}
+		if (info->frag != NULL) {
+			key_append_shader_info(&key, GL_FRAGMENT_SHADER,
+			    dirpath, info->frag);
+		}
+		if (info->comp != NULL) {
+			key_append_shader_info(&key, GL_COMPUTE_SHADER,
+			    dirpath, info->comp);
+		}
+		key_append_binds(&key, info->attr_binds);
+		prog = prog_cache_load(info->progname, key);
+		if (prog != 0)
+			return (prog);
+	}
 	if (info->vert != NULL && !shader_from_file_or_text(GL_VERTEX_SHADER,
 	    dirpath, info, info->vert, &vert_shader))
 		goto errout;
@@ -676,6 +1120,8 @@ shader_prog_from_info(const char *dirpath, const shader_prog_info_t *info)
 	    comp_shader, info->attr_binds);
 	if (debugger && prog != 0)
 		logMsg("loaded %s  progID: %d", info->progname, prog);
+	if (prog != 0 && prog_cache.dir != NULL)
+		prog_cache_store(info->progname, key, prog, start);
 
 	return (prog);
 errout:
@@ -708,6 +1154,10 @@ shaders2prog(const char *progname, GLuint vert_shader, GLuint frag_shader,
 	ASSERT((vert_shader == 0 && frag_shader == 0) || comp_shader == 0);
 
 	prog = glCreateProgram();
+	if (prog_cache.dir != NULL) {
+		glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT,
+		    GL_TRUE);
+	}
 	if (vert_shader != 0)
 		glAttachShader(prog, vert_shader);
 	if (frag_shader != 0)
@@ -0,0 +1,170 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/cairo_utils.h>
+#include <acfutils/log.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/time.h>
+
+/*
+ * Compares the cairo_utils pixel kernels against straightforward
+ * byte-at-a-time loops on a large image (8192x8192 by default, the size
+ * of a big chart at high zoom) and verifies they produce the same result.
+ */
+
+static unsigned w, h;
+static size_t stride;
+static uint8_t *rgba, *ref, *out;
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+static void
+report(const char *name, uint64_t t_ref, uint64_t t_kern)
+{
+	printf("  %-22s bytewise %8.3f ms   kernel %8.3f ms   (%.2fx)\n",
+	    name, t_ref / 1000.0, t_kern / 1000.0, t_ref / (double)t_kern);
+}
+
+/* Byte-at-a-time, as chartdb used to do it (little-endian only) */
+static void
+ref_invert(uint8_t *data)
+{
+	for (unsigned y = 0; y < h; y++) {
+		uint8_t *p = data + y * stride;
+
+		for (unsigned x = 0; x < w; x++) {
+			p[0] = p[3] - p[0];
+			p[1] = p[3] - p[1];
+			p[2] = p[3] - p[2];
+			p += 4;
+		}
+	}
+}
+
+static void
+ref_rgba2argb32(const uint8_t *src, uint8_t *dst)
+{
+	for (unsigned y = 0; y < h; y++) {
+		const uint8_t *s = src + y * w * 4;
+		uint32_t *d = (uint32_t *)(dst + y * stride);
+
+		for (unsigned x = 0; x < w; x++) {
+			unsigned a = s[3];
+			unsigned r = (s[0] * a + 127) / 255;
+			unsigned g = (s[1] * a + 127) / 255;
+			unsigned b = (s[2] * a + 127) / 255;
+
+			d[x] = (a << 24) | (r << 16) | (g << 8) | b;
+			s += 4;
+		}
+	}
+}
+
+static void
+gen_image(bool_t opaque)
+{
+	for (size_t i = 0; i < (size_t)w * h * 4; i++)
+		rgba[i] = rand();
+	if (opaque) {
+		for (size_t i = 3; i < (size_t)w * h * 4; i += 4)
+			rgba[i] = 255;
+	}
+}
+
+static void
+bench(bool_t opaque)
+{
+	uint64_t t_ref, t_kern;
+
+	gen_image(opaque);
+	printf("%s pixels\n", opaque ? "opaque" : "translucent");
+
+	t_ref = microclock();
+	ref_rgba2argb32(rgba, ref);
+	t_ref = microclock() - t_ref;
+	t_kern = microclock();
+	cairo_utils_rgba2argb32(rgba, w * 4, out, stride, w, h);
+	t_kern = microclock() - t_kern;
+	VERIFY0(memcmp(ref, out, stride * h));
+	report("rgba2argb32", t_ref, t_kern);
+
+	/* Straight alpha in ARGB32 order, as libpng produces with BGR */
+	for (unsigned y = 0; y < h; y++) {
+		uint32_t *row = (uint32_t *)(out + y * stride);
+		const uint8_t *s = rgba + y * w * 4;
+
+		for (unsigned x = 0; x < w; x++, s += 4) {
+			row[x] = ((uint32_t)s[3] << 24) | (s[0] << 16) |
+			    (s[1] << 8) | s[2];
+		}
+	}
+	t_kern = microclock();
+	cairo_utils_premultiply_argb32(out, stride, w, h);
+	t_kern = microclock() - t_kern;
+	VERIFY0(memcmp(ref, out, stride * h));
+	printf("  %-22s                       kernel %8.3f ms\n",
+	    "premultiply_argb32", t_kern / 1000.0);
+
+	t_ref = microclock();
+	ref_invert(ref);
+	t_ref = microclock() - t_ref;
+	t_kern = microclock();
+	cairo_utils_invert_argb32(out, stride, w, h);
+	t_kern = microclock() - t_kern;
+	VERIFY0(memcmp(ref, out, stride * h));
+	report("invert_argb32", t_ref, t_kern);
+}
+
+int
+main(int argc, char **argv)
+{
+	log_init(log_func, "cairo_utils_bench");
+
+	w = h = (argc >= 2 ? atoi(argv[1]) : 8192);
+	VERIFY3U(w, >, 0);
+	/* Odd width, so the rows are unaligned and have a scalar tail */
+	w -= 1;
+	stride = w * 4 + 64;
+	rgba = safe_malloc((size_t)w * h * 4);
+	ref = safe_malloc(stride * h);
+	out = safe_malloc(stride * h);
+	/* Fault the pages in, so the first measurement isn't skewed */
+	memset(ref, 0, stride * h);
+	memset(out, 0, stride * h);
+
+	printf("%ux%u image, %.1f MB\n", w, h, (w * 4.0 * h) / 1e6);
+	srand(1234);
+	bench(B_TRUE);
+	bench(B_FALSE);
+
+	free(rgba);
+	free(ref);
+	free(out);
+	log_fini();
+
+	return (0);
+}
@@ -0,0 +1,223 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/log.h>
+#include <acfutils/safe_alloc.h>
+
+#include "../chart_cache.h"
+
+/*
+ * Exercises the chart disk cache: deduplication of identical downloads,
+ * validator bookkeeping, index persistence and LRU eviction.
+ */
+
+#define	TEST_DIR	"chart_cache_test.tmp"
+#define	FILE_SZ		(1 << 20)
+#define	NUM_FILES	100
+
+static uint8_t buf[FILE_SZ];
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+static char *
+file_path(int i)
+{
+	char name[32];
+
+	snprintf(name, sizeof (name), "chart%03d.pdf", i);
+	return (mkpathname(TEST_DIR, "2301", "KXYZ", name, NULL));
+}
+
+static void
+fill_buf(int i)
+{
+	srand(i);
+	for (int j = 0; j < FILE_SZ; j++)
+		buf[j] = rand();
+}
+
+static ino_t
+file_ino(const char *path)
+{
+	struct stat st;
+
+	VERIFY0(stat(path, &st));
+	return (st.st_ino);
+}
+
+/*
+ * Makes all files look like they were last used a while ago, with
+ * file 0 being the oldest.
+ */
+static void
+age_index(void)
+{
+	char *path = mkpathname(TEST_DIR, "cache.idx", NULL);
+	char *str = file2str(path, NULL);
+	char **lines, *out = NULL;
+	size_t n_lines, outsz = 0;
+	time_t now = time(NULL);
+
+	VERIFY(str != NULL);
+	lines = strsplit(str, "\n", B_TRUE, &n_lines);
+	append_format(&out, &outsz, "%s\n", lines[0]);
+	for (size_t i = 1; i < n_lines; i++) {
+		char *comps[8];
+		int nr;
+
+		VERIFY3S(explode_line(lines[i], '\t', comps, 8), ==, 8);
+		VERIFY3S(sscanf(comps[0], "2301/KXYZ/chart%d.pdf", &nr), ==, 1);
+		append_format(&out, &outsz,
+		    "%s\t%s\t%s\t%s\t%lld\t%s\t%s\t%s\n",
+		    comps[0], comps[1], comps[2], comps[3],
+		    (long long)(now - 3600 + nr), comps[5], comps[6], comps[7]);
+	}
+	VERIFY(remove_file(path, B_FALSE));
+	{
+		FILE *fp = fopen(path, "wb");
+		VERIFY(fp != NULL);
+		fwrite(out, 1, outsz, fp);
+		fclose(fp);
+	}
+	free_strlist(lines, n_lines);
+	free(out);
+	free(str);
+	free(path);
+}
+
+int
+main(void)
+{
+	chart_cache_t *cache;
+	chart_cache_valid_t valid = { .etag = "\"abc\"" }, v2;
+	char *path, *derived, *outside;
+	uint64_t used, quota;
+	ino_t ino;
+
+	log_init(log_func, "chart_cache_test");
+
+	if (file_exists(TEST_DIR, NULL))
+		remove_directory(TEST_DIR);
+	VERIFY(create_directory(TEST_DIR));
+
+	cache = chart_cache_alloc(TEST_DIR, 0);
+	chart_cache_open(cache);
+	chart_cache_get_usage(cache, &used, &quota);
+	VERIFY3U(used, ==, 0);
+	VERIFY3U(quota, ==, CHART_CACHE_MIN_QUOTA);
+
+	/* Identical downloads don't touch the file */
+	path = file_path(0);
+	fill_buf(0);
+	VERIFY(!chart_cache_is_fresh(cache, path));
+	VERIFY(chart_cache_store(cache, path, buf, FILE_SZ, &valid));
+	VERIFY(chart_cache_is_fresh(cache, path));
+	ino = file_ino(path);
+	VERIFY(chart_cache_store(cache, path, buf, FILE_SZ, &valid));
+	VERIFY3U(file_ino(path), ==, ino);
+	buf[0]++;
+	VERIFY(chart_cache_store(cache, path, buf, FILE_SZ, &valid));
+	VERIFY3U(file_ino(path), !=, ino);
+	VERIFY(chart_cache_get_valid(cache, path, &v2));
+	VERIFY0(strcmp(v2.etag, valid.etag));
+	VERIFY3U(v2.last_mod[0], ==, 0);
+
+	/* Derived data is charged to the file and deleted with it */
+	derived = chart_cache_derived_path(path);
+	VERIFY(create_directory(derived));
+	chart_cache_add_derived(cache, path, 1000);
+	chart_cache_get_usage(cache, &used, NULL);
+	VERIFY3U(used, ==, FILE_SZ + 1000);
+	chart_cache_drop_derived(cache, path);
+	VERIFY(!file_exists(derived, NULL));
+	chart_cache_get_usage(cache, &used, NULL);
+	VERIFY3U(used, ==, FILE_SZ);
+	free(derived);
+	free(path);
+
+	/* Files outside of the cache are written, but not tracked */
+	outside = mkpathname(TEST_DIR "_outside", "x.pdf", NULL);
+	VERIFY(chart_cache_store(cache, outside, buf, 16, NULL));
+	VERIFY3S(filesz(outside), ==, 16);
+	VERIFY(!chart_cache_is_fresh(cache, outside));
+	remove_directory(TEST_DIR "_outside");
+	free(outside);
+
+	/* Recently used files are never evicted, even over quota */
+	for (int i = 1; i < NUM_FILES; i++) {
+		path = file_path(i);
+		fill_buf(i);
+		VERIFY(chart_cache_store(cache, path, buf, FILE_SZ, NULL));
+		free(path);
+	}
+	chart_cache_get_usage(cache, &used, NULL);
+	VERIFY3U(used, ==, (uint64_t)NUM_FILES * FILE_SZ);
+	chart_cache_free(cache);
+
+	/* After a while, the least recently used files go first */
+	age_index();
+	/* File 99 was modified behind our back and must be revalidated */
+	path = file_path(NUM_FILES - 1);
+	{
+		FILE *fp = fopen(path, "wb");
+		VERIFY(fp != NULL);
+		fwrite(buf, 1, 1000, fp);
+		fclose(fp);
+	}
+	free(path);
+
+	cache = chart_cache_alloc(TEST_DIR, 0);
+	chart_cache_open(cache);
+	chart_cache_get_usage(cache, &used, &quota);
+	printf("cache usage after reopen: %.1f MB (quota %.1f MB)\n",
+	    used / 1048576.0, quota / 1048576.0);
+	VERIFY3U(used, <=, quota);
+	for (int i = 0; i < NUM_FILES; i++) {
+		bool_t evicted = (i < NUM_FILES - 64);
+
+		path = file_path(i);
+		VERIFY3U(file_exists(path, NULL), ==, !evicted);
+		if (i == NUM_FILES - 1) {
+			VERIFY(!chart_cache_is_fresh(cache, path));
+			VERIFY(!chart_cache_get_valid(cache, path, &v2));
+		} else if (!evicted) {
+			VERIFY(chart_cache_is_fresh(cache, path));
+		}
+		free(path);
+	}
+	chart_cache_free(cache);
+
+	remove_directory(TEST_DIR);
+	log_fini();
+	printf("all tests passed\n");
+
+	return (0);
+}
@@ -0,0 +1,132 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/log.h>
+#include <acfutils/time.h>
+
+#include "../chartdb_impl.h"
+
+/*
+ * Measures the time-to-first-pixel of opening a PDF chart, using the
+ * in-process poppler rasterizer and optionally the external pdfinfo &
+ * pdftoppm utilities. libacfutils must be built with ACFUTILS_POPPLER.
+ */
+
+#ifndef	ACFUTILS_POPPLER
+#error	"chartdb_pdf_bench requires libacfutils built with ACFUTILS_POPPLER"
+#endif
+
+static const double zooms[] = { 1.0, 2.0, 4.0 };
+
+typedef struct {
+	uint64_t	start;
+	uint64_t	first_t;
+	int		bands;
+} bench_t;
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+static bool_t
+band_cb(cairo_surface_t *surf, int rows_done, void *userinfo)
+{
+	bench_t *b = userinfo;
+
+	UNUSED(surf);
+	UNUSED(rows_done);
+	if (b->bands++ == 0)
+		b->first_t = microclock() - b->start;
+	return (B_TRUE);
+}
+
+static void
+bench_poppler(const char *path, double zoom)
+{
+	bench_t b = { .start = microclock() };
+	int num_pages;
+	uint64_t t;
+	void *doc;
+	cairo_surface_t *surf;
+
+	doc = chartdb_pdf_open(path, &num_pages);
+	VERIFY(doc != NULL);
+	VERIFY3S(num_pages, >, 0);
+	surf = chartdb_pdf_render(doc, 0, zoom, band_cb, &b);
+	VERIFY(surf != NULL);
+	t = microclock() - b.start;
+	printf("  poppler   zoom %.1f  %5dx%-5d  first pixel %8.3f ms   "
+	    "total %8.3f ms  (%d bands)\n", zoom,
+	    cairo_image_surface_get_width(surf),
+	    cairo_image_surface_get_height(surf), b.first_t / 1000.0,
+	    t / 1000.0, b.bands);
+	cairo_surface_destroy(surf);
+	chartdb_pdf_close(doc);
+}
+
+static void
+bench_pdftoppm(const char *path, const char *pdftoppm, const char *pdfinfo,
+    double zoom)
+{
+	uint64_t start = microclock(), t;
+	char *png_path;
+	cairo_surface_t *surf;
+
+	VERIFY3S(chartdb_pdf_count_pages_file(pdfinfo, path), >, 0);
+	png_path = chartdb_pdf_convert_file(pdftoppm, (char *)path, 0, zoom);
+	VERIFY(png_path != NULL);
+	surf = cairo_image_surface_create_from_png(png_path);
+	VERIFY3U(cairo_surface_status(surf), ==, CAIRO_STATUS_SUCCESS);
+	t = microclock() - start;
+	/* Nothing can be shown before the whole PNG has been decoded */
+	printf("  pdftoppm  zoom %.1f  %5dx%-5d  first pixel %8.3f ms   "
+	    "total %8.3f ms\n", zoom, cairo_image_surface_get_width(surf),
+	    cairo_image_surface_get_height(surf), t / 1000.0, t / 1000.0);
+	cairo_surface_destroy(surf);
+	remove_file(png_path, B_FALSE);
+	free(png_path);
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc != 2 && argc != 4) {
+		fprintf(stderr, "Usage: %s <chart.pdf> [<pdftoppm> <pdfinfo>]\n",
+		    argv[0]);
+		return (1);
+	}
+	log_init(log_func, "chartdb_pdf_bench");
+
+	printf("%s\n", argv[1]);
+	for (size_t i = 0; i < ARRAY_NUM_ELEM(zooms); i++) {
+		bench_poppler(argv[1], zooms[i]);
+		if (argc == 4)
+			bench_pdftoppm(argv[1], argv[2], argv[3], zooms[i]);
+	}
+
+	log_fini();
+
+	return (0);
+}
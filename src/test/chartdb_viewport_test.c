@@ -0,0 +1,200 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/log.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/time.h>
+
+#include "../chartdb_impl.h"
+
+/*
+ * Draws two viewports showing different parts of the same chart and
+ * checks that neither of them cancels the tile loads queued by the other,
+ * while tiles which nobody has asked for in a while still get canceled.
+ *
+ * All downloads are pointed at an unreachable proxy, so the provider
+ * never finishes initializing and the loader never starts. That way all
+ * requests stay in the loader queues, where we can inspect them.
+ */
+
+#define	TEST_DIR	"chartdb_viewport_test.tmp"
+#define	ICAO		"KXYZ"
+#define	CHART_NAME	"TEST CHART"
+#define	LEVEL_TILES	8	/* level size in tiles on each side */
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+static bool_t
+tile_in_vp(const chart_tile_t *tile, const chart_viewport_t *vp)
+{
+	return (tile->x >= vp->x / CHART_TILE_SZ &&
+	    tile->x < (vp->x + vp->w) / CHART_TILE_SZ &&
+	    tile->y >= vp->y / CHART_TILE_SZ &&
+	    tile->y < (vp->y + vp->h) / CHART_TILE_SZ);
+}
+
+/*
+ * Counts the tiles which have a load queued and returns the total
+ * number of tiles in memory.
+ */
+static int
+count_tiles(chartdb_t *cdb, const chart_viewport_t *vp, int *n_queued,
+    int *n_in_vp)
+{
+	int n_tiles = 0;
+
+	*n_queued = 0;
+	*n_in_vp = 0;
+	mutex_enter(&cdb->lock);
+	for (chart_tile_t *tile = avl_first(&cdb->tiles); tile != NULL;
+	    tile = AVL_NEXT(&cdb->tiles, tile)) {
+		n_tiles++;
+		if (list_link_active(&tile->load_req.node))
+			(*n_queued)++;
+		if (tile_in_vp(tile, vp))
+			(*n_in_vp)++;
+	}
+	mutex_exit(&cdb->lock);
+
+	return (n_tiles);
+}
+
+static void
+draw(chartdb_t *cdb, const chart_viewport_t *vp, cairo_t *cr)
+{
+	chart_viewport_status_t st;
+
+	VERIFY(chartdb_draw_chart_viewport(cdb, ICAO, CHART_NAME, vp, cr,
+	    &st));
+	/* Nothing ever gets loaded */
+	VERIFY(!st.complete);
+}
+
+/*
+ * Pretends the loader has generated the chart's level, so the viewports
+ * go on to request its tiles.
+ */
+static void
+level_fake_ready(chartdb_t *cdb)
+{
+	chart_level_t *lvl;
+
+	mutex_enter(&cdb->lock);
+	lvl = avl_first(&cdb->levels);
+	VERIFY(lvl != NULL);
+	VERIFY3P(AVL_NEXT(&cdb->levels, lvl), ==, NULL);
+	lvl->ready = B_TRUE;
+	lvl->w = LEVEL_TILES * CHART_TILE_SZ;
+	lvl->h = LEVEL_TILES * CHART_TILE_SZ;
+	mutex_exit(&cdb->lock);
+}
+
+static void
+tiles_make_old(chartdb_t *cdb)
+{
+	mutex_enter(&cdb->lock);
+	for (chart_tile_t *tile = avl_first(&cdb->tiles); tile != NULL;
+	    tile = AVL_NEXT(&cdb->tiles, tile))
+		tile->used_t -= SEC2USEC(60);
+	mutex_exit(&cdb->lock);
+}
+
+int
+main(void)
+{
+	const chart_viewport_t vp_a = {
+	    .zoom = 1, .x = 0, .y = 0,
+	    .w = 2 * CHART_TILE_SZ, .h = 2 * CHART_TILE_SZ
+	};
+	const chart_viewport_t vp_b = {
+	    .zoom = 1, .x = 4 * CHART_TILE_SZ, .y = 4 * CHART_TILE_SZ,
+	    .w = 2 * CHART_TILE_SZ, .h = 2 * CHART_TILE_SZ
+	};
+	chartdb_t *cdb;
+	chart_arpt_t *arpt;
+	chart_t *chart;
+	cairo_surface_t *surf;
+	cairo_t *cr;
+	int n_tiles, n_queued, n_in_vp;
+
+	log_init(log_func, "chartdb_viewport_test");
+	/* Nothing listens on the discard port */
+	setenv("http_proxy", "http://127.0.0.1:9", 1);
+	setenv("https_proxy", "http://127.0.0.1:9", 1);
+	if (file_exists(TEST_DIR, NULL))
+		remove_directory(TEST_DIR);
+	VERIFY(create_directory(TEST_DIR));
+
+	cdb = chartdb_init(TEST_DIR, NULL, NULL, 2301, "aeronav.faa.gov",
+	    NULL);
+	VERIFY(cdb != NULL);
+	arpt = chartdb_add_arpt(cdb, ICAO, "Test Airport", "Test City", "XX");
+	chart = safe_calloc(1, sizeof (*chart));
+	chart->name = safe_strdup(CHART_NAME);
+	chart->filename = safe_strdup("test.png");
+	chart->type = CHART_TYPE_APD;
+	VERIFY(chartdb_add_chart(arpt, chart));
+
+	surf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+	    2 * CHART_TILE_SZ, 2 * CHART_TILE_SZ);
+	cr = cairo_create(surf);
+
+	/* The first draw only queues the generation of the level */
+	draw(cdb, &vp_a, cr);
+	VERIFY0(count_tiles(cdb, &vp_a, &n_queued, &n_in_vp));
+	level_fake_ready(cdb);
+
+	/* Both viewports' tiles must survive the other one being drawn */
+	for (int i = 0; i < 3; i++) {
+		draw(cdb, &vp_a, cr);
+		draw(cdb, &vp_b, cr);
+	}
+	draw(cdb, &vp_a, cr);
+	n_tiles = count_tiles(cdb, &vp_a, &n_queued, &n_in_vp);
+	VERIFY3S(n_tiles, ==, 8);
+	VERIFY3S(n_queued, ==, 8);
+	VERIFY3S(n_in_vp, ==, 4);
+	printf("two viewports: %d tiles queued\n", n_queued);
+
+	/* Once viewport B goes away, its tiles are no longer wanted */
+	tiles_make_old(cdb);
+	draw(cdb, &vp_a, cr);
+	n_tiles = count_tiles(cdb, &vp_a, &n_queued, &n_in_vp);
+	VERIFY3S(n_tiles, ==, 4);
+	VERIFY3S(n_queued, ==, 4);
+	VERIFY3S(n_in_vp, ==, 4);
+	printf("one viewport: %d tiles queued\n", n_queued);
+
+	cairo_destroy(cr);
+	cairo_surface_destroy(surf);
+	chartdb_fini(cdb);
+	remove_directory(TEST_DIR);
+	log_fini();
+	printf("all tests passed\n");
+
+	return (0);
+}
@@ -0,0 +1,190 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/geom.h>
+#include <acfutils/log.h>
+#include <acfutils/math.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/time.h>
+
+/*
+ * Checks fx_lin_curve_eval, fx_lin_curve_eval_hint and fx_lin_curve_eval_v
+ * against fx_lin_multi2 on an unevenly and an evenly spaced curve, with
+ * inputs extending past both ends of the curve, and times all of them on
+ * random and on sorted inputs.
+ */
+
+enum { NUM_CURVE_PTS = 300, NUM_EVALS = 1000000 };
+
+static double *xs, *ref, *out;
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+static double
+rand_range(double min_val, double max_val)
+{
+	return (min_val + (max_val - min_val) * (rand() / (double)RAND_MAX));
+}
+
+static int
+dbl_compar(const void *a, const void *b)
+{
+	double da = *(const double *)a, db = *(const double *)b;
+
+	if (da < db)
+		return (-1);
+	if (da > db)
+		return (1);
+	return (0);
+}
+
+static void
+check(const char *what, bool_t extrapolate)
+{
+	for (int i = 0; i < NUM_EVALS; i++) {
+		if (isnan(ref[i])) {
+			VERIFY_MSG(isnan(out[i]), "%s(%f, %d) = %f, "
+			    "expected NAN", what, xs[i], extrapolate, out[i]);
+		} else {
+			VERIFY_MSG(fabs(out[i] - ref[i]) <=
+			    1e-9 * MAX(fabs(ref[i]), 1), "%s(%f, %d) = %f, "
+			    "expected %f", what, xs[i], extrapolate, out[i],
+			    ref[i]);
+		}
+	}
+}
+
+/*
+ * Inputs cover the curve's X range plus 10% beyond each end, with every
+ * fourth one sitting exactly on a curve point, where the segment lookup
+ * has to break ties the same way as fx_lin_multi2.
+ */
+static void
+make_inputs(const vect2_t *pts, bool_t sorted)
+{
+	double x_min = pts[0].x, x_max = pts[NUM_CURVE_PTS - 1].x;
+	double margin = (x_max - x_min) / 10;
+
+	for (int i = 0; i < NUM_EVALS; i++) {
+		if (i % 4 == 0)
+			xs[i] = pts[rand() % NUM_CURVE_PTS].x;
+		else
+			xs[i] = rand_range(x_min - margin, x_max + margin);
+	}
+	if (sorted)
+		qsort(xs, NUM_EVALS, sizeof (*xs), dbl_compar);
+}
+
+static void
+bench_inputs(const vect2_t *pts, const fx_lin_curve_t *curve,
+    const char *name, bool_t extrapolate)
+{
+	uint64_t t_multi, t_eval, t_hint, t_vect;
+	size_t hint = 0;
+
+	t_multi = microclock();
+	for (int i = 0; i < NUM_EVALS; i++) {
+		ref[i] = fx_lin_multi2(xs[i], pts, NUM_CURVE_PTS,
+		    extrapolate);
+	}
+	t_multi = microclock() - t_multi;
+
+	t_eval = microclock();
+	for (int i = 0; i < NUM_EVALS; i++)
+		out[i] = fx_lin_curve_eval(curve, xs[i], extrapolate);
+	t_eval = microclock() - t_eval;
+	check("fx_lin_curve_eval", extrapolate);
+
+	t_hint = microclock();
+	for (int i = 0; i < NUM_EVALS; i++) {
+		out[i] = fx_lin_curve_eval_hint(curve, xs[i], extrapolate,
+		    &hint);
+	}
+	t_hint = microclock() - t_hint;
+	check("fx_lin_curve_eval_hint", extrapolate);
+
+	t_vect = microclock();
+	fx_lin_curve_eval_v(curve, xs, NUM_EVALS, extrapolate, out);
+	t_vect = microclock() - t_vect;
+	check("fx_lin_curve_eval_v", extrapolate);
+
+	if (extrapolate) {
+		printf("  %-14s multi2 %7.2f ms  eval %6.2f ms  "
+		    "hint %6.2f ms  v %6.2f ms\n", name, t_multi / 1000.0,
+		    t_eval / 1000.0, t_hint / 1000.0, t_vect / 1000.0);
+	}
+}
+
+static void
+bench_curve(const vect2_t *pts, const char *name)
+{
+	fx_lin_curve_t *curve = fx_lin_curve_alloc2(pts, NUM_CURVE_PTS);
+	char buf[32];
+
+	printf("%s curve, %d points\n", name, NUM_CURVE_PTS);
+	for (int sorted = 0; sorted <= 1; sorted++) {
+		make_inputs(pts, sorted);
+		snprintf(buf, sizeof (buf), "%s x", sorted ? "sorted" :
+		    "random");
+		for (int extrapolate = 0; extrapolate <= 1; extrapolate++)
+			bench_inputs(pts, curve, buf, extrapolate);
+	}
+	fx_lin_curve_free(curve);
+}
+
+int
+main(void)
+{
+	vect2_t pts[NUM_CURVE_PTS];
+	double x = -50;
+
+	log_init(log_func, "fx_lin_curve_bench");
+	srand(1);
+	xs = safe_calloc(NUM_EVALS, sizeof (*xs));
+	ref = safe_calloc(NUM_EVALS, sizeof (*ref));
+	out = safe_calloc(NUM_EVALS, sizeof (*out));
+
+	/*
+	 * Segment lengths varying over four orders of magnitude, so many
+	 * segments share a lookup bucket and others span several.
+	 */
+	for (int i = 0; i < NUM_CURVE_PTS; i++) {
+		x += (i % 7 == 0 ? 0.001 : rand_range(0.01, 10));
+		pts[i] = VECT2(x, rand_range(-100, 100));
+	}
+	bench_curve(pts, "Uneven");
+
+	for (int i = 0; i < NUM_CURVE_PTS; i++)
+		pts[i] = VECT2(i * 0.25 - 10, rand_range(-100, 100));
+	bench_curve(pts, "Even");
+
+	free(xs);
+	free(ref);
+	free(out);
+	log_fini();
+
+	return (0);
+}
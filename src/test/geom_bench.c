@@ -0,0 +1,255 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define	ACFUTILS_GEOM_INLINE
+#include <acfutils/assert.h>
+#include <acfutils/geom.h>
+#include <acfutils/log.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/time.h>
+
+enum { NUM_POINTS = 1000000 };
+
+static double *ref_lat, *ref_lon, *ref_elev;
+static double *lat, *lon, *elev;
+static double *x, *y, *z;
+static double *out1, *out2, *out3;
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+static double
+rand_range(double min_val, double max_val)
+{
+	return (min_val + (max_val - min_val) * (rand() / (double)RAND_MAX));
+}
+
+static void
+report(const char *name, uint64_t t_scalar, uint64_t t_vect)
+{
+	printf("  %-14s scalar %8.3f ms   array %8.3f ms   (%.2fx)\n", name,
+	    t_scalar / 1000.0, t_vect / 1000.0, t_scalar / (double)t_vect);
+}
+
+static void
+bench_geo2ecef(void)
+{
+	uint64_t t_scalar, t_vect;
+
+	t_scalar = microclock();
+	for (int i = 0; i < NUM_POINTS; i++) {
+		vect3_t v = geo2ecef_mtr(GEO_POS3(lat[i], lon[i], elev[i]),
+		    &wgs84);
+		x[i] = v.x;
+		y[i] = v.y;
+		z[i] = v.z;
+	}
+	t_scalar = microclock() - t_scalar;
+
+	t_vect = microclock();
+	geo2ecef_mtr_v(lat, lon, elev, NUM_POINTS, &wgs84, out1, out2, out3);
+	t_vect = microclock() - t_vect;
+
+	for (int i = 0; i < NUM_POINTS; i++) {
+		VERIFY3F(out1[i], ==, x[i]);
+		VERIFY3F(out2[i], ==, y[i]);
+		VERIFY3F(out3[i], ==, z[i]);
+	}
+	report("geo2ecef_mtr", t_scalar, t_vect);
+}
+
+static void
+bench_ecef2geo(void)
+{
+	uint64_t t_scalar, t_vect, t_fast;
+	double max_dlat = 0, max_dlon = 0, max_delev = 0;
+
+	t_scalar = microclock();
+	for (int i = 0; i < NUM_POINTS; i++) {
+		geo_pos3_t p = ecef2geo(VECT3(x[i], y[i], z[i]), &wgs84);
+		out1[i] = p.lat;
+		out2[i] = p.lon;
+		out3[i] = p.elev;
+	}
+	t_scalar = microclock() - t_scalar;
+
+	t_vect = microclock();
+	ecef2geo_v(x, y, z, NUM_POINTS, &wgs84, lat, lon, elev);
+	t_vect = microclock() - t_vect;
+	for (int i = 0; i < NUM_POINTS; i++) {
+		VERIFY3F(out1[i], ==, lat[i]);
+		VERIFY3F(out2[i], ==, lon[i]);
+		VERIFY3F(out3[i], ==, elev[i]);
+	}
+	report("ecef2geo", t_scalar, t_vect);
+
+	t_fast = microclock();
+	ecef2geo_fast_v(x, y, z, NUM_POINTS, &wgs84, lat, lon, elev);
+	t_fast = microclock() - t_fast;
+	report("ecef2geo_fast", t_scalar, t_fast);
+
+	/* Check round-trip precision against the original coordinates */
+	for (int i = 0; i < NUM_POINTS; i++) {
+		max_dlat = MAX(max_dlat, fabs(lat[i] - ref_lat[i]));
+		max_dlon = MAX(max_dlon, fabs(lon[i] - ref_lon[i]));
+		max_delev = MAX(max_delev, fabs(elev[i] - ref_elev[i]));
+	}
+	printf("  ecef2geo_fast max error: lat %.3g deg  lon %.3g deg  "
+	    "elev %.3g m\n", max_dlat, max_dlon, max_delev);
+	VERIFY3F(max_dlat, <, 1e-12);
+	VERIFY3F(max_dlon, <, 1e-12);
+	VERIFY3F(max_delev, <, 1e-6);
+	memcpy(lat, ref_lat, NUM_POINTS * sizeof (*lat));
+	memcpy(lon, ref_lon, NUM_POINTS * sizeof (*lon));
+	memcpy(elev, ref_elev, NUM_POINTS * sizeof (*elev));
+}
+
+static void
+bench_geo2fpp(void)
+{
+	fpp_t fpp = stereo_fpp_init(GEO_POS2(47, 12), 30, &wgs84, B_FALSE);
+	uint64_t t_scalar, t_vect;
+
+	t_scalar = microclock();
+	for (int i = 0; i < NUM_POINTS; i++) {
+		vect2_t v = geo2fpp(GEO_POS2(lat[i], lon[i]), &fpp);
+		out1[i] = v.x;
+		out2[i] = v.y;
+	}
+	t_scalar = microclock() - t_scalar;
+
+	t_vect = microclock();
+	geo2fpp_v(lat, lon, NUM_POINTS, &fpp, x, y);
+	t_vect = microclock() - t_vect;
+
+	for (int i = 0; i < NUM_POINTS; i++) {
+		if (isnan(out1[i])) {
+			VERIFY(isnan(x[i]) && isnan(y[i]));
+		} else {
+			/* Relative, since points near the antipode explode */
+			VERIFY3F(fabs(x[i] - out1[i]), <=,
+			    1e-9 * MAX(fabs(out1[i]), 1));
+			VERIFY3F(fabs(y[i] - out2[i]), <=,
+			    1e-9 * MAX(fabs(out2[i]), 1));
+		}
+	}
+	report("geo2fpp", t_scalar, t_vect);
+}
+
+/*
+ * Simulates the inner loop of find_nearest_airports_tile() & friends:
+ * filter a set of ECEF points by distance from a reference point. The
+ * parenthesized function names bypass the ACFUTILS_GEOM_INLINE macros
+ * and call the exported out-of-line versions.
+ */
+static void
+bench_vect_inline(void)
+{
+	vect3_t ref = geo2ecef_mtr(GEO_POS3(47, 12, 0), &wgs84);
+	const double max_dist = 500000;
+	uint64_t t_scalar, t_inline;
+	int n_scalar = 0, n_inline = 0;
+	double sum_scalar = 0, sum_inline = 0;
+
+	geo2ecef_mtr_v(ref_lat, ref_lon, ref_elev, NUM_POINTS, &wgs84,
+	    x, y, z);
+
+	t_scalar = microclock();
+	for (int i = 0; i < NUM_POINTS; i++) {
+		vect3_t v = (vect3_sub)(VECT3(x[i], y[i], z[i]), ref);
+
+		if ((vect3_abs)(v) < max_dist) {
+			sum_scalar += (vect3_dotprod)((vect3_mean)(v, ref),
+			    (vect3_scmul)(v, 0.5));
+			n_scalar++;
+		}
+	}
+	t_scalar = microclock() - t_scalar;
+
+	t_inline = microclock();
+	for (int i = 0; i < NUM_POINTS; i++) {
+		vect3_t v = vect3_sub(VECT3(x[i], y[i], z[i]), ref);
+
+		if (vect3_abs(v) < max_dist) {
+			sum_inline += vect3_dotprod(vect3_mean(v, ref),
+			    vect3_scmul(v, 0.5));
+			n_inline++;
+		}
+	}
+	t_inline = microclock() - t_inline;
+
+	VERIFY3S(n_scalar, ==, n_inline);
+	VERIFY3F(sum_scalar, ==, sum_inline);
+	printf("  %-14s call   %8.3f ms   inline %8.3f ms   (%.2fx)\n",
+	    "vect3 filter", t_scalar / 1000.0, t_inline / 1000.0,
+	    t_scalar / (double)t_inline);
+}
+
+int
+main(void)
+{
+	log_init(log_func, "geom_bench");
+
+	ref_lat = safe_malloc(NUM_POINTS * sizeof (*ref_lat));
+	ref_lon = safe_malloc(NUM_POINTS * sizeof (*ref_lon));
+	ref_elev = safe_malloc(NUM_POINTS * sizeof (*ref_elev));
+	lat = safe_malloc(NUM_POINTS * sizeof (*lat));
+	lon = safe_malloc(NUM_POINTS * sizeof (*lon));
+	elev = safe_malloc(NUM_POINTS * sizeof (*elev));
+	x = safe_malloc(NUM_POINTS * sizeof (*x));
+	y = safe_malloc(NUM_POINTS * sizeof (*y));
+	z = safe_malloc(NUM_POINTS * sizeof (*z));
+	out1 = safe_malloc(NUM_POINTS * sizeof (*out1));
+	out2 = safe_malloc(NUM_POINTS * sizeof (*out2));
+	out3 = safe_malloc(NUM_POINTS * sizeof (*out3));
+
+	srand(1234);
+	for (int i = 0; i < NUM_POINTS; i++) {
+		lat[i] = ref_lat[i] = rand_range(-90, 90);
+		lon[i] = ref_lon[i] = rand_range(-180, 180);
+		elev[i] = ref_elev[i] = rand_range(-10000, 1000000);
+	}
+	printf("%d points\n", NUM_POINTS);
+	bench_geo2ecef();
+	bench_ecef2geo();
+	bench_geo2fpp();
+	bench_vect_inline();
+
+	free(ref_lat);
+	free(ref_lon);
+	free(ref_elev);
+	free(lat);
+	free(lon);
+	free(elev);
+	free(x);
+	free(y);
+	free(z);
+	free(out1);
+	free(out2);
+	free(out3);
+	log_fini();
+
+	return (0);
+}
@@ -0,0 +1,260 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/glew.h>
+#include <acfutils/glutils.h>
+#include <acfutils/log.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/shader.h>
+#include <acfutils/time.h>
+
+#define	GLFW_INCLUDE_NONE
+#include <GLFW/glfw3.h>
+
+/*
+ * Draws a map-like scene of many small symbols and short polylines,
+ * once using a separate glutils_quads_t/glutils_lines_t per object and
+ * once using a glutils_batch_t, and reports the CPU time per frame along
+ * with the number of draw calls and vertices submitted. Needs an X
+ * display, but any GL 2.1 implementation will do, so it can be run on a
+ * headless machine using Xvfb and Mesa's llvmpipe:
+ *
+ *	$ LIBGL_ALWAYS_SOFTWARE=1 xvfb-run ./glutils_batch_bench
+ */
+
+#define	WIN_SZ		1024
+#define	SYM_SZ		8
+#define	LINE_PTS	8
+
+static const char *vert_shader =
+    "#version 120\n"
+    "uniform mat4	pvm;\n"
+    "attribute vec3	vtx_pos;\n"
+    "attribute vec2	vtx_tex0;\n"
+    "varying vec2	tex_coord;\n"
+    "void main() {\n"
+    "	tex_coord = vtx_tex0;\n"
+    "	gl_Position = pvm * vec4(vtx_pos, 1.0);\n"
+    "}\n";
+
+static const char *frag_shader =
+    "#version 120\n"
+    "varying vec2	tex_coord;\n"
+    "void main() {\n"
+    "	gl_FragColor = vec4(tex_coord, 1.0, 1.0);\n"
+    "}\n";
+
+static unsigned num_syms = 2000, num_lines = 500, num_frames = 200;
+static vect2_t *sym_pts, *sym_tex, *line_pts;
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+static void
+make_scene(void)
+{
+	sym_pts = safe_malloc(num_syms * 4 * sizeof (*sym_pts));
+	sym_tex = safe_malloc(num_syms * 4 * sizeof (*sym_tex));
+	line_pts = safe_malloc(num_lines * LINE_PTS * sizeof (*line_pts));
+
+	srand(1);
+	for (unsigned i = 0; i < num_syms; i++) {
+		double x = rand() % (WIN_SZ - SYM_SZ);
+		double y = rand() % (WIN_SZ - SYM_SZ);
+		vect2_t *p = &sym_pts[i * 4], *t = &sym_tex[i * 4];
+
+		p[0] = VECT2(x, y);
+		p[1] = VECT2(x, y + SYM_SZ);
+		p[2] = VECT2(x + SYM_SZ, y + SYM_SZ);
+		p[3] = VECT2(x + SYM_SZ, y);
+		t[0] = VECT2(0, 0);
+		t[1] = VECT2(0, 1);
+		t[2] = VECT2(1, 1);
+		t[3] = VECT2(1, 0);
+	}
+	for (unsigned i = 0; i < num_lines; i++) {
+		vect2_t *p = &line_pts[i * LINE_PTS];
+
+		p[0] = VECT2(rand() % WIN_SZ, rand() % WIN_SZ);
+		for (unsigned j = 1; j < LINE_PTS; j++) {
+			p[j] = VECT2(p[j - 1].x + (rand() % 32) - 16,
+			    p[j - 1].y + (rand() % 32) - 16);
+		}
+	}
+}
+
+static void
+report(const char *name, uint64_t t, uint64_t draws, uint64_t vtx)
+{
+	printf("  %-10s %8.3f ms/frame   %7.1f draws/frame   "
+	    "%9.1f vertices/frame\n", name, t / (1000.0 * num_frames),
+	    draws / (double)num_frames, vtx / (double)num_frames);
+}
+
+static void
+bench_separate(GLuint prog)
+{
+	glutils_quads_t *quads = safe_calloc(num_syms, sizeof (*quads));
+	glutils_lines_t *lines = safe_calloc(num_lines, sizeof (*lines));
+	uint64_t start, draws = 0, vtx = 0;
+
+	for (unsigned i = 0; i < num_syms; i++) {
+		glutils_init_2D_quads(&quads[i], &sym_pts[i * 4],
+		    &sym_tex[i * 4], 4);
+	}
+	for (unsigned i = 0; i < num_lines; i++) {
+		vect3_t p[LINE_PTS];
+
+		for (unsigned j = 0; j < LINE_PTS; j++) {
+			p[j] = VECT3(line_pts[i * LINE_PTS + j].x,
+			    line_pts[i * LINE_PTS + j].y, 0);
+		}
+		glutils_init_3D_lines(&lines[i], p, LINE_PTS);
+	}
+	glFinish();
+
+	start = microclock();
+	for (unsigned f = 0; f < num_frames; f++) {
+		glClear(GL_COLOR_BUFFER_BIT);
+		for (unsigned i = 0; i < num_syms; i++)
+			glutils_draw_quads(&quads[i], prog);
+		for (unsigned i = 0; i < num_lines; i++)
+			glutils_draw_lines(&lines[i], prog);
+		draws += num_syms + num_lines;
+		vtx += num_syms * 4 + num_lines * LINE_PTS;
+		glFinish();
+	}
+	report("separate", microclock() - start, draws, vtx);
+
+	for (unsigned i = 0; i < num_syms; i++)
+		glutils_destroy_quads(&quads[i]);
+	for (unsigned i = 0; i < num_lines; i++)
+		glutils_destroy_lines(&lines[i]);
+	free(quads);
+	free(lines);
+}
+
+static void
+bench_batch(GLuint prog)
+{
+	glutils_batch_t *batch = glutils_batch_alloc(3 * (num_syms * 4 +
+	    num_lines * (LINE_PTS - 1) * 2));
+	glutils_batch_stats_t st;
+	uint64_t start;
+
+	glFinish();
+	start = microclock();
+	for (unsigned f = 0; f < num_frames; f++) {
+		glClear(GL_COLOR_BUFFER_BIT);
+		glutils_batch_begin(batch, prog);
+		for (unsigned i = 0; i < num_syms; i++) {
+			glutils_batch_add_2D_quads(batch, &sym_pts[i * 4],
+			    &sym_tex[i * 4], 4);
+		}
+		for (unsigned i = 0; i < num_lines; i++) {
+			glutils_batch_add_2D_lines(batch,
+			    &line_pts[i * LINE_PTS], LINE_PTS);
+		}
+		glutils_batch_end(batch);
+		glFinish();
+	}
+	glutils_batch_get_stats(batch, &st);
+	report("batch", microclock() - start, st.draws, st.vertices);
+	printf("  %-10s %llu objects, %llu stalls\n", "",
+	    (unsigned long long)st.objects, (unsigned long long)st.stalls);
+
+	glutils_batch_free(batch);
+}
+
+int
+main(int argc, char **argv)
+{
+	GLFWwindow *win;
+	GLuint prog;
+	mat4 pvm;
+	int opt;
+
+	log_init(log_func, "glutils_batch_bench");
+
+	while ((opt = getopt(argc, argv, "s:l:f:")) != -1) {
+		switch (opt) {
+		case 's':
+			num_syms = atoi(optarg);
+			break;
+		case 'l':
+			num_lines = atoi(optarg);
+			break;
+		case 'f':
+			num_frames = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s <symbols>] "
+			    "[-l <lines>] [-f <frames>]\n", argv[0]);
+			return (1);
+		}
+	}
+	if (num_syms == 0 || num_lines == 0 || num_frames == 0) {
+		fprintf(stderr, "Counts must be greater than zero\n");
+		return (1);
+	}
+
+	VERIFY(glfwInit());
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	win = glfwCreateWindow(WIN_SZ, WIN_SZ, "glutils_batch_bench",
+	    NULL, NULL);
+	VERIFY(win != NULL);
+	glfwMakeContextCurrent(win);
+	VERIFY3U(glewInit(), ==, GLEW_OK);
+
+	prog = shader_prog_from_text("glutils_batch_bench", vert_shader,
+	    frag_shader, "vtx_pos", VTX_ATTRIB_POS,
+	    "vtx_tex0", VTX_ATTRIB_TEX0, NULL);
+	VERIFY(prog != 0);
+	glViewport(0, 0, WIN_SZ, WIN_SZ);
+	glm_ortho(0, WIN_SZ, 0, WIN_SZ, 0, 1, pvm);
+	glUseProgram(prog);
+	glUniformMatrix4fv(glGetUniformLocation(prog, "pvm"), 1, GL_FALSE,
+	    (const GLfloat *)pvm);
+
+	make_scene();
+	printf("%s: %u symbols, %u line strips of %u points, %u frames\n",
+	    (const char *)glGetString(GL_RENDERER), num_syms, num_lines,
+	    LINE_PTS, num_frames);
+	bench_separate(prog);
+	bench_batch(prog);
+
+	glUseProgram(0);
+	glDeleteProgram(prog);
+	free(sym_pts);
+	free(sym_tex);
+	free(line_pts);
+	glfwDestroyWindow(win);
+	glfwTerminate();
+	log_fini();
+
+	return (0);
+}
@@ -0,0 +1,190 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/log.h>
+#include <acfutils/odb.h>
+#include <acfutils/perf.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/thread.h>
+#include <acfutils/time.h>
+
+#include "../zip/zip.h"
+
+/*
+ * Measures odb query throughput with several reader threads hammering
+ * the database concurrently, first on their own and then while the
+ * database is being refreshed in the background.
+ */
+
+#define	TEST_DIR	"odb_bench.tmp"
+#define	LAT_MIN		30
+#define	LAT_MAX		40
+#define	LON_MIN		-100
+#define	LON_MAX		-90
+#define	NUM_OBST	200000
+#define	MAX_READERS	8
+#define	RUN_TIME	SEC2USEC(1)
+
+typedef struct {
+	odb_t		*odb;
+	unsigned	seed;
+	uint64_t	queries;
+	uint64_t	max_lat_us;
+	thread_t	thr;
+} reader_t;
+
+static volatile bool stop = false;
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+static double
+rand_range(double min_val, double max_val)
+{
+	return (min_val + (max_val - min_val) * (rand() / (double)RAND_MAX));
+}
+
+static double
+rand_range_r(unsigned *seed, double min_val, double max_val)
+{
+	return (min_val + (max_val - min_val) *
+	    (rand_r(seed) / (double)RAND_MAX));
+}
+
+static void
+write_fixture(const char *path)
+{
+	struct zip_t *zip = zip_open(path, ZIP_DEFAULT_COMPRESSION_LEVEL, 'w');
+	char *buf = NULL;
+	size_t bufsz = 0;
+
+	VERIFY(zip != NULL);
+	VERIFY0(zip_entry_open(zip, "DOF.CSV"));
+	for (int i = 0; i < NUM_OBST; i++) {
+		int agl_ft = 20 + rand() % 1500;
+
+		append_format(&buf, &bufsz, "%02d-%06d,O,US,XX,CITY,"
+		    "%.8f,%.8f,,,TOWER,1,%d,%d,R,1A,A,N,,A,2023001\r\n",
+		    i % 100, i, rand_range(LAT_MIN, LAT_MAX),
+		    rand_range(LON_MIN, LON_MAX), agl_ft, agl_ft + 1000);
+	}
+	VERIFY0(zip_entry_write(zip, buf, bufsz));
+	free(buf);
+	VERIFY0(zip_entry_close(zip));
+	zip_close(zip);
+}
+
+static void
+reader_func(void *arg)
+{
+	reader_t *rd = arg;
+
+	while (!stop) {
+		geo_pos2_t center = GEO_POS2(
+		    rand_range_r(&rd->seed, LAT_MIN + 1, LAT_MAX - 1),
+		    rand_range_r(&rd->seed, LON_MIN + 1, LON_MAX - 1));
+		uint64_t start = microclock();
+
+		(void)odb_get_obstacles_radius(rd->odb, center, NM2MET(10), 0,
+		    NULL, 0);
+		rd->max_lat_us = MAX(rd->max_lat_us, microclock() - start);
+		rd->queries++;
+	}
+}
+
+static void
+run_readers(odb_t *odb, unsigned n_readers, const char *refresh_path)
+{
+	reader_t readers[MAX_READERS] = {{0}};
+	uint64_t start, t, queries = 0, max_lat_us = 0;
+	int n_refresh = 0;
+
+	stop = false;
+	for (unsigned i = 0; i < n_readers; i++) {
+		readers[i].odb = odb;
+		readers[i].seed = i + 1;
+		VERIFY(thread_create(&readers[i].thr, reader_func,
+		    &readers[i]));
+	}
+	start = microclock();
+	if (refresh_path != NULL) {
+		while (microclock() - start < RUN_TIME) {
+			VERIFY(odb_refresh_cc_from_file(odb, "US",
+			    refresh_path));
+			n_refresh++;
+		}
+	} else {
+		usleep(RUN_TIME);
+	}
+	stop = true;
+	for (unsigned i = 0; i < n_readers; i++) {
+		thread_join(&readers[i].thr);
+		queries += readers[i].queries;
+		max_lat_us = MAX(max_lat_us, readers[i].max_lat_us);
+	}
+	t = microclock() - start;
+
+	printf("  %u reader%s%-11s %9.0f queries/s   max latency %7.3f ms",
+	    n_readers, n_readers == 1 ? " " : "s",
+	    refresh_path != NULL ? " + refresh" : "",
+	    queries / USEC2SEC((double)t), max_lat_us / 1000.0);
+	if (n_refresh != 0)
+		printf("   (%d refreshes)", n_refresh);
+	printf("\n");
+}
+
+int
+main(void)
+{
+	char *zippath;
+	odb_t *odb;
+
+	log_init(log_func, "odb_bench");
+
+	if (file_exists(TEST_DIR, NULL))
+		remove_directory(TEST_DIR);
+	VERIFY(create_directory(TEST_DIR));
+	srand(1234);
+	zippath = mkpathname(TEST_DIR, "DOF.zip", NULL);
+	write_fixture(zippath);
+
+	odb = odb_init(TEST_DIR, NULL);
+	VERIFY(odb_refresh_cc_from_file(odb, "US", zippath));
+
+	printf("%d obstacles, %d CPUs\n", NUM_OBST, lacf_get_num_cpus());
+	for (unsigned n = 1; n <= MAX_READERS; n *= 2)
+		run_readers(odb, n, NULL);
+	for (unsigned n = 1; n <= MAX_READERS; n *= 2)
+		run_readers(odb, n, zippath);
+
+	odb_fini(odb);
+	remove_directory(TEST_DIR);
+	lacf_free(zippath);
+	log_fini();
+
+	return (0);
+}
@@ -0,0 +1,170 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/log.h>
+#include <acfutils/odb.h>
+#include <acfutils/perf.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/time.h>
+
+#include "../zip/zip.h"
+
+/*
+ * Generates a synthetic FAA DOF archive, imports it using
+ * odb_refresh_cc_from_file() and verifies the resulting tiles.
+ */
+
+#define	TEST_DIR	"odb_import.tmp"
+#define	LAT_MIN		25
+#define	LAT_MAX		49
+#define	LON_MIN		-125
+#define	LON_MAX		-67
+
+static geo_pos2_t *pts;
+static float *agls;
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+static double
+rand_range(double min_val, double max_val)
+{
+	return (min_val + (max_val - min_val) * (rand() / (double)RAND_MAX));
+}
+
+static void
+write_fixture(const char *path, int num_obst)
+{
+	struct zip_t *zip = zip_open(path, ZIP_DEFAULT_COMPRESSION_LEVEL, 'w');
+	char *buf = NULL;
+	size_t bufsz = 0;
+
+	VERIFY(zip != NULL);
+	VERIFY0(zip_entry_open(zip, "DOF.CSV"));
+	append_format(&buf, &bufsz, "OAS,VERIFIED STATUS,COUNTRY,STATE,CITY,"
+	    "LATDEC,LONDEC,DMS LAT,DMS LON,TYPE,QUANTITY,AGL HT,AMSL HT,"
+	    "LIGHTING,HORIZ ACC,VERT ACC,MARK INDICATOR,FAA STUDY,ACTION,"
+	    "JDATE\r\n");
+	for (int i = 0; i < num_obst; i++) {
+		int agl_ft = 20 + rand() % 1500;
+
+		pts[i] = GEO_POS2(rand_range(LAT_MIN, LAT_MAX),
+		    rand_range(LON_MIN, LON_MAX));
+		agls[i] = FEET2MET(agl_ft);
+		append_format(&buf, &bufsz, "%02d-%06d,O,US,XX,CITY,"
+		    "%.8f,%.8f,,,%s,%d,%d,%d,R,1A,A,N,,A,2023001\r\n",
+		    i % 100, i, pts[i].lat, pts[i].lon,
+		    i % 3 == 0 ? "TOWER" : "BLDG", 1 + i % 3, agl_ft,
+		    agl_ft + 1000);
+		if (bufsz > (1 << 20)) {
+			VERIFY0(zip_entry_write(zip, buf, bufsz));
+			LACF_DESTROY(buf);
+			bufsz = 0;
+		}
+	}
+	if (bufsz != 0)
+		VERIFY0(zip_entry_write(zip, buf, bufsz));
+	free(buf);
+	VERIFY0(zip_entry_close(zip));
+	zip_close(zip);
+}
+
+static void
+count_obst(obst_type_t type, geo_pos3_t pos, float agl, obst_light_t light,
+    unsigned quant, void *userinfo)
+{
+	int *count = userinfo;
+
+	UNUSED(type);
+	UNUSED(pos);
+	UNUSED(agl);
+	UNUSED(light);
+	UNUSED(quant);
+	(*count)++;
+}
+
+int
+main(int argc, char **argv)
+{
+	int num_obst = (argc >= 2 ? atoi(argv[1]) : 500000);
+	char *zippath;
+	odb_t *odb;
+	uint64_t t_import;
+	int count = 0, brute = 0;
+	size_t n;
+	const geo_pos2_t center = GEO_POS2(40, -100);
+	const double radius = NM2MET(60), min_agl = FEET2MET(1000);
+
+	log_init(log_func, "odb_import");
+	VERIFY3S(num_obst, >, 0);
+
+	if (file_exists(TEST_DIR, NULL))
+		remove_directory(TEST_DIR);
+	VERIFY(create_directory(TEST_DIR));
+	pts = safe_calloc(num_obst, sizeof (*pts));
+	agls = safe_calloc(num_obst, sizeof (*agls));
+
+	srand(1234);
+	zippath = mkpathname(TEST_DIR, "DOF.zip", NULL);
+	write_fixture(zippath, num_obst);
+
+	odb = odb_init(TEST_DIR, NULL);
+	t_import = microclock();
+	VERIFY(odb_refresh_cc_from_file(odb, "US", zippath));
+	t_import = microclock() - t_import;
+	printf("%d obstacles imported in %.3f s (%.0f obstacles/s)\n",
+	    num_obst, USEC2SEC((double)t_import),
+	    num_obst / USEC2SEC((double)t_import));
+	VERIFY(odb_get_cc_refresh_date(odb, "US") != 0);
+
+	/* Every obstacle must have ended up in exactly one tile */
+	for (int lat = LAT_MIN; lat < LAT_MAX; lat++) {
+		for (int lon = LON_MIN; lon < LON_MAX; lon++)
+			odb_get_obstacles(odb, lat, lon, count_obst, &count);
+	}
+	printf("  tiles contain %d obstacles\n", count);
+	VERIFY3S(count, ==, num_obst);
+
+	n = odb_get_obstacles_radius(odb, center, radius, min_agl, NULL, 0);
+	for (int i = 0; i < num_obst; i++) {
+		if (agls[i] >= min_agl && gc_distance(center, pts[i]) <= radius)
+			brute++;
+	}
+	printf("  radius query found %d obstacles (expected %d)\n",
+	    (int)n, brute);
+	/* Allow for obstacles right on the edge, due to quantization */
+	VERIFY3S(abs((int)n - brute), <=, 1 + brute / 1000);
+
+	odb_fini(odb);
+	remove_directory(TEST_DIR);
+	lacf_free(zippath);
+	free(pts);
+	free(agls);
+	log_fini();
+
+	return (0);
+}
@@ -0,0 +1,455 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <png.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/log.h>
+#include <acfutils/png.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/time.h>
+
+/*
+ * Encodes a synthetic chart-like RGBA image using each of the encoder
+ * modes and then decodes it again using the allocating loader, the
+ * direct-to-buffer loader and the progressive decoder fed in small
+ * chunks, checking that all of them produce the same pixels. After
+ * that, a few round trips that aren't timed check the ARGB32 encoder,
+ * greyscale and interlaced images, and that damaged input is rejected.
+ */
+
+#define	TEST_FILE	"png_bench.tmp.png"
+#define	FEED_CHUNK	(16 << 10)
+
+static int img_w = 2048, img_h = 2048, num_iter = 5;
+static uint8_t *img;
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+/*
+ * Mostly flat areas with thin lines, some text-like noise and a
+ * partially transparent border, which is roughly what rendered charts
+ * and map tiles look like.
+ */
+static void
+make_image(void)
+{
+	img = safe_malloc(img_w * img_h * 4);
+	srand(1);
+	for (int y = 0; y < img_h; y++) {
+		for (int x = 0; x < img_w; x++) {
+			uint8_t *p = &img[(y * img_w + x) * 4];
+			bool_t line = (x % 97 == 0 || y % 89 == 0);
+			bool_t text = ((x / 8 + y / 12) % 13 == 0 &&
+			    rand() % 3 == 0);
+
+			p[0] = (line || text ? 20 : 230 - (y * 40) / img_h);
+			p[1] = (line || text ? 20 : 225);
+			p[2] = (line || text ? 60 : 200 + (x * 40) / img_w);
+			p[3] = (x < 16 || y < 16 ? 128 : 255);
+		}
+	}
+}
+
+static size_t
+bench_encode(const char *name, png_enc_mode_t mode)
+{
+	uint64_t start = microclock();
+	size_t sz;
+
+	for (int i = 0; i < num_iter; i++) {
+		VERIFY(png_write_to_file_fmt(TEST_FILE, img_w, img_h, img,
+		    img_w * 4, PNG_PIXFMT_RGBA8, mode));
+	}
+	sz = filesz(TEST_FILE);
+	printf("  encode %-8s %8.1f ms   %8.1f KiB\n", name,
+	    (microclock() - start) / (1000.0 * num_iter), sz / 1024.0);
+
+	return (sz);
+}
+
+typedef struct {
+	uint8_t		*out;
+	int		w, h, bpp;
+	int		rows_seen;
+} stream_t;
+
+static void
+rows_cb(int first_row, int num_rows, void *userinfo)
+{
+	stream_t *st = userinfo;
+
+	VERIFY3S(first_row, ==, st->rows_seen);
+	st->rows_seen += num_rows;
+}
+
+static bool_t
+header_cb(int width, int height, void *userinfo, void **out,
+    size_t *stride)
+{
+	stream_t *st = userinfo;
+
+	VERIFY3S(width, ==, st->w);
+	VERIFY3S(height, ==, st->h);
+	*out = st->out;
+	*stride = width * st->bpp;
+
+	return (B_TRUE);
+}
+
+static void
+bench_decode(const uint8_t *png, size_t len)
+{
+	uint8_t *out = safe_malloc(img_w * img_h * 4);
+	uint64_t start;
+	int w, h;
+
+	VERIFY(png_get_dims_from_buffer(png, len, &w, &h));
+	VERIFY3S(w, ==, img_w);
+	VERIFY3S(h, ==, img_h);
+
+	start = microclock();
+	for (int i = 0; i < num_iter; i++) {
+		uint8_t *pixels = png_load_from_buffer(png, len, &w, &h);
+
+		VERIFY(pixels != NULL);
+		VERIFY0(memcmp(pixels, img, img_w * img_h * 4));
+		free(pixels);
+	}
+	printf("  decode %-8s %8.1f ms\n", "alloc",
+	    (microclock() - start) / (1000.0 * num_iter));
+
+	start = microclock();
+	for (int i = 0; i < num_iter; i++) {
+		VERIFY(png_load_from_buffer_into(png, len, PNG_PIXFMT_RGBA8,
+		    img_w, img_h, out, img_w * 4));
+	}
+	printf("  decode %-8s %8.1f ms\n", "into",
+	    (microclock() - start) / (1000.0 * num_iter));
+	VERIFY0(memcmp(out, img, img_w * img_h * 4));
+
+	memset(out, 0, img_w * img_h * 4);
+	start = microclock();
+	for (int i = 0; i < num_iter; i++) {
+		stream_t st = { .out = out, .w = img_w, .h = img_h, .bpp = 4 };
+		png_dec_t *dec = png_dec_alloc(PNG_PIXFMT_RGBA8, header_cb,
+		    rows_cb, &st);
+
+		for (size_t off = 0; off < len; off += FEED_CHUNK) {
+			VERIFY(png_dec_feed(dec, &png[off],
+			    MIN(len - off, FEED_CHUNK)));
+		}
+		VERIFY(png_dec_is_done(dec));
+		VERIFY3S(st.rows_seen, ==, img_h);
+		png_dec_free(dec);
+	}
+	printf("  decode %-8s %8.1f ms\n", "stream",
+	    (microclock() - start) / (1000.0 * num_iter));
+	VERIFY0(memcmp(out, img, img_w * img_h * 4));
+
+	start = microclock();
+	for (int i = 0; i < num_iter; i++) {
+		VERIFY(png_load_from_buffer_into(png, len, PNG_PIXFMT_ARGB32,
+		    img_w, img_h, out, img_w * 4));
+	}
+	printf("  decode %-8s %8.1f ms\n", "argb32",
+	    (microclock() - start) / (1000.0 * num_iter));
+	for (int i = 0; i < img_w * img_h; i++) {
+		const uint8_t *p = &img[i * 4];
+		uint32_t px;
+
+		memcpy(&px, &out[i * 4], sizeof (px));
+		VERIFY3U(px >> 24, ==, p[3]);
+		VERIFY3U((px >> 16) & 0xff, ==, (p[0] * p[3] + 127) / 255);
+		VERIFY3U(px & 0xff, ==, (p[2] * p[3] + 127) / 255);
+	}
+
+	free(out);
+}
+
+/*
+ * Feeds a whole image to a progressive decoder in `chunk' sized pieces.
+ */
+static bool_t
+stream_decode(const uint8_t *png, size_t len, size_t chunk,
+    png_pixfmt_t fmt, int w, int h, int bpp, uint8_t *out)
+{
+	stream_t st = { .out = out, .w = w, .h = h, .bpp = bpp };
+	png_dec_t *dec = png_dec_alloc(fmt, header_cb, rows_cb, &st);
+	bool_t res = B_TRUE;
+
+	for (size_t off = 0; res && off < len; off += chunk)
+		res = png_dec_feed(dec, &png[off], MIN(len - off, chunk));
+	if (res) {
+		VERIFY(png_dec_is_done(dec));
+		VERIFY3S(st.rows_seen, ==, h);
+	}
+	png_dec_free(dec);
+
+	return (res);
+}
+
+/*
+ * Premultiplied ARGB32 in, straight RGBA out. Rounding to 8 bits on the
+ * way in and out can move each color channel by at most 1 for the
+ * alpha values in the test image.
+ */
+static void
+test_argb32_encode(void)
+{
+	uint8_t *argb = safe_malloc(img_w * img_h * 4);
+	uint8_t *png, *out;
+	size_t len;
+	int w, h;
+
+	for (int i = 0; i < img_w * img_h; i++) {
+		const uint8_t *p = &img[i * 4];
+		uint32_t px = (uint32_t)p[3] << 24;
+
+		for (int c = 0; c < 3; c++)
+			px |= ((p[c] * p[3] + 127) / 255) << (16 - 8 * c);
+		memcpy(&argb[i * 4], &px, sizeof (px));
+	}
+	VERIFY(png_write_to_file_fmt(TEST_FILE, img_w, img_h, argb,
+	    img_w * 4, PNG_PIXFMT_ARGB32, PNG_ENC_FAST));
+	png = file2buf(TEST_FILE, &len);
+	VERIFY(png != NULL);
+	out = png_load_from_buffer(png, len, &w, &h);
+	VERIFY(out != NULL);
+	VERIFY3S(w, ==, img_w);
+	VERIFY3S(h, ==, img_h);
+	for (int i = 0; i < img_w * img_h; i++) {
+		const uint8_t *p = &img[i * 4], *q = &out[i * 4];
+
+		VERIFY3U(q[3], ==, p[3]);
+		for (int c = 0; c < 3; c++)
+			VERIFY3S(abs(q[c] - p[c]), <=, 1);
+	}
+	printf("  argb32 encode round trip OK\n");
+
+	free(out);
+	free(png);
+	free(argb);
+}
+
+static void
+test_grey8(void)
+{
+	uint8_t *grey = safe_malloc(img_w * img_h);
+	uint8_t *out = safe_malloc(img_w * img_h);
+	uint8_t *png;
+	size_t len;
+
+	for (int i = 0; i < img_w * img_h; i++)
+		grey[i] = img[i * 4 + 1];
+	VERIFY(png_write_to_file_grey8(TEST_FILE, img_w, img_h, grey));
+	png = file2buf(TEST_FILE, &len);
+	VERIFY(png != NULL);
+	VERIFY(png_load_from_buffer_into(png, len, PNG_PIXFMT_GREY8,
+	    img_w, img_h, out, img_w));
+	VERIFY0(memcmp(out, grey, img_w * img_h));
+	memset(out, 0, img_w * img_h);
+	VERIFY(stream_decode(png, len, 1000, PNG_PIXFMT_GREY8, img_w, img_h,
+	    1, out));
+	VERIFY0(memcmp(out, grey, img_w * img_h));
+	printf("  grey8 round trip OK\n");
+
+	free(png);
+	free(out);
+	free(grey);
+}
+
+static void
+mem_write(png_structp png_ptr, png_bytep data, png_size_t len)
+{
+	FILE *fp = png_get_io_ptr(png_ptr);
+
+	VERIFY3U(fwrite(data, 1, len, fp), ==, len);
+}
+
+static void
+mem_flush(png_structp png_ptr)
+{
+	UNUSED(png_ptr);
+}
+
+/*
+ * Our encoder never interlaces, so use libpng directly to produce an
+ * Adam7 interlaced version of the test image.
+ */
+static uint8_t *
+make_interlaced(size_t *len)
+{
+	png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING,
+	    NULL, NULL, NULL);
+	png_infop info_ptr = png_create_info_struct(png_ptr);
+	png_bytep *rows = safe_malloc(img_h * sizeof (*rows));
+	char *buf = NULL;
+	FILE *fp;
+
+	VERIFY(png_ptr != NULL && info_ptr != NULL);
+	fp = open_memstream(&buf, len);
+	VERIFY(fp != NULL);
+	VERIFY0(setjmp(png_jmpbuf(png_ptr)));
+	png_set_write_fn(png_ptr, fp, mem_write, mem_flush);
+	png_set_IHDR(png_ptr, info_ptr, img_w, img_h, 8,
+	    PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_ADAM7,
+	    PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE);
+	for (int y = 0; y < img_h; y++)
+		rows[y] = &img[y * img_w * 4];
+	png_set_rows(png_ptr, info_ptr, rows);
+	png_write_png(png_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+	fclose(fp);
+	free(rows);
+
+	return ((uint8_t *)buf);
+}
+
+static void
+test_interlaced(void)
+{
+	uint8_t *out = safe_malloc(img_w * img_h * 4);
+	size_t len;
+	uint8_t *png = make_interlaced(&len);
+
+	VERIFY(png_load_from_buffer_into(png, len, PNG_PIXFMT_RGBA8,
+	    img_w, img_h, out, img_w * 4));
+	VERIFY0(memcmp(out, img, img_w * img_h * 4));
+	memset(out, 0, img_w * img_h * 4);
+	VERIFY(stream_decode(png, len, 1000, PNG_PIXFMT_RGBA8, img_w, img_h,
+	    4, out));
+	VERIFY0(memcmp(out, img, img_w * img_h * 4));
+	printf("  interlaced decode OK\n");
+
+	free(png);
+	free(out);
+}
+
+/*
+ * A truncated image can't be told apart from one that is still arriving,
+ * so png_dec_feed() accepts it, but the decoder must never report it as
+ * done. Damaged data must make png_dec_feed() fail.
+ */
+static void
+test_damaged(void)
+{
+	uint8_t *out = safe_malloc(img_w * img_h * 4);
+	uint8_t *png;
+	size_t len;
+
+	VERIFY(png_write_to_file_fmt(TEST_FILE, img_w, img_h, img,
+	    img_w * 4, PNG_PIXFMT_RGBA8, PNG_ENC_FAST));
+	png = file2buf(TEST_FILE, &len);
+	VERIFY(png != NULL);
+
+	for (size_t cut = 1; cut < len; cut = cut * 2 + 1) {
+		stream_t st = { .out = out, .w = img_w, .h = img_h, .bpp = 4 };
+		png_dec_t *dec = png_dec_alloc(PNG_PIXFMT_RGBA8, header_cb,
+		    rows_cb, &st);
+
+		VERIFY(png_dec_feed(dec, png, cut));
+		VERIFY(!png_dec_is_done(dec));
+		png_dec_free(dec);
+		VERIFY(!png_load_from_buffer_into(png, cut, PNG_PIXFMT_RGBA8,
+		    img_w, img_h, out, img_w * 4));
+	}
+	/* bad signature */
+	png[1] ^= 0xff;
+	VERIFY(!stream_decode(png, len, FEED_CHUNK, PNG_PIXFMT_RGBA8,
+	    img_w, img_h, 4, out));
+	png[1] ^= 0xff;
+	/* damaged compressed data, caught by the chunk CRC */
+	png[len / 2] ^= 0xff;
+	VERIFY(!stream_decode(png, len, FEED_CHUNK, PNG_PIXFMT_RGBA8,
+	    img_w, img_h, 4, out));
+	VERIFY(!png_load_from_buffer_into(png, len, PNG_PIXFMT_RGBA8,
+	    img_w, img_h, out, img_w * 4));
+	printf("  damaged input rejected OK\n");
+
+	free(png);
+	free(out);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint8_t *png;
+	size_t len, sz_default, sz_small, sz_fast;
+	int opt;
+
+	log_init(log_func, "png_bench");
+
+	while ((opt = getopt(argc, argv, "w:h:n:")) != -1) {
+		switch (opt) {
+		case 'w':
+			img_w = atoi(optarg);
+			break;
+		case 'h':
+			img_h = atoi(optarg);
+			break;
+		case 'n':
+			num_iter = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-w <width>] [-h <height>] "
+			    "[-n <iterations>]\n", argv[0]);
+			return (1);
+		}
+	}
+	if (img_w <= 0 || img_h <= 0 || num_iter <= 0) {
+		fprintf(stderr, "Arguments must be greater than zero\n");
+		return (1);
+	}
+
+	make_image();
+	printf("%dx%d RGBA image, %d iterations\n", img_w, img_h, num_iter);
+	sz_default = bench_encode("default", PNG_ENC_DEFAULT);
+	sz_small = bench_encode("small", PNG_ENC_SMALL);
+	sz_fast = bench_encode("fast", PNG_ENC_FAST);
+	/* The modes are only worth having if they trade size for speed */
+	VERIFY3U(sz_small, <=, sz_default);
+	VERIFY3U(sz_default, <=, sz_fast);
+
+	/* Decode the output of the fast encoder, as cache readers would */
+	png = file2buf(TEST_FILE, &len);
+	VERIFY(png != NULL);
+	bench_decode(png, len);
+	free(png);
+
+	test_argb32_encode();
+	test_grey8();
+	test_interlaced();
+	test_damaged();
+
+	free(img);
+	remove_file(TEST_FILE, B_FALSE);
+	log_fini();
+
+	return (0);
+}
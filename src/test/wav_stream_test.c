@@ -0,0 +1,230 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/helpers.h>
+#include <acfutils/log.h>
+#include <acfutils/riff.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/wav.h>
+
+/*
+ * Plays a generated WAV file, as well as the Opus and MP3 files in
+ * data/, through wav_load_stream and checks that playback position,
+ * seeking, looping and stopping behave like they do for sounds loaded
+ * using wav_load. Unless overridden in the environment, OpenAL Soft's
+ * "null" backend is used, which mixes in real time without any audio
+ * hardware, so this can be run on a headless machine. Run it from the
+ * src/test directory, or pass the path to the data directory.
+ */
+
+#define	TEST_FILE	"wav_stream_test.tmp.wav"
+#define	SRATE		22050
+#define	DURATION	3	/* seconds, of all test files */
+#define	TOLERANCE	0.1	/* seconds */
+
+static alc_t *alc;
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+static void
+put32(FILE *fp, uint32_t x)
+{
+	VERIFY3U(fwrite(&x, sizeof (x), 1, fp), ==, 1);
+}
+
+/*
+ * Stereo 16-bit sine. An odd-sized chunk precedes `data' to check that
+ * the streaming loader skips it with the correct padding.
+ */
+static void
+write_wav(void)
+{
+	wav_fmt_hdr_t fmt = {
+	    .datafmt = 1, .n_channels = 2, .srate = SRATE,
+	    .byte_rate = SRATE * 4, .padding = 4, .bps = 16
+	};
+	uint32_t datasz = SRATE * DURATION * 4;
+	FILE *fp = fopen(TEST_FILE, "wb");
+
+	VERIFY(fp != NULL);
+	put32(fp, FOURCC("RIFF"));
+	put32(fp, 4 + 8 + sizeof (fmt) + 8 + 4 + 8 + datasz);
+	put32(fp, FOURCC("WAVE"));
+	put32(fp, FOURCC("fmt "));
+	put32(fp, sizeof (fmt));
+	VERIFY3U(fwrite(&fmt, sizeof (fmt), 1, fp), ==, 1);
+	put32(fp, FOURCC("junk"));
+	put32(fp, 3);
+	put32(fp, 0);
+	put32(fp, FOURCC("data"));
+	put32(fp, datasz);
+	for (unsigned i = 0; i < SRATE * DURATION; i++) {
+		int16_t s = 8000 * sin(i * 2 * M_PI * 440 / SRATE);
+		int16_t frame[2] = { s, s };
+
+		VERIFY3U(fwrite(frame, sizeof (frame), 1, fp), ==, 1);
+	}
+	fclose(fp);
+}
+
+static void
+check_offset(wav_t *wav, double expected)
+{
+	double offset = wav_get_offset(wav);
+
+	VERIFY_MSG(fabs(offset - expected) <= TOLERANCE,
+	    "%s: offset %.3f, expected %.3f", wav->name, offset, expected);
+}
+
+static void
+sleep_sec(double secs)
+{
+	usleep(secs * 1000000);
+}
+
+/*
+ * Polls the offset while playback wraps around the loop point. It must
+ * stay within the file and go back to the start exactly once.
+ */
+static void
+check_loop_wrap(wav_t *wav, double secs)
+{
+	double prev = wav_get_offset(wav);
+	int wraps = 0;
+
+	for (double t = 0; t < secs; t += 0.01) {
+		double offset;
+
+		sleep_sec(0.01);
+		offset = wav_get_offset(wav);
+		VERIFY_MSG(offset >= 0 && offset <= wav->duration,
+		    "%s: offset %.3f outside of file (duration %.3f)",
+		    wav->name, offset, wav->duration);
+		if (offset < prev)
+			wraps++;
+		prev = offset;
+	}
+	VERIFY3S(wraps, ==, 1);
+}
+
+/*
+ * `dur_tol' is how far the reported duration may be from DURATION.
+ * It is only an estimate for MP3 streams.
+ */
+static void
+test_file(const char *filename, double dur_tol)
+{
+	wav_t *wav = wav_load_stream(filename, filename, alc);
+
+	printf("%s\n", filename);
+	VERIFY(wav != NULL);
+	VERIFY(wav->stream != NULL);
+	VERIFY_MSG(fabs(wav->duration - DURATION) <= dur_tol,
+	    "%s: duration %.3f", filename, wav->duration);
+	VERIFY(!wav_is_playing(wav));
+
+	printf("  play\n");
+	VERIFY(wav_play(wav));
+	VERIFY(wav_is_playing(wav));
+	sleep_sec(0.5);
+	check_offset(wav, 0.5);
+
+	printf("  seek while playing\n");
+	wav_set_offset(wav, 2);
+	sleep_sec(0.2);
+	check_offset(wav, 2.2);
+	VERIFY(wav_is_playing(wav));
+
+	printf("  seek backwards\n");
+	wav_set_offset(wav, 1);
+	sleep_sec(0.2);
+	check_offset(wav, 1.2);
+	wav_set_offset(wav, 2.2);
+
+	printf("  play to the end\n");
+	sleep_sec(DURATION - 2.2 + 0.5);
+	VERIFY(!wav_is_playing(wav));
+	check_offset(wav, 0);
+
+	printf("  loop across the end\n");
+	wav_set_loop(wav, B_TRUE);
+	wav_set_offset(wav, DURATION - 0.5);
+	VERIFY(!wav_is_playing(wav));
+	VERIFY(wav_play(wav));
+	/* starting after a seek plays from the seek target */
+	sleep_sec(0.2);
+	check_offset(wav, DURATION - 0.3);
+	check_loop_wrap(wav, 1.3);
+	VERIFY(wav_is_playing(wav));
+	check_offset(wav, 1);
+
+	printf("  stop looping\n");
+	wav_set_loop(wav, B_FALSE);
+	sleep_sec(DURATION);
+	VERIFY(!wav_is_playing(wav));
+
+	printf("  stop\n");
+	VERIFY(wav_play(wav));
+	sleep_sec(0.3);
+	wav_stop(wav);
+	VERIFY(!wav_is_playing(wav));
+	check_offset(wav, 0);
+
+	wav_free(wav);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *datadir = (argc > 1 ? argv[1] : "data");
+	char *path;
+
+	log_init(log_func, "wav_stream_test");
+	setenv("ALSOFT_DRIVERS", "null", 0);
+	alc = openal_init(NULL, B_FALSE);
+	VERIFY(alc != NULL);
+
+	write_wav();
+	test_file(TEST_FILE, 1e-6);
+	remove_file(TEST_FILE, B_FALSE);
+
+	path = mkpathname(datadir, "sine440.opus", NULL);
+	test_file(path, 0.001);
+	free(path);
+
+	path = mkpathname(datadir, "sine440.mp3", NULL);
+	test_file(path, 0.1);
+	free(path);
+
+	openal_fini(alc);
+	printf("OK\n");
+	log_fini();
+
+	return (0);
+}
@@ -0,0 +1,151 @@
+/*
+ * CDDL HEADER START
+ *
+ * This file and its contents are supplied under the terms of the
+ * Common Development and Distribution License ("CDDL"), version 1.0.
+ * You may only use this file in accordance with the terms of version
+ * 1.0 of the CDDL.
+ *
+ * A full copy of the text of the CDDL should have accompanied this
+ * source.  A copy of the CDDL is also available via the Internet at
+ * http://www.illumos.org/license/CDDL.
+ *
+ * CDDL HEADER END
+*/
+/*
+ * Copyright 2023 Saso Kiselkov. All rights reserved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <acfutils/assert.h>
+#include <acfutils/log.h>
+#include <acfutils/safe_alloc.h>
+#include <acfutils/time.h>
+#include <acfutils/wmm.h>
+
+enum { NUM_POINTS = 200000 };
+
+static void
+log_func(const char *str)
+{
+	fputs(str, stderr);
+}
+
+static double
+rand_range(double min_val, double max_val)
+{
+	return (min_val + (max_val - min_val) * (rand() / (double)RAND_MAX));
+}
+
+static uint64_t
+run_decl(const wmm_t *wmm, const geo_pos3_t *pts, double *out,
+    bool_t exact)
+{
+	uint64_t start = microclock();
+
+	for (int i = 0; i < NUM_POINTS; i++) {
+		out[i] = (exact ? wmm_get_decl_exact(wmm, pts[i]) :
+		    wmm_get_decl(wmm, pts[i]));
+	}
+	return (microclock() - start);
+}
+
+int
+main(int argc, char **argv)
+{
+	wmm_t *wmm;
+	geo_pos3_t *pts;
+	double *exact, *grid;
+	double year, max_err = 0, sum_err = 0;
+	uint64_t t_exact, t_batch, t_exact_rows, t_batch_rows, t_cold, t_warm;
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s <WMM.COF> [year]\n", argv[0]);
+		return (1);
+	}
+	log_init(log_func, "wmm_bench");
+
+	wmm = wmm_open(argv[1], 0);
+	if (wmm == NULL) {
+		fprintf(stderr, "Can't open %s\n", argv[1]);
+		return (1);
+	}
+	year = (argc >= 3 ? atof(argv[2]) : wmm_get_start(wmm) + 1);
+	wmm_reopen(wmm, year);
+
+	pts = safe_calloc(NUM_POINTS, sizeof (*pts));
+	exact = safe_calloc(NUM_POINTS, sizeof (*exact));
+	grid = safe_calloc(NUM_POINTS, sizeof (*grid));
+	/*
+	 * Simulate a navaid database over a limited area (Europe), which
+	 * is the typical use case. The cold pass includes the cost of
+	 * lazily building the grid tiles covering the area.
+	 */
+	srand(1234);
+	for (int i = 0; i < NUM_POINTS; i++) {
+		pts[i] = GEO_POS3(rand_range(35, 60), rand_range(-10, 30),
+		    rand_range(0, 45000));
+	}
+	t_exact = run_decl(wmm, pts, exact, B_TRUE);
+
+	t_batch = microclock();
+	wmm_get_decl_v(wmm, pts, NUM_POINTS, grid);
+	t_batch = microclock() - t_batch;
+	for (int i = 0; i < NUM_POINTS; i++)
+		VERIFY3F(fabs(grid[i] - exact[i]), <, 1e-9);
+
+	wmm_set_decl_grid(wmm, 0.25);
+	t_cold = run_decl(wmm, pts, grid, B_FALSE);
+	t_warm = run_decl(wmm, pts, grid, B_FALSE);
+
+	for (int i = 0; i < NUM_POINTS; i++) {
+		double err = fabs(grid[i] - exact[i]);
+
+		if (err > 180)
+			err = 360 - err;
+		max_err = MAX(max_err, err);
+		sum_err += err;
+	}
+	/*
+	 * A regular lat/lon grid listed column by column, where points on
+	 * the same parallel are spread across the whole input. This is
+	 * the case where sorting the batch pays off.
+	 */
+	for (int i = 0; i < NUM_POINTS; i++) {
+		pts[i] = GEO_POS3(35 + (i % 400) * 0.0625,
+		    -10 + (i / 400) * 0.08, 0);
+	}
+	t_exact_rows = run_decl(wmm, pts, exact, B_TRUE);
+	t_batch_rows = microclock();
+	wmm_get_decl_v(wmm, pts, NUM_POINTS, grid);
+	t_batch_rows = microclock() - t_batch_rows;
+	for (int i = 0; i < NUM_POINTS; i++)
+		VERIFY3F(fabs(grid[i] - exact[i]), <, 1e-9);
+
+	printf("%d points, model year %.1f\n", NUM_POINTS, year);
+	printf("  exact:       %8.3f ms  (%.3f us/pt)\n", t_exact / 1000.0,
+	    t_exact / (double)NUM_POINTS);
+	printf("  batch:       %8.3f ms  (%.3f us/pt)\n", t_batch / 1000.0,
+	    t_batch / (double)NUM_POINTS);
+	printf("  exact (rows):%8.3f ms  (%.3f us/pt)\n",
+	    t_exact_rows / 1000.0, t_exact_rows / (double)NUM_POINTS);
+	printf("  batch (rows):%8.3f ms  (%.3f us/pt)\n",
+	    t_batch_rows / 1000.0, t_batch_rows / (double)NUM_POINTS);
+	printf("  grid (cold): %8.3f ms  (%.3f us/pt)\n", t_cold / 1000.0,
+	    t_cold / (double)NUM_POINTS);
+	printf("  grid (warm): %8.3f ms  (%.3f us/pt)\n", t_warm / 1000.0,
+	    t_warm / (double)NUM_POINTS);
+	printf("  error: max %.5f deg, avg %.5f deg (limit %.3f deg)\n",
+	    max_err, sum_err / NUM_POINTS, WMM_DECL_GRID_MAX_ERR);
+	VERIFY3F(max_err, <=, WMM_DECL_GRID_MAX_ERR);
+
+	free(pts);
+	free(exact);
+	free(grid);
+	wmm_close(wmm);
+	log_fini();
+
+	return (0);
+}
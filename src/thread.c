@@ -16,6 +16,10 @@
  * Copyright 2021 Saso Kiselkov. All rights reserved.
  */
 
+#if	!IBM
+#include <unistd.h>
+#endif
+
 #include "acfutils/thread.h"
 
 bool_t	lacf_thread_list_inited = B_FALSE;
@@ -47,3 +51,23 @@ lacf_thread_start_routine(void *arg)
 }
 
 #endif
+
+/**
+ * @return The number of CPUs (logical processors) currently online in
+ *	the system. Useful for sizing worker thread pools. Always returns
+ *	at least 1.
+ */
+unsigned
+lacf_get_num_cpus(void)
+{
+#if	IBM
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	return (MAX(si.dwNumberOfProcessors, 1));
+#else	/* !IBM */
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (MAX(n, 1));
+#endif	/* !IBM */
+}
@@ -41,9 +41,11 @@
 #include <acfutils/log.h>
 #include <acfutils/riff.h>
 #include <acfutils/safe_alloc.h>
+#include <acfutils/thread.h>
 #include <acfutils/time.h>
 #include <acfutils/types.h>
 #include <acfutils/wav.h>
+#include <acfutils/worker.h>
 
 #include "minimp3.h"
 
@@ -52,6 +54,7 @@
 #define	DATA_ID	FOURCC("data")
 
 #define	READ_BUFSZ	((1024 * 1024) / sizeof (opus_int16))	/* bytes */
+#define	OPUS_SRATE	48000	/* Opus always outputs 48 kHz! */
 
 #define	WAV_OP_PARAM(al_op, al_param_name, err_ret, ...) \
 	do { \
@@ -299,8 +302,41 @@ check_audio_fmt(const wav_fmt_hdr_t *fmt, const char *filename)
 	return (B_TRUE);
 }
 
+static void
+fake_fmt_hdr(wav_fmt_hdr_t *fmt, unsigned n_channels, unsigned srate)
+{
+	fmt->datafmt = 1;
+	fmt->n_channels = n_channels;
+	fmt->srate = srate;
+	fmt->bps = 16;
+	fmt->byte_rate = (fmt->srate * fmt->bps * fmt->n_channels) / 8;
+}
+
+static void
+fmt_hdr_bswap(wav_fmt_hdr_t *fmt)
+{
+	fmt->datafmt = BSWAP16(fmt->datafmt);
+	fmt->n_channels = BSWAP16(fmt->n_channels);
+	fmt->srate = BSWAP32(fmt->srate);
+	fmt->byte_rate = BSWAP32(fmt->byte_rate);
+	fmt->bps = BSWAP16(fmt->bps);
+}
+
+static ALenum
+fmt_hdr2al(const wav_fmt_hdr_t *fmt)
+{
+	if (fmt->bps == 16)
+		return (fmt->n_channels == 2 ? AL_FORMAT_STEREO16 :
+		    AL_FORMAT_MONO16);
+	return (fmt->n_channels == 2 ? AL_FORMAT_STEREO8 : AL_FORMAT_MONO8);
+}
+
+/*
+ * Creates the source of a wav_t and sets it up with default parameters.
+ * If wav->albuf is set, it gets attached to the source.
+ */
 static bool_t
-wav_gen_al_bufs(wav_t *wav, const void *buf, size_t bufsz, const char *filename)
+wav_gen_al_src(wav_t *wav, const char *filename)
 {
 	ALuint err;
 	ALfloat zeroes[3] = { 0.0, 0.0, 0.0 };
@@ -309,30 +345,6 @@ wav_gen_al_bufs(wav_t *wav, const void *buf, size_t bufsz, const char *filename)
 	if (!ctx_save(wav->alc, &sav))
 		return (B_FALSE);
 
-	alGenBuffers(1, &wav->albuf);
-	if ((err = alGetError()) != AL_NO_ERROR) {
-		logMsg("Error loading WAV file %s: alGenBuffers failed (0x%x).",
-		    filename, err);
-		(void) ctx_restore(wav->alc, &sav);
-		return (B_FALSE);
-	}
-	if (wav->fmt.bps == 16) {
-		alBufferData(wav->albuf, wav->fmt.n_channels == 2 ?
-		    AL_FORMAT_STEREO16 : AL_FORMAT_MONO16, buf, bufsz,
-		    wav->fmt.srate);
-	} else {
-		alBufferData(wav->albuf, wav->fmt.n_channels == 2 ?
-		    AL_FORMAT_STEREO8 : AL_FORMAT_MONO8, buf, bufsz,
-		    wav->fmt.srate);
-	}
-
-	if ((err = alGetError()) != AL_NO_ERROR) {
-		logMsg("Error loading WAV file %s: alBufferData failed (0x%x).",
-		    filename, err);
-		(void) ctx_restore(wav->alc, &sav);
-		return (B_FALSE);
-	}
-
 	alGenSources(1, &wav->alsrc);
 	if ((err = alGetError()) != AL_NO_ERROR) {
 		logMsg("Error loading WAV file %s: alGenSources failed (0x%x).",
@@ -353,18 +365,50 @@ wav_gen_al_bufs(wav_t *wav, const void *buf, size_t bufsz, const char *filename)
 			return (B_FALSE); \
 		} \
 	} while (0)
-	CHECK_ERROR(alSourcei(wav->alsrc, AL_BUFFER, wav->albuf));
+	if (wav->albuf != 0)
+		CHECK_ERROR(alSourcei(wav->alsrc, AL_BUFFER, wav->albuf));
 	CHECK_ERROR(alSourcef(wav->alsrc, AL_PITCH, 1.0));
 	CHECK_ERROR(alSourcef(wav->alsrc, AL_GAIN, 1.0));
 	CHECK_ERROR(alSourcei(wav->alsrc, AL_LOOPING, 0));
 	CHECK_ERROR(alSourcefv(wav->alsrc, AL_POSITION, zeroes));
 	CHECK_ERROR(alSourcefv(wav->alsrc, AL_VELOCITY, zeroes));
+#undef	CHECK_ERROR
 
 	(void) ctx_restore(wav->alc, &sav);
 
 	return (B_TRUE);
 }
 
+static bool_t
+wav_gen_al_bufs(wav_t *wav, const void *buf, size_t bufsz, const char *filename)
+{
+	ALuint err;
+	alc_t sav;
+
+	if (!ctx_save(wav->alc, &sav))
+		return (B_FALSE);
+
+	alGenBuffers(1, &wav->albuf);
+	if ((err = alGetError()) != AL_NO_ERROR) {
+		logMsg("Error loading WAV file %s: alGenBuffers failed (0x%x).",
+		    filename, err);
+		(void) ctx_restore(wav->alc, &sav);
+		return (B_FALSE);
+	}
+	alBufferData(wav->albuf, fmt_hdr2al(&wav->fmt), buf, bufsz,
+	    wav->fmt.srate);
+	if ((err = alGetError()) != AL_NO_ERROR) {
+		logMsg("Error loading WAV file %s: alBufferData failed (0x%x).",
+		    filename, err);
+		(void) ctx_restore(wav->alc, &sav);
+		return (B_FALSE);
+	}
+
+	(void) ctx_restore(wav->alc, &sav);
+
+	return (wav_gen_al_src(wav, filename));
+}
+
 static wav_t *
 wav_load_opus(const char *filename, alc_t *alc)
 {
@@ -387,12 +431,7 @@ wav_load_opus(const char *filename, alc_t *alc)
 	wav->alc = alc;
 
 	/* fake a wav_fmt_hdr_t from the OpusHead object */
-	wav->fmt.datafmt = 1;
-	wav->fmt.n_channels = head->channel_count;
-	wav->fmt.srate = 48000;		/* Opus always outputs 48 kHz! */
-	wav->fmt.bps = 16;
-	wav->fmt.byte_rate = (wav->fmt.srate * wav->fmt.bps *
-	    wav->fmt.n_channels) / 8;
+	fake_fmt_hdr(&wav->fmt, head->channel_count, OPUS_SRATE);
 
 	if (!check_audio_fmt(&wav->fmt, filename))
 		goto errout;
@@ -459,17 +498,12 @@ wav_load_mp3(const char *filename, alc_t *alc)
 	bytes = mp3_decode(mp3, contents, len, pcm, &info);
 	if (bytes == 0) {
 		logMsg("Error decoding MP3 file %s", filename);
-		mp3_done(&mp3);
+		mp3_done(mp3);
 		goto errout;
 	}
 
-	/* fake a wav_fmt_hdr_t from the OpusHead object */
-	wav->fmt.datafmt = 1;
-	wav->fmt.n_channels = info.channels;
-	wav->fmt.srate = info.sample_rate;
-	wav->fmt.bps = 16;
-	wav->fmt.byte_rate = (wav->fmt.srate * wav->fmt.bps *
-	    wav->fmt.n_channels) / 8;
+	/* fake a wav_fmt_hdr_t from the MP3 frame info */
+	fake_fmt_hdr(&wav->fmt, info.channels, info.sample_rate);
 
 	audio_bytes = 0;
 	while ((n_bytes = mp3_decode(mp3, &contents[bytes], len - bytes,
@@ -479,7 +513,7 @@ wav_load_mp3(const char *filename, alc_t *alc)
 	}
 
 	if (!check_audio_fmt(&wav->fmt, filename)) {
-		mp3_done(&mp3);
+		mp3_done(mp3);
 		goto errout;
 	}
 
@@ -488,7 +522,7 @@ wav_load_mp3(const char *filename, alc_t *alc)
 
 	wav_gen_al_bufs(wav, pcm, bytes, filename);
 
-	mp3_done(&mp3);
+	mp3_done(mp3);
 	free(contents);
 	free(pcm);
 
@@ -543,13 +577,8 @@ wav_load_wav(const char *filename, alc_t *alc)
 		goto errout;
 	}
 	memcpy(&wav->fmt, chunk->data, sizeof (wav->fmt));
-	if (riff->bswap) {
-		wav->fmt.datafmt = BSWAP16(wav->fmt.datafmt);
-		wav->fmt.n_channels = BSWAP16(wav->fmt.n_channels);
-		wav->fmt.srate = BSWAP32(wav->fmt.srate);
-		wav->fmt.byte_rate = BSWAP32(wav->fmt.byte_rate);
-		wav->fmt.bps = BSWAP16(wav->fmt.bps);
-	}
+	if (riff->bswap)
+		fmt_hdr_bswap(&wav->fmt);
 
 	if (!check_audio_fmt(&wav->fmt, filename))
 		goto errout;
@@ -594,6 +623,21 @@ errout:
 	return (NULL);
 }
 
+static void
+wav_set_defaults(wav_t *wav, const char *descr_name)
+{
+	wav->name = strdup(descr_name);
+
+	/* set up some defaults */
+	wav->cone_outer = 360;
+	wav->cone_inner = 360;
+	wav->ref_dist = 1.0;
+	wav->max_dist = 1e10;
+	wav->rolloff_fact = 1.0;
+	wav->gain = 1.0;
+	wav->pitch = 1.0;
+}
+
 /*
  * Loads a WAV file from a file and returns a buffered representation
  * ready to be passed to OpenAL. Currently we only support mono or
@@ -616,24 +660,796 @@ wav_load(const char *filename, const char *descr_name, alc_t *alc)
 	} else {
 		wav = wav_load_wav(filename, alc);
 	}
-	if (wav != NULL) {
-		wav->name = strdup(descr_name);
+	if (wav != NULL)
+		wav_set_defaults(wav, descr_name);
+
+	return (wav);
+}
+
+/*
+ * Streaming playback. Rather than decoding the whole file into a single
+ * OpenAL buffer up front, a streamed wav_t keeps its decoder open and
+ * feeds the source from a small ring of STREAM_NUM_BUFS buffers, each
+ * holding STREAM_BUF_MSEC of audio, using alSourceQueueBuffers. A worker
+ * thread unqueues processed buffers, decodes the next piece of the file
+ * into them and requeues them, so memory use doesn't depend on the length
+ * of the sound. The worker uses ALC_EXT_thread_local_context to talk to
+ * the wav_t's context, so it never touches the process-wide current
+ * context of the caller.
+ */
+#define	STREAM_NUM_BUFS		4
+#define	STREAM_BUF_MSEC		250
+#define	STREAM_REFILL_INTVAL	50000	/* us */
+
+typedef enum {
+	STREAM_WAV,
+	STREAM_OPUS,
+	STREAM_MP3
+} stream_type_t;
+
+typedef struct {
+	ALuint		buf;
+	uint64_t	start;		/* first frame contained in `buf' */
+	unsigned	frames;		/* number of frames in `buf' */
+} stream_buf_t;
+
+struct wav_stream_s {
+	stream_type_t	type;
+	unsigned	frame_sz;	/* bytes per frame (all channels) */
+	uint64_t	num_frames;	/* 0 if unknown */
+	ALenum		al_fmt;
+	ALCcontext	*ctx;		/* made current on the worker thread */
+
+	/* STREAM_WAV */
+	FILE		*fp;
+	bool_t		bswap;
+	long		data_off;
+	/* STREAM_OPUS */
+	OggOpusFile	*opus;
+	/* STREAM_MP3, compressed data is kept in memory */
+	mp3_decoder_t	mp3;
+	char		*mp3_data;
+	long		mp3_len;
+	long		mp3_off;
+	int16_t		mp3_pcm[MP3_MAX_SAMPLES_PER_FRAME];
+	unsigned	mp3_pcm_frames;
+	unsigned	mp3_pcm_off;
+
+	mutex_t		lock;
+	/* protected by `lock' */
+	uint64_t	frame;		/* next frame returned by the decoder */
+	bool_t		active;		/* source is playing or about to */
+	bool_t		eof;		/* decoder reached end, not looping */
+	ALuint		bufs[STREAM_NUM_BUFS];
+	ALuint		free_bufs[STREAM_NUM_BUFS];
+	unsigned	num_free;
+	stream_buf_t	queue[STREAM_NUM_BUFS];	/* oldest first */
+	unsigned	q_head;
+	unsigned	q_len;
+	uint8_t		*pcm;
+	unsigned	buf_frames;
+
+	bool_t		wk_inited;
+	worker_t	wk;
+};
+
+static unsigned
+stream_read_wav(wav_stream_t *st, uint8_t *out, unsigned max_frames)
+{
+	unsigned n = max_frames;
+
+	if (st->num_frames - st->frame < n)
+		n = st->num_frames - st->frame;
+	/* a short read is treated as the end of the data */
+	n = fread(out, st->frame_sz, n, st->fp);
+	if (st->bswap && st->al_fmt != AL_FORMAT_MONO8 &&
+	    st->al_fmt != AL_FORMAT_STEREO8) {
+		uint16_t *s = (uint16_t *)out;
+
+		for (unsigned i = 0; i < (n * st->frame_sz) / 2; i++)
+			s[i] = BSWAP16(s[i]);
+	}
+
+	return (n);
+}
+
+static unsigned
+stream_read_opus(wav_t *wav, uint8_t *out, unsigned max_frames)
+{
+	wav_stream_t *st = wav->stream;
+	opus_int16 *pcm = (opus_int16 *)out;
+	unsigned nch = wav->fmt.n_channels;
+	unsigned n = 0;
+
+	while (n < max_frames) {
+		int res = op_read(st->opus, &pcm[n * nch],
+		    (max_frames - n) * nch, NULL);
+
+		if (res < 0) {
+			logMsg("Error decoding OPUS stream %s: op_read "
+			    "error %d", wav->name, res);
+			break;
+		}
+		if (res == 0)
+			break;
+		n += res;
+	}
+
+	return (n);
+}
+
+static bool_t
+stream_mp3_next_frame(wav_t *wav)
+{
+	wav_stream_t *st = wav->stream;
+
+	while (st->mp3_off < st->mp3_len) {
+		mp3_info_t info;
+		int bytes = mp3_decode(st->mp3, &st->mp3_data[st->mp3_off],
+		    st->mp3_len - st->mp3_off, st->mp3_pcm, &info);
+
+		if (bytes <= 0)
+			break;
+		st->mp3_off += bytes;
+		/* frames which don't decode to any audio are skipped */
+		if (info.audio_bytes > 0 &&
+		    (unsigned)info.channels == wav->fmt.n_channels) {
+			st->mp3_pcm_frames = info.audio_bytes / st->frame_sz;
+			st->mp3_pcm_off = 0;
+			return (B_TRUE);
+		}
+	}
+
+	return (B_FALSE);
+}
+
+/*
+ * `out' may be NULL, in which case the decoded audio is discarded. This is
+ * used for seeking, since MP3 frames can't be located without decoding.
+ */
+static unsigned
+stream_read_mp3(wav_t *wav, uint8_t *out, unsigned max_frames)
+{
+	wav_stream_t *st = wav->stream;
+	unsigned n = 0;
+
+	while (n < max_frames) {
+		unsigned avail;
+
+		if (st->mp3_pcm_off == st->mp3_pcm_frames &&
+		    !stream_mp3_next_frame(wav))
+			break;
+		avail = MIN(st->mp3_pcm_frames - st->mp3_pcm_off,
+		    max_frames - n);
+		if (out != NULL) {
+			memcpy(&out[n * st->frame_sz], &st->mp3_pcm[
+			    st->mp3_pcm_off * wav->fmt.n_channels],
+			    avail * st->frame_sz);
+		}
+		st->mp3_pcm_off += avail;
+		n += avail;
+	}
+
+	return (n);
+}
+
+/*
+ * Decodes up to `max_frames' frames into `out' and advances the stream
+ * position. Returns the number of frames decoded, 0 at the end of file.
+ */
+static unsigned
+stream_decode(wav_t *wav, uint8_t *out, unsigned max_frames)
+{
+	wav_stream_t *st = wav->stream;
+	unsigned n;
+
+	switch (st->type) {
+	case STREAM_WAV:
+		n = stream_read_wav(st, out, max_frames);
+		break;
+	case STREAM_OPUS:
+		n = stream_read_opus(wav, out, max_frames);
+		break;
+	case STREAM_MP3:
+		n = stream_read_mp3(wav, out, max_frames);
+		break;
+	default:
+		VERIFY_FAIL();
+	}
+	st->frame += n;
+
+	return (n);
+}
+
+static void
+stream_mp3_rewind(wav_stream_t *st)
+{
+	mp3_done(st->mp3);
+	st->mp3 = mp3_create();
+	st->mp3_off = 0;
+	st->mp3_pcm_frames = 0;
+	st->mp3_pcm_off = 0;
+	st->frame = 0;
+}
+
+static bool_t
+stream_seek(wav_t *wav, uint64_t frame)
+{
+	wav_stream_t *st = wav->stream;
+	int err;
+
+	if (st->num_frames != 0)
+		frame = MIN(frame, st->num_frames);
+
+	switch (st->type) {
+	case STREAM_WAV:
+		if (fseek(st->fp, st->data_off + frame * st->frame_sz,
+		    SEEK_SET) != 0) {
+			logMsg("Error seeking WAV stream %s: %s", wav->name,
+			    strerror(errno));
+			return (B_FALSE);
+		}
+		st->frame = frame;
+		break;
+	case STREAM_OPUS:
+		if ((err = op_pcm_seek(st->opus, frame)) != 0) {
+			logMsg("Error seeking OPUS stream %s: op_pcm_seek "
+			    "error %d", wav->name, err);
+			return (B_FALSE);
+		}
+		st->frame = frame;
+		break;
+	case STREAM_MP3:
+		if (frame < st->frame)
+			stream_mp3_rewind(st);
+		while (st->frame < frame) {
+			if (stream_decode(wav, NULL, MIN(frame - st->frame,
+			    UINT32_MAX)) == 0)
+				break;
+		}
+		break;
+	default:
+		VERIFY_FAIL();
+	}
+
+	return (B_TRUE);
+}
+
+static bool_t
+stream_open_wav(wav_t *wav, const char *filename)
+{
+	wav_stream_t *st = wav->stream;
+	uint32_t hdr[3], chunk[2];
+	bool_t have_fmt = B_FALSE;
+
+	if ((st->fp = fopen(filename, "rb")) == NULL) {
+		logMsg("Error loading WAV file \"%s\": can't open file: %s",
+		    filename, strerror(errno));
+		return (B_FALSE);
+	}
+	if (fread(hdr, sizeof (hdr), 1, st->fp) != 1)
+		goto badfile;
+	if (hdr[0] == FOURCC("RIFF"))
+		st->bswap = B_FALSE;
+	else if (hdr[0] == BSWAP32(FOURCC("RIFF")))
+		st->bswap = B_TRUE;
+	else
+		goto badfile;
+	if ((st->bswap ? BSWAP32(hdr[2]) : hdr[2]) != WAVE_ID)
+		goto badfile;
+	/*
+	 * Walk the top-level chunks up to the `data' chunk. Unlike riff_parse,
+	 * this only reads the headers, not the whole file.
+	 */
+	for (;;) {
+		long skip;
+
+		if (fread(chunk, sizeof (chunk), 1, st->fp) != 1)
+			goto badfile;
+		if (st->bswap) {
+			chunk[0] = BSWAP32(chunk[0]);
+			chunk[1] = BSWAP32(chunk[1]);
+		}
+		if (chunk[0] == DATA_ID)
+			break;
+		/* chunks are aligned to a two-byte boundary */
+		skip = chunk[1] + (chunk[1] & 1);
+		if (chunk[0] == FMT_ID && chunk[1] >= sizeof (wav->fmt)) {
+			if (fread(&wav->fmt, sizeof (wav->fmt), 1, st->fp) != 1)
+				goto badfile;
+			if (st->bswap)
+				fmt_hdr_bswap(&wav->fmt);
+			have_fmt = B_TRUE;
+			skip -= sizeof (wav->fmt);
+		}
+		if (fseek(st->fp, skip, SEEK_CUR) != 0)
+			goto badfile;
+	}
+	if (!have_fmt) {
+		logMsg("Error loading WAV file \"%s\": file missing or "
+		    "malformed `fmt ' chunk.", filename);
+		return (B_FALSE);
+	}
+	if (!check_audio_fmt(&wav->fmt, filename))
+		return (B_FALSE);
+
+	st->frame_sz = (wav->fmt.n_channels * wav->fmt.bps) / 8;
+	if (chunk[1] == 0 || chunk[1] % st->frame_sz != 0) {
+		logMsg("Error loading WAV file %s: `data' chunk missing or "
+		    "contains bad number of samples.", filename);
+		return (B_FALSE);
+	}
+	st->num_frames = chunk[1] / st->frame_sz;
+	st->data_off = ftell(st->fp);
+
+	return (B_TRUE);
+badfile:
+	logMsg("Error loading WAV file \"%s\": file doesn't appear "
+	    "to be valid RIFF.", filename);
+	return (B_FALSE);
+}
+
+static bool_t
+stream_open_opus(wav_t *wav, const char *filename)
+{
+	wav_stream_t *st = wav->stream;
+	const OpusHead *head;
+	int error;
 
-		/* set up some defaults */
-		wav->cone_outer = 360;
-		wav->cone_inner = 360;
-		wav->ref_dist = 1.0;
-		wav->max_dist = 1e10;
-		wav->rolloff_fact = 1.0;
-		wav->gain = 1.0;
-		wav->pitch = 1.0;
+	st->opus = op_open_file(filename, &error);
+	if (st->opus == NULL) {
+		logMsg("Error reading OPUS file \"%s\": op_open_file error %d",
+		    filename, error);
+		return (B_FALSE);
 	}
+	head = op_head(st->opus, 0);
+	VERIFY(head != NULL);
+	fake_fmt_hdr(&wav->fmt, head->channel_count, OPUS_SRATE);
+	if (!check_audio_fmt(&wav->fmt, filename))
+		return (B_FALSE);
+	st->frame_sz = (wav->fmt.n_channels * wav->fmt.bps) / 8;
+	st->num_frames = MAX(op_pcm_total(st->opus, -1), 0);
+	wav->duration = ((double)st->num_frames) / wav->fmt.srate;
+
+	return (B_TRUE);
+}
+
+static bool_t
+stream_open_mp3(wav_t *wav, const char *filename)
+{
+	wav_stream_t *st = wav->stream;
+	mp3_info_t info;
+	int bytes1, bytes2;
+
+	st->mp3_data = file2str_name(&st->mp3_len, filename);
+	if (st->mp3_data == NULL) {
+		logMsg("Error reading MP3 file \"%s\": %s", filename,
+		    strerror(errno));
+		return (B_FALSE);
+	}
+	st->mp3 = mp3_create();
+	bytes1 = mp3_decode(st->mp3, st->mp3_data, st->mp3_len, st->mp3_pcm,
+	    &info);
+	if (bytes1 == 0) {
+		logMsg("Error decoding MP3 file %s", filename);
+		return (B_FALSE);
+	}
+	/* fake a wav_fmt_hdr_t from the MP3 frame info */
+	fake_fmt_hdr(&wav->fmt, info.channels, info.sample_rate);
+	if (!check_audio_fmt(&wav->fmt, filename))
+		return (B_FALSE);
+	st->frame_sz = (wav->fmt.n_channels * wav->fmt.bps) / 8;
+	/*
+	 * The exact length of an MP3 file is only known after decoding all
+	 * of it, so estimate the duration from the size of the second frame
+	 * (the first one can include leading junk such as ID3 tags). This is
+	 * exact for constant bitrate files. num_frames is left at 0 (unknown).
+	 */
+	bytes2 = mp3_decode(st->mp3, &st->mp3_data[bytes1],
+	    st->mp3_len - bytes1, st->mp3_pcm, &info);
+	if (bytes2 > 0 && info.audio_bytes > 0) {
+		wav->duration = ((double)(st->mp3_len - bytes1) / bytes2 + 1) *
+		    (info.audio_bytes / st->frame_sz) / wav->fmt.srate;
+	}
+	stream_mp3_rewind(st);
+
+	return (B_TRUE);
+}
+
+static void
+stream_close(wav_stream_t *st)
+{
+	if (st->fp != NULL)
+		fclose(st->fp);
+	if (st->opus != NULL)
+		op_free(st->opus);
+	if (st->mp3 != NULL)
+		mp3_done(st->mp3);
+	free(st->mp3_data);
+	free(st->pcm);
+	mutex_destroy(&st->lock);
+	free(st);
+}
+
+/*
+ * Detaches all buffers from the source. Must be called with the source
+ * stopped, or else OpenAL refuses to unqueue buffers which are pending.
+ */
+static void
+stream_reset_queue(wav_t *wav)
+{
+	wav_stream_t *st = wav->stream;
+
+	ASSERT_MUTEX_HELD(&st->lock);
+
+	alSourcei(wav->alsrc, AL_BUFFER, 0);
+	for (unsigned i = 0; i < STREAM_NUM_BUFS; i++)
+		st->free_bufs[i] = st->bufs[i];
+	st->num_free = STREAM_NUM_BUFS;
+	st->q_head = 0;
+	st->q_len = 0;
+}
+
+/*
+ * Decodes the next piece of the file into a free buffer and queues it on
+ * the source. A buffer never straddles the loop point, so that every
+ * queued buffer maps to a contiguous range of frames, which is what
+ * wav_get_offset relies on. Returns B_FALSE if there was nothing to queue.
+ */
+static bool_t
+stream_queue_buf(wav_t *wav)
+{
+	wav_stream_t *st = wav->stream;
+	unsigned n;
+	uint64_t start;
+	ALuint buf, err;
+
+	ASSERT_MUTEX_HELD(&st->lock);
+	ASSERT(st->num_free != 0);
+
+	if (st->eof)
+		return (B_FALSE);
+	start = st->frame;
+	n = stream_decode(wav, st->pcm, st->buf_frames);
+	if (n == 0 && wav->loop && start != 0) {
+		/* wrap around, but don't spin on a file with no audio */
+		if (!stream_seek(wav, 0))
+			return (B_FALSE);
+		start = 0;
+		n = stream_decode(wav, st->pcm, st->buf_frames);
+	}
+	if (n < st->buf_frames && !wav->loop)
+		st->eof = B_TRUE;
+	if (n == 0) {
+		st->eof = B_TRUE;
+		return (B_FALSE);
+	}
+
+	buf = st->free_bufs[--st->num_free];
+	alBufferData(buf, st->al_fmt, st->pcm, n * st->frame_sz,
+	    wav->fmt.srate);
+	alSourceQueueBuffers(wav->alsrc, 1, &buf);
+	if ((err = alGetError()) != AL_NO_ERROR) {
+		logMsg("Error queueing audio for stream %s (0x%x).",
+		    wav->name, err);
+		st->free_bufs[st->num_free++] = buf;
+		return (B_FALSE);
+	}
+	ASSERT3U(st->q_len, <, STREAM_NUM_BUFS);
+	st->queue[(st->q_head + st->q_len) % STREAM_NUM_BUFS] =
+	    (stream_buf_t){ .buf = buf, .start = start, .frames = n };
+	st->q_len++;
+
+	return (B_TRUE);
+}
+
+/*
+ * (Re)starts playback from the current decoder position. The queue is
+ * filled before the source starts, so playback begins without a gap.
+ */
+static bool_t
+stream_start(wav_t *wav)
+{
+	wav_stream_t *st = wav->stream;
+	ALuint err;
+
+	ASSERT_MUTEX_HELD(&st->lock);
+
+	alSourceStop(wav->alsrc);
+	stream_reset_queue(wav);
+	st->eof = B_FALSE;
+	while (st->num_free != 0 && stream_queue_buf(wav))
+		;
+	if (st->q_len == 0) {
+		st->active = B_FALSE;
+		return (B_FALSE);
+	}
+	alSourcePlay(wav->alsrc);
+	if ((err = alGetError()) != AL_NO_ERROR) {
+		logMsg("Can't play sound: alSourcePlay failed (0x%x).", err);
+		st->active = B_FALSE;
+		return (B_FALSE);
+	}
+	st->active = B_TRUE;
+
+	return (B_TRUE);
+}
+
+/*
+ * Stops playback and puts the decoder at `frame', without starting.
+ */
+static void
+stream_stop(wav_t *wav, uint64_t frame)
+{
+	wav_stream_t *st = wav->stream;
+
+	ASSERT_MUTEX_HELD(&st->lock);
+
+	alSourceStop(wav->alsrc);
+	stream_reset_queue(wav);
+	(void) stream_seek(wav, frame);
+	st->eof = B_FALSE;
+	st->active = B_FALSE;
+}
+
+static void
+stream_refill(wav_t *wav)
+{
+	wav_stream_t *st = wav->stream;
+	ALint processed = 0, state = 0;
+
+	ASSERT_MUTEX_HELD(&st->lock);
+
+	alGetSourcei(wav->alsrc, AL_BUFFERS_PROCESSED, &processed);
+	for (; processed > 0; processed--) {
+		ALuint buf;
+
+		alSourceUnqueueBuffers(wav->alsrc, 1, &buf);
+		ASSERT(st->q_len != 0);
+		ASSERT3U(buf, ==, st->queue[st->q_head].buf);
+		st->q_head = (st->q_head + 1) % STREAM_NUM_BUFS;
+		st->q_len--;
+		st->free_bufs[st->num_free++] = buf;
+	}
+	while (st->num_free != 0 && stream_queue_buf(wav))
+		;
+	if (st->q_len == 0) {
+		/* everything has been played */
+		st->active = B_FALSE;
+		return;
+	}
+	alGetSourcei(wav->alsrc, AL_SOURCE_STATE, &state);
+	if (state != AL_PLAYING) {
+		/*
+		 * The source ran dry before we got to refill it (e.g. the
+		 * machine was heavily loaded), so it stopped on its own.
+		 */
+		logMsg("Audio stream %s underrun, restarting.", wav->name);
+		alSourcePlay(wav->alsrc);
+	}
+	(void) alGetError();
+}
+
+static bool_t
+stream_worker_init(void *userinfo)
+{
+	wav_t *wav = userinfo;
+
+	VERIFY3U(alcSetThreadContext(wav->stream->ctx), ==, ALC_TRUE);
+
+	return (B_TRUE);
+}
+
+static bool_t
+stream_worker(void *userinfo)
+{
+	wav_t *wav = userinfo;
+	wav_stream_t *st = wav->stream;
+
+	mutex_enter(&st->lock);
+	if (st->active)
+		stream_refill(wav);
+	mutex_exit(&st->lock);
+
+	return (B_TRUE);
+}
+
+static void
+stream_worker_fini(void *userinfo)
+{
+	UNUSED(userinfo);
+	alcSetThreadContext(NULL);
+}
+
+/*
+ * Same as wav_load, except that the file is decoded incrementally while
+ * playing, instead of all at once during loading. Use this for long
+ * sounds such as music or ambient loops, where decoding up front would
+ * take long and keep lots of PCM data in memory. Looping, seeking and
+ * all other wav_* functions work the same as with wav_load, except:
+ *
+ * - seeking an MP3 stream backwards requires decoding it again from
+ *	the start, up to the target position.
+ * - the `duration' of an MP3 stream is an estimate based on its bitrate.
+ *
+ * Requires the ALC_EXT_thread_local_context extension. If it isn't
+ * available, this falls back to loading the whole file using wav_load.
+ */
+wav_t *
+wav_load_stream(const char *filename, const char *descr_name, alc_t *alc)
+{
+	const char *dot = strrchr(filename, '.');
+	wav_t *wav;
+	wav_stream_t *st;
+	ALuint err;
+	alc_t sav;
+	bool_t ok;
+
+	ASSERT(alc != NULL);
+
+	if (!alcIsExtensionPresent(NULL, "ALC_EXT_thread_local_context")) {
+		logMsg("Cannot stream %s: OpenAL doesn't support "
+		    "ALC_EXT_thread_local_context, loading it whole instead.",
+		    filename);
+		return (wav_load(filename, descr_name, alc));
+	}
+
+	wav = safe_calloc(1, sizeof (*wav));
+	wav->alc = alc;
+	st = safe_calloc(1, sizeof (*st));
+	mutex_init(&st->lock);
+	wav->stream = st;
+
+	if (dot != NULL && (strcmp(&dot[1], "opus") == 0 ||
+	    strcmp(&dot[1], "OPUS") == 0)) {
+		st->type = STREAM_OPUS;
+		ok = stream_open_opus(wav, filename);
+	} else if (dot != NULL && (strcmp(&dot[1], "mp3") == 0 ||
+	    strcmp(&dot[1], "MP3") == 0)) {
+		st->type = STREAM_MP3;
+		ok = stream_open_mp3(wav, filename);
+	} else {
+		st->type = STREAM_WAV;
+		ok = stream_open_wav(wav, filename);
+		if (ok) {
+			wav->duration = ((double)st->num_frames) /
+			    wav->fmt.srate;
+		}
+	}
+	if (!ok)
+		goto errout;
+	wav_set_defaults(wav, descr_name);
+	st->al_fmt = fmt_hdr2al(&wav->fmt);
+	st->buf_frames = (wav->fmt.srate * STREAM_BUF_MSEC) / 1000;
+	st->pcm = safe_malloc(st->buf_frames * st->frame_sz);
+
+	if (!wav_gen_al_src(wav, filename) || !ctx_save(alc, &sav))
+		goto errout;
+	/* with a shared alc, we play into whatever context is current */
+	st->ctx = (alc->ctx != NULL ? alc->ctx : alcGetCurrentContext());
+	if (st->ctx == NULL) {
+		logMsg("Error loading WAV file %s: no current audio context.",
+		    filename);
+		(void) ctx_restore(alc, &sav);
+		goto errout;
+	}
+	alGenBuffers(STREAM_NUM_BUFS, st->bufs);
+	if ((err = alGetError()) != AL_NO_ERROR) {
+		logMsg("Error loading WAV file %s: alGenBuffers failed (0x%x).",
+		    filename, err);
+		memset(st->bufs, 0, sizeof (st->bufs));
+		(void) ctx_restore(alc, &sav);
+		goto errout;
+	}
+	mutex_enter(&st->lock);
+	stream_reset_queue(wav);
+	mutex_exit(&st->lock);
+	(void) ctx_restore(alc, &sav);
+
+	worker_init2(&st->wk, stream_worker_init, stream_worker,
+	    stream_worker_fini, STREAM_REFILL_INTVAL, wav, "wav_stream");
+	st->wk_inited = B_TRUE;
 
 	return (wav);
+errout:
+	wav_free(wav);
+	return (NULL);
+}
+
+static void
+stream_set_offset(wav_t *wav, float offset_sec)
+{
+	wav_stream_t *st = wav->stream;
+	uint64_t frame = MAX(offset_sec, 0) * wav->fmt.srate;
+	bool_t was_active;
+	alc_t sav;
+
+	VERIFY(ctx_save(wav->alc, &sav));
+	mutex_enter(&st->lock);
+	was_active = st->active;
+	stream_stop(wav, frame);
+	if (was_active)
+		(void) stream_start(wav);
+	mutex_exit(&st->lock);
+	VERIFY(ctx_restore(wav->alc, &sav));
+}
+
+static float
+stream_get_offset(wav_t *wav)
+{
+	wav_stream_t *st = wav->stream;
+	uint64_t frame = 0;
+	alc_t sav;
+
+	VERIFY(ctx_save(wav->alc, &sav));
+	mutex_enter(&st->lock);
+	if (st->q_len != 0) {
+		ALint off = 0;
+		unsigned i = 0;
+		const stream_buf_t *sb;
+
+		/*
+		 * The offset counts from the start of the oldest buffer still
+		 * queued, including ones already played, which the worker
+		 * hasn't unqueued yet. Find the buffer it falls into, since
+		 * buffers after a loop wrap don't continue where the previous
+		 * one ended.
+		 */
+		alGetSourcei(wav->alsrc, AL_SAMPLE_OFFSET, &off);
+		for (;;) {
+			sb = &st->queue[(st->q_head + i) % STREAM_NUM_BUFS];
+			if ((unsigned)off < sb->frames || i + 1 == st->q_len)
+				break;
+			off -= sb->frames;
+			i++;
+		}
+		frame = sb->start + MIN((unsigned)off, sb->frames);
+	} else if (!st->eof) {
+		frame = st->frame;
+	}
+	mutex_exit(&st->lock);
+	VERIFY(ctx_restore(wav->alc, &sav));
+
+	return (((double)frame) / wav->fmt.srate);
+}
+
+static void
+stream_set_loop(wav_t *wav, bool_t loop)
+{
+	wav_stream_t *st = wav->stream;
+
+	mutex_enter(&st->lock);
+	wav->loop = loop;
+	/*
+	 * If the decoder already hit the end, but the tail is still playing,
+	 * let the worker wrap around and continue queueing from the start.
+	 */
+	if (loop && st->active)
+		st->eof = B_FALSE;
+	mutex_exit(&st->lock);
+}
+
+static bool_t
+stream_play(wav_t *wav)
+{
+	wav_stream_t *st = wav->stream;
+	bool_t res;
+	alc_t sav;
+
+	VERIFY(ctx_save(wav->alc, &sav));
+	mutex_enter(&st->lock);
+	/* like alSourcePlay, replaying or playing after the end rewinds */
+	if (st->active || st->eof)
+		(void) stream_seek(wav, 0);
+	res = stream_start(wav);
+	mutex_exit(&st->lock);
+	VERIFY(ctx_restore(wav->alc, &sav));
+
+	return (res);
 }
 
 /*
- * Destroys a WAV file as returned by wav_load().
+ * Destroys a WAV file as returned by wav_load() or wav_load_stream().
  */
 void
 wav_free(wav_t *wav)
@@ -643,6 +1459,10 @@ wav_free(wav_t *wav)
 	if (wav == NULL)
 		return;
 
+	/* the worker must be gone before we pull the source from under it */
+	if (wav->stream != NULL && wav->stream->wk_inited)
+		worker_fini(&wav->stream->wk);
+
 	VERIFY(ctx_save(wav->alc, &sav));
 	free(wav->name);
 	if (wav->alsrc != 0) {
@@ -651,14 +1471,22 @@ wav_free(wav_t *wav)
 	}
 	if (wav->albuf != 0)
 		alDeleteBuffers(1, &wav->albuf);
+	if (wav->stream != NULL && wav->stream->bufs[0] != 0)
+		alDeleteBuffers(STREAM_NUM_BUFS, wav->stream->bufs);
 	VERIFY(ctx_restore(wav->alc, &sav));
 
+	if (wav->stream != NULL)
+		stream_close(wav->stream);
 	free(wav);
 }
 
 void
 wav_set_offset(wav_t *wav, float offset_sec)
 {
+	if (wav != NULL && wav->stream != NULL) {
+		stream_set_offset(wav, offset_sec);
+		return;
+	}
 	WAV_SET_PARAM(alSourcef, AL_SEC_OFFSET, offset_sec);
 }
 
@@ -666,6 +1494,9 @@ float
 wav_get_offset(wav_t *wav)
 {
 	float offset;
+
+	if (wav != NULL && wav->stream != NULL)
+		return (stream_get_offset(wav));
 	WAV_OP_PARAM(alGetSourcef, AL_SEC_OFFSET, 0, &offset);
 	return (offset);
 }
@@ -696,6 +1527,11 @@ wav_get_gain(wav_t *wav)
 void
 wav_set_loop(wav_t *wav, bool_t loop)
 {
+	/* streams loop by requeueing, AL_LOOPING would repeat the queue */
+	if (wav != NULL && wav->stream != NULL) {
+		stream_set_loop(wav, loop);
+		return;
+	}
 	WAV_SET_PARAM(alSourcei, AL_LOOPING, loop);
 	wav->loop = loop;
 }
@@ -871,6 +1707,12 @@ wav_play(wav_t *wav)
 
 	if (wav == NULL)
 		return (B_FALSE);
+	if (wav->stream != NULL) {
+		if (!stream_play(wav))
+			return (B_FALSE);
+		wav->play_start = microclock();
+		return (B_TRUE);
+	}
 
 	VERIFY(ctx_save(wav->alc, &sav));
 
@@ -890,6 +1732,15 @@ wav_play(wav_t *wav)
 bool_t
 wav_is_playing(wav_t *wav)
 {
+	if (wav != NULL && wav->stream != NULL) {
+		bool_t active;
+
+		mutex_enter(&wav->stream->lock);
+		active = wav->stream->active;
+		mutex_exit(&wav->stream->lock);
+
+		return (active);
+	}
 	return (wav != NULL && wav->play_start != 0 && (wav_get_loop(wav) ||
 	    USEC2SEC(microclock() - wav->play_start) < wav->duration));
 }
@@ -908,7 +1759,13 @@ wav_stop(wav_t *wav)
 		return;
 
 	VERIFY(ctx_save(wav->alc, &sav));
-	alSourceStop(wav->alsrc);
+	if (wav->stream != NULL) {
+		mutex_enter(&wav->stream->lock);
+		stream_stop(wav, 0);
+		mutex_exit(&wav->stream->lock);
+	} else {
+		alSourceStop(wav->alsrc);
+	}
 	if ((err = alGetError()) != AL_NO_ERROR)
 		logMsg("Can't stop sound, alSourceStop failed (0x%x).", err);
 	VERIFY(ctx_restore(wav->alc, &sav));
@@ -24,22 +24,115 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "GeomagnetismLibrary.h"
 
 #include <acfutils/assert.h>
 #include <acfutils/helpers.h>
+#include <acfutils/math.h>
 #include <acfutils/perf.h>
 #include <acfutils/safe_alloc.h>
+#include <acfutils/taskq.h>
+#include <acfutils/thread.h>
 #include <acfutils/wmm.h>
 
+/*
+ * Batch evaluations are split up into chunks of this many points. Batches
+ * smaller than BATCH_PAR_MIN points, or any batches on machines with only
+ * one CPU, are processed directly on the calling thread.
+ */
+#define	BATCH_CHUNK_SZ		1024
+#define	BATCH_PAR_MIN		(4 * BATCH_CHUNK_SZ)
+/*
+ * Sorting a batch costs about as much as evaluating a quarter of its
+ * points, while each point which can reuse the Legendre functions of its
+ * predecessor saves about half of its evaluation. So we only sort if that
+ * makes at least this fraction of the points reusable.
+ */
+#define	BATCH_SORT_MIN_REUSE	0.67
+/* How long idle batch worker threads linger before exiting (us) */
+#define	BATCH_THR_STOP_DELAY	SEC2USEC(2)
+
+/*
+ * The declination grid is split up into square tiles of GRID_TILE_DEG
+ * degrees on each side. Tiles are constructed lazily on first access.
+ */
+#define	GRID_TILE_DEG		5
+#define	GRID_TILES_LAT		(180 / GRID_TILE_DEG)
+#define	GRID_TILES_LON		(360 / GRID_TILE_DEG)
+/*
+ * Altitude layers (in feet) of the grid. Declination varies very slowly
+ * and smoothly with altitude, so a handful of layers with linear
+ * interpolation between them is plenty. Points below the lowest layer
+ * are clamped to it, points above the highest layer are evaluated
+ * directly from the model.
+ */
+static const double grid_layers_ft[] = { 0, 20000, 40000, 60000 };
+#define	GRID_NUM_LAYERS		ARRAY_NUM_ELEM(grid_layers_ft)
+
+typedef struct {
+	/*
+	 * Declination values at the grid points of each layer, stored as
+	 * [layer][lat][lon] with (cells + 1) points along each axis.
+	 */
+	float		*decl;
+	/*
+	 * Cells which failed validation against the full model and must
+	 * be evaluated directly. Stored as [layer][lat][lon] with `cells'
+	 * entries along each axis.
+	 */
+	bool_t		*exact;
+} decl_tile_t;
+
+typedef struct {
+	double		res;
+	unsigned	cells;		/* cells per tile along each axis */
+	mutex_t		lock;
+	/* protected by lock */
+	decl_tile_t	*tiles[GRID_TILES_LAT][GRID_TILES_LON];
+} decl_grid_t;
+
 struct wmm_s {
 	/* time-modified model according to year passed to wmm_open */
 	MAGtype_MagneticModel	*timed_model;
 	MAGtype_MagneticModel	*fixed_model;
 	MAGtype_Ellipsoid	ellip;
+	/* optional declination grid cache, see wmm_set_decl_grid */
+	decl_grid_t		*grid;
+	/* workers for wmm_get_decl_v, threads are only spawned on demand */
+	taskq_t			*tq;
 };
 
+typedef struct {
+	geo_pos3_t	p;
+	size_t		idx;
+} batch_pt_t;
+
+typedef struct {
+	const wmm_t	*wmm;
+	/* either `pts' in input order, or `sorted' if sorting paid off */
+	const geo_pos3_t *pts;
+	const batch_pt_t *sorted;
+	double		*out;
+
+	mutex_t		lock;
+	condvar_t	cv;
+	size_t		chunks_left;
+} batch_t;
+
+typedef struct {
+	batch_t		*batch;
+	size_t		start;
+	size_t		end;
+} batch_chunk_t;
+
+static void grid_flush(decl_grid_t *grid);
+static void *batch_thr_init(void *userinfo);
+static void batch_thr_fini(void *userinfo, void *thr_info);
+static void batch_proc(void *userinfo, void *thr_info, void *task);
+static void batch_discard(void *userinfo, void *task);
+
 /*
  * Opens a World Magnetic Model coefficient file and time-adjusts it.
  *
@@ -80,6 +173,8 @@ wmm_open(const char *filename, double year)
 		.epssq = wgs84.ecc2,
 		.re = wgs84.r
 	};
+	wmm->tq = taskq_alloc(0, lacf_get_num_cpus(), BATCH_THR_STOP_DELAY,
+	    batch_thr_init, batch_thr_fini, batch_proc, batch_discard, wmm);
 
 	return (wmm);
 }
@@ -94,6 +189,9 @@ wmm_reopen(wmm_t *wmm, double year)
 	ASSERT(wmm->timed_model != NULL);
 
 	MAG_TimelyModifyMagneticModel(date, wmm->fixed_model, wmm->timed_model);
+	/* Any cached declination values are now stale */
+	if (wmm->grid != NULL)
+		grid_flush(wmm->grid);
 }
 
 /*
@@ -103,6 +201,8 @@ void
 wmm_close(wmm_t *wmm)
 {
 	ASSERT(wmm != NULL);
+	wmm_set_decl_grid(wmm, 0);
+	taskq_free(wmm->tq);
 	MAG_FreeMagneticModelMemory(wmm->fixed_model);
 	MAG_FreeMagneticModelMemory(wmm->timed_model);
 	free(wmm);
@@ -127,15 +227,11 @@ wmm_get_end(const wmm_t *wmm)
 }
 
 /*
- * Returns the magnetic declination (variation) in degrees at a given point.
- * East declination is positive, west negative.
- *
- * @param wmm Magnetic model to use. See wmm_open.
- * @param p Geodetic position on the WGS84 spheroid for which to determine
- *	the magnetic declination.
+ * Same as wmm_get_decl, but always evaluates the full spherical harmonic
+ * model, bypassing the declination grid cache (if enabled).
  */
 double
-wmm_get_decl(const wmm_t *wmm, geo_pos3_t p)
+wmm_get_decl_exact(const wmm_t *wmm, geo_pos3_t p)
 {
 	MAGtype_CoordSpherical		coord_sph;
 	MAGtype_CoordGeodetic		coord_geo = {
@@ -144,12 +240,537 @@ wmm_get_decl(const wmm_t *wmm, geo_pos3_t p)
 	};
 	MAGtype_GeoMagneticElements	gme;
 
+	ASSERT(wmm != NULL);
+
 	MAG_GeodeticToSpherical(wmm->ellip, coord_geo, &coord_sph);
 	MAG_Geomag(wmm->ellip, coord_sph, coord_geo, wmm->timed_model, &gme);
 
 	return (gme.Decl);
 }
 
+static MAGtype_Workspace *
+decl_ws_alloc(const wmm_t *wmm)
+{
+	MAGtype_Workspace *ws = MAG_AllocateWorkspace(wmm->timed_model->nMax);
+	VERIFY(ws != NULL);
+	return (ws);
+}
+
+/*
+ * Same as wmm_get_decl_exact, but reuses the scratch buffers in `ws'.
+ * When consecutive calls share the same latitude & elevation, the
+ * Legendre functions are reused from the previous call.
+ */
+static double
+decl_eval(const wmm_t *wmm, MAGtype_Workspace *ws, geo_pos3_t p)
+{
+	MAGtype_CoordSpherical		coord_sph;
+	MAGtype_CoordGeodetic		coord_geo = {
+		.lambda = p.lon, .phi = p.lat,
+		.HeightAboveEllipsoid = FEET2MET(p.elev)
+	};
+
+	MAG_GeodeticToSpherical(wmm->ellip, coord_geo, &coord_sph);
+	return (MAG_GeomagDecl(ws, wmm->ellip, coord_sph, coord_geo,
+	    wmm->timed_model));
+}
+
+static void
+grid_tile_free(decl_tile_t *tile)
+{
+	free(tile->decl);
+	free(tile->exact);
+	free(tile);
+}
+
+static void
+grid_flush(decl_grid_t *grid)
+{
+	mutex_enter(&grid->lock);
+	for (int i = 0; i < GRID_TILES_LAT; i++) {
+		for (int j = 0; j < GRID_TILES_LON; j++) {
+			if (grid->tiles[i][j] != NULL) {
+				grid_tile_free(grid->tiles[i][j]);
+				grid->tiles[i][j] = NULL;
+			}
+		}
+	}
+	mutex_exit(&grid->lock);
+}
+
+/*
+ * Returns the difference between two declination values, taking angle
+ * wrapping into account, so that the result is always within +-180 deg.
+ */
+static inline double
+decl_diff(double d1, double d2)
+{
+	double d = d2 - d1;
+
+	if (d > 180)
+		d -= 360;
+	else if (d < -180)
+		d += 360;
+
+	return (d);
+}
+
+/*
+ * Bilinearly interpolates between the four corner declinations of a cell.
+ * Declination wraps around at +-180 degrees (which happens in the vicinity
+ * of the magnetic poles), so we unwrap the corners relative to the first
+ * one before interpolating.
+ */
+static double
+grid_interp(double d00, double d01, double d10, double d11,
+    double fx, double fy)
+{
+	double d;
+
+	d01 = d00 + decl_diff(d00, d01);
+	d10 = d00 + decl_diff(d00, d10);
+	d11 = d00 + decl_diff(d00, d11);
+	d = wavg(wavg(d00, d01, fx), wavg(d10, d11, fx), fy);
+
+	return (normalize_lon(d));
+}
+
+static inline float *
+tile_decl(const decl_grid_t *grid, const decl_tile_t *tile, unsigned layer,
+    unsigned lat, unsigned lon)
+{
+	unsigned pts = grid->cells + 1;
+	return (&tile->decl[(layer * pts + lat) * pts + lon]);
+}
+
+static inline bool_t *
+tile_exact(const decl_grid_t *grid, const decl_tile_t *tile, unsigned layer,
+    unsigned lat, unsigned lon)
+{
+	unsigned cells = grid->cells;
+	return (&tile->exact[(layer * cells + lat) * cells + lon]);
+}
+
+/*
+ * Constructs a new grid tile from the full model. Every cell of the tile
+ * is validated by evaluating the model at the cell's center point and
+ * comparing it to the interpolated value. Cells where the difference
+ * exceeds half of WMM_DECL_GRID_MAX_ERR are marked for direct evaluation.
+ * The safety margin accounts for the error peak not being exactly at the
+ * cell center in the vicinity of the magnetic poles, where declination
+ * changes very rapidly.
+ */
+static decl_tile_t *
+grid_tile_build(const wmm_t *wmm, const decl_grid_t *grid,
+    unsigned tile_lat, unsigned tile_lon)
+{
+	decl_tile_t *tile = safe_calloc(1, sizeof (*tile));
+	unsigned cells = grid->cells, pts = cells + 1;
+	double lat0 = tile_lat * GRID_TILE_DEG - 90.0;
+	double lon0 = tile_lon * GRID_TILE_DEG - 180.0;
+	/* Rows are evaluated west-to-east, so Legendre functions get reused */
+	MAGtype_Workspace *ws = decl_ws_alloc(wmm);
+
+	tile->decl = safe_calloc(GRID_NUM_LAYERS * pts * pts,
+	    sizeof (*tile->decl));
+	tile->exact = safe_calloc(GRID_NUM_LAYERS * cells * cells,
+	    sizeof (*tile->exact));
+
+	for (unsigned l = 0; l < GRID_NUM_LAYERS; l++) {
+		for (unsigned i = 0; i < pts; i++) {
+			for (unsigned j = 0; j < pts; j++) {
+				geo_pos3_t p = GEO_POS3(lat0 + i * grid->res,
+				    lon0 + j * grid->res, grid_layers_ft[l]);
+				*tile_decl(grid, tile, l, i, j) =
+				    decl_eval(wmm, ws, p);
+			}
+		}
+		for (unsigned i = 0; i < cells; i++) {
+			for (unsigned j = 0; j < cells; j++) {
+				geo_pos3_t p = GEO_POS3(
+				    lat0 + (i + 0.5) * grid->res,
+				    lon0 + (j + 0.5) * grid->res,
+				    grid_layers_ft[l]);
+				double exact = decl_eval(wmm, ws, p);
+				double interp = grid_interp(
+				    *tile_decl(grid, tile, l, i, j),
+				    *tile_decl(grid, tile, l, i, j + 1),
+				    *tile_decl(grid, tile, l, i + 1, j),
+				    *tile_decl(grid, tile, l, i + 1, j + 1),
+				    0.5, 0.5);
+				*tile_exact(grid, tile, l, i, j) =
+				    (ABS(decl_diff(exact, interp)) >
+				    WMM_DECL_GRID_MAX_ERR / 2);
+			}
+		}
+	}
+	MAG_FreeWorkspace(ws);
+
+	return (tile);
+}
+
+static decl_tile_t *
+grid_get_tile(const wmm_t *wmm, decl_grid_t *grid, unsigned tile_lat,
+    unsigned tile_lon)
+{
+	decl_tile_t *tile;
+
+	mutex_enter(&grid->lock);
+	tile = grid->tiles[tile_lat][tile_lon];
+	mutex_exit(&grid->lock);
+	if (tile != NULL)
+		return (tile);
+	/*
+	 * Building a tile is expensive, so do it without holding the lock.
+	 * If somebody else beat us to it in the mean time, just use theirs.
+	 */
+	tile = grid_tile_build(wmm, grid, tile_lat, tile_lon);
+	mutex_enter(&grid->lock);
+	if (grid->tiles[tile_lat][tile_lon] == NULL) {
+		grid->tiles[tile_lat][tile_lon] = tile;
+	} else {
+		grid_tile_free(tile);
+		tile = grid->tiles[tile_lat][tile_lon];
+	}
+	mutex_exit(&grid->lock);
+
+	return (tile);
+}
+
+static double
+grid_get_decl_layer(const decl_grid_t *grid, const decl_tile_t *tile,
+    unsigned layer, unsigned i, unsigned j, double fx, double fy)
+{
+	if (*tile_exact(grid, tile, layer, i, j))
+		return (NAN);
+	return (grid_interp(*tile_decl(grid, tile, layer, i, j),
+	    *tile_decl(grid, tile, layer, i, j + 1),
+	    *tile_decl(grid, tile, layer, i + 1, j),
+	    *tile_decl(grid, tile, layer, i + 1, j + 1), fx, fy));
+}
+
+/*
+ * Looks up the declination in the grid. Returns NAN if the point cannot
+ * be serviced from the grid and must be evaluated directly.
+ */
+static double
+grid_get_decl(const wmm_t *wmm, decl_grid_t *grid, geo_pos3_t p)
+{
+	double lat = clamp(p.lat, -90, 90);
+	double lon = normalize_lon(p.lon);
+	double elev = MAX(p.elev, grid_layers_ft[0]);
+	unsigned tile_lat, tile_lon, layer, i, j;
+	double x, y, fx, fy, d1, d2;
+	decl_tile_t *tile;
+
+	if (elev > grid_layers_ft[GRID_NUM_LAYERS - 1])
+		return (NAN);
+
+	tile_lat = MIN((lat + 90) / GRID_TILE_DEG, GRID_TILES_LAT - 1);
+	tile_lon = MIN((lon + 180) / GRID_TILE_DEG, GRID_TILES_LON - 1);
+	tile = grid_get_tile(wmm, grid, tile_lat, tile_lon);
+
+	y = (lat - (tile_lat * GRID_TILE_DEG - 90.0)) / grid->res;
+	x = (lon - (tile_lon * GRID_TILE_DEG - 180.0)) / grid->res;
+	i = MIN(y, grid->cells - 1);
+	j = MIN(x, grid->cells - 1);
+
+	for (layer = 0; layer + 2 < GRID_NUM_LAYERS; layer++) {
+		if (elev <= grid_layers_ft[layer + 1])
+			break;
+	}
+	fx = clamp(x - j, 0, 1);
+	fy = clamp(y - i, 0, 1);
+	d1 = grid_get_decl_layer(grid, tile, layer, i, j, fx, fy);
+	d2 = grid_get_decl_layer(grid, tile, layer + 1, i, j, fx, fy);
+	if (isnan(d1) || isnan(d2))
+		return (NAN);
+
+	return (normalize_lon(d1 + decl_diff(d1, d2) *
+	    iter_fract(elev, grid_layers_ft[layer],
+	    grid_layers_ft[layer + 1], B_TRUE)));
+}
+
+/*
+ * Enables or disables the declination grid cache of a magnetic model.
+ *
+ * When enabled, wmm_get_decl (and by extension wmm_mag2true and
+ * wmm_true2mag) no longer evaluate the full spherical harmonic model on
+ * every call. Instead, they bilinearly interpolate declination from a
+ * precomputed lat/lon grid with a few altitude layers between 0 and
+ * 60000 feet. The grid is built lazily in 5x5 degree tiles the first time
+ * a point in a tile is queried, so only the areas actually used are ever
+ * computed. Each grid cell is validated against the full model when the
+ * tile is built and cells where the interpolated value would deviate by
+ * more than WMM_DECL_GRID_MAX_ERR degrees (near the magnetic poles) are
+ * always evaluated directly. Points above the highest altitude layer are
+ * likewise evaluated directly.
+ *
+ * @param wmm Magnetic model for which to configure the grid.
+ * @param res_deg Grid resolution in degrees of latitude & longitude.
+ *	Must evenly divide 5 degrees (e.g. 0.1, 0.25, 0.5, 1). Pass 0
+ *	to disable the grid and release its memory. A resolution of
+ *	0.25 degrees is a good default.
+ */
+void
+wmm_set_decl_grid(wmm_t *wmm, double res_deg)
+{
+	decl_grid_t *grid;
+
+	ASSERT(wmm != NULL);
+
+	if (wmm->grid != NULL) {
+		grid_flush(wmm->grid);
+		mutex_destroy(&wmm->grid->lock);
+		free(wmm->grid);
+		wmm->grid = NULL;
+	}
+	if (res_deg == 0)
+		return;
+
+	ASSERT3F(res_deg, >, 0);
+	ASSERT3F(res_deg, <=, GRID_TILE_DEG);
+	ASSERT3F(fabs(GRID_TILE_DEG / res_deg - round(GRID_TILE_DEG / res_deg)),
+	    <, 1e-6);
+
+	grid = safe_calloc(1, sizeof (*grid));
+	grid->res = res_deg;
+	grid->cells = round(GRID_TILE_DEG / res_deg);
+	mutex_init(&grid->lock);
+	wmm->grid = grid;
+}
+
+/*
+ * Returns the magnetic declination (variation) in degrees at a given point.
+ * East declination is positive, west negative. If the declination grid
+ * cache is enabled (see wmm_set_decl_grid), the value is interpolated from
+ * the grid, otherwise the full model is evaluated (see wmm_get_decl_exact).
+ *
+ * @param wmm Magnetic model to use. See wmm_open.
+ * @param p Geodetic position on the WGS84 spheroid for which to determine
+ *	the magnetic declination.
+ */
+double
+wmm_get_decl(const wmm_t *wmm, geo_pos3_t p)
+{
+	ASSERT(wmm != NULL);
+
+	if (wmm->grid != NULL && !IS_NULL_GEO_POS(p)) {
+		double decl = grid_get_decl(wmm, wmm->grid, p);
+		if (!isnan(decl))
+			return (decl);
+	}
+	return (wmm_get_decl_exact(wmm, p));
+}
+
+static void *
+batch_thr_init(void *userinfo)
+{
+	return (decl_ws_alloc(userinfo));
+}
+
+static void
+batch_thr_fini(void *userinfo, void *thr_info)
+{
+	LACF_UNUSED(userinfo);
+	MAG_FreeWorkspace(thr_info);
+}
+
+static void
+batch_proc_chunk(const batch_t *batch, MAGtype_Workspace *ws, size_t start,
+    size_t end)
+{
+	if (batch->sorted == NULL) {
+		for (size_t i = start; i < end; i++) {
+			batch->out[i] = decl_eval(batch->wmm, ws,
+			    batch->pts[i]);
+		}
+		return;
+	}
+	for (size_t i = start; i < end; i++) {
+		const batch_pt_t *bp = &batch->sorted[i];
+		batch->out[bp->idx] = decl_eval(batch->wmm, ws, bp->p);
+	}
+}
+
+static void
+batch_proc(void *userinfo, void *thr_info, void *task)
+{
+	batch_chunk_t *chunk = task;
+	batch_t *batch = chunk->batch;
+
+	LACF_UNUSED(userinfo);
+	batch_proc_chunk(batch, thr_info, chunk->start, chunk->end);
+
+	mutex_enter(&batch->lock);
+	ASSERT(batch->chunks_left != 0);
+	batch->chunks_left--;
+	if (batch->chunks_left == 0)
+		cv_broadcast(&batch->cv);
+	mutex_exit(&batch->lock);
+}
+
+static void
+batch_discard(void *userinfo, void *task)
+{
+	/*
+	 * Batches always wait for all of their chunks to complete, so
+	 * there can never be any left over when the taskq is freed.
+	 */
+	LACF_UNUSED(userinfo);
+	LACF_UNUSED(task);
+	VERIFY_FAIL();
+}
+
+static int
+batch_pt_compar(const void *a, const void *b)
+{
+	const batch_pt_t *pa = a, *pb = b;
+
+	if (pa->p.lat < pb->p.lat)
+		return (-1);
+	if (pa->p.lat > pb->p.lat)
+		return (1);
+	if (pa->p.elev < pb->p.elev)
+		return (-1);
+	if (pa->p.elev > pb->p.elev)
+		return (1);
+	if (pa->idx < pb->idx)
+		return (-1);
+	if (pa->idx > pb->idx)
+		return (1);
+	return (0);
+}
+
+static inline bool_t
+same_parallel(const geo_pos3_t *a, const geo_pos3_t *b)
+{
+	return (a->lat == b->lat && a->elev == b->elev);
+}
+
+static inline uint64_t
+parallel_hash(const geo_pos3_t *p)
+{
+	uint64_t a, b;
+
+	memcpy(&a, &p->lat, sizeof (a));
+	memcpy(&b, &p->elev, sizeof (b));
+	return ((a ^ (b * 0x9e3779b97f4a7c15ull)) * 0xff51afd7ed558ccdull);
+}
+
+/*
+ * Decides whether sorting the points by latitude & elevation would let
+ * enough of them reuse the Legendre functions of their predecessor (see
+ * BATCH_SORT_MIN_REUSE). Counts the points which share a parallel with
+ * some earlier point using a scratch hash set, which is a lot cheaper
+ * than the sort itself, and subtracts those which already directly
+ * follow a point on the same parallel.
+ */
+static bool_t
+batch_should_sort(const geo_pos3_t *pts, size_t n)
+{
+	size_t n_buckets = 1, shared = 0, in_order = 0;
+	const geo_pos3_t **set;
+
+	while (n_buckets < 2 * n)
+		n_buckets <<= 1;
+	set = safe_calloc(n_buckets, sizeof (*set));
+	for (size_t i = 0; i < n; i++) {
+		size_t b = parallel_hash(&pts[i]) >> 32 & (n_buckets - 1);
+
+		if (i > 0 && same_parallel(&pts[i], &pts[i - 1]))
+			in_order++;
+		for (;;) {
+			if (set[b] == NULL) {
+				set[b] = &pts[i];
+				break;
+			}
+			if (same_parallel(set[b], &pts[i])) {
+				shared++;
+				break;
+			}
+			b = (b + 1) & (n_buckets - 1);
+		}
+	}
+	free(set);
+
+	return (shared - in_order >= BATCH_SORT_MIN_REUSE * n);
+}
+
+/*
+ * Batch version of wmm_get_decl_exact, intended for bulk jobs, such as
+ * computing the declination for every fix or navaid in a database.
+ * Points lying on the same parallel (same latitude & elevation) share
+ * the associated Legendre function evaluation if they directly follow
+ * each other. If many points share parallels, but aren't already
+ * ordered that way, they are internally sorted by latitude & elevation
+ * first. Large batches are split up into chunks and evaluated in
+ * parallel on all available CPUs. This function blocks until all points
+ * have been evaluated and is never slower than calling
+ * wmm_get_decl_exact for each point. The grid cache (see
+ * wmm_set_decl_grid) is never used by this function.
+ *
+ * @param wmm Magnetic model to use. See wmm_open.
+ * @param pts Array of `n' geodetic positions on the WGS84 spheroid.
+ * @param n Number of points in `pts' and `out'.
+ * @param out Output array, which will be filled with the magnetic
+ *	declinations in degrees at the respective points in `pts'.
+ */
+void
+wmm_get_decl_v(const wmm_t *wmm, const geo_pos3_t *pts, size_t n,
+    double *out)
+{
+	batch_t batch = { .wmm = wmm, .pts = pts, .out = out };
+	batch_pt_t *sorted = NULL;
+	size_t n_chunks;
+
+	ASSERT(wmm != NULL);
+	ASSERT(pts != NULL || n == 0);
+	ASSERT(out != NULL || n == 0);
+
+	if (n == 0)
+		return;
+
+	if (batch_should_sort(pts, n)) {
+		sorted = safe_malloc(n * sizeof (*sorted));
+		for (size_t i = 0; i < n; i++) {
+			sorted[i].p = pts[i];
+			sorted[i].idx = i;
+		}
+		qsort(sorted, n, sizeof (*sorted), batch_pt_compar);
+		batch.sorted = sorted;
+	}
+
+	n_chunks = (n + BATCH_CHUNK_SZ - 1) / BATCH_CHUNK_SZ;
+	/* Handing chunks off to a single worker only adds overhead */
+	if (n < BATCH_PAR_MIN || lacf_get_num_cpus() < 2) {
+		MAGtype_Workspace *ws = decl_ws_alloc(wmm);
+		batch_proc_chunk(&batch, ws, 0, n);
+		MAG_FreeWorkspace(ws);
+	} else {
+		batch_chunk_t *chunks = safe_calloc(n_chunks,
+		    sizeof (*chunks));
+
+		mutex_init(&batch.lock);
+		cv_init(&batch.cv);
+		batch.chunks_left = n_chunks;
+		for (size_t i = 0; i < n_chunks; i++) {
+			chunks[i].batch = &batch;
+			chunks[i].start = i * BATCH_CHUNK_SZ;
+			chunks[i].end = MIN((i + 1) * BATCH_CHUNK_SZ, n);
+			taskq_submit(wmm->tq, &chunks[i]);
+		}
+		mutex_enter(&batch.lock);
+		while (batch.chunks_left != 0)
+			cv_wait(&batch.cv, &batch.lock);
+		mutex_exit(&batch.lock);
+		cv_destroy(&batch.cv);
+		mutex_destroy(&batch.lock);
+		free(chunks);
+	}
+	free(sorted);
+}
+
 /*
  * Converts a magnetic heading to true according to the world magnetic model.
  *